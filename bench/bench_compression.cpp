@@ -0,0 +1,76 @@
+
+#include "stand_in.hpp"
+
+#include "rest.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+namespace sf = stockfighter;
+
+namespace {
+
+// Something shaped like a busy order book
+auto make_orderbook(int levels) -> std::string
+{
+    auto side = [levels](int start, int step, bool is_buy) {
+        auto out = std::string{"["};
+        for (int i = 0; i < levels; ++i) {
+            if (i > 0) {
+                out += ',';
+            }
+            out += "{\"price\":" + std::to_string(start + i * step) +
+                   ",\"qty\":" + std::to_string(50 + (i * 37) % 400) +
+                   ",\"isBuy\":" + (is_buy ? "true" : "false") + "}";
+        }
+        return out + "]";
+    };
+
+    return "{\"ok\":true,\"venue\":\"TESTEX\",\"symbol\":\"FOOBAR\","
+           "\"bids\":" + side(5000, -1, true) +
+           ",\"asks\":" + side(5001, 1, false) +
+           ",\"ts\":\"2015-12-04T09:02:16.680986205Z\"}";
+}
+
+auto run(sf::bench::stand_in_server& server, bool compression, int requests)
+{
+    sf::net::set_compression(compression);
+    const auto url = server.url("/ob/api/venues/TESTEX/stocks/FOOBAR");
+
+    // Warm up the connection so that only transfers are timed
+    sf::rest::get(sf::net::endpoint::orderbook, url);
+    server.reset_bytes_sent();
+
+    const auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < requests; ++i) {
+        sf::rest::get(sf::net::endpoint::orderbook, url);
+    }
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+
+    std::printf("%-14s %8.1f ms total %8.3f ms/request %10zu bytes on the wire\n",
+                compression ? "gzip" : "identity",
+                std::chrono::duration<double, std::milli>(elapsed).count(),
+                std::chrono::duration<double, std::milli>(elapsed).count() / requests,
+                server.bytes_sent());
+}
+
+} // end anonymous namespace
+
+// Usage: bench_compression [megabits per second] [book levels] [requests]
+// A bandwidth of 0 leaves the loopback interface unthrottled.
+int main(int argc, char** argv)
+{
+    const double mbps = argc > 1 ? std::atof(argv[1]) : 50;
+    const int levels = argc > 2 ? std::atoi(argv[2]) : 2000;
+    const int requests = argc > 3 ? std::atoi(argv[3]) : 50;
+
+    sf::bench::stand_in_server server{{make_orderbook(levels), mbps}};
+
+    std::printf("Order book of %zu bytes (%zu gzipped), %g Mbit/s, %d requests\n",
+                server.body_size(), server.gzipped_size(), mbps, requests);
+
+    run(server, false, requests);
+    run(server, true, requests);
+}
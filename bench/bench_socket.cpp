@@ -0,0 +1,122 @@
+
+#include "stand_in.hpp"
+
+#include "connection_pool.hpp"
+#include "epoll_transport.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace sf = stockfighter;
+
+namespace {
+
+struct variant {
+    const char* name;
+    sf::net::socket_options socket;
+};
+
+auto variants() -> std::vector<variant>
+{
+    auto out = std::vector<variant>{};
+    out.push_back({"defaults", {}});
+
+    auto v = variant{"no_delay off", {}};
+    v.socket.no_delay = false;
+    out.push_back(v);
+
+    v = variant{"quick_ack", {}};
+    v.socket.quick_ack = true;
+    out.push_back(v);
+
+    v = variant{"busy_poll 50us", {}};
+    v.socket.busy_poll = std::chrono::microseconds{50};
+    out.push_back(v);
+
+    v = variant{"buffers 16K", {}};
+    v.socket.receive_buffer = v.socket.send_buffer = 16 * 1024;
+    out.push_back(v);
+
+    v = variant{"buffers 1M", {}};
+    v.socket.receive_buffer = v.socket.send_buffer = 1024 * 1024;
+    out.push_back(v);
+
+    v = variant{"keepalive 5s", {}};
+    v.socket.keepalive_interval = std::chrono::seconds{5};
+    out.push_back(v);
+
+    return out;
+}
+
+// Times blocking requests made one after another over a kept-alive
+// connection, and prints the median, 99th percentile and mean
+void run(const char* backend, const variant& v, sf::net::transport& transport,
+         const sf::http::request& req, int requests)
+{
+    // Connecting isn't timed
+    for (int i = 0; i < 100; ++i) {
+        transport.send(req);
+    }
+
+    auto times = std::vector<double>{};
+    times.reserve(requests);
+    for (int i = 0; i < requests; ++i) {
+        const auto start = std::chrono::steady_clock::now();
+        transport.send(req);
+        times.push_back(std::chrono::duration<double, std::micro>(
+                std::chrono::steady_clock::now() - start).count());
+    }
+
+    auto total = 0.0;
+    for (const auto t : times) {
+        total += t;
+    }
+    std::sort(times.begin(), times.end());
+
+    std::printf("%-6s %-16s p50 %7.1f us  p99 %7.1f us  mean %7.1f us\n",
+                backend, v.name,
+                times[times.size() / 2],
+                times[times.size() * 99 / 100],
+                total / times.size());
+}
+
+} // end anonymous namespace
+
+// Usage: bench_socket [requests] [body bytes]
+// Measures the round trip time of requests to a local stand-in server with
+// each of the socket options changed in turn from the defaults. Every run
+// opens fresh connections, as the options are applied when a connection is
+// opened. Over loopback, the buffer sizes and keepalive are not expected to
+// make a difference; they are there to check that they cost nothing. Busy
+// polling above net.core.busy_read needs CAP_NET_ADMIN, and is otherwise
+// left as it was.
+int main(int argc, char** argv)
+{
+    const int requests = argc > 1 ? std::atoi(argv[1]) : 5000;
+    const auto body_size = argc > 2 ? std::size_t(std::atol(argv[2])) : 2000;
+
+    sf::bench::stand_in_server server{{std::string(body_size, 'x'), 0}};
+
+    auto req = sf::http::request{};
+    req.method = "GET";
+    req.uri = sf::http::parse_url(server.url("/ob/api/venues/TESTEX/stocks/FOOBAR/quote"));
+
+    std::printf("%d requests, %zu byte bodies\n", requests, body_size);
+
+    for (const auto& v : variants()) {
+        auto options = sf::net::pool_options{};
+        options.socket = v.socket;
+
+        sf::net::connection_pool pool{sf::net::default_io(), options};
+        run("asio", v, pool, req, requests);
+#ifdef __linux__
+        sf::net::epoll_transport epoll{options};
+        run("epoll", v, epoll, req, requests);
+#endif
+    }
+}
@@ -0,0 +1,182 @@
+
+#include "stand_in.hpp"
+
+#include "connection_pool.hpp"
+#include "epoll_transport.hpp"
+#include "uring_transport.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <new>
+#include <string>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace sf = stockfighter;
+
+namespace {
+
+std::atomic<std::size_t> allocations{0};
+
+} // end anonymous namespace
+
+// Every allocation in the process, on any thread, is counted
+void* operator new(std::size_t size)
+{
+    ++allocations;
+    if (void* p = std::malloc(size ? size : 1)) {
+        return p;
+    }
+    throw std::bad_alloc{};
+}
+
+void operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept
+{
+    std::free(p);
+}
+
+namespace {
+
+// Keeps a number of requests in flight, sending the next one from the
+// handler of each that finishes
+class window {
+public:
+    window(sf::net::transport& transport, const sf::http::request& req, int requests)
+        : transport_(transport), req_(req), remaining_(requests)
+    {}
+
+    void run(int in_flight)
+    {
+        for (int i = 0; i < in_flight; ++i) {
+            next();
+        }
+        std::unique_lock<std::mutex> lock{mutex_};
+        finished_.wait(lock, [this] { return outstanding_ == 0; });
+    }
+
+private:
+    void next()
+    {
+        if (remaining_.fetch_sub(1) <= 0) {
+            return;
+        }
+        ++outstanding_;
+        transport_.async_send(req_, [this](std::exception_ptr error, sf::http::response) {
+            if (error) {
+                std::rethrow_exception(error);
+            }
+            next();
+            std::lock_guard<std::mutex> lock{mutex_};
+            if (--outstanding_ == 0) {
+                finished_.notify_one();
+            }
+        }, sf::net::cancellation_token::never());
+    }
+
+    sf::net::transport& transport_;
+    const sf::http::request& req_;
+    std::atomic<int> remaining_;
+    std::atomic<int> outstanding_{0};
+    std::mutex mutex_;
+    std::condition_variable finished_;
+};
+
+void run(const char* name, sf::net::transport& transport,
+         const sf::http::request& req, int requests, int in_flight)
+{
+    // Warm up so that connecting and the TLS handshake aren't timed
+    window{transport, req, in_flight * 10}.run(in_flight);
+
+    const auto allocs_before = allocations.load();
+    const auto start = std::chrono::steady_clock::now();
+    if (in_flight > 1) {
+        window{transport, req, requests}.run(in_flight);
+    } else {
+        for (int i = 0; i < requests; ++i) {
+            transport.send(req);
+        }
+    }
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+    const auto allocs = allocations.load() - allocs_before;
+
+    std::printf("%-6s %3d in flight %8.1f ms total %8.1f us/request %6.1f allocations/request\n",
+                name, in_flight,
+                std::chrono::duration<double, std::milli>(elapsed).count(),
+                std::chrono::duration<double, std::micro>(elapsed).count() / requests,
+                double(allocs) / requests);
+}
+
+// The stand-in runs in a child process so that its allocations aren't counted
+auto start_server(const std::string& body, int& port) -> pid_t
+{
+    int fds[2];
+    if (::pipe(fds) != 0) {
+        throw std::runtime_error{"pipe() failed"};
+    }
+
+    const auto pid = ::fork();
+    if (pid == 0) {
+        ::close(fds[0]);
+        sf::bench::stand_in_server server{{body, 0}};
+        const auto url = server.url("/");
+        const int p = std::atoi(url.c_str() + url.rfind(':') + 1);
+        (void) ::write(fds[1], &p, sizeof(p));
+        // Serve until the parent kills us
+        while (true) {
+            ::pause();
+        }
+    }
+
+    ::close(fds[1]);
+    if (::read(fds[0], &port, sizeof(port)) != sizeof(port)) {
+        throw std::runtime_error{"The stand-in server didn't start"};
+    }
+    ::close(fds[0]);
+    return pid;
+}
+
+} // end anonymous namespace
+
+// Usage: bench_transport [requests] [body bytes]
+// Compares the Asio connection pool with the epoll and io_uring transports over
+// kept-alive connections, first with blocking requests made one after
+// another and then with several asynchronous requests in flight. To compare system
+// calls as well, run under `strace -f -c`.
+int main(int argc, char** argv)
+{
+    const int requests = argc > 1 ? std::atoi(argv[1]) : 20000;
+    const auto body_size = argc > 2 ? std::size_t(std::atol(argv[2])) : 200;
+
+    int port = 0;
+    const auto server = start_server(std::string(body_size, 'x'), port);
+
+    auto req = sf::http::request{};
+    req.method = "GET";
+    req.uri = sf::http::parse_url(
+            "http://127.0.0.1:" + std::to_string(port) +
+            "/ob/api/venues/TESTEX/stocks/FOOBAR/quote");
+
+    std::printf("%d requests, %zu byte bodies\n", requests, body_size);
+
+    for (const int in_flight : {1, 8}) {
+        run("asio", sf::net::default_pool(), req, requests, in_flight);
+        run("epoll", sf::net::default_epoll(), req, requests, in_flight);
+        if (sf::net::uring_transport::available()) {
+            run("uring", sf::net::default_uring(), req, requests, in_flight);
+        }
+    }
+
+    ::kill(server, SIGTERM);
+    ::waitpid(server, nullptr, 0);
+}
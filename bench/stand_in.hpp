@@ -0,0 +1,198 @@
+#pragma once
+
+#include <boost/asio.hpp>
+
+#include <zlib.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace stockfighter {
+namespace bench {
+
+// A minimal plain-HTTP stand-in for the exchange which runs in the
+// benchmark's (or test's) own process. Every GET is answered with the same
+// body, gzipped if the client asks for it, and writes can be paced to
+// emulate a link of a given bandwidth.
+class stand_in_server {
+public:
+    struct options {
+        std::string body;
+        // Zero means as fast as the loopback interface allows
+        double megabits_per_second = 0;
+        // Each connection is closed once it has had this many responses.
+        // Zero keeps connections open.
+        int requests_per_connection = 0;
+        // Responses are written this many bytes at a time
+        std::size_t segment_size = 16384;
+    };
+
+    explicit stand_in_server(options opts)
+        : opts_(std::move(opts)),
+          gzipped_(gzip(opts_.body)),
+          acceptor_(io_, {boost::asio::ip::address_v4::loopback(), 0})
+    {
+        thread_ = std::thread{[this] { accept_loop(); }};
+    }
+
+    ~stand_in_server()
+    {
+        stopping_ = true;
+        // Wake up the blocking accept
+        boost::asio::ip::tcp::socket s{io_};
+        boost::system::error_code ec;
+        s.connect(acceptor_.local_endpoint(), ec);
+        thread_.join();
+        // Clients keep their connections open, so wake up the readers too
+        for (auto& sock : sockets_) {
+            sock->shutdown(boost::asio::ip::tcp::socket::shutdown_both, ec);
+        }
+        for (auto& t : connections_) {
+            t.join();
+        }
+    }
+
+    stand_in_server(const stand_in_server&) = delete;
+    stand_in_server& operator=(const stand_in_server&) = delete;
+
+    auto url(const std::string& target) const -> std::string
+    {
+        return "http://127.0.0.1:" +
+               std::to_string(acceptor_.local_endpoint().port()) + target;
+    }
+
+    auto body_size() const { return opts_.body.size(); }
+    auto connections() const { return connections_accepted_.load(); }
+    auto gzipped_size() const { return gzipped_.size(); }
+
+    // Total bytes written to clients, headers included
+    auto bytes_sent() const { return bytes_sent_.load(); }
+    void reset_bytes_sent() { bytes_sent_ = 0; }
+
+private:
+    static auto gzip(const std::string& in) -> std::string
+    {
+        z_stream z{};
+        if (deflateInit2(&z, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8,
+                         Z_DEFAULT_STRATEGY) != Z_OK) {
+            throw std::runtime_error{"deflateInit2 failed"};
+        }
+        auto out = std::string(deflateBound(&z, in.size()) + 32, '\0');
+        z.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(in.data()));
+        z.avail_in = static_cast<uInt>(in.size());
+        z.next_out = reinterpret_cast<Bytef*>(&out[0]);
+        z.avail_out = static_cast<uInt>(out.size());
+        deflate(&z, Z_FINISH);
+        out.resize(z.total_out);
+        deflateEnd(&z);
+        return out;
+    }
+
+    void accept_loop()
+    {
+        while (true) {
+            auto sock = std::make_shared<boost::asio::ip::tcp::socket>(io_);
+            boost::system::error_code ec;
+            acceptor_.accept(*sock, ec);
+            if (stopping_ || ec) {
+                return;
+            }
+            ++connections_accepted_;
+            sockets_.push_back(sock);
+            connections_.emplace_back([this, sock] { serve(*sock); });
+        }
+    }
+
+    void serve(boost::asio::ip::tcp::socket& sock)
+    {
+        sock.set_option(boost::asio::ip::tcp::no_delay{true});
+        auto buf = std::string{};
+        char chunk[4096];
+        boost::system::error_code ec;
+        int answered = 0;
+
+        while (!stopping_) {
+            if (opts_.requests_per_connection > 0 &&
+                answered == opts_.requests_per_connection) {
+                sock.shutdown(boost::asio::ip::tcp::socket::shutdown_both, ec);
+                return;
+            }
+
+            const auto end = buf.find("\r\n\r\n");
+            if (end == std::string::npos) {
+                const auto n = sock.read_some(boost::asio::buffer(chunk), ec);
+                if (ec) {
+                    return;
+                }
+                buf.append(chunk, n);
+                continue;
+            }
+
+            const auto head = buf.substr(0, end);
+            buf.erase(0, end + 4);
+
+            const bool gzip = head.find("gzip") != std::string::npos;
+            const auto& body = gzip ? gzipped_ : opts_.body;
+
+            auto response = std::string{"HTTP/1.1 200 OK\r\n"
+                                        "Content-Type: application/json\r\n"};
+            if (gzip) {
+                response += "Content-Encoding: gzip\r\n";
+            }
+            response += "Content-Length: " + std::to_string(body.size()) + "\r\n\r\n";
+            response += body;
+
+            if (!write_paced(sock, response)) {
+                return;
+            }
+            ++answered;
+        }
+    }
+
+    bool write_paced(boost::asio::ip::tcp::socket& sock, const std::string& data)
+    {
+        using clock = std::chrono::steady_clock;
+        const auto segment = opts_.segment_size;
+
+        const auto start = clock::now();
+        boost::system::error_code ec;
+
+        for (std::size_t pos = 0; pos < data.size(); pos += segment) {
+            const auto n = std::min(segment, data.size() - pos);
+            boost::asio::write(sock, boost::asio::buffer(data.data() + pos, n), ec);
+            if (ec) {
+                return false;
+            }
+            bytes_sent_ += n;
+
+            if (opts_.megabits_per_second > 0) {
+                const auto due = std::chrono::duration<double>(
+                        (pos + n) * 8 / (opts_.megabits_per_second * 1e6));
+                std::this_thread::sleep_until(
+                        start + std::chrono::duration_cast<clock::duration>(due));
+            }
+        }
+        return true;
+    }
+
+    options opts_;
+    std::string gzipped_;
+    boost::asio::io_context io_;
+    boost::asio::ip::tcp::acceptor acceptor_;
+    std::thread thread_;
+    std::vector<std::shared_ptr<boost::asio::ip::tcp::socket>> sockets_;
+    std::vector<std::thread> connections_;
+    std::atomic<bool> stopping_{false};
+    std::atomic<std::size_t> bytes_sent_{0};
+    std::atomic<int> connections_accepted_{0};
+};
+
+} // end namespace bench
+} // end namespace stockfighter
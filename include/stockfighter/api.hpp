@@ -1,24 +1,48 @@
 
 #pragma once
 
+#include <stockfighter/net.hpp>
+#include <stockfighter/result.hpp>
 #include <stockfighter/types.hpp>
 
+#include <functional>
+#include <future>
+#include <new>
 #include <string>
 #include <vector>
 
 namespace stockfighter {
 namespace api {
+    // Every call takes an optional net::call_options, to give it a
+    // deadline or a token with which it can be cancelled
+
     // API calls not requiring an API key
-    bool heartbeat();
+    bool heartbeat(const net::call_options& opts = {});
 
-    bool venue_heartbeat(const std::string& venue);
+    bool venue_heartbeat(const std::string& venue,
+                         const net::call_options& opts = {});
 
-    std::vector<stock> get_stocks(const std::string& venue);
+    std::vector<stock> get_stocks(const std::string& venue,
+                                  const net::call_options& opts = {});
 
     orderbook get_orderbook(const std::string& venue,
-                                   const std::string& stock);
+                                   const std::string& stock,
+                                   const net::call_options& opts = {});
+
+    quote get_quote(const std::string& venue, const std::string& stock,
+                    const net::call_options& opts = {});
 
-    quote get_quote(const std::string& venue, const std::string& stock);
+    // Fetch quotes or orderbooks for several stocks at once. The requests
+    // are pipelined on one connection, so the whole batch costs about one
+    // round trip rather than one per stock. Results are in the same order
+    // as the symbols.
+    std::vector<quote> get_quotes(const std::string& venue,
+                                  const std::vector<std::string>& stocks,
+                                  const net::call_options& opts = {});
+
+    std::vector<orderbook> get_orderbooks(const std::string& venue,
+                                          const std::vector<std::string>& stocks,
+                                          const net::call_options& opts = {});
 
     order_status place_order(const std::string& api_key,
                              const std::string& account,
@@ -26,17 +50,173 @@ namespace api {
                              const std::string& stock,
                              int price, int quantity,
                              direction dir,
-                             order_type type);
+                             order_type type,
+                             const net::call_options& opts = {});
 
     order_status cancel_order(const std::string& api_key,
                               const std::string& venue,
                               const std::string& stock,
-                              int order_id);
+                              int order_id,
+                              const net::call_options& opts = {});
 
     order_status get_order_status(const std::string& api_key,
                                   const std::string& venue,
                                   const std::string& stock,
-                                  int order_id);
+                                  int order_id,
+                                  const net::call_options& opts = {});
+
+    // Asynchronous versions of the above. These return immediately and
+    // either invoke the callback or complete the returned future once the
+    // response arrives. Requests are performed by a small shared pool of
+    // I/O threads (see net::set_io_threads()), and callbacks are run on
+    // those threads, so they should not block.
+    void async_heartbeat(callback<bool> cb,
+                         const net::call_options& opts = {});
+
+    std::future<bool> async_heartbeat(const net::call_options& opts = {});
+
+    void async_venue_heartbeat(const std::string& venue, callback<bool> cb,
+                               const net::call_options& opts = {});
+
+    std::future<bool> async_venue_heartbeat(const std::string& venue,
+                                            const net::call_options& opts = {});
+
+    void async_get_stocks(const std::string& venue,
+                          callback<std::vector<stock>> cb,
+                          const net::call_options& opts = {});
+
+    std::future<std::vector<stock>> async_get_stocks(const std::string& venue,
+                                                     const net::call_options& opts = {});
+
+    void async_get_orderbook(const std::string& venue,
+                             const std::string& stock,
+                             callback<orderbook> cb,
+                             const net::call_options& opts = {});
+
+    std::future<orderbook> async_get_orderbook(const std::string& venue,
+                                               const std::string& stock,
+                                               const net::call_options& opts = {});
+
+    void async_get_quote(const std::string& venue,
+                         const std::string& stock,
+                         callback<quote> cb,
+                         const net::call_options& opts = {});
+
+    std::future<quote> async_get_quote(const std::string& venue,
+                                       const std::string& stock,
+                                       const net::call_options& opts = {});
+
+    void async_place_order(const std::string& api_key,
+                           const std::string& account,
+                           const std::string& venue,
+                           const std::string& stock,
+                           int price, int quantity,
+                           direction dir,
+                           order_type type,
+                           callback<order_status> cb,
+                           const net::call_options& opts = {});
+
+    std::future<order_status> async_place_order(const std::string& api_key,
+                                                const std::string& account,
+                                                const std::string& venue,
+                                                const std::string& stock,
+                                                int price, int quantity,
+                                                direction dir,
+                                                order_type type,
+                                                const net::call_options& opts = {});
+
+    void async_cancel_order(const std::string& api_key,
+                            const std::string& venue,
+                            const std::string& stock,
+                            int order_id,
+                            callback<order_status> cb,
+                            const net::call_options& opts = {});
+
+    std::future<order_status> async_cancel_order(const std::string& api_key,
+                                                 const std::string& venue,
+                                                 const std::string& stock,
+                                                 int order_id,
+                                                 const net::call_options& opts = {});
+
+    void async_get_order_status(const std::string& api_key,
+                                const std::string& venue,
+                                const std::string& stock,
+                                int order_id,
+                                callback<order_status> cb,
+                                const net::call_options& opts = {});
+
+    std::future<order_status> async_get_order_status(const std::string& api_key,
+                                                     const std::string& venue,
+                                                     const std::string& stock,
+                                                     int order_id,
+                                                     const net::call_options& opts = {});
+
+    // Places several orders at once, e.g. a ladder being repriced. The
+    // requests are written to one pooled connection together and pipelined,
+    // so the batch costs about one round trip. Each order succeeds or fails
+    // on its own, and the results are in the same order as the orders. An
+    // order which went unanswered because the connection closed is not sent
+    // again, as it may have been placed.
+    std::vector<result<order_status>> place_orders(const std::string& api_key,
+                                                   const std::vector<order_request>& orders,
+                                                   const net::call_options& opts = {});
+
+    // Versions of the single-request calls which return failures rather than
+    // throwing them, e.g. api::place_order(std::nothrow, ...). Orders turned
+    // down and cancels of orders which have already gone are routine, and
+    // then these cost no more than a success. The result's value() throws
+    // whatever the throwing version would have; the throwing versions are
+    // in fact just that.
+    result<bool> heartbeat(std::nothrow_t, const net::call_options& opts = {});
+
+    result<bool> venue_heartbeat(std::nothrow_t, const std::string& venue,
+                                 const net::call_options& opts = {});
+
+    result<std::vector<stock>> get_stocks(std::nothrow_t, const std::string& venue,
+                                          const net::call_options& opts = {});
+
+    result<orderbook> get_orderbook(std::nothrow_t, const std::string& venue,
+                                    const std::string& stock,
+                                    const net::call_options& opts = {});
+
+    result<quote> get_quote(std::nothrow_t, const std::string& venue,
+                            const std::string& stock,
+                            const net::call_options& opts = {});
+
+    result<order_status> place_order(std::nothrow_t,
+                                     const std::string& api_key,
+                                     const std::string& account,
+                                     const std::string& venue,
+                                     const std::string& stock,
+                                     int price, int quantity,
+                                     direction dir,
+                                     order_type type,
+                                     const net::call_options& opts = {});
+
+    result<order_status> cancel_order(std::nothrow_t,
+                                      const std::string& api_key,
+                                      const std::string& venue,
+                                      const std::string& stock,
+                                      int order_id,
+                                      const net::call_options& opts = {});
+
+    result<order_status> get_order_status(std::nothrow_t,
+                                          const std::string& api_key,
+                                          const std::string& venue,
+                                          const std::string& stock,
+                                          int order_id,
+                                          const net::call_options& opts = {});
+
+    // Opens connections to the API server in parallel, as many as
+    // net::pool_options::max_connections_per_host allows, then sends each
+    // venue a heartbeat, so that the first real requests don't have to pay
+    // for any of that. game::start_level() and game::resume_level() do this
+    // themselves. Failures are ignored, since anything which is still wrong
+    // will show up in the requests which follow.
+    void warm_up(const std::vector<std::string>& venues);
+
+    void async_warm_up(const std::vector<std::string>& venues,
+                       std::function<void()> done);
 
 } // end namespace api
 } // end namespace stockfighter
@@ -0,0 +1,342 @@
+#ifndef STOCKFIGHTER_CORO_HPP
+#define STOCKFIGHTER_CORO_HPP
+
+// Awaitable versions of the api:: and game:: calls, for use from C++20
+// coroutines. The library itself only requires C++14, so this header is
+// empty unless it is included from code built with coroutine support.
+//
+// Each call suspends the awaiting coroutine until the response arrives
+// and then resumes it on one of the library's I/O threads. Setting the
+// number of I/O threads to 1 (see net::set_io_threads()) gives a single
+// threaded event loop driving every coroutine.
+
+#include <stockfighter/api.hpp>
+#include <stockfighter/game.hpp>
+
+#if defined(__cpp_impl_coroutine) && __cpp_impl_coroutine >= 201902L
+
+#include <atomic>
+#include <coroutine>
+#include <exception>
+#include <functional>
+#include <utility>
+
+namespace stockfighter {
+namespace coro {
+
+// Awaitable which starts an async_ call when awaited
+template <typename T>
+class async_call {
+public:
+    using starter = std::function<void(callback<T>)>;
+
+    explicit async_call(starter start) : start_(std::move(start)) {}
+
+    bool await_ready() const noexcept { return false; }
+
+    bool await_suspend(std::coroutine_handle<> handle)
+    {
+        auto start = std::move(start_);
+        start([this, handle](std::exception_ptr error, T result) {
+            error_ = error;
+            result_ = std::move(result);
+            // If the call finished before start() returned, await_suspend()
+            // carries on with the coroutine instead. Resuming it from in
+            // here would nest one call inside another, and a loop of
+            // such calls would run out of stack.
+            if (state_.exchange(completed, std::memory_order_acq_rel) == suspended) {
+                handle.resume();
+            }
+        });
+
+        // Once the state is set to suspended, the coroutine may be resumed,
+        // destroying *this, on an I/O thread, so don't touch any members
+        // afterwards
+        return state_.exchange(suspended, std::memory_order_acq_rel) != completed;
+    }
+
+    T await_resume()
+    {
+        if (error_) {
+            std::rethrow_exception(error_);
+        }
+        return std::move(result_);
+    }
+
+private:
+    enum state { starting, suspended, completed };
+
+    starter start_;
+    std::atomic<state> state_{starting};
+    std::exception_ptr error_;
+    T result_{};
+};
+
+// Lazily started coroutine returning a T. A task may be co_awaited by
+// another coroutine, or started from ordinary code with spawn().
+template <typename T>
+class task;
+
+namespace detail {
+
+template <typename T>
+struct task_promise_base {
+    struct final_awaiter {
+        bool await_ready() const noexcept { return false; }
+
+        template <typename Promise>
+        auto await_suspend(std::coroutine_handle<Promise> handle) noexcept
+                -> std::coroutine_handle<>
+        {
+            auto& promise = handle.promise();
+            if (promise.continuation) {
+                return promise.continuation;
+            }
+            if (promise.on_complete) {
+                // Detached via spawn(), nobody else will clean up
+                auto on_complete = std::move(promise.on_complete);
+                auto error = promise.error;
+                auto result = promise.take_result();
+                handle.destroy();
+                on_complete(error, std::move(result));
+            }
+            return std::noop_coroutine();
+        }
+
+        void await_resume() const noexcept {}
+    };
+
+    std::suspend_always initial_suspend() const noexcept { return {}; }
+
+    final_awaiter final_suspend() const noexcept { return {}; }
+
+    void unhandled_exception() { error = std::current_exception(); }
+
+    std::coroutine_handle<> continuation;
+    callback<T> on_complete;
+    std::exception_ptr error;
+};
+
+template <typename T>
+struct task_promise : task_promise_base<T> {
+    auto get_return_object() -> task<T>;
+
+    void return_value(T value) { result = std::move(value); }
+
+    T take_result() { return std::move(result); }
+
+    T result{};
+};
+
+// Tasks returning nothing report their completion as a bool
+template <>
+struct task_promise<void> : task_promise_base<bool> {
+    auto get_return_object() -> task<void>;
+
+    void return_void() {}
+
+    bool take_result() { return true; }
+};
+
+} // end namespace detail
+
+template <typename T>
+class task {
+public:
+    using promise_type = detail::task_promise<T>;
+
+    task(task&& other) noexcept : handle_(std::exchange(other.handle_, {})) {}
+
+    task& operator=(task&& other) noexcept
+    {
+        std::swap(handle_, other.handle_);
+        return *this;
+    }
+
+    ~task()
+    {
+        if (handle_) {
+            handle_.destroy();
+        }
+    }
+
+    bool await_ready() const noexcept { return false; }
+
+    auto await_suspend(std::coroutine_handle<> awaiting) noexcept
+            -> std::coroutine_handle<>
+    {
+        handle_.promise().continuation = awaiting;
+        return handle_;
+    }
+
+    T await_resume()
+    {
+        auto& promise = handle_.promise();
+        if (promise.error) {
+            std::rethrow_exception(promise.error);
+        }
+        if constexpr (!std::is_void<T>::value) {
+            return promise.take_result();
+        }
+    }
+
+private:
+    template <typename U, typename Callback>
+    friend void spawn(task<U> t, Callback cb);
+
+    explicit task(std::coroutine_handle<promise_type> handle)
+            : handle_(handle) {}
+
+    friend promise_type;
+
+    std::coroutine_handle<promise_type> handle_;
+};
+
+namespace detail {
+
+template <typename T>
+auto task_promise<T>::get_return_object() -> task<T>
+{
+    return task<T>{std::coroutine_handle<task_promise>::from_promise(*this)};
+}
+
+inline auto task_promise<void>::get_return_object() -> task<void>
+{
+    return task<void>{std::coroutine_handle<task_promise>::from_promise(*this)};
+}
+
+} // end namespace detail
+
+// Starts a task running in the calling thread, without waiting for it.
+// The callback is invoked, from whichever thread the task finishes on, with
+// the task's result or the exception it exited with. Tasks returning void
+// pass true as their result.
+template <typename T, typename Callback>
+void spawn(task<T> t, Callback cb)
+{
+    auto handle = std::exchange(t.handle_, {});
+    handle.promise().on_complete = std::move(cb);
+    handle.resume();
+}
+
+// api:: calls
+
+inline auto heartbeat(net::call_options opts = {})
+{
+    return async_call<bool>{[opts = std::move(opts)](auto cb) {
+        api::async_heartbeat(std::move(cb), opts);
+    }};
+}
+
+inline auto venue_heartbeat(std::string venue, net::call_options opts = {})
+{
+    return async_call<bool>{[=](auto cb) {
+        api::async_venue_heartbeat(venue, std::move(cb), opts);
+    }};
+}
+
+inline auto get_stocks(std::string venue, net::call_options opts = {})
+{
+    return async_call<std::vector<stock>>{[=](auto cb) {
+        api::async_get_stocks(venue, std::move(cb), opts);
+    }};
+}
+
+inline auto get_orderbook(std::string venue, std::string stock,
+                          net::call_options opts = {})
+{
+    return async_call<orderbook>{[=](auto cb) {
+        api::async_get_orderbook(venue, stock, std::move(cb), opts);
+    }};
+}
+
+inline auto get_quote(std::string venue, std::string stock,
+                      net::call_options opts = {})
+{
+    return async_call<quote>{[=](auto cb) {
+        api::async_get_quote(venue, stock, std::move(cb), opts);
+    }};
+}
+
+inline auto place_order(std::string api_key,
+                        std::string account,
+                        std::string venue,
+                        std::string stock,
+                        int price, int quantity,
+                        direction dir,
+                        order_type type,
+                        net::call_options opts = {})
+{
+    return async_call<order_status>{[=](auto cb) {
+        api::async_place_order(api_key, account, venue, stock, price,
+                               quantity, dir, type, std::move(cb), opts);
+    }};
+}
+
+inline auto cancel_order(std::string api_key,
+                         std::string venue,
+                         std::string stock,
+                         int order_id,
+                         net::call_options opts = {})
+{
+    return async_call<order_status>{[=](auto cb) {
+        api::async_cancel_order(api_key, venue, stock, order_id,
+                                std::move(cb), opts);
+    }};
+}
+
+inline auto get_order_status(std::string api_key,
+                             std::string venue,
+                             std::string stock,
+                             int order_id,
+                             net::call_options opts = {})
+{
+    return async_call<order_status>{[=](auto cb) {
+        api::async_get_order_status(api_key, venue, stock, order_id,
+                                    std::move(cb), opts);
+    }};
+}
+
+// game:: calls
+
+inline auto start_level(std::string api_key, int level_num)
+{
+    return async_call<level_info>{[=](auto cb) {
+        game::async_start_level(api_key, level_num, std::move(cb));
+    }};
+}
+
+inline auto restart_level(std::string api_key, int instance_id)
+{
+    return async_call<level_info>{[=](auto cb) {
+        game::async_restart_level(api_key, instance_id, std::move(cb));
+    }};
+}
+
+inline auto stop_level(std::string api_key, int instance_id)
+{
+    return async_call<bool>{[=](auto cb) {
+        game::async_stop_level(api_key, instance_id, std::move(cb));
+    }};
+}
+
+inline auto resume_level(std::string api_key, int instance_id)
+{
+    return async_call<level_info>{[=](auto cb) {
+        game::async_resume_level(api_key, instance_id, std::move(cb));
+    }};
+}
+
+inline auto get_level_status(std::string api_key, int instance_id)
+{
+    return async_call<level_status>{[=](auto cb) {
+        game::async_get_level_status(api_key, instance_id, std::move(cb));
+    }};
+}
+
+} // end namespace coro
+} // end namespace stockfighter
+
+#endif // __cpp_impl_coroutine
+
+#endif // STOCKFIGHTER_CORO_HPP
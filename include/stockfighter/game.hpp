@@ -4,11 +4,15 @@
 
 #include <stockfighter/types.hpp>
 
+#include <future>
 #include <string>
 
 namespace stockfighter {
 namespace game {
 
+// Starting, restarting or resuming a level also warms up the connections
+// to the API server which its venues will need (see api::warm_up()), so
+// that trading can begin at full speed as soon as these return
 auto start_level(const std::string& api_key, int level_num) -> level_info;
 
 auto restart_level(const std::string& api_key, int instance_id) -> level_info;
@@ -19,6 +23,37 @@ auto resume_level(const std::string& api_key, int instance_id) -> level_info;
 
 auto get_level_status(const std::string& api_key, int instance_id) -> level_status;
 
+// Asynchronous versions of the above, see the notes in api.hpp
+void async_start_level(const std::string& api_key, int level_num,
+                       callback<level_info> cb);
+
+auto async_start_level(const std::string& api_key,
+                       int level_num) -> std::future<level_info>;
+
+void async_restart_level(const std::string& api_key, int instance_id,
+                         callback<level_info> cb);
+
+auto async_restart_level(const std::string& api_key,
+                         int instance_id) -> std::future<level_info>;
+
+void async_stop_level(const std::string& api_key, int instance_id,
+                      callback<bool> cb);
+
+auto async_stop_level(const std::string& api_key,
+                      int instance_id) -> std::future<bool>;
+
+void async_resume_level(const std::string& api_key, int instance_id,
+                        callback<level_info> cb);
+
+auto async_resume_level(const std::string& api_key,
+                        int instance_id) -> std::future<level_info>;
+
+void async_get_level_status(const std::string& api_key, int instance_id,
+                            callback<level_status> cb);
+
+auto async_get_level_status(const std::string& api_key,
+                            int instance_id) -> std::future<level_status>;
+
 }
 }
 
@@ -0,0 +1,68 @@
+#ifndef STOCKFIGHTER_HTTP_HPP
+#define STOCKFIGHTER_HTTP_HPP
+
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace stockfighter {
+namespace http {
+
+struct url {
+    std::string scheme;
+    std::string host;
+    std::string port;
+    std::string target;
+};
+
+struct header {
+    std::string name;
+    std::string value;
+};
+
+// Headers which many requests have in common, such as the API key, put
+// together once. serialised holds them as they are written for HTTP/1.1,
+// with the Host header first.
+struct header_block {
+    std::vector<header> headers;
+    std::string serialised;
+};
+
+struct request {
+    std::string method;
+    url uri;
+    std::vector<header> headers;
+    std::string body;
+    // Sent ahead of headers, if set
+    std::shared_ptr<const header_block> common;
+    // Roughly how large the response body is likely to be, so that room
+    // can be set aside for it before it arrives. Zero if unknown.
+    std::size_t response_size_hint = 0;
+};
+
+struct response {
+    int status = 0;
+    std::string reason;
+    std::vector<header> headers;
+    std::string body;
+    bool keep_alive = true;
+};
+
+// Completion handler for asynchronous requests. On failure, error is set
+// and the response is empty.
+using response_handler = std::function<void(std::exception_ptr error, response)>;
+
+// Case-insensitive lookup, returns nullptr if the header is not present
+auto find_header(const std::vector<header>& headers,
+                 const std::string& name) -> const std::string*;
+
+// All of a request's headers, the common ones first
+auto all_headers(const request& req) -> std::vector<header>;
+
+} // end namespace http
+} // end namespace stockfighter
+
+#endif // STOCKFIGHTER_HTTP_HPP
@@ -0,0 +1,75 @@
+#ifndef STOCKFIGHTER_MONITOR_HPP
+#define STOCKFIGHTER_MONITOR_HPP
+
+#include <stockfighter/net.hpp>
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace stockfighter {
+
+// What the venue monitor last found out about a venue
+struct venue_health {
+    // Whether a monitor is watching the venue at all. If not, the rest of
+    // this is whatever was last known.
+    bool monitored = false;
+    // False once enough heartbeats in a row have failed, until one succeeds
+    bool up = true;
+    // Heartbeats which have failed since the last success
+    int failures = 0;
+    // Round trip time of the last successful heartbeat
+    std::chrono::microseconds rtt{0};
+    std::chrono::steady_clock::time_point last_success;
+};
+
+struct monitor_options {
+    // How often each venue is sent a heartbeat
+    std::chrono::milliseconds interval{1000};
+    // A heartbeat which takes longer than this once sent has failed. Those
+    // which go unanswered or get a 5xx status fail too, but not those held
+    // back by the rate limiter or the scheduler.
+    std::chrono::milliseconds timeout{2000};
+    // How many heartbeats in a row must fail before the venue is down
+    int failures_before_down = 2;
+    // Whether api::place_order() and api::cancel_order() fail straight
+    // away, with errc::venue_down, for a venue which is down
+    bool fail_fast = true;
+};
+
+// Watches a set of venues from a thread of its own, sending each of them
+// a heartbeat every interval, until it is destroyed. What it finds can be
+// read from any thread with get_venue_health(), without taking any locks.
+class venue_monitor {
+public:
+    explicit venue_monitor(std::vector<std::string> venues,
+                           const monitor_options& options = {});
+    ~venue_monitor();
+
+    venue_monitor(const venue_monitor&) = delete;
+    venue_monitor& operator=(const venue_monitor&) = delete;
+
+private:
+    void run();
+    void check_all();
+
+    std::vector<std::string> venues_;
+    monitor_options options_;
+
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    bool stopping_ = false;
+    // Abandons the heartbeats in flight when the monitor is destroyed
+    net::cancellation_token stop_;
+    std::thread thread_;
+};
+
+// Lock-free, and safe to call from any thread
+auto get_venue_health(const std::string& venue) -> venue_health;
+
+} // end namespace stockfighter
+
+#endif // STOCKFIGHTER_MONITOR_HPP
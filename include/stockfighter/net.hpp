@@ -0,0 +1,350 @@
+#ifndef STOCKFIGHTER_NET_HPP
+#define STOCKFIGHTER_NET_HPP
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace stockfighter {
+namespace net {
+
+// Low-level settings for the TCP sockets under each connection. They are
+// applied as connections are opened, so changing them doesn't affect those
+// already open. Zero sizes and intervals leave the system's default, and
+// settings which the system refuses are quietly left as they were.
+struct socket_options {
+    // Sends each request straight away rather than waiting to see if more
+    // data follows (Nagle's algorithm)
+    bool no_delay = true;
+    // Linux only: acknowledges data as soon as it arrives rather than
+    // waiting to see if a reply can carry the acknowledgement. The kernel
+    // drops back to delayed acknowledgements by itself, so this is set
+    // again after every read, at the cost of a system call.
+    bool quick_ack = false;
+    // Linux only: how long a read which would block spins polling the
+    // network device for data before sleeping. Going above the
+    // net.core.busy_read sysctl needs CAP_NET_ADMIN.
+    std::chrono::microseconds busy_poll{0};
+    // SO_RCVBUF and SO_SNDBUF, in bytes. With the Boost.Asio backend these
+    // are set once the connection is established, which is too late to
+    // change the window scaling agreed with the server.
+    int receive_buffer = 0;
+    int send_buffer = 0;
+    // If set, idle connections send TCP keepalive probes this often, so
+    // that one which has silently died is noticed without a request
+    // having to fail first
+    std::chrono::seconds keepalive_interval{0};
+};
+
+// Settings for the pool of persistent connections used by the api:: and
+// game:: calls. Connections are kept separately for each host.
+struct pool_options {
+    // Maximum number of connections open to a single host at once. Callers
+    // wait for a connection to be returned when this many are in use.
+    int max_connections_per_host = 4;
+    // With adaptive sizing, each host starts out allowed this many
+    // connections. More are opened, up to the maximum, once requests spend
+    // long enough queueing for one compared with the server's round trip
+    // time. Connections left idle for scale_down_after are closed again,
+    // down to the minimum. Without it, the maximum is the only limit. The
+    // epoll and io_uring backends always allow the maximum.
+    bool adaptive = true;
+    int min_connections_per_host = 1;
+    std::chrono::milliseconds scale_down_after{5000};
+    // Idle connections which have not been used for this long are closed
+    // rather than reused
+    std::chrono::seconds idle_timeout{30};
+    // Batched GETs such as api::get_quotes() write up to this many requests
+    // to a connection before waiting for the responses
+    int max_pipeline_depth = 16;
+    // Applied to every connection the pool opens, and to the HTTP/2
+    // connections too
+    socket_options socket;
+};
+
+void set_pool_options(const pool_options& options);
+
+auto get_pool_options() -> pool_options;
+
+// How the HTTP/1.1 pool's connections to one host stand at the moment
+struct host_pool_stats {
+    // scheme://host:port
+    std::string host;
+    int open = 0;
+    int idle = 0;
+    // Requests waiting for a connection
+    int waiting = 0;
+    // How many connections the host may have just now; fixed at the
+    // maximum unless the pool is adaptive
+    int limit = 0;
+    // Smoothed over recent requests: the time spent waiting for a
+    // connection, and the time from sending a request to its response
+    std::chrono::microseconds queue_delay{0};
+    std::chrono::microseconds rtt{0};
+};
+
+auto get_pool_stats() -> std::vector<host_pool_stats>;
+
+// Number of threads which perform the asynchronous api:: calls and run
+// their callbacks. Only has an effect if called before the first
+// asynchronous call is made. Defaults to 2.
+void set_io_threads(int count);
+
+enum class protocol {
+    http1_1,
+    http2
+};
+
+// Selects how requests are sent. With HTTP/2, all of the requests to a
+// host are multiplexed over a single TLS connection, so a slow request
+// never holds up the others. Hosts which don't negotiate HTTP/2, and
+// plain http:// URLs, still use HTTP/1.1. Defaults to HTTP/1.1.
+void set_protocol(protocol p);
+
+auto get_protocol() -> protocol;
+
+// What drives the network I/O. The default uses Boost.Asio and supports
+// both HTTP/1.1 and HTTP/2. On Linux, epoll instead runs every request on
+// one thread of its own using non-blocking sockets and epoll directly. With
+// several requests in flight, that costs fewer system calls and
+// allocations per request; one blocking call at a time is a little slower,
+// since it has to be handed to that thread and back. It only speaks
+// HTTP/1.1 and ignores set_protocol(). io_uring is like epoll, but
+// hands the I/O for all of its connections to the kernel in batches, one
+// system call at a time; it falls back to epoll if the kernel doesn't
+// allow io_uring or is older than Linux 5.13. Elsewhere both are the same as asio.
+enum class backend {
+    asio,
+    epoll,
+    io_uring
+};
+
+void set_backend(backend b);
+
+auto get_backend() -> backend;
+
+// Counts of TLS handshakes since the program started. Sessions are cached
+// for each host, so reconnecting to a host normally resumes the previous
+// session with an abbreviated handshake.
+struct tls_stats {
+    long full_handshakes = 0;
+    long resumed_handshakes = 0;
+};
+
+auto get_tls_stats() -> tls_stats;
+
+// Host names are resolved once and then served from a cache, which is
+// refreshed in the background before entries are older than the TTL.
+// Defaults to 60 seconds.
+void set_dns_ttl(std::chrono::seconds ttl);
+
+// Sends everything for the host to a fixed IP address instead of looking it
+// up, for example to use a local stand-in for the exchange. A port of 0
+// keeps the port from the URL. TLS certificates are still checked against
+// the original host name.
+void pin_host(const std::string& host, const std::string& address,
+              unsigned short port = 0);
+
+void unpin_host(const std::string& host);
+
+// Asks servers to compress response bodies with gzip or deflate. Bodies
+// are decompressed as they arrive, so this mostly pays off for large
+// responses such as order books. Defaults to on.
+void set_compression(bool enabled);
+
+auto get_compression() -> bool;
+
+// The kinds of request made by the api:: and game:: calls, for settings
+// which can differ between them
+enum class endpoint {
+    heartbeat,
+    venue_heartbeat,
+    stocks,
+    orderbook,
+    quote,
+    order_status,
+    level_status,
+    place_order,
+    cancel_order,
+    level_control
+};
+
+constexpr std::size_t endpoint_count = 10;
+
+// Identical GETs (same URL and API key) can share one request: callers
+// asking while one is already in flight wait for it and get a copy of its
+// result. Off for every endpoint by default.
+struct coalescing_options {
+    bool enabled = false;
+    // Results which arrived no longer ago than this are also handed out
+    // without making a new request. Zero only shares requests still in
+    // flight.
+    std::chrono::microseconds max_staleness{0};
+};
+
+// Only has an effect for GET endpoints
+void set_coalescing(endpoint e, const coalescing_options& options);
+
+auto get_coalescing(endpoint e) -> coalescing_options;
+
+// Hedging sends a GET a second time if no response has arrived after
+// the given percentile of the endpoint's recent response times, and uses
+// whichever copy is answered first. This trims the tail latency caused by
+// the odd stalled connection, at the cost of some extra requests. Hedging
+// only starts once a few responses have been timed. Off for every
+// endpoint by default.
+struct hedging_options {
+    bool enabled = false;
+    double percentile = 0.95;
+    // Never hedge sooner than this
+    std::chrono::microseconds min_delay{1000};
+};
+
+// Only has an effect for GET endpoints
+void set_hedging(endpoint e, const hedging_options& options);
+
+auto get_hedging(endpoint e) -> hedging_options;
+
+struct hedging_stats {
+    // Requests made with hedging enabled
+    long requests = 0;
+    long hedges_sent = 0;
+    // Hedges which were answered before the original request
+    long hedges_won = 0;
+};
+
+auto get_hedging_stats() -> hedging_stats;
+
+// Classes of request for the rate limiter, most important first
+enum class priority {
+    cancel,
+    order,
+    status,
+    market_data
+};
+
+constexpr std::size_t priority_count = 4;
+
+// Client-side token bucket covering every request. Each request takes a
+// token, and tokens are replenished at a steady rate up to the burst size.
+// Lower priority classes have to leave some tokens behind, so that when
+// the budget runs low, cancels and orders still get through while quotes
+// and orderbooks are held back. Requests wait in priority order for a
+// token, and fail with net::rate_limited if they wait for longer than
+// their class allows. Off by default.
+struct rate_limit_options {
+    bool enabled = false;
+    double requests_per_second = 10;
+    double burst = 20;
+    // Tokens which must be left in the bucket after a request of each
+    // class takes one, indexed by priority
+    std::array<double, priority_count> reserve{{0, 1, 3, 5}};
+    // How long requests of each class may wait; milliseconds::max() means
+    // they are never dropped
+    std::array<std::chrono::milliseconds, priority_count> max_wait{{
+            std::chrono::milliseconds::max(),
+            std::chrono::milliseconds::max(),
+            std::chrono::milliseconds{2000},
+            std::chrono::milliseconds{250}
+    }};
+};
+
+struct rate_limited : std::runtime_error {
+    using std::runtime_error::runtime_error;
+};
+
+void set_rate_limit(const rate_limit_options& options);
+
+auto get_rate_limit() -> rate_limit_options;
+
+// The number of tokens currently in the bucket
+auto rate_limit_budget() -> double;
+
+// Once a host has as many requests in flight as its connections can carry,
+// further requests wait their turn in the scheduler rather than in the
+// transport. They go in priority order, the same classes as the rate
+// limiter uses, and within a class the one with the earliest deadline goes
+// first, so a cancel never waits behind a queue of orderbook polls.
+// Market data whose deadline has passed by the time it reaches the front
+// is dropped rather than sent. Requests already sent are never held up.
+// The api::get_quotes() and api::place_orders() batches are pipelined on a
+// single connection, so each batch takes one turn. Off by default.
+struct scheduler_options {
+    bool enabled = false;
+    // Zero follows the transport: max_connections_per_host for the
+    // HTTP/1.1 backends, and no limit with HTTP/2, whose requests don't
+    // queue, or with a transport installed with set_transport() which
+    // doesn't say
+    int max_in_flight_per_host = 0;
+};
+
+void set_scheduler_options(const scheduler_options& options);
+
+auto get_scheduler_options() -> scheduler_options;
+
+// Passed to the callback (or thrown) when a request's deadline passes
+// before the response arrives
+struct timed_out : std::runtime_error {
+    using std::runtime_error::runtime_error;
+};
+
+// Passed to the callback (or thrown) when a request is withdrawn by
+// cancelling its token
+struct cancelled : std::runtime_error {
+    using std::runtime_error::runtime_error;
+};
+
+// Lets requests be withdrawn once they are no longer wanted, for example
+// when a fresher quote has arrived. Copies share their state, so one token
+// can be given to any number of requests and cancelled from any thread.
+class cancellation_token {
+public:
+    using callback_id = std::uint64_t;
+
+    // A new token, not yet cancelled
+    cancellation_token();
+
+    // A token which can never be cancelled. Copying it is free.
+    static auto never() -> const cancellation_token&;
+
+    void cancel();
+
+    bool is_cancelled() const;
+
+    bool can_be_cancelled() const { return state_ != nullptr; }
+
+    // For transports: arranges for the function to be called, on the
+    // thread which cancels the token, when the token is cancelled. If it
+    // already has been, the function is called straight away.
+    auto on_cancel(std::function<void()> func) const -> callback_id;
+
+    void remove_callback(callback_id id) const;
+
+private:
+    struct state;
+
+    explicit cancellation_token(std::shared_ptr<state> s);
+
+    std::shared_ptr<state> state_;
+};
+
+// Per-call settings for the api:: calls
+struct call_options {
+    // The request fails with net::timed_out if the response hasn't arrived
+    // within this time, including any wait for the rate limiter. Zero
+    // means no deadline.
+    std::chrono::milliseconds timeout{0};
+    // Cancelling the token makes the request fail with net::cancelled
+    cancellation_token token = cancellation_token::never();
+};
+
+} // end namespace net
+} // end namespace stockfighter
+
+#endif // STOCKFIGHTER_NET_HPP
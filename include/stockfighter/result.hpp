@@ -0,0 +1,108 @@
+#ifndef STOCKFIGHTER_RESULT_HPP
+#define STOCKFIGHTER_RESULT_HPP
+
+#include <exception>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+namespace stockfighter {
+
+// Why a call made through one of the non-throwing overloads failed
+enum class errc {
+    // The server turned the request down and said why, e.g. an order it
+    // won't accept or a cancel for an order it doesn't know
+    rejected = 1,
+    // The server answered with an error status and no explanation
+    bad_status,
+    // The response wasn't what we expected
+    bad_response,
+    // No response arrived: the request timed out, was cancelled or rate
+    // limited, or the connection failed
+    no_response,
+    // Not sent at all, because a venue_monitor says the venue is down
+    venue_down
+};
+
+struct error {
+    errc code = errc::rejected;
+    // The HTTP status, or 0 if no response arrived
+    int status = 0;
+    // The server's own explanation, exactly as it was sent, or else the
+    // status line's reason phrase
+    std::string message;
+    // For no_response and bad_response, whatever was thrown along the way
+    std::exception_ptr exception;
+};
+
+// Thrown by the throwing calls when the server rejects a request or
+// answers with an error status
+struct call_failed : std::runtime_error {
+    explicit call_failed(error e);
+
+    error details;
+};
+
+// Throws what the throwing version of a call would have thrown: the
+// original exception if there was one, otherwise call_failed
+[[noreturn]] void throw_error(const error& e);
+
+// The outcome of a call which reports failure by returning it rather than
+// by throwing: either a value, or the error. On failure, the value is
+// default-constructed.
+template <typename T>
+class result {
+public:
+    result(T value) : value_(std::move(value)) {}
+
+    result(stockfighter::error e) : failed_(true), error_(std::move(e)) {}
+
+    explicit operator bool() const { return !failed_; }
+
+    bool has_value() const { return !failed_; }
+
+    // These throw as the throwing version of the call would have, if it
+    // failed
+    auto value() & -> T&
+    {
+        check();
+        return value_;
+    }
+
+    auto value() const & -> const T&
+    {
+        check();
+        return value_;
+    }
+
+    auto value() && -> T
+    {
+        check();
+        return std::move(value_);
+    }
+
+    auto operator*() -> T& { return value_; }
+    auto operator*() const -> const T& { return value_; }
+    auto operator->() -> T* { return &value_; }
+    auto operator->() const -> const T* { return &value_; }
+
+    // Only meaningful if the call failed
+    auto error() const & -> const stockfighter::error& { return error_; }
+    auto error() && -> stockfighter::error { return std::move(error_); }
+
+private:
+    void check() const
+    {
+        if (failed_) {
+            throw_error(error_);
+        }
+    }
+
+    bool failed_ = false;
+    T value_{};
+    stockfighter::error error_;
+};
+
+} // end namespace stockfighter
+
+#endif // STOCKFIGHTER_RESULT_HPP
@@ -0,0 +1,93 @@
+#ifndef STOCKFIGHTER_TRANSPORT_HPP
+#define STOCKFIGHTER_TRANSPORT_HPP
+
+#include <stockfighter/http.hpp>
+#include <stockfighter/net.hpp>
+#include <stockfighter/result.hpp>
+
+#include <functional>
+#include <memory>
+#include <vector>
+
+namespace stockfighter {
+namespace net {
+
+// Something which can carry HTTP requests to a server and bring back the
+// responses. The api:: and game:: calls send everything through a
+// transport: normally one of the built-in network transports, or one
+// installed with set_transport().
+class transport {
+public:
+    virtual ~transport() = default;
+
+    virtual auto send(const http::request& req) -> http::response = 0;
+
+    // Sends a batch of idempotent GETs to the same host. Responses are in
+    // the same order as the requests.
+    virtual auto send_pipelined(const std::vector<http::request>& reqs)
+            -> std::vector<http::response> = 0;
+
+    // Sends a batch of requests to the same host which mustn't be repeated,
+    // such as orders, and returns what became of each of them, in order.
+    // None is sent twice unless the server can't have seen it. By default
+    // they are sent concurrently with async_send().
+    virtual auto send_batch(const std::vector<http::request>& reqs)
+            -> std::vector<result<http::response>>;
+
+    // Returns immediately (or, at least, without waiting on the network),
+    // calling the handler once the response has arrived. If the token is
+    // cancelled first, the transport should abandon the request as soon as
+    // it can; the handler is still called, but its result will be ignored.
+    virtual void async_send(http::request req,
+                            http::response_handler handler,
+                            const cancellation_token& token) = 0;
+
+    // Opens up to the given number of connections to the host ahead of
+    // time, so that the requests which follow don't have to wait for them.
+    // Calls done once they are ready, or have failed; either way, it is
+    // only an optimisation. By default there is nothing to prepare and done
+    // is called straight away.
+    virtual void async_warm_up(const http::url& /*host*/, int /*connections*/,
+                               std::function<void()> done)
+    {
+        done();
+    }
+
+    // How many requests to one host the transport can carry at once. When
+    // the scheduler is enabled, it holds any more back itself, in priority
+    // order. Zero, the default, means there is no such limit.
+    virtual auto max_in_flight_per_host() const -> int { return 0; }
+};
+
+// Sends every subsequent request through the given transport. Passing
+// nullptr goes back to the built-in transport chosen by set_protocol().
+void set_transport(std::shared_ptr<transport> t);
+
+// Transport which never touches the network: each request is handed
+// straight to a function, and whatever it returns (or throws) is the
+// response. Useful for offline tests, and for measuring the cost of our
+// own code without a network in the way. Asynchronous requests are
+// completed on the calling thread before async_send() returns.
+class loopback_transport : public transport {
+public:
+    using handler = std::function<http::response(const http::request&)>;
+
+    explicit loopback_transport(handler h);
+
+    auto send(const http::request& req) -> http::response override;
+
+    auto send_pipelined(const std::vector<http::request>& reqs)
+            -> std::vector<http::response> override;
+
+    void async_send(http::request req,
+                    http::response_handler handler,
+                    const cancellation_token& token) override;
+
+private:
+    handler handler_;
+};
+
+} // end namespace net
+} // end namespace stockfighter
+
+#endif // STOCKFIGHTER_TRANSPORT_HPP
@@ -3,7 +3,10 @@
 #define STOCKFIGHTER_TYPES_HPP
 
 #include <chrono>
+#include <exception>
+#include <functional>
 #include <map>
+#include <stdexcept>
 #include <string>
 #include <vector>
 
@@ -11,6 +14,11 @@ namespace stockfighter {
 
 using time_point = std::chrono::system_clock::time_point;
 
+// Completion handler for asynchronous calls. On failure, error is set and
+// result is default-constructed.
+template <typename T>
+using callback = std::function<void(std::exception_ptr error, T result)>;
+
 struct stock {
     std::string symbol;
     std::string name;
@@ -27,6 +35,7 @@ inline auto to_string(direction d) -> std::string
     case direction::buy: return "buy";
     case direction::sell: return "sell";
     }
+    throw std::domain_error("Unexpected direction passed to to_string()");
 }
 
 inline auto direction_from_string(const std::string& str) -> direction
@@ -70,6 +79,7 @@ inline auto to_string(order_type o) -> std::string
     case order_type::fill_or_kill: return "fill-or-kill";
     case order_type::immediate_or_cancel: return "immediate-or-cancel";
     }
+    throw std::domain_error("Unexpected order type passed to to_string()");
 }
 
 inline auto order_type_from_string(const std::string& str) -> order_type
@@ -103,6 +113,17 @@ struct quote {
     time_point quote_time; // timestamp of quote
 };
 
+// One of the orders for api::place_orders()
+struct order_request {
+    std::string account;
+    std::string venue;
+    std::string stock;
+    int price = 0;
+    int quantity = 0;
+    direction dir = direction::buy;
+    order_type type = order_type::limit;
+};
+
 struct order_status {
     struct fill {
         int price = 0;
@@ -112,11 +133,11 @@ struct order_status {
 
     std::string symbol;
     std::string venue;
-    direction direction = direction::buy;
+    stockfighter::direction direction = stockfighter::direction::buy;
     int original_quantity = 0;
     int quantity = 0;
     int price = 0;
-    order_type order_type = order_type::limit;
+    stockfighter::order_type order_type = stockfighter::order_type::limit;
     int id = 0;
     std::string account;
     time_point timestamp;
@@ -1,14 +1,26 @@
 
 #include <stockfighter/api.hpp>
 
+#include "async.hpp"
+#include "io_runner.hpp"
+#include "monitor.hpp"
 #include "rest.hpp"
 
+#include <boost/asio/post.hpp>
 #include <cppformat/format.h>
 #include <date.h>
 
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <new>
+#include <utility>
+
 namespace nl = nlohmann;
 
 using namespace std::string_literals;
+using stockfighter::detail::converting;
+using stockfighter::detail::make_future;
 
 namespace stockfighter {
 namespace api {
@@ -76,22 +88,8 @@ auto make_order_status(const nl::json& json)
     return s;
 }
 
-} // end anonymous namespace
-
-
-bool heartbeat()
-{
-    constexpr char uri[] = "https://api.stockfighter.io/ob/api/heartbeat";
-    rest::get(uri);
-
-    return true;
-}
-
-bool venue_heartbeat(const std::string& venue)
+auto json_to_venue_ok(const nl::json& json, const std::string& venue)
 {
-    constexpr char uri[] = "https://api.stockfighter.io/ob/api/venues/{}/heartbeat";
-    const auto json = rest::get(fmt::format(uri, venue));
-
     if (json.at("venue") != venue) {
         throw std::runtime_error{"Not working"};
     }
@@ -99,11 +97,8 @@ bool venue_heartbeat(const std::string& venue)
     return true;
 }
 
-std::vector<stock> get_stocks(const std::string& venue)
+auto json_to_stocks(const nl::json& json)
 {
-    constexpr char uri[] = "https://api.stockfighter.io/ob/api/venues/{}/stocks";
-    const auto json = rest::get(fmt::format(uri, venue));
-
     auto output = std::vector<stock>{};
 
     for (const auto& s : json.at("symbols")) {
@@ -113,12 +108,13 @@ std::vector<stock> get_stocks(const std::string& venue)
     return output;
 }
 
-orderbook get_orderbook(const std::string& venue, const std::string& stock)
+auto json_to_orderbook(const nl::json& json,
+                       const std::string& venue,
+                       const std::string& stock)
 {
-    constexpr char uri[] = "https://api.stockfighter.io/ob/api/venues/{}/stocks/{}";
-    const auto json = rest::get(fmt::format(uri, venue, stock));
-
-    auto output = orderbook{venue, stock};
+    auto output = orderbook{};
+    output.venue = venue;
+    output.symbol = stock;
 
     for (const auto& bid : json.at("bids")) {
         output.bids.push_back(
@@ -137,11 +133,8 @@ orderbook get_orderbook(const std::string& venue, const std::string& stock)
     return output;
 }
 
-quote get_quote(const std::string& venue, const std::string& stock)
+auto json_to_quote(const nl::json& json)
 {
-    constexpr char uri[] = "https://api.stockfighter.io/ob/api/venues/{}/stocks/{}/quote";
-    const auto json = rest::get(fmt::format(uri, venue, stock));
-
     return quote {
             json.at("symbol"),
             json.at("venue"),
@@ -158,16 +151,15 @@ quote get_quote(const std::string& venue, const std::string& stock)
     };
 }
 
-order_status place_order(const std::string& api_key,
-                         const std::string& account,
-                         const std::string& venue,
-                         const std::string& stock,
-                         int price,
-                         int quantity,
-                         direction dir,
-                         order_type type)
+auto make_order_json(const std::string& account,
+                     const std::string& venue,
+                     const std::string& stock,
+                     int price,
+                     int quantity,
+                     direction dir,
+                     order_type type)
 {
-    const auto in_json = nl::json::object(
+    return nl::json::object(
             {
                     {"account",   account},
                     {"venue",     venue},
@@ -177,34 +169,505 @@ order_status place_order(const std::string& api_key,
                     {"direction", to_string(dir)},
                     {"orderType", to_string(type)}
             });
+}
+
+// Converts a successful response, reporting a malformed one as an error
+template <typename Convert>
+auto converted(result<nl::json> json, Convert convert)
+        -> result<decltype(convert(std::declval<const nl::json&>()))>
+{
+    if (!json) {
+        return std::move(json).error();
+    }
+    try {
+        return convert(*json);
+    } catch (...) {
+        return error{errc::bad_response, 200, {}, std::current_exception()};
+    }
+}
+
+// A venue which a venue_monitor knows to be down isn't worth waiting on
+auto venue_down() -> error
+{
+    return error{errc::venue_down, 0, {}, nullptr};
+}
+
+// Fails an asynchronous order call on the I/O threads, where callbacks are
+// promised to run, rather than on the caller's thread
+void post_venue_down(callback<order_status> cb)
+{
+    auto& io = net::default_io();
+    io.start();
+    boost::asio::post(io.context(), [cb = std::move(cb)] {
+        cb(std::make_exception_ptr(call_failed{venue_down()}), {});
+    });
+}
+
+auto always_ok(const nl::json&)
+{
+    return true;
+}
+
+constexpr char heartbeat_uri[] = "https://api.stockfighter.io/ob/api/heartbeat";
+constexpr char api_host_uri[] = "https://api.stockfighter.io";
+constexpr char venue_heartbeat_uri[] = "https://api.stockfighter.io/ob/api/venues/{}/heartbeat";
+constexpr char stocks_uri[] = "https://api.stockfighter.io/ob/api/venues/{}/stocks";
+constexpr char orderbook_uri[] = "https://api.stockfighter.io/ob/api/venues/{}/stocks/{}";
+constexpr char quote_uri[] = "https://api.stockfighter.io/ob/api/venues/{}/stocks/{}/quote";
+constexpr char orders_uri[] = "https://api.stockfighter.io/ob/api/venues/{}/stocks/{}/orders";
+constexpr char order_uri[] = "https://api.stockfighter.io/ob/api/venues/{}/stocks/{}/orders/{}";
+
+} // end anonymous namespace
 
-    constexpr char uri[] = "https://api.stockfighter.io/ob/api/venues/{}/stocks/{}/orders";
-    const auto out_json = rest::post(fmt::format(uri, venue, stock),
-                                     in_json.dump(),
-                                     api_key);
 
-    return make_order_status(out_json);
+result<bool> heartbeat(std::nothrow_t, const net::call_options& opts)
+{
+    return converted(rest::try_get(net::endpoint::heartbeat, heartbeat_uri, {}, opts),
+                     always_ok);
+}
+
+bool heartbeat(const net::call_options& opts)
+{
+    return heartbeat(std::nothrow, opts).value();
+}
+
+result<bool> venue_heartbeat(std::nothrow_t, const std::string& venue,
+                             const net::call_options& opts)
+{
+    return converted(rest::try_get(net::endpoint::venue_heartbeat,
+                                   fmt::format(venue_heartbeat_uri, venue), {}, opts),
+                     [&venue](const nl::json& json) {
+                         return json_to_venue_ok(json, venue);
+                     });
+}
+
+bool venue_heartbeat(const std::string& venue,
+                     const net::call_options& opts)
+{
+    return venue_heartbeat(std::nothrow, venue, opts).value();
+}
+
+result<std::vector<stock>> get_stocks(std::nothrow_t, const std::string& venue,
+                                      const net::call_options& opts)
+{
+    return converted(rest::try_get(net::endpoint::stocks,
+                                   fmt::format(stocks_uri, venue), {}, opts),
+                     json_to_stocks);
+}
+
+std::vector<stock> get_stocks(const std::string& venue,
+                              const net::call_options& opts)
+{
+    return get_stocks(std::nothrow, venue, opts).value();
+}
+
+result<orderbook> get_orderbook(std::nothrow_t, const std::string& venue,
+                                const std::string& stock,
+                                const net::call_options& opts)
+{
+    return converted(rest::try_get(net::endpoint::orderbook,
+                                   fmt::format(orderbook_uri, venue, stock), {}, opts),
+                     [&](const nl::json& json) {
+                         return json_to_orderbook(json, venue, stock);
+                     });
+}
+
+orderbook get_orderbook(const std::string& venue, const std::string& stock,
+                        const net::call_options& opts)
+{
+    return get_orderbook(std::nothrow, venue, stock, opts).value();
+}
+
+result<quote> get_quote(std::nothrow_t, const std::string& venue,
+                        const std::string& stock,
+                        const net::call_options& opts)
+{
+    return converted(rest::try_get(net::endpoint::quote,
+                                   fmt::format(quote_uri, venue, stock), {}, opts),
+                     json_to_quote);
+}
+
+quote get_quote(const std::string& venue, const std::string& stock,
+                const net::call_options& opts)
+{
+    return get_quote(std::nothrow, venue, stock, opts).value();
+}
+
+std::vector<quote> get_quotes(const std::string& venue,
+                              const std::vector<std::string>& stocks,
+                              const net::call_options& opts)
+{
+    auto uris = std::vector<std::string>{};
+    for (const auto& stock : stocks) {
+        uris.push_back(fmt::format(quote_uri, venue, stock));
+    }
+
+    auto output = std::vector<quote>{};
+    for (const auto& json : rest::get_pipelined(net::endpoint::quote, uris, {}, opts)) {
+        output.push_back(json_to_quote(json));
+    }
+
+    return output;
+}
+
+std::vector<orderbook> get_orderbooks(const std::string& venue,
+                                      const std::vector<std::string>& stocks,
+                                      const net::call_options& opts)
+{
+    auto uris = std::vector<std::string>{};
+    for (const auto& stock : stocks) {
+        uris.push_back(fmt::format(orderbook_uri, venue, stock));
+    }
+
+    const auto responses = rest::get_pipelined(net::endpoint::orderbook, uris,
+                                                 {}, opts);
+
+    auto output = std::vector<orderbook>{};
+    for (std::size_t i = 0; i < responses.size(); ++i) {
+        output.push_back(json_to_orderbook(responses[i], venue, stocks[i]));
+    }
+
+    return output;
+}
+
+result<order_status> place_order(std::nothrow_t,
+                                 const std::string& api_key,
+                                 const std::string& account,
+                                 const std::string& venue,
+                                 const std::string& stock,
+                                 int price,
+                                 int quantity,
+                                 direction dir,
+                                 order_type type,
+                                 const net::call_options& opts)
+{
+    if (detail::refuses_orders(venue)) {
+        return venue_down();
+    }
+
+    const auto in_json = make_order_json(account, venue, stock, price,
+                                         quantity, dir, type);
+
+    return converted(rest::try_post(net::endpoint::place_order,
+                                    fmt::format(orders_uri, venue, stock),
+                                    in_json.dump(),
+                                    api_key, opts),
+                     make_order_status);
+}
+
+order_status place_order(const std::string& api_key,
+                         const std::string& account,
+                         const std::string& venue,
+                         const std::string& stock,
+                         int price,
+                         int quantity,
+                         direction dir,
+                         order_type type,
+                         const net::call_options& opts)
+{
+    return place_order(std::nothrow, api_key, account, venue, stock, price,
+                       quantity, dir, type, opts).value();
+}
+
+std::vector<result<order_status>> place_orders(const std::string& api_key,
+                                               const std::vector<order_request>& orders,
+                                               const net::call_options& opts)
+{
+    auto output = std::vector<result<order_status>>{};
+    output.reserve(orders.size());
+
+    // Orders for venues known to be down are left out of the batch
+    auto sent = std::vector<std::size_t>{};
+    auto uris = std::vector<std::string>{};
+    auto bodies = std::vector<std::string>{};
+
+    for (std::size_t i = 0; i < orders.size(); ++i) {
+        const auto& o = orders[i];
+        if (detail::refuses_orders(o.venue)) {
+            output.push_back(venue_down());
+            continue;
+        }
+        output.push_back(order_status{});
+        sent.push_back(i);
+        uris.push_back(fmt::format(orders_uri, o.venue, o.stock));
+        bodies.push_back(make_order_json(o.account, o.venue, o.stock, o.price,
+                                         o.quantity, o.dir, o.type).dump());
+    }
+
+    auto responses = rest::post_batch(net::endpoint::place_order, uris, bodies,
+                                      api_key, opts);
+    for (std::size_t i = 0; i < sent.size(); ++i) {
+        output[sent[i]] = converted(std::move(responses[i]), make_order_status);
+    }
+
+    return output;
+}
+
+result<order_status> cancel_order(std::nothrow_t,
+                                  const std::string& api_key,
+                                  const std::string& venue,
+                                  const std::string& stock, int order_id,
+                                  const net::call_options& opts)
+{
+    if (detail::refuses_orders(venue)) {
+        return venue_down();
+    }
+
+    return converted(rest::try_delete(net::endpoint::cancel_order,
+                                      fmt::format(order_uri, venue, stock, order_id),
+                                      api_key, opts),
+                     make_order_status);
 }
 
 order_status cancel_order(const std::string& api_key,
                           const std::string& venue,
-                          const std::string& stock, int order_id)
+                          const std::string& stock, int order_id,
+                          const net::call_options& opts)
+{
+    return cancel_order(std::nothrow, api_key, venue, stock, order_id, opts).value();
+}
+
+result<order_status> get_order_status(std::nothrow_t,
+                                      const std::string& api_key,
+                                      const std::string& venue,
+                                      const std::string& stock,
+                                      int order_id,
+                                      const net::call_options& opts)
 {
-    constexpr char uri[] = "https://api.stockfighter.io/ob/api/venues/{}/stocks/{}/orders/{}";
-    const auto json = rest::delete_(fmt::format(uri, venue, stock, order_id),
-                                    api_key);
-    return make_order_status(json);
+    return converted(rest::try_get(net::endpoint::order_status,
+                                   fmt::format(order_uri, venue, stock, order_id),
+                                   api_key, opts),
+                     make_order_status);
 }
 
 order_status get_order_status(const std::string& api_key,
                               const std::string& venue,
                               const std::string& stock,
-                              int order_id)
+                              int order_id,
+                              const net::call_options& opts)
+{
+    return get_order_status(std::nothrow, api_key, venue, stock, order_id,
+                            opts).value();
+}
+
+void async_heartbeat(callback<bool> cb,
+                     const net::call_options& opts)
+{
+    rest::async_get(net::endpoint::heartbeat, heartbeat_uri, {},
+                    converting(std::move(cb), [](const nl::json&) {
+                        return true;
+                    }),
+                    opts);
+}
+
+void async_venue_heartbeat(const std::string& venue, callback<bool> cb,
+                           const net::call_options& opts)
+{
+    rest::async_get(net::endpoint::venue_heartbeat,
+                    fmt::format(venue_heartbeat_uri, venue), {},
+                    converting(std::move(cb), [venue](const nl::json& json) {
+                        return json_to_venue_ok(json, venue);
+                    }),
+                    opts);
+}
+
+void async_get_stocks(const std::string& venue,
+                      callback<std::vector<stock>> cb,
+                      const net::call_options& opts)
+{
+    rest::async_get(net::endpoint::stocks,
+                    fmt::format(stocks_uri, venue), {},
+                    converting(std::move(cb), json_to_stocks), opts);
+}
+
+void async_get_orderbook(const std::string& venue,
+                         const std::string& stock,
+                         callback<orderbook> cb,
+                         const net::call_options& opts)
+{
+    rest::async_get(net::endpoint::orderbook,
+                    fmt::format(orderbook_uri, venue, stock), {},
+                    converting(std::move(cb), [venue, stock](const nl::json& json) {
+                        return json_to_orderbook(json, venue, stock);
+                    }),
+                    opts);
+}
+
+void async_get_quote(const std::string& venue,
+                     const std::string& stock,
+                     callback<quote> cb,
+                     const net::call_options& opts)
+{
+    rest::async_get(net::endpoint::quote,
+                    fmt::format(quote_uri, venue, stock), {},
+                    converting(std::move(cb), json_to_quote), opts);
+}
+
+void async_place_order(const std::string& api_key,
+                       const std::string& account,
+                       const std::string& venue,
+                       const std::string& stock,
+                       int price, int quantity,
+                       direction dir,
+                       order_type type,
+                       callback<order_status> cb,
+                       const net::call_options& opts)
+{
+    if (detail::refuses_orders(venue)) {
+        return post_venue_down(std::move(cb));
+    }
+
+    const auto in_json = make_order_json(account, venue, stock, price,
+                                         quantity, dir, type);
+
+    rest::async_post(net::endpoint::place_order,
+                     fmt::format(orders_uri, venue, stock),
+                     in_json.dump(),
+                     api_key,
+                     converting(std::move(cb), make_order_status),
+                     opts);
+}
+
+void async_cancel_order(const std::string& api_key,
+                        const std::string& venue,
+                        const std::string& stock,
+                        int order_id,
+                        callback<order_status> cb,
+                        const net::call_options& opts)
+{
+    if (detail::refuses_orders(venue)) {
+        return post_venue_down(std::move(cb));
+    }
+
+    rest::async_delete(net::endpoint::cancel_order,
+                       fmt::format(order_uri, venue, stock, order_id),
+                       api_key,
+                       converting(std::move(cb), make_order_status),
+                       opts);
+}
+
+void async_get_order_status(const std::string& api_key,
+                            const std::string& venue,
+                            const std::string& stock,
+                            int order_id,
+                            callback<order_status> cb,
+                            const net::call_options& opts)
+{
+    rest::async_get(net::endpoint::order_status,
+                    fmt::format(order_uri, venue, stock, order_id),
+                    api_key,
+                    converting(std::move(cb), make_order_status),
+                    opts);
+}
+
+std::future<bool> async_heartbeat(const net::call_options& opts)
+{
+    return make_future<bool>([&](auto cb) {
+        async_heartbeat(std::move(cb), opts);
+    });
+}
+
+std::future<bool> async_venue_heartbeat(const std::string& venue,
+                                        const net::call_options& opts)
+{
+    return make_future<bool>([&](auto cb) {
+        async_venue_heartbeat(venue, std::move(cb), opts);
+    });
+}
+
+std::future<std::vector<stock>> async_get_stocks(const std::string& venue,
+                                                 const net::call_options& opts)
+{
+    return make_future<std::vector<stock>>([&](auto cb) {
+        async_get_stocks(venue, std::move(cb), opts);
+    });
+}
+
+std::future<orderbook> async_get_orderbook(const std::string& venue,
+                                           const std::string& stock,
+                                           const net::call_options& opts)
+{
+    return make_future<orderbook>([&](auto cb) {
+        async_get_orderbook(venue, stock, std::move(cb), opts);
+    });
+}
+
+std::future<quote> async_get_quote(const std::string& venue,
+                                   const std::string& stock,
+                                   const net::call_options& opts)
+{
+    return make_future<quote>([&](auto cb) {
+        async_get_quote(venue, stock, std::move(cb), opts);
+    });
+}
+
+std::future<order_status> async_place_order(const std::string& api_key,
+                                            const std::string& account,
+                                            const std::string& venue,
+                                            const std::string& stock,
+                                            int price, int quantity,
+                                            direction dir,
+                                            order_type type,
+                                            const net::call_options& opts)
+{
+    return make_future<order_status>([&](auto cb) {
+        async_place_order(api_key, account, venue, stock, price, quantity,
+                          dir, type, std::move(cb), opts);
+    });
+}
+
+std::future<order_status> async_cancel_order(const std::string& api_key,
+                                             const std::string& venue,
+                                             const std::string& stock,
+                                             int order_id,
+                                             const net::call_options& opts)
+{
+    return make_future<order_status>([&](auto cb) {
+        async_cancel_order(api_key, venue, stock, order_id, std::move(cb),
+                           opts);
+    });
+}
+
+std::future<order_status> async_get_order_status(const std::string& api_key,
+                                                 const std::string& venue,
+                                                 const std::string& stock,
+                                                 int order_id,
+                                                 const net::call_options& opts)
+{
+    return make_future<order_status>([&](auto cb) {
+        async_get_order_status(api_key, venue, stock, order_id,
+                               std::move(cb), opts);
+    });
+}
+
+void async_warm_up(const std::vector<std::string>& venues,
+                   std::function<void()> done)
+{
+    const auto connections = std::max(net::get_pool_options().max_connections_per_host, 1);
+
+    rest::async_warm_up(api_host_uri, connections, [venues, done] {
+        if (venues.empty()) {
+            return done();
+        }
+
+        // The heartbeats go out together, over the connections just opened
+        auto remaining = std::make_shared<std::atomic<std::size_t>>(venues.size());
+        for (const auto& venue : venues) {
+            async_venue_heartbeat(venue, [remaining, done](std::exception_ptr, bool) {
+                if (--*remaining == 0) {
+                    done();
+                }
+            });
+        }
+    });
+}
+
+void warm_up(const std::vector<std::string>& venues)
 {
-    constexpr char uri[] = "https://api.stockfighter.io/ob/api/venues/{}/stocks/{}/orders/{}";
-    const auto json = rest::get(fmt::format(uri, venue, stock, order_id),
-                                api_key);
-    return make_order_status(json);
+    auto promise = std::make_shared<std::promise<void>>();
+    auto future = promise->get_future();
+    async_warm_up(venues, [promise] { promise->set_value(); });
+    future.wait();
 }
 
 } // end namespace api
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <stockfighter/types.hpp>
+
+#include <json.hpp>
+
+#include <future>
+#include <memory>
+
+namespace stockfighter {
+namespace detail {
+
+// Adapts a callback expecting T into one accepting the raw JSON response,
+// running convert on the I/O thread
+template <typename T, typename Convert>
+auto converting(callback<T> cb, Convert convert) -> callback<nlohmann::json>
+{
+    return [cb, convert](std::exception_ptr error, nlohmann::json json) {
+        auto result = T{};
+        if (!error) {
+            try {
+                result = convert(json);
+            } catch (...) {
+                error = std::current_exception();
+            }
+        }
+        cb(error, std::move(result));
+    };
+}
+
+// Calls an async_ function taking a callback, returning a future instead
+template <typename T, typename AsyncFunc>
+auto make_future(AsyncFunc func) -> std::future<T>
+{
+    auto promise = std::make_shared<std::promise<T>>();
+    auto future = promise->get_future();
+
+    func([promise](std::exception_ptr error, T result) {
+        if (error) {
+            promise->set_exception(error);
+        } else {
+            promise->set_value(std::move(result));
+        }
+    });
+
+    return future;
+}
+
+} // end namespace detail
+} // end namespace stockfighter
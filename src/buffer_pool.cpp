@@ -0,0 +1,123 @@
+
+#include "buffer_pool.hpp"
+
+#include <algorithm>
+
+namespace stockfighter {
+namespace http {
+
+namespace {
+
+// The bucket holding sizes up to 2^i
+auto bucket_for(std::size_t size) -> std::size_t
+{
+    std::size_t i = 0;
+    while (i < 31 && (std::size_t{1} << i) < size) {
+        ++i;
+    }
+    return i;
+}
+
+} // end anonymous namespace
+
+constexpr std::size_t response_pool::max_kept;
+constexpr std::size_t response_pool::max_body;
+
+response_pool::response_pool()
+{
+    // So that giving responses back never allocates
+    free_.reserve(max_kept);
+}
+
+auto response_pool::take(std::size_t size) -> response
+{
+    auto r = response{};
+    {
+        std::lock_guard<std::mutex> lock{mutex_};
+        if (!free_.empty()) {
+            // The smallest which is big enough, otherwise the biggest
+            auto best = free_.begin();
+            for (auto it = free_.begin() + 1; it != free_.end(); ++it) {
+                const auto cap = it->body.capacity();
+                const auto best_cap = best->body.capacity();
+                if (best_cap < size) {
+                    if (cap > best_cap) {
+                        best = it;
+                    }
+                } else if (cap >= size && cap < best_cap) {
+                    best = it;
+                }
+            }
+            r = std::move(*best);
+            if (best != free_.end() - 1) {
+                *best = std::move(free_.back());
+            }
+            free_.pop_back();
+        }
+    }
+
+    r.status = 0;
+    r.reason.clear();
+    r.body.clear();
+    r.body.reserve(size);
+    r.keep_alive = true;
+    return r;
+}
+
+void response_pool::give_back(response&& r)
+{
+    if (r.body.capacity() > max_body) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock{mutex_};
+    if (free_.size() < max_kept) {
+        free_.push_back(std::move(r));
+    }
+}
+
+auto default_response_pool() -> response_pool&
+{
+    static response_pool pool;
+    return pool;
+}
+
+constexpr std::uint32_t size_histogram::decay_after;
+
+void size_histogram::record(std::size_t size)
+{
+    std::lock_guard<std::mutex> lock{mutex_};
+    ++buckets_[bucket_for(size)];
+    ++total_;
+
+    if (++since_decay_ == decay_after) {
+        since_decay_ = 0;
+        total_ = 0;
+        for (auto& b : buckets_) {
+            b /= 2;
+            total_ += b;
+        }
+    }
+}
+
+auto size_histogram::typical() const -> std::size_t
+{
+    std::lock_guard<std::mutex> lock{mutex_};
+    if (total_ == 0) {
+        return 0;
+    }
+
+    // The 95th percentile, rounded up to its bucket's limit
+    const auto wanted = total_ - total_ / 20;
+    std::uint32_t seen = 0;
+    for (std::size_t i = 0; i < buckets_.size(); ++i) {
+        seen += buckets_[i];
+        if (seen >= wanted) {
+            return std::size_t{1} << i;
+        }
+    }
+    return std::size_t{1} << (buckets_.size() - 1);
+}
+
+} // end namespace http
+} // end namespace stockfighter
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <stockfighter/http.hpp>
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+namespace stockfighter {
+namespace http {
+
+// Responses which have been dealt with, kept for their storage. Parsers
+// fill one of these instead of a new response, so once a few requests have
+// been made, a steady stream of similar responses can be received without
+// allocating anything.
+class response_pool {
+public:
+    response_pool();
+
+    // A cleared response with room for at least size bytes of body, if
+    // one is to hand. The headers are left in place for the parser to
+    // overwrite, and must be cut down to those it actually set.
+    auto take(std::size_t size) -> response;
+
+    // Keeps the response's storage for next time, unless there are enough
+    // spare already or it is too big to be worth keeping
+    void give_back(response&& r);
+
+private:
+    static constexpr std::size_t max_kept = 32;
+    static constexpr std::size_t max_body = 1 << 20;
+
+    std::mutex mutex_;
+    std::vector<response> free_;
+};
+
+auto default_response_pool() -> response_pool&;
+
+// Recent body sizes, counted in power of two buckets. Older samples fade
+// away, so a change in the typical size is picked up after a while.
+class size_histogram {
+public:
+    void record(std::size_t size);
+
+    // Big enough for nearly all of the recent sizes, or zero if nothing has
+    // been recorded yet
+    auto typical() const -> std::size_t;
+
+private:
+    static constexpr std::uint32_t decay_after = 256;
+
+    mutable std::mutex mutex_;
+    std::array<std::uint32_t, 32> buckets_{};
+    std::uint32_t total_ = 0;
+    std::uint32_t since_decay_ = 0;
+};
+
+} // end namespace http
+} // end namespace stockfighter
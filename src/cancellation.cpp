@@ -0,0 +1,119 @@
+
+#include "cancellation.hpp"
+
+#include <cppformat/format.h>
+
+#include <mutex>
+#include <utility>
+#include <vector>
+
+namespace stockfighter {
+namespace net {
+
+struct cancellation_token::state {
+    std::mutex mutex;
+    bool cancelled = false;
+    callback_id next_id = 1;
+    std::vector<std::pair<callback_id, std::function<void()>>> callbacks;
+};
+
+cancellation_token::cancellation_token()
+        : state_(std::make_shared<state>())
+{}
+
+cancellation_token::cancellation_token(std::shared_ptr<state> s)
+        : state_(std::move(s))
+{}
+
+auto cancellation_token::never() -> const cancellation_token&
+{
+    static const cancellation_token token{nullptr};
+    return token;
+}
+
+void cancellation_token::cancel()
+{
+    if (!state_) {
+        return;
+    }
+
+    auto callbacks = decltype(state_->callbacks){};
+    {
+        std::lock_guard<std::mutex> lock{state_->mutex};
+        if (state_->cancelled) {
+            return;
+        }
+        state_->cancelled = true;
+        callbacks.swap(state_->callbacks);
+    }
+
+    for (auto& c : callbacks) {
+        c.second();
+    }
+}
+
+bool cancellation_token::is_cancelled() const
+{
+    if (!state_) {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock{state_->mutex};
+    return state_->cancelled;
+}
+
+auto cancellation_token::on_cancel(std::function<void()> func) const -> callback_id
+{
+    if (!state_) {
+        return 0;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock{state_->mutex};
+        if (!state_->cancelled) {
+            const auto id = state_->next_id++;
+            state_->callbacks.emplace_back(id, std::move(func));
+            return id;
+        }
+    }
+
+    func();
+    return 0;
+}
+
+void cancellation_token::remove_callback(callback_id id) const
+{
+    if (!state_ || id == 0) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock{state_->mutex};
+    auto& callbacks = state_->callbacks;
+    for (auto it = callbacks.begin(); it != callbacks.end(); ++it) {
+        if (it->first == id) {
+            callbacks.erase(it);
+            return;
+        }
+    }
+}
+
+auto cancelled_error(const http::request& req) -> std::exception_ptr
+{
+    return std::make_exception_ptr(cancelled{
+            fmt::format("Request for \"{}\" was cancelled", req.uri.target)});
+}
+
+auto timed_out_error(const http::request& req,
+                     std::chrono::milliseconds timeout,
+                     bool sent) -> std::exception_ptr
+{
+    auto message = fmt::format("Request for \"{}\" timed out after {}ms",
+                               req.uri.target, timeout.count());
+    if (!sent) {
+        return std::make_exception_ptr(timed_out_unsent{
+                message + " without being sent"});
+    }
+    return std::make_exception_ptr(timed_out{message});
+}
+
+} // end namespace net
+} // end namespace stockfighter
@@ -0,0 +1,28 @@
+#pragma once
+
+#include "http.hpp"
+
+#include <stockfighter/net.hpp>
+
+#include <chrono>
+#include <exception>
+
+namespace stockfighter {
+namespace net {
+
+// A request whose deadline passed while it was still held back on this
+// side, so the server never saw it
+struct timed_out_unsent : timed_out {
+    using timed_out::timed_out;
+};
+
+// The errors reported for requests which are given up on. A timeout for a
+// request which hadn't been handed to the transport is a timed_out_unsent.
+auto cancelled_error(const http::request& req) -> std::exception_ptr;
+
+auto timed_out_error(const http::request& req,
+                     std::chrono::milliseconds timeout,
+                     bool sent = true) -> std::exception_ptr;
+
+} // end namespace net
+} // end namespace stockfighter
@@ -0,0 +1,358 @@
+
+#include "connection.hpp"
+#include "dns_cache.hpp"
+#include "session_cache.hpp"
+#include "socket_options.hpp"
+
+#include <boost/asio/connect.hpp>
+#include <boost/asio/dispatch.hpp>
+#include <boost/asio/read.hpp>
+#include <boost/asio/ssl/host_name_verification.hpp>
+#include <boost/asio/write.hpp>
+
+#include <cppformat/format.h>
+
+namespace asio = boost::asio;
+using tcp = boost::asio::ip::tcp;
+using boost::system::error_code;
+
+namespace stockfighter {
+namespace net {
+
+namespace {
+
+bool is_disconnect(const error_code& ec)
+{
+    return ec == asio::error::eof ||
+           ec == asio::error::connection_reset ||
+           ec == asio::error::broken_pipe ||
+           ec == asio::ssl::error::stream_truncated;
+}
+
+} // end anonymous namespace
+
+connection::connection(asio::io_context& io,
+                       asio::ssl::context& ssl,
+                       const http::url& host,
+                       const socket_options& sockets)
+        : host_(host),
+          sockets_(sockets),
+          strand_{asio::make_strand(io)},
+          resolver_{io},
+          stream_{io, ssl},
+          tls_{host.scheme == "https"}
+{}
+
+void connection::connect()
+{
+    asio::connect(stream_.next_layer(),
+                  default_dns_cache().resolve(host_.host, host_.port));
+    on_connected();
+
+    if (tls_) {
+        prepare_tls();
+        stream_.handshake(tls_stream::client);
+        default_session_cache().handshake_done(stream_.native_handle());
+    }
+
+    open_ = true;
+}
+
+void connection::async_connect(connect_handler handler)
+{
+    auto on_handshake = [this, handler](const error_code& ec) {
+        if (ec) {
+            return handler(std::make_exception_ptr(boost::system::system_error{ec}));
+        }
+        if (tls_) {
+            default_session_cache().handshake_done(stream_.native_handle());
+        }
+        open_ = true;
+        handler(nullptr);
+    };
+
+    auto on_connect = [this, handler, on_handshake](const error_code& ec,
+                                                   const tcp::endpoint&) {
+        if (ec) {
+            return handler(std::make_exception_ptr(boost::system::system_error{ec}));
+        }
+        on_connected();
+        if (!tls_) {
+            return on_handshake(ec);
+        }
+        try {
+            prepare_tls();
+        } catch (...) {
+            return handler(std::current_exception());
+        }
+        stream_.async_handshake(tls_stream::client, on_handshake);
+    };
+
+    default_dns_cache().async_resolve(resolver_, host_.host, host_.port,
+                                      [this, handler, on_connect](const error_code& ec,
+                                                                  dns_cache::endpoints results) {
+        if (ec) {
+            return handler(std::make_exception_ptr(boost::system::system_error{ec}));
+        }
+        asio::async_connect(stream_.next_layer(), results, on_connect);
+    });
+}
+
+void connection::prepare_tls()
+{
+    if (!SSL_set_tlsext_host_name(stream_.native_handle(), host_.host.c_str())) {
+        throw std::runtime_error{
+                fmt::format("Could not set SNI host name \"{}\"", host_.host)};
+    }
+    stream_.set_verify_mode(asio::ssl::verify_peer);
+    stream_.set_verify_callback(asio::ssl::host_name_verification{host_.host});
+    default_session_cache().prepare(stream_.native_handle(), host_);
+}
+
+void connection::on_connected()
+{
+    dns_hold_ = default_dns_cache().hold(host_.host, host_.port);
+    apply_socket_options(stream_.next_layer().native_handle(), sockets_);
+}
+
+void connection::on_read()
+{
+    rearm_quick_ack(stream_.next_layer().native_handle(), sockets_);
+}
+
+void connection::start_write(const http::request* reqs, std::size_t count)
+{
+    reused_ = requests_sent_ > 0 || idle_;
+    requests_sent_ += static_cast<int>(count);
+
+    write_buf_.clear();
+    for (std::size_t i = 0; i < count; ++i) {
+        http::write_request(write_buf_, reqs[i]);
+    }
+
+    if (count > 0) {
+        parser_.expect(reqs[0].response_size_hint);
+    }
+}
+
+auto connection::send(const http::request& req) -> http::response
+{
+    start_write(&req, 1);
+
+    auto ec = error_code{};
+
+    with_stream([&](auto& s) {
+        asio::write(s, asio::buffer(write_buf_), ec);
+    });
+
+    try {
+        while (!ec && !parser_.done()) {
+            std::size_t space = 0;
+            if (auto body = parser_.body_space(space)) {
+                // Read the body straight into the response
+                const auto n = with_stream([&](auto& s) {
+                    return s.read_some(asio::buffer(body, space), ec);
+                });
+                on_read();
+                parser_.commit(n);
+                continue;
+            }
+            const auto n = with_stream([&](auto& s) {
+                return s.read_some(asio::buffer(read_buf_), ec);
+            });
+            on_read();
+            parser_.feed(read_buf_.data(), n);
+        }
+    } catch (...) {
+        // Can't tell where the next response would start after this
+        close();
+        parser_.release();
+        throw;
+    }
+
+    return complete(ec);
+}
+
+auto connection::send_pipelined(const http::request* reqs,
+                                std::size_t count) -> std::vector<http::response>
+{
+    start_write(reqs, count);
+
+    auto ec = error_code{};
+
+    with_stream([&](auto& s) {
+        asio::write(s, asio::buffer(write_buf_), ec);
+    });
+
+    auto responses = std::vector<http::response>{};
+    responses.reserve(count);
+
+    // Several responses may arrive in a single read, so keep track of
+    // where the next one starts
+    std::size_t pos = 0;
+    std::size_t len = 0;
+
+    try {
+        while (!ec && responses.size() < count) {
+            if (pos == len) {
+                pos = 0;
+                len = with_stream([&](auto& s) {
+                    return s.read_some(asio::buffer(read_buf_), ec);
+                });
+                on_read();
+                continue;
+            }
+            pos += parser_.feed(read_buf_.data() + pos, len - pos);
+            if (parser_.done()) {
+                responses.push_back(parser_.release());
+                if (!responses.back().keep_alive) {
+                    break;
+                }
+                if (responses.size() < count) {
+                    parser_.expect(reqs[responses.size()].response_size_hint);
+                }
+            }
+        }
+    } catch (...) {
+        close();
+        parser_.release();
+        throw;
+    }
+
+    if (responses.size() < count) {
+        if (responses.empty()) {
+            // Throws unless the response was delimited by the close
+            responses.push_back(complete(ec));
+        } else if (ec && is_disconnect(ec) && parser_.finish()) {
+            responses.push_back(parser_.release());
+        }
+        close();
+        parser_.release();
+        return responses;
+    }
+
+    last_used_ = clock::now();
+
+    if (!responses.back().keep_alive) {
+        close();
+    }
+
+    return responses;
+}
+
+void connection::async_send(const http::request& req, send_handler handler,
+                            bool abortable)
+{
+    start_write(&req, 1);
+    abortable_ = abortable;
+
+    // An abortable write is started on the strand, so that an abort can't
+    // shut the socket down part way through
+    if (abortable) {
+        asio::dispatch(strand_, [this, handler = std::move(handler)] {
+            async_write_request(handler);
+        });
+    } else {
+        async_write_request(std::move(handler));
+    }
+}
+
+void connection::async_write_request(send_handler handler)
+{
+    with_stream([&](auto& s) {
+        with_handler([this, handler](const error_code& ec, std::size_t) {
+            if (ec) {
+                try {
+                    complete(ec);
+                } catch (...) {
+                    return handler(std::current_exception(), {});
+                }
+            }
+            async_read_response(handler);
+        }, [&](auto h) {
+            asio::async_write(s, asio::buffer(write_buf_), std::move(h));
+        });
+    });
+}
+
+void connection::async_read_response(send_handler handler)
+{
+    std::size_t space = 0;
+    auto body = parser_.body_space(space);
+    const bool direct = body != nullptr;
+    const auto buffer = direct ? asio::buffer(body, space)
+                               : asio::buffer(read_buf_);
+
+    with_stream([&](auto& s) {
+        with_handler([this, handler, direct](const error_code& ec, std::size_t n) {
+            auto response = http::response{};
+            on_read();
+            try {
+                if (direct) {
+                    parser_.commit(n);
+                } else {
+                    parser_.feed(read_buf_.data(), n);
+                }
+                if (!ec && !parser_.done()) {
+                    return async_read_response(handler);
+                }
+                response = complete(ec);
+            } catch (...) {
+                close();
+                parser_.release();
+                return handler(std::current_exception(), {});
+            }
+            handler(nullptr, std::move(response));
+        }, [&](auto h) {
+            s.async_read_some(buffer, std::move(h));
+        });
+    });
+}
+
+auto connection::complete(const error_code& ec) -> http::response
+{
+    if (aborted_) {
+        // Whatever arrived, the caller has stopped waiting for it
+        close();
+        parser_.release();
+        throw boost::system::system_error{asio::error::operation_aborted};
+    }
+
+    if (ec && !(is_disconnect(ec) && parser_.finish())) {
+        const bool nothing_received = !parser_.started();
+        close();
+        parser_.release();
+        if (reused_ && nothing_received && is_disconnect(ec)) {
+            throw stale_connection{ec.message()};
+        }
+        throw boost::system::system_error{ec};
+    }
+
+    auto response = parser_.release();
+    last_used_ = clock::now();
+
+    if (!response.keep_alive) {
+        close();
+    }
+
+    return response;
+}
+
+void connection::abort()
+{
+    // Wakes the operation in progress up with an error
+    aborted_ = true;
+    auto ec = error_code{};
+    stream_.next_layer().shutdown(tcp::socket::shutdown_both, ec);
+}
+
+void connection::close()
+{
+    auto ec = error_code{};
+    stream_.next_layer().shutdown(tcp::socket::shutdown_both, ec);
+    stream_.next_layer().close(ec);
+    open_ = false;
+}
+
+} // end namespace net
+} // end namespace stockfighter
@@ -0,0 +1,142 @@
+#pragma once
+
+#include "http.hpp"
+
+#include <stockfighter/net.hpp>
+
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/bind_executor.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/ssl/context.hpp>
+#include <boost/asio/ssl/stream.hpp>
+#include <boost/asio/strand.hpp>
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+
+namespace stockfighter {
+namespace net {
+
+// Thrown when a reused connection turns out to have been closed by the
+// server before any part of the response arrived. The request was not
+// processed, so it is safe to send it again on a fresh connection.
+struct stale_connection : std::runtime_error {
+    using std::runtime_error::runtime_error;
+};
+
+// A single persistent HTTP/1.1 connection, optionally over TLS. Either the
+// blocking or the asynchronous functions may be used, but only one request
+// may be outstanding at a time.
+class connection {
+public:
+    using clock = std::chrono::steady_clock;
+    using connect_handler = std::function<void(std::exception_ptr)>;
+    using send_handler = http::response_handler;
+
+    connection(boost::asio::io_context& io,
+               boost::asio::ssl::context& ssl,
+               const http::url& host,
+               const socket_options& sockets = {});
+
+    connection(const connection&) = delete;
+    connection& operator=(const connection&) = delete;
+
+    void connect();
+
+    auto send(const http::request& req) -> http::response;
+
+    // Writes all of the requests back-to-back and reads the responses in
+    // order. If the server closes the connection part way through, the
+    // responses received up to that point are returned, so only requests
+    // which are safe to repeat should be pipelined.
+    auto send_pipelined(const http::request* reqs,
+                        std::size_t count) -> std::vector<http::response>;
+
+    using executor_type = boost::asio::strand<boost::asio::io_context::executor_type>;
+
+    // Handlers are invoked from a thread running the io_context
+    void async_connect(connect_handler handler);
+
+    // If the request may be aborted, its I/O is done on the connection's
+    // strand, which costs a few allocations
+    void async_send(const http::request& req, send_handler handler,
+                    bool abortable = false);
+
+    bool is_open() const { return open_; }
+
+    // For a connection opened before anything needed it. As with a reused
+    // one, the server may close it before the first request arrives.
+    void mark_idle() { idle_ = true; }
+
+    // Makes the asynchronous request in progress, which must have been sent
+    // as abortable, fail promptly. This must run on the connection's strand,
+    // so that it doesn't touch the socket at the same time as a handler. The
+    // connection is closed afterwards.
+    void abort();
+
+    auto get_executor() const -> executor_type { return strand_; }
+
+    auto last_used() const -> clock::time_point { return last_used_; }
+
+    void close();
+
+private:
+    template <typename Func>
+    auto with_stream(Func&& func)
+    {
+        return tls_ ? func(stream_) : func(stream_.next_layer());
+    }
+
+    // Calls func with the handler, bound to the strand if the request in
+    // progress is abortable
+    template <typename Handler, typename Func>
+    void with_handler(Handler&& handler, Func&& func)
+    {
+        if (abortable_) {
+            func(boost::asio::bind_executor(strand_, std::forward<Handler>(handler)));
+        } else {
+            func(std::forward<Handler>(handler));
+        }
+    }
+
+    void prepare_tls();
+    // Called once the TCP connection is established
+    void on_connected();
+    // After anything has been read from the socket
+    void on_read();
+    void start_write(const http::request* reqs, std::size_t count);
+    void async_write_request(send_handler handler);
+    void async_read_response(send_handler handler);
+
+    // Turns the outcome of a request into a response, or throws
+    auto complete(const boost::system::error_code& ec) -> http::response;
+
+    using tls_stream = boost::asio::ssl::stream<boost::asio::ip::tcp::socket>;
+
+    http::url host_;
+    socket_options sockets_;
+    executor_type strand_;
+    boost::asio::ip::tcp::resolver resolver_;
+    // Keeps the host in the DNS cache while the connection is open
+    std::shared_ptr<const void> dns_hold_;
+    tls_stream stream_;
+    bool tls_;
+    bool open_ = false;
+    bool reused_ = false;
+    bool idle_ = false;
+    std::atomic<bool> aborted_{false};
+    bool abortable_ = false;
+    int requests_sent_ = 0;
+    clock::time_point last_used_ = clock::now();
+    http::response_parser parser_;
+    std::string write_buf_;
+    std::array<char, 8192> read_buf_;
+};
+
+} // end namespace net
+} // end namespace stockfighter
@@ -0,0 +1,540 @@
+
+#include "connection_pool.hpp"
+#include "cancellation.hpp"
+#include "session_cache.hpp"
+
+#include <boost/asio/post.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <future>
+#include <iterator>
+
+namespace asio = boost::asio;
+
+namespace stockfighter {
+namespace net {
+
+struct connection_pool::async_request {
+    http::request req;
+    connection::send_handler handler;
+    std::unique_ptr<connection> conn;
+
+    // Guards the following against a cancellation from another thread
+    std::mutex mutex;
+    // The connection while the request is on the wire
+    connection* sending = nullptr;
+    bool cancelled = false;
+
+    cancellation_token token = cancellation_token::never();
+    cancellation_token::callback_id cancel_slot = 0;
+
+    // Calls the handler, once the cancellation callback is out of the way
+    void finish(std::exception_ptr error, http::response response)
+    {
+        token.remove_callback(cancel_slot);
+        handler(error, std::move(response));
+    }
+};
+
+connection_pool::connection_pool(io_runner& io, const pool_options& options)
+        : io_(io),
+          ssl_{asio::ssl::context::tls_client},
+          options_(options)
+{
+    ssl_.set_default_verify_paths();
+    default_session_cache().attach(ssl_);
+}
+
+auto connection_pool::send(const http::request& req) -> http::response
+{
+    while (true) {
+        auto conn = acquire(req.uri);
+
+        try {
+            const auto sent = connection::clock::now();
+            auto response = conn->send(req);
+            release(req.uri, std::move(conn), connection::clock::now() - sent);
+            return response;
+        } catch (const stale_connection&) {
+            // Drop it and go round again; a fresh connection is never stale
+            release(req.uri, std::move(conn));
+        } catch (...) {
+            release(req.uri, std::move(conn));
+            throw;
+        }
+    }
+}
+
+auto connection_pool::send_pipelined(const std::vector<http::request>& reqs)
+        -> std::vector<http::response>
+{
+    auto responses = std::vector<http::response>{};
+    responses.reserve(reqs.size());
+
+    const auto depth = static_cast<std::size_t>(
+            std::max(options().max_pipeline_depth, 1));
+
+    while (responses.size() < reqs.size()) {
+        const auto& host = reqs.front().uri;
+        const auto first = responses.size();
+        const auto count = std::min(reqs.size() - first, depth);
+
+        auto conn = acquire(host);
+
+        try {
+            auto batch = conn->send_pipelined(&reqs[first], count);
+            release(host, std::move(conn));
+            std::move(batch.begin(), batch.end(), std::back_inserter(responses));
+        } catch (const stale_connection&) {
+            release(host, std::move(conn));
+        } catch (...) {
+            release(host, std::move(conn));
+            throw;
+        }
+    }
+
+    return responses;
+}
+
+auto connection_pool::send_batch(const std::vector<http::request>& reqs)
+        -> std::vector<result<http::response>>
+{
+    auto results = std::vector<result<http::response>>{};
+    results.reserve(reqs.size());
+
+    const auto depth = static_cast<std::size_t>(
+            std::max(options().max_pipeline_depth, 1));
+
+    while (results.size() < reqs.size()) {
+        const auto& host = reqs.front().uri;
+        const auto first = results.size();
+        const auto count = std::min(reqs.size() - first, depth);
+
+        auto failure = std::exception_ptr{};
+        auto batch = std::vector<http::response>{};
+        auto conn = std::unique_ptr<connection>{};
+
+        try {
+            conn = acquire(host);
+        } catch (...) {
+            failure = std::current_exception();
+        }
+
+        if (conn) {
+            try {
+                batch = conn->send_pipelined(&reqs[first], count);
+            } catch (const stale_connection&) {
+                // The server closed the connection before it read any of
+                // them, so they can all go again
+                release(host, std::move(conn));
+                continue;
+            } catch (...) {
+                failure = std::current_exception();
+            }
+            release(host, std::move(conn));
+        }
+
+        for (auto& response : batch) {
+            results.emplace_back(std::move(response));
+        }
+
+        // The server may or may not have acted on these before the
+        // connection closed, so they mustn't be sent again
+        if (!failure && results.size() < first + count) {
+            failure = std::make_exception_ptr(std::runtime_error{
+                    "The connection closed before the request was answered"});
+        }
+        while (results.size() < first + count) {
+            results.emplace_back(error{errc::no_response, 0, {}, failure});
+        }
+    }
+
+    return results;
+}
+
+void connection_pool::async_send(http::request req,
+                                 http::response_handler handler,
+                                 const cancellation_token& token)
+{
+    io_.start();
+
+    auto op = std::make_shared<async_request>();
+    op->req = std::move(req);
+    op->handler = std::move(handler);
+
+    // A request which is waiting for a connection is dropped once it gets
+    // one, but one on the wire can only be stopped by closing the socket
+    op->token = token;
+    op->cancel_slot = token.on_cancel([weak = std::weak_ptr<async_request>{op}] {
+        if (const auto op = weak.lock()) {
+            std::lock_guard<std::mutex> lock{op->mutex};
+            op->cancelled = true;
+            if (op->sending) {
+                // The connection is only touched from its strand. It is
+                // still sending if the completion handler, which runs there
+                // too, hasn't yet taken it back.
+                asio::post(op->sending->get_executor(), [op] {
+                    std::lock_guard<std::mutex> lock{op->mutex};
+                    if (op->sending) {
+                        op->sending->abort();
+                    }
+                });
+            }
+        }
+    });
+
+    async_attempt(std::move(op));
+}
+
+void connection_pool::async_attempt(std::shared_ptr<async_request> op)
+{
+    async_acquire(op->req.uri, [this, op](std::unique_ptr<connection> conn) {
+        auto send = [this, op] {
+            {
+                std::lock_guard<std::mutex> lock{op->mutex};
+                if (!op->cancelled) {
+                    op->sending = op->conn.get();
+                }
+            }
+            if (!op->sending) {
+                // A newly opened connection still goes into the pool
+                release(op->req.uri, std::move(op->conn));
+                return op->finish(cancelled_error(op->req), {});
+            }
+
+            const auto sent = connection::clock::now();
+            op->conn->async_send(op->req, [this, op, sent](std::exception_ptr error,
+                                                           http::response response) {
+                bool cancelled = false;
+                {
+                    std::lock_guard<std::mutex> lock{op->mutex};
+                    op->sending = nullptr;
+                    cancelled = op->cancelled;
+                }
+                release(op->req.uri, std::move(op->conn),
+                        error ? connection::clock::duration{}
+                              : connection::clock::now() - sent);
+                if (error && !cancelled) {
+                    try {
+                        std::rethrow_exception(error);
+                    } catch (const stale_connection&) {
+                        return async_attempt(op);
+                    } catch (...) {}
+                }
+                op->finish(error, std::move(response));
+            }, op->token.can_be_cancelled());
+        };
+
+        if (conn) {
+            op->conn = std::move(conn);
+            return send();
+        }
+
+        op->conn = make_connection(op->req.uri);
+        op->conn->async_connect([this, op, send](std::exception_ptr error) {
+            if (error) {
+                release(op->req.uri, std::move(op->conn));
+                return op->finish(error, {});
+            }
+            send();
+        });
+    });
+}
+
+void connection_pool::async_warm_up(const http::url& host, int connections,
+                                    std::function<void()> done)
+{
+    int count = 0;
+    {
+        std::lock_guard<std::mutex> lock{mutex_};
+        auto& pool = host_pool_for(host);
+        const auto wanted = std::min(connections, options_.max_connections_per_host);
+        // Asking for connections ahead of time is as good as needing them
+        pool.limit = std::max(pool.limit, wanted);
+        count = wanted - pool.open;
+        if (count > 0) {
+            pool.open += count;
+        }
+    }
+
+    if (count <= 0) {
+        return done();
+    }
+
+    io_.start();
+
+    auto remaining = std::make_shared<std::atomic<int>>(count);
+    for (int i = 0; i < count; ++i) {
+        auto conn = std::make_shared<std::unique_ptr<connection>>(
+                make_connection(host));
+        (*conn)->async_connect([this, host, conn, remaining, done](std::exception_ptr) {
+            // One which failed to connect just gives its place back
+            (*conn)->mark_idle();
+            release(host, std::move(*conn));
+            if (--*remaining == 0) {
+                done();
+            }
+        });
+    }
+}
+
+void connection_pool::set_options(const pool_options& options)
+{
+    auto woken = std::vector<acquire_handler>{};
+
+    {
+        std::lock_guard<std::mutex> lock{mutex_};
+        options_ = options;
+
+        // Raising the limit may let some waiters open a connection
+        for (auto& entry : hosts_) {
+            auto& pool = entry.second;
+            pool.limit = std::max(std::min(pool.limit, options_.max_connections_per_host),
+                                  options_.min_connections_per_host);
+            while (!pool.waiters.empty() && pool.open < limit(pool)) {
+                ++pool.open;
+                record_wait(pool, pool.waiters.front());
+                woken.push_back(std::move(pool.waiters.front().handler));
+                pool.waiters.pop_front();
+            }
+        }
+    }
+
+    for (auto& w : woken) {
+        w(nullptr);
+    }
+}
+
+auto connection_pool::max_in_flight_per_host() const -> int
+{
+    std::lock_guard<std::mutex> lock{mutex_};
+    return std::max(options_.max_connections_per_host, 1);
+}
+
+auto connection_pool::options() const -> pool_options
+{
+    std::lock_guard<std::mutex> lock{mutex_};
+    return options_;
+}
+
+auto connection_pool::stats() const -> std::vector<host_pool_stats>
+{
+    using std::chrono::duration_cast;
+    using std::chrono::microseconds;
+
+    std::lock_guard<std::mutex> lock{mutex_};
+
+    auto output = std::vector<host_pool_stats>{};
+    for (const auto& entry : hosts_) {
+        const auto& pool = entry.second;
+        auto s = host_pool_stats{};
+        s.host = entry.first;
+        s.open = pool.open;
+        s.idle = static_cast<int>(pool.idle.size());
+        s.waiting = static_cast<int>(pool.waiters.size());
+        s.limit = limit(pool);
+        s.queue_delay = duration_cast<microseconds>(pool.queue_delay);
+        s.rtt = duration_cast<microseconds>(pool.rtt);
+        output.push_back(std::move(s));
+    }
+    return output;
+}
+
+auto connection_pool::acquire(const http::url& host) -> std::unique_ptr<connection>
+{
+    auto conn = std::unique_ptr<connection>{};
+    bool claimed = false;
+    {
+        // Don't bother with the promise if we needn't wait
+        std::lock_guard<std::mutex> lock{mutex_};
+        claimed = try_claim(host_pool_for(host), conn);
+    }
+
+    if (!claimed) {
+        auto promise = std::make_shared<std::promise<std::unique_ptr<connection>>>();
+        auto future = promise->get_future();
+        async_acquire(host, [promise](std::unique_ptr<connection> conn) {
+            promise->set_value(std::move(conn));
+        });
+        conn = future.get();
+    }
+
+    if (!conn) {
+        conn = make_connection(host);
+        try {
+            conn->connect();
+        } catch (...) {
+            release(host, std::move(conn));
+            throw;
+        }
+    }
+
+    return conn;
+}
+
+void connection_pool::async_acquire(const http::url& host,
+                                    acquire_handler handler)
+{
+    std::unique_lock<std::mutex> lock{mutex_};
+    auto& pool = host_pool_for(host);
+
+    auto conn = std::unique_ptr<connection>{};
+    if (!try_claim(pool, conn)) {
+        pool.waiters.push_back(waiter{std::move(handler), connection::clock::now()});
+        return;
+    }
+
+    lock.unlock();
+    handler(std::move(conn));
+}
+
+bool connection_pool::try_claim(host_pool& pool, std::unique_ptr<connection>& conn)
+{
+    const auto now = connection::clock::now();
+
+    // Idle connections are kept in the order they were returned, so
+    // anything which has been sitting around for too long is at the
+    // front. The server has probably given up on those anyway.
+    const auto cutoff = now - options_.idle_timeout;
+    const auto fresh = std::find_if(pool.idle.begin(), pool.idle.end(),
+                                    [&](const auto& c) {
+                                        return c->last_used() >= cutoff;
+                                    });
+    pool.open -= static_cast<int>(fresh - pool.idle.begin());
+    pool.idle.erase(pool.idle.begin(), fresh);
+
+    // Connections which haven't been needed for a while are more than the
+    // load calls for
+    if (options_.adaptive) {
+        const auto unused = now - options_.scale_down_after;
+        while (pool.idle.size() > 1 && pool.open > options_.min_connections_per_host &&
+               pool.idle.front()->last_used() < unused) {
+            pool.idle.erase(pool.idle.begin());
+            --pool.open;
+            pool.limit = std::max(pool.open, options_.min_connections_per_host);
+        }
+    }
+
+    if (!pool.idle.empty()) {
+        // Take the most recently used, it is the least likely to have
+        // been closed at the other end
+        conn = std::move(pool.idle.back());
+        pool.idle.pop_back();
+    } else if (pool.open < limit(pool)) {
+        ++pool.open;
+    } else if (options_.adaptive && pool.open < options_.max_connections_per_host &&
+               should_grow(pool)) {
+        ++pool.limit;
+        ++pool.open;
+    } else {
+        return false;
+    }
+
+    // Not having to wait counts towards the average too
+    pool.queue_delay -= pool.queue_delay / 8;
+    return true;
+}
+
+void connection_pool::release(const http::url& host,
+                              std::unique_ptr<connection> conn,
+                              connection::clock::duration rtt)
+{
+    std::unique_lock<std::mutex> lock{mutex_};
+    auto& pool = host_pool_for(host);
+
+    if (rtt.count() > 0) {
+        pool.rtt += (rtt - pool.rtt) / 8;
+    }
+
+    if (conn && conn->is_open() && pool.open <= limit(pool)) {
+        if (pool.waiters.empty()) {
+            pool.idle.push_back(std::move(conn));
+            return;
+        }
+    } else {
+        // The caller will be told to open a new connection instead
+        conn.reset();
+        --pool.open;
+        if (pool.waiters.empty() || pool.open >= limit(pool)) {
+            return;
+        }
+        ++pool.open;
+    }
+
+    record_wait(pool, pool.waiters.front());
+    auto handler = std::move(pool.waiters.front().handler);
+    pool.waiters.pop_front();
+    lock.unlock();
+    handler(std::move(conn));
+}
+
+auto connection_pool::limit(const host_pool& pool) const -> int
+{
+    if (!options_.adaptive) {
+        return options_.max_connections_per_host;
+    }
+    return std::max(std::min(pool.limit, options_.max_connections_per_host),
+                    options_.min_connections_per_host);
+}
+
+bool connection_pool::should_grow(const host_pool& pool) const
+{
+    // A queue longer than the connections serving it won't clear within a
+    // round trip. Otherwise, grow once requests have been spending more
+    // than a quarter of a round trip waiting.
+    return pool.waiters.size() >= static_cast<std::size_t>(pool.open) ||
+           pool.queue_delay * 4 > pool.rtt;
+}
+
+void connection_pool::record_wait(host_pool& pool, const waiter& w)
+{
+    const auto waited = connection::clock::now() - w.queued;
+    pool.queue_delay += (waited - pool.queue_delay) / 8;
+}
+
+auto connection_pool::host_pool_for(const http::url& host) -> host_pool&
+{
+    key_buf_.clear();
+    key_buf_ += host.scheme;
+    key_buf_ += "://";
+    key_buf_ += host.host;
+    key_buf_ += ':';
+    key_buf_ += host.port;
+    return hosts_[key_buf_];
+}
+
+auto connection_pool::make_connection(const http::url& host)
+        -> std::unique_ptr<connection>
+{
+    auto sockets = socket_options{};
+    {
+        std::lock_guard<std::mutex> lock{mutex_};
+        sockets = options_.socket;
+    }
+    return std::make_unique<connection>(io_.context(), ssl_, host, sockets);
+}
+
+auto default_pool() -> connection_pool&
+{
+    static connection_pool pool{default_io()};
+    return pool;
+}
+
+void set_pool_options(const pool_options& options)
+{
+    default_pool().set_options(options);
+}
+
+auto get_pool_options() -> pool_options
+{
+    return default_pool().options();
+}
+
+auto get_pool_stats() -> std::vector<host_pool_stats>
+{
+    return default_pool().stats();
+}
+
+} // end namespace net
+} // end namespace stockfighter
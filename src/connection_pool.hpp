@@ -0,0 +1,129 @@
+#pragma once
+
+#include "connection.hpp"
+#include "io_runner.hpp"
+#include "transport.hpp"
+
+#include <stockfighter/net.hpp>
+
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace stockfighter {
+namespace net {
+
+// HTTP/1.1 transport which keeps persistent connections to each host,
+// handing them out to one request at a time
+class connection_pool : public transport {
+public:
+    explicit connection_pool(io_runner& io, const pool_options& options = {});
+
+    connection_pool(const connection_pool&) = delete;
+    connection_pool& operator=(const connection_pool&) = delete;
+
+    // Sends a request on a pooled connection, transparently retrying on a
+    // new connection if the server has closed the one we picked
+    auto send(const http::request& req) -> http::response override;
+
+    // Sends a batch of requests to the same host, pipelining them on a
+    // single connection. Requests which were not answered because the
+    // server closed the connection are sent again, so this must only be
+    // used for idempotent requests.
+    auto send_pipelined(const std::vector<http::request>& reqs)
+            -> std::vector<http::response> override;
+
+    // Pipelines the requests on one connection as send_pipelined() does,
+    // writing each group of them at once, but without sending anything
+    // again which the server may have acted on. Requests left unanswered
+    // when the connection closes fail instead.
+    auto send_batch(const std::vector<http::request>& reqs)
+            -> std::vector<result<http::response>> override;
+
+    // As send(), but returns immediately. The handler is called from one of
+    // the I/O threads.
+    void async_send(http::request req,
+                    http::response_handler handler,
+                    const cancellation_token& token) override;
+
+    // Opens connections in parallel until the host has as many as asked
+    // for, or as the options allow, and puts them in the pool
+    void async_warm_up(const http::url& host, int connections,
+                       std::function<void()> done) override;
+
+    // The maximum number of connections per host, even if the pool is
+    // adaptive: it only opens more when requests queue for a connection
+    auto max_in_flight_per_host() const -> int override;
+
+    void set_options(const pool_options& options);
+
+    auto options() const -> pool_options;
+
+    auto stats() const -> std::vector<host_pool_stats>;
+
+private:
+    // Called with an idle connection, or with nullptr if the caller should
+    // open a new one
+    using acquire_handler = std::function<void(std::unique_ptr<connection>)>;
+
+    struct waiter {
+        acquire_handler handler;
+        connection::clock::time_point queued;
+    };
+
+    struct host_pool {
+        std::vector<std::unique_ptr<connection>> idle;
+        std::deque<waiter> waiters;
+        int open = 0;
+        // How many connections may be open just now, if the pool is
+        // adaptive
+        int limit = 0;
+        // Smoothed over recent requests
+        connection::clock::duration queue_delay{0};
+        connection::clock::duration rtt{0};
+    };
+
+    struct async_request;
+
+    // Waits for an idle connection or opens a new one
+    auto acquire(const http::url& host) -> std::unique_ptr<connection>;
+    void async_acquire(const http::url& host, acquire_handler handler);
+    // If rtt is non-zero, it's how long the connection's request took
+    void release(const http::url& host, std::unique_ptr<connection> conn,
+                 connection::clock::duration rtt = {});
+
+    // How many connections the host may have; must be called with the
+    // mutex held
+    auto limit(const host_pool& pool) const -> int;
+    // Whether a request which would have to wait should get a new
+    // connection instead
+    bool should_grow(const host_pool& pool) const;
+    void record_wait(host_pool& pool, const waiter& w);
+    // Takes an idle connection, or leaves conn empty to say that a new one
+    // may be opened, if either is allowed without waiting. Must be called
+    // with the mutex held.
+    bool try_claim(host_pool& pool, std::unique_ptr<connection>& conn);
+
+    void async_attempt(std::shared_ptr<async_request> op);
+
+    auto host_pool_for(const http::url& host) -> host_pool&;
+    auto make_connection(const http::url& host) -> std::unique_ptr<connection>;
+
+    io_runner& io_;
+    boost::asio::ssl::context ssl_;
+
+    mutable std::mutex mutex_;
+    pool_options options_;
+    std::map<std::string, host_pool> hosts_;
+    // For building keys into hosts_ without allocating
+    std::string key_buf_;
+};
+
+// The process-wide pool, used by the rest:: functions when speaking
+// HTTP/1.1
+auto default_pool() -> connection_pool&;
+
+} // end namespace net
+} // end namespace stockfighter
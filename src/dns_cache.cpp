@@ -0,0 +1,240 @@
+
+#include "dns_cache.hpp"
+
+#include <stockfighter/net.hpp>
+
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/post.hpp>
+
+namespace asio = boost::asio;
+using tcp = boost::asio::ip::tcp;
+using boost::system::error_code;
+
+namespace stockfighter {
+namespace net {
+
+namespace {
+
+auto to_endpoints(const tcp::resolver::results_type& results) -> dns_cache::endpoints
+{
+    auto output = dns_cache::endpoints{};
+    for (const auto& r : results) {
+        output.push_back(r.endpoint());
+    }
+    return output;
+}
+
+} // end anonymous namespace
+
+dns_cache::~dns_cache()
+{
+    {
+        std::lock_guard<std::mutex> lock{mutex_};
+        stopping_ = true;
+    }
+    wake_.notify_all();
+
+    if (refresher_.joinable()) {
+        refresher_.join();
+    }
+}
+
+auto dns_cache::resolve(const std::string& host,
+                        const std::string& port) -> endpoints
+{
+    auto output = endpoints{};
+    if (lookup(host, port, output)) {
+        return output;
+    }
+
+    asio::io_context io;
+    auto resolver = tcp::resolver{io};
+    output = to_endpoints(resolver.resolve(host, port));
+    store(host, port, output);
+    return output;
+}
+
+void dns_cache::async_resolve(tcp::resolver& resolver,
+                              const std::string& host, const std::string& port,
+                              resolve_handler handler)
+{
+    auto cached = endpoints{};
+    if (lookup(host, port, cached)) {
+        asio::post(resolver.get_executor(), [handler, cached] {
+            handler(error_code{}, cached);
+        });
+        return;
+    }
+
+    resolver.async_resolve(host, port,
+                           [this, host, port, handler](const error_code& ec,
+                                                       tcp::resolver::results_type results) {
+        auto addresses = endpoints{};
+        if (!ec) {
+            addresses = to_endpoints(results);
+            store(host, port, addresses);
+        }
+        handler(ec, std::move(addresses));
+    });
+}
+
+bool dns_cache::lookup(const std::string& host, const std::string& port,
+                       endpoints& out)
+{
+    std::lock_guard<std::mutex> lock{mutex_};
+
+    const auto pin = pins_.find(host);
+    if (pin != pins_.end()) {
+        const auto p = pin->second.port ? pin->second.port
+                                        : static_cast<unsigned short>(std::stoi(port));
+        out = endpoints{tcp::endpoint{pin->second.address, p}};
+        return true;
+    }
+
+    const auto it = entries_.find({host, port});
+    if (it == entries_.end()) {
+        return false;
+    }
+
+    // Stale addresses are still better than waiting; the refresher will
+    // keep trying to replace them
+    it->second.last_used = clock::now();
+    out = it->second.addresses;
+    return true;
+}
+
+void dns_cache::store(const std::string& host, const std::string& port,
+                      endpoints addresses)
+{
+    std::lock_guard<std::mutex> lock{mutex_};
+
+    const auto now = clock::now();
+    auto& e = entries_[{host, port}];
+    e.addresses = std::move(addresses);
+    e.resolved = now;
+    e.last_used = now;
+
+    if (!refresher_.joinable() && !stopping_) {
+        refresher_ = std::thread{[this] { refresh_loop(); }};
+    }
+}
+
+void dns_cache::refresh_loop()
+{
+    asio::io_context io;
+    auto resolver = tcp::resolver{io};
+
+    std::unique_lock<std::mutex> lock{mutex_};
+
+    while (!stopping_) {
+        // Entries are renewed once three quarters of their TTL has passed,
+        // leaving time to try again if the lookup fails
+        const auto now = clock::now();
+        const auto refresh_age = std::chrono::duration_cast<clock::duration>(ttl_) * 3 / 4;
+        auto next = now + refresh_age;
+        auto due = std::vector<std::pair<std::string, std::string>>{};
+
+        for (auto it = entries_.begin(); it != entries_.end();) {
+            auto& e = it->second;
+            if (e.holders.use_count() > 1) {
+                // Connections to the host are still open
+                e.last_used = now;
+            } else if (now - e.last_used > ttl_ * 10) {
+                // Nobody is talking to this host any more
+                it = entries_.erase(it);
+                continue;
+            }
+            if (now - e.resolved >= refresh_age) {
+                due.push_back(it->first);
+            } else {
+                next = std::min(next, e.resolved + refresh_age);
+            }
+            ++it;
+        }
+
+        for (const auto& key : due) {
+            lock.unlock();
+            auto ec = error_code{};
+            auto results = resolver.resolve(key.first, key.second, ec);
+            lock.lock();
+
+            const auto it = entries_.find(key);
+            if (it == entries_.end()) {
+                continue;
+            }
+            if (!ec && !results.empty()) {
+                it->second.addresses = to_endpoints(results);
+                it->second.resolved = clock::now();
+            } else {
+                // Keep the old addresses and retry shortly
+                next = std::min(next, clock::now() + std::chrono::seconds{5});
+            }
+        }
+
+        wake_.wait_until(lock, next);
+    }
+}
+
+void dns_cache::pin(const std::string& host, const std::string& address,
+                    unsigned short port)
+{
+    std::lock_guard<std::mutex> lock{mutex_};
+    pins_[host] = pinned_address{asio::ip::make_address(address), port};
+}
+
+void dns_cache::unpin(const std::string& host)
+{
+    std::lock_guard<std::mutex> lock{mutex_};
+    pins_.erase(host);
+}
+
+void dns_cache::set_ttl(std::chrono::seconds ttl)
+{
+    {
+        std::lock_guard<std::mutex> lock{mutex_};
+        ttl_ = std::max(ttl, std::chrono::seconds{1});
+    }
+    wake_.notify_all();
+}
+
+auto dns_cache::hold(const std::string& host,
+                     const std::string& port) -> std::shared_ptr<const void>
+{
+    std::lock_guard<std::mutex> lock{mutex_};
+    // Pinned hosts have no entry to keep
+    const auto it = entries_.find({host, port});
+    return it == entries_.end() ? nullptr : it->second.holders;
+}
+
+auto dns_cache::resolved_at(const std::string& host,
+                            const std::string& port) -> clock::time_point
+{
+    std::lock_guard<std::mutex> lock{mutex_};
+    const auto it = entries_.find({host, port});
+    return it == entries_.end() ? clock::time_point{} : it->second.resolved;
+}
+
+auto default_dns_cache() -> dns_cache&
+{
+    static dns_cache cache;
+    return cache;
+}
+
+void pin_host(const std::string& host, const std::string& address,
+              unsigned short port)
+{
+    default_dns_cache().pin(host, address, port);
+}
+
+void unpin_host(const std::string& host)
+{
+    default_dns_cache().unpin(host);
+}
+
+void set_dns_ttl(std::chrono::seconds ttl)
+{
+    default_dns_cache().set_ttl(ttl);
+}
+
+} // end namespace net
+} // end namespace stockfighter
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <boost/asio/ip/tcp.hpp>
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace stockfighter {
+namespace net {
+
+// Process-wide cache of resolved addresses. Once a host has been looked up,
+// later lookups are answered straight from the cache, and a background
+// thread re-resolves it before its entry goes stale, so connecting never
+// waits on DNS again.
+class dns_cache {
+public:
+    using clock = std::chrono::steady_clock;
+    using endpoints = std::vector<boost::asio::ip::tcp::endpoint>;
+    using resolve_handler = std::function<void(const boost::system::error_code&,
+                                               endpoints)>;
+
+    dns_cache() = default;
+
+    ~dns_cache();
+
+    dns_cache(const dns_cache&) = delete;
+    dns_cache& operator=(const dns_cache&) = delete;
+
+    // Only resolves on the calling thread the first time a host is seen.
+    // Throws boost::system::system_error if that fails.
+    auto resolve(const std::string& host, const std::string& port) -> endpoints;
+
+    // As above, but a host which isn't cached yet is resolved
+    // asynchronously with the given resolver. The handler is always called
+    // from the resolver's executor.
+    void async_resolve(boost::asio::ip::tcp::resolver& resolver,
+                       const std::string& host, const std::string& port,
+                       resolve_handler handler);
+
+    // Never resolves: returns true and fills in the addresses if the host
+    // is pinned or cached
+    bool lookup(const std::string& host, const std::string& port,
+                endpoints& out);
+
+    // address must be an IP address. A port of 0 keeps the port in the URL.
+    void pin(const std::string& host, const std::string& address,
+             unsigned short port);
+
+    void unpin(const std::string& host);
+
+    void set_ttl(std::chrono::seconds ttl);
+
+    // Entries which haven't been looked up for a long while are dropped,
+    // but connections only look their host up as they open. So each open
+    // connection keeps the result of this, and the host's entry is kept
+    // for as long as any of them is.
+    auto hold(const std::string& host, const std::string& port)
+            -> std::shared_ptr<const void>;
+
+    // Exposed for testing: when the host's cached addresses were last
+    // looked up, or clock::time_point{} if it isn't cached
+    auto resolved_at(const std::string& host, const std::string& port)
+            -> clock::time_point;
+
+private:
+    struct pinned_address {
+        boost::asio::ip::address address;
+        unsigned short port;
+    };
+
+    struct entry {
+        endpoints addresses;
+        clock::time_point resolved;
+        clock::time_point last_used;
+        // Shared with hold()'s callers
+        std::shared_ptr<const void> holders = std::make_shared<char>();
+    };
+
+
+    void store(const std::string& host, const std::string& port,
+               endpoints addresses);
+
+    void refresh_loop();
+
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::map<std::string, pinned_address> pins_;
+    std::map<std::pair<std::string, std::string>, entry> entries_;
+    std::chrono::seconds ttl_{60};
+    std::thread refresher_;
+    bool stopping_ = false;
+};
+
+auto default_dns_cache() -> dns_cache&;
+
+} // end namespace net
+} // end namespace stockfighter
@@ -0,0 +1,155 @@
+
+#include "epoll_transport.hpp"
+
+#ifdef __linux__
+
+#include <boost/system/system_error.hpp>
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cerrno>
+
+namespace stockfighter {
+namespace net {
+
+epoll_transport::epoll_transport(const pool_options& options)
+        : reactor_transport(options)
+{
+    epoll_fd_ = ::epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd_ < 0) {
+        throw boost::system::system_error{
+                boost::system::error_code{errno, boost::system::system_category()}};
+    }
+
+    // The eventfd is edge triggered, so every write wakes the thread and it
+    // never needs to be read
+    auto ev = epoll_event{};
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.ptr = nullptr;
+    ::epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, wake_fd(), &ev);
+
+    start();
+}
+
+epoll_transport::~epoll_transport()
+{
+    stop();
+    free_closed();
+    ::close(epoll_fd_);
+}
+
+void epoll_transport::poll(bool block)
+{
+    const auto n = ::epoll_wait(epoll_fd_, events_.data(),
+                                static_cast<int>(events_.size()), block ? -1 : 0);
+
+    for (int i = 0; i < n; ++i) {
+        auto* c = static_cast<connection*>(events_[i].data.ptr);
+        if (c && !c->closed) {
+            on_event(*c, events_[i].events);
+        }
+    }
+}
+
+auto epoll_transport::begin_connect(connection& c) -> int
+{
+    // Registered once for both directions, edge triggered, so the
+    // registration never has to change
+    auto ev = epoll_event{};
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLET;
+    ev.data.ptr = &c;
+    ::epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, c.fd, &ev);
+
+    const auto& address = c.addresses[c.address];
+    if (::connect(c.fd, address.data(), static_cast<socklen_t>(address.size())) == 0 ||
+        errno == EINPROGRESS) {
+        // Either way, EPOLLOUT says when it's done
+        return 0;
+    }
+    return errno;
+}
+
+void epoll_transport::on_event(connection& c, std::uint32_t events)
+{
+    if (c.st == connection::state::connecting) {
+        if (!(events & (EPOLLOUT | EPOLLERR | EPOLLHUP))) {
+            return;
+        }
+
+        int err = 0;
+        auto len = static_cast<socklen_t>(sizeof(err));
+        ::getsockopt(c.fd, SOL_SOCKET, SO_ERROR, &err, &len);
+        return connected(c, err);
+    }
+
+    if (events & EPOLLOUT) {
+        write(c);
+    }
+
+    if (!c.closed && (events & (EPOLLIN | EPOLLERR | EPOLLHUP))) {
+        on_readable(c);
+    }
+}
+
+void epoll_transport::write(connection& c)
+{
+    while (c.out_pos < c.out.size()) {
+        const auto n = ::send(c.fd, c.out.data() + c.out_pos,
+                              c.out.size() - c.out_pos, MSG_NOSIGNAL);
+        if (n >= 0) {
+            c.out_pos += static_cast<std::size_t>(n);
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            // The rest goes when EPOLLOUT says there's room
+            return;
+        } else if (errno != EINTR) {
+            return on_eof(c, errno);
+        }
+    }
+
+    c.out.clear();
+    c.out_pos = 0;
+}
+
+void epoll_transport::on_readable(connection& c)
+{
+    while (!c.closed) {
+        auto space = std::size_t{0};
+        auto direct = false;
+        const auto dest = read_space(c, space, direct);
+
+        const auto n = ::recv(c.fd, dest, space, 0);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                on_eof(c, errno);
+            }
+            return;
+        }
+        if (n == 0) {
+            return on_eof(c, 0);
+        }
+
+        const auto size = static_cast<std::size_t>(n);
+        received(c, dest, size, direct);
+
+        if (size < space) {
+            // A short read means the socket has been drained, and with edge
+            // triggering we'll hear about anything more that arrives
+            return;
+        }
+    }
+}
+
+auto default_epoll() -> epoll_transport&
+{
+    static epoll_transport transport{get_pool_options()};
+    return transport;
+}
+
+} // end namespace net
+} // end namespace stockfighter
+
+#endif // __linux__
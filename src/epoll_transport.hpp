@@ -0,0 +1,42 @@
+#pragma once
+
+#ifdef __linux__
+
+#include "reactor_transport.hpp"
+
+#include <array>
+#include <cstdint>
+
+#include <sys/epoll.h>
+
+namespace stockfighter {
+namespace net {
+
+// Drives its connections with non-blocking sockets and epoll, so every
+// read and write is a single system call made as soon as the socket is
+// ready for it
+class epoll_transport : public reactor_transport {
+public:
+    explicit epoll_transport(const pool_options& options = {});
+    ~epoll_transport() override;
+
+private:
+    void poll(bool block) override;
+    auto begin_connect(connection& c) -> int override;
+    void start_reading(connection&) override {}
+    void write(connection& c) override;
+    void closing(connection&) override {}
+
+    void on_event(connection& c, std::uint32_t events);
+    void on_readable(connection& c);
+
+    int epoll_fd_ = -1;
+    std::array<epoll_event, 64> events_;
+};
+
+auto default_epoll() -> epoll_transport&;
+
+} // end namespace net
+} // end namespace stockfighter
+
+#endif // __linux__
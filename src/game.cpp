@@ -1,13 +1,17 @@
 
 #include <stockfighter/game.hpp>
+#include <stockfighter/api.hpp>
 
 #include <cppformat/format.h>
 #include <json.hpp>
 
+#include "async.hpp"
 #include "rest.hpp"
 
 namespace nl = nlohmann;
 using namespace std::string_literals;
+using stockfighter::detail::converting;
+using stockfighter::detail::make_future;
 
 namespace stockfighter {
 namespace game {
@@ -16,11 +20,10 @@ namespace {
 
 auto json_to_level_info(const nl::json& json)
 {
-    auto info = level_info{
-            json.at("account"),
-            json.at("instanceId"),
-            std::chrono::seconds{json.at("secondsPerTradingDay")}
-    };
+    auto info = level_info{};
+    info.account = json.at("account");
+    info.instance_id = json.at("instanceId");
+    info.seconds_per_trading_day = std::chrono::seconds{json.at("secondsPerTradingDay")};
 
     for (const auto& t : json.at("tickers")) {
         info.tickers.push_back(t);
@@ -46,46 +49,72 @@ auto json_to_level_status(const nl::json& json)
     return status;
 }
 
-}
-
-
-auto start_level(const std::string& api_key, int level_num) -> level_info
+auto level_uri(int level_num) -> std::string
 {
-    std::string uri;
-
     switch(level_num) {
     case 1:
-        uri = "https://www.stockfighter.io/gm/levels/first_steps";
-        break;
+        return "https://www.stockfighter.io/gm/levels/first_steps";
     case 2:
-        uri = "https://www.stockfighter.io/gm/levels/chock_a_block";
-        break;
+        return "https://www.stockfighter.io/gm/levels/chock_a_block";
     case 3:
-        uri = "https://www.stockfighter.io/gm/levels/sell_side";
-        break;
+        return "https://www.stockfighter.io/gm/levels/sell_side";
     default:
         throw std::runtime_error{"Unknown level"};
     }
+}
 
-    const auto response = rest::post(uri, "", api_key);
+auto instance_uri(int instance_id, const char* action) -> std::string
+{
+    return fmt::format("https://www.stockfighter.io/gm/instances/{}{}",
+                       instance_id, action);
+}
 
-    return json_to_level_info(response);
+// Trading starts as soon as the level is running, so the connections it
+// will use are opened before the level is handed over
+auto warmed(level_info info) -> level_info
+{
+    api::warm_up(info.venues);
+    return info;
+}
+
+auto warming(callback<level_info> cb) -> callback<level_info>
+{
+    return [cb = std::move(cb)](std::exception_ptr error, level_info info) {
+        if (error) {
+            return cb(error, std::move(info));
+        }
+        const auto venues = info.venues;
+        api::async_warm_up(venues, [cb, info = std::move(info)] {
+            cb(nullptr, info);
+        });
+    };
+}
+
+}
+
+
+auto start_level(const std::string& api_key, int level_num) -> level_info
+{
+    const auto response = rest::post(net::endpoint::level_control,
+                                     level_uri(level_num), "", api_key);
+
+    return warmed(json_to_level_info(response));
 }
 
 auto restart_level(const std::string& api_key, int instance_id) -> level_info
 {
-    const auto response = rest::post(fmt::format("https://www.stockfighter.io/gm/instances/{}/restart",
-                                                 instance_id),
+    const auto response = rest::post(net::endpoint::level_control,
+                                     instance_uri(instance_id, "/restart"),
                                      "",
                                      api_key);
 
-    return json_to_level_info(response);
+    return warmed(json_to_level_info(response));
 }
 
 auto stop_level(const std::string& api_key, int instance_id) -> bool
 {
-    const auto response = rest::post(fmt::format("https://www.stockfighter.io/gm/instances/{}/stop",
-                                                 instance_id),
+    const auto response = rest::post(net::endpoint::level_control,
+                                     instance_uri(instance_id, "/stop"),
                                      "",
                                      api_key);
 
@@ -94,24 +123,104 @@ auto stop_level(const std::string& api_key, int instance_id) -> bool
 
 auto resume_level(const std::string& api_key, int instance_id) -> level_info
 {
-    const auto response = rest::post(fmt::format("https://www.stockfighter.io/gm/instances/{}/resume",
-                                                 instance_id),
+    const auto response = rest::post(net::endpoint::level_control,
+                                     instance_uri(instance_id, "/resume"),
                                      "",
                                      api_key);
 
-    return json_to_level_info(response);
+    return warmed(json_to_level_info(response));
 }
 
 auto get_level_status(const std::string& api_key,
                       int instance_id) -> level_status
 {
-    const auto response = rest::get(
-            fmt::format("https://www.stockfighter.io/gm/instances/{}",
-                        instance_id),
-            api_key);
+    const auto response = rest::get(net::endpoint::level_status,
+                                    instance_uri(instance_id, ""), api_key);
 
     return json_to_level_status(response);
 }
 
+void async_start_level(const std::string& api_key, int level_num,
+                       callback<level_info> cb)
+{
+    rest::async_post(net::endpoint::level_control,
+                     level_uri(level_num), "", api_key,
+                     converting(warming(std::move(cb)), json_to_level_info));
+}
+
+auto async_start_level(const std::string& api_key,
+                       int level_num) -> std::future<level_info>
+{
+    return make_future<level_info>([&](auto cb) {
+        async_start_level(api_key, level_num, std::move(cb));
+    });
+}
+
+void async_restart_level(const std::string& api_key, int instance_id,
+                         callback<level_info> cb)
+{
+    rest::async_post(net::endpoint::level_control,
+                     instance_uri(instance_id, "/restart"), "", api_key,
+                     converting(warming(std::move(cb)), json_to_level_info));
+}
+
+auto async_restart_level(const std::string& api_key,
+                         int instance_id) -> std::future<level_info>
+{
+    return make_future<level_info>([&](auto cb) {
+        async_restart_level(api_key, instance_id, std::move(cb));
+    });
+}
+
+void async_stop_level(const std::string& api_key, int instance_id,
+                      callback<bool> cb)
+{
+    rest::async_post(net::endpoint::level_control,
+                     instance_uri(instance_id, "/stop"), "", api_key,
+                     converting(std::move(cb), [](const nl::json&) {
+                         return true;
+                     }));
+}
+
+auto async_stop_level(const std::string& api_key,
+                      int instance_id) -> std::future<bool>
+{
+    return make_future<bool>([&](auto cb) {
+        async_stop_level(api_key, instance_id, std::move(cb));
+    });
+}
+
+void async_resume_level(const std::string& api_key, int instance_id,
+                        callback<level_info> cb)
+{
+    rest::async_post(net::endpoint::level_control,
+                     instance_uri(instance_id, "/resume"), "", api_key,
+                     converting(warming(std::move(cb)), json_to_level_info));
+}
+
+auto async_resume_level(const std::string& api_key,
+                        int instance_id) -> std::future<level_info>
+{
+    return make_future<level_info>([&](auto cb) {
+        async_resume_level(api_key, instance_id, std::move(cb));
+    });
+}
+
+void async_get_level_status(const std::string& api_key, int instance_id,
+                            callback<level_status> cb)
+{
+    rest::async_get(net::endpoint::level_status,
+                    instance_uri(instance_id, ""), api_key,
+                    converting(std::move(cb), json_to_level_status));
+}
+
+auto async_get_level_status(const std::string& api_key,
+                            int instance_id) -> std::future<level_status>
+{
+    return make_future<level_status>([&](auto cb) {
+        async_get_level_status(api_key, instance_id, std::move(cb));
+    });
+}
+
 } // end namespace game
 } // end namespace stockfighter
\ No newline at end of file
@@ -0,0 +1,201 @@
+
+#include "hedging.hpp"
+
+#include <boost/asio/steady_timer.hpp>
+
+#include <algorithm>
+#include <memory>
+
+namespace stockfighter {
+namespace rest {
+
+namespace {
+
+// Latencies are judged over this many recent requests, and hedging only
+// starts once there are enough of them to mean anything
+constexpr std::size_t history_size = 256;
+constexpr std::size_t min_samples = 20;
+
+std::mutex hedging_mutex;
+std::array<net::hedging_options, net::endpoint_count> hedging;
+
+} // end anonymous namespace
+
+struct hedger::operation {
+    explicit operation(boost::asio::io_context& io) : timer{io} {}
+
+    std::mutex mutex;
+    boost::asio::steady_timer timer;
+    http::request req;
+    http::response_handler handler;
+    send_function send;
+    net::endpoint endpoint;
+    // When the original request was sent
+    clock::time_point started;
+    std::array<net::cancellation_token, 2> attempts;
+    net::cancellation_token caller = net::cancellation_token::never();
+    net::cancellation_token::callback_id caller_slot = 0;
+    int outstanding = 1;
+    bool done = false;
+};
+
+hedger::hedger(net::io_runner& io)
+        : io_(io)
+{}
+
+void hedger::send(net::endpoint e,
+                  const net::hedging_options& options,
+                  http::request req,
+                  http::response_handler handler,
+                  send_function send,
+                  const net::cancellation_token& token)
+{
+    ++requests_;
+
+    auto delay = clock::duration{};
+    const bool can_hedge = delay_for(e, options, delay);
+
+    auto op = std::make_shared<operation>(io_.context());
+    op->req = std::move(req);
+    op->handler = std::move(handler);
+    op->send = std::move(send);
+    op->endpoint = e;
+
+    op->caller = token;
+    op->caller_slot = token.on_cancel([weak = std::weak_ptr<operation>{op}] {
+        if (const auto op = weak.lock()) {
+            op->attempts[0].cancel();
+            op->attempts[1].cancel();
+        }
+    });
+
+    // Index 0 is the original request, 1 the hedge
+    auto on_response = [this, op](int index) {
+        return [this, op, index](std::exception_ptr error,
+                                 http::response response) {
+            std::unique_lock<std::mutex> lock{op->mutex};
+            if (op->done) {
+                // The other one won, and this one has been cancelled
+                return;
+            }
+
+            --op->outstanding;
+            if (error && op->outstanding > 0) {
+                // Give the other one a chance
+                return;
+            }
+
+            op->done = true;
+            op->timer.cancel();
+            const bool other_outstanding = op->outstanding > 0;
+            lock.unlock();
+
+            op->caller.remove_callback(op->caller_slot);
+
+            if (other_outstanding) {
+                op->attempts[1 - index].cancel();
+            }
+
+            if (!error) {
+                // Timed from the original request, whichever copy answered.
+                // When the hedge wins, this is as long as the original had
+                // taken without an answer, so slow originals still show up
+                // in the history rather than only the fast ones.
+                record(op->endpoint, clock::now() - op->started);
+                if (index == 1) {
+                    ++hedges_won_;
+                }
+            }
+            op->handler(error, std::move(response));
+        };
+    };
+
+    if (can_hedge) {
+        io_.start();
+        op->timer.expires_after(delay);
+        op->timer.async_wait([this, op, on_response](const boost::system::error_code& ec) {
+            {
+                std::lock_guard<std::mutex> lock{op->mutex};
+                if (ec || op->done) {
+                    return;
+                }
+                ++op->outstanding;
+            }
+            ++hedges_sent_;
+            op->send(op->req, on_response(1), op->attempts[1]);
+        });
+    }
+
+    op->started = clock::now();
+    op->send(op->req, on_response(0), op->attempts[0]);
+}
+
+auto hedger::stats() const -> net::hedging_stats
+{
+    return net::hedging_stats{requests_, hedges_sent_, hedges_won_};
+}
+
+void hedger::record(net::endpoint e, clock::duration latency)
+{
+    std::lock_guard<std::mutex> lock{mutex_};
+    auto& h = history_[static_cast<std::size_t>(e)];
+
+    if (h.samples.size() < history_size) {
+        h.samples.push_back(latency);
+    } else {
+        h.samples[h.next] = latency;
+        h.next = (h.next + 1) % history_size;
+    }
+}
+
+bool hedger::delay_for(net::endpoint e, const net::hedging_options& options,
+                       clock::duration& delay)
+{
+    auto samples = std::vector<clock::duration>{};
+    {
+        std::lock_guard<std::mutex> lock{mutex_};
+        samples = history_[static_cast<std::size_t>(e)].samples;
+    }
+
+    if (samples.size() < min_samples) {
+        return false;
+    }
+
+    const auto fraction = std::min(std::max(options.percentile, 0.0), 1.0);
+    const auto n = std::min(static_cast<std::size_t>(fraction * samples.size()),
+                            samples.size() - 1);
+    std::nth_element(samples.begin(), samples.begin() + n, samples.end());
+
+    delay = std::max<clock::duration>(samples[n], options.min_delay);
+    return true;
+}
+
+auto default_hedger() -> hedger&
+{
+    static hedger h{net::default_io()};
+    return h;
+}
+
+} // end namespace rest
+
+namespace net {
+
+void set_hedging(endpoint e, const hedging_options& options)
+{
+    std::lock_guard<std::mutex> lock{rest::hedging_mutex};
+    rest::hedging[static_cast<std::size_t>(e)] = options;
+}
+
+auto get_hedging(endpoint e) -> hedging_options
+{
+    std::lock_guard<std::mutex> lock{rest::hedging_mutex};
+    return rest::hedging[static_cast<std::size_t>(e)];
+}
+
+auto get_hedging_stats() -> hedging_stats
+{
+    return rest::default_hedger().stats();
+}
+
+} // end namespace net
+} // end namespace stockfighter
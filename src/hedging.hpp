@@ -0,0 +1,70 @@
+#pragma once
+
+#include "http.hpp"
+#include "io_runner.hpp"
+
+#include <stockfighter/net.hpp>
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+namespace stockfighter {
+namespace rest {
+
+// Sends idempotent requests a second time if the first is taking
+// unusually long, and takes whichever response arrives first. "Unusually
+// long" is judged against the recent response times for the endpoint.
+class hedger {
+public:
+    using clock = std::chrono::steady_clock;
+    using send_function = std::function<void(http::request,
+                                             http::response_handler,
+                                             const net::cancellation_token&)>;
+
+    explicit hedger(net::io_runner& io);
+
+    // Sends the request using send, and sends it again if no response has
+    // arrived after the hedging delay for the endpoint. Whichever copy
+    // loses is cancelled, as are both if the token is.
+    void send(net::endpoint e,
+              const net::hedging_options& options,
+              http::request req,
+              http::response_handler handler,
+              send_function send,
+              const net::cancellation_token& token);
+
+    auto stats() const -> net::hedging_stats;
+
+private:
+    struct operation;
+
+    // Recent response times for one endpoint
+    struct latency_history {
+        std::vector<clock::duration> samples;
+        std::size_t next = 0;
+    };
+
+    void record(net::endpoint e, clock::duration latency);
+
+    // Returns false if there aren't yet enough samples to tell
+    bool delay_for(net::endpoint e, const net::hedging_options& options,
+                   clock::duration& delay);
+
+    net::io_runner& io_;
+
+    std::mutex mutex_;
+    std::array<latency_history, net::endpoint_count> history_;
+
+    std::atomic<long> requests_{0};
+    std::atomic<long> hedges_sent_{0};
+    std::atomic<long> hedges_won_{0};
+};
+
+auto default_hedger() -> hedger&;
+
+} // end namespace rest
+} // end namespace stockfighter
@@ -0,0 +1,706 @@
+
+#include "hpack.hpp"
+
+#include <algorithm>
+#include <array>
+#include <stdexcept>
+
+namespace stockfighter {
+namespace hpack {
+
+namespace {
+
+// RFC 7541 Appendix A
+const std::array<http::header, 61> static_table{{
+    {":authority", ""},
+    {":method", "GET"},
+    {":method", "POST"},
+    {":path", "/"},
+    {":path", "/index.html"},
+    {":scheme", "http"},
+    {":scheme", "https"},
+    {":status", "200"},
+    {":status", "204"},
+    {":status", "206"},
+    {":status", "304"},
+    {":status", "400"},
+    {":status", "404"},
+    {":status", "500"},
+    {"accept-charset", ""},
+    {"accept-encoding", "gzip, deflate"},
+    {"accept-language", ""},
+    {"accept-ranges", ""},
+    {"accept", ""},
+    {"access-control-allow-origin", ""},
+    {"age", ""},
+    {"allow", ""},
+    {"authorization", ""},
+    {"cache-control", ""},
+    {"content-disposition", ""},
+    {"content-encoding", ""},
+    {"content-language", ""},
+    {"content-length", ""},
+    {"content-location", ""},
+    {"content-range", ""},
+    {"content-type", ""},
+    {"cookie", ""},
+    {"date", ""},
+    {"etag", ""},
+    {"expect", ""},
+    {"expires", ""},
+    {"from", ""},
+    {"host", ""},
+    {"if-match", ""},
+    {"if-modified-since", ""},
+    {"if-none-match", ""},
+    {"if-range", ""},
+    {"if-unmodified-since", ""},
+    {"last-modified", ""},
+    {"link", ""},
+    {"location", ""},
+    {"max-forwards", ""},
+    {"proxy-authenticate", ""},
+    {"proxy-authorization", ""},
+    {"range", ""},
+    {"referer", ""},
+    {"refresh", ""},
+    {"retry-after", ""},
+    {"server", ""},
+    {"set-cookie", ""},
+    {"strict-transport-security", ""},
+    {"transfer-encoding", ""},
+    {"user-agent", ""},
+    {"vary", ""},
+    {"via", ""},
+    {"www-authenticate", ""},
+}};
+
+struct huffman_code {
+    std::uint32_t code;
+    int bits;
+};
+
+// RFC 7541 Appendix B, indexed by symbol
+const std::array<huffman_code, 257> huffman_codes{{
+    {0x00001ff8, 13},
+    {0x007fffd8, 23},
+    {0x0fffffe2, 28},
+    {0x0fffffe3, 28},
+    {0x0fffffe4, 28},
+    {0x0fffffe5, 28},
+    {0x0fffffe6, 28},
+    {0x0fffffe7, 28},
+    {0x0fffffe8, 28},
+    {0x00ffffea, 24},
+    {0x3ffffffc, 30},
+    {0x0fffffe9, 28},
+    {0x0fffffea, 28},
+    {0x3ffffffd, 30},
+    {0x0fffffeb, 28},
+    {0x0fffffec, 28},
+    {0x0fffffed, 28},
+    {0x0fffffee, 28},
+    {0x0fffffef, 28},
+    {0x0ffffff0, 28},
+    {0x0ffffff1, 28},
+    {0x0ffffff2, 28},
+    {0x3ffffffe, 30},
+    {0x0ffffff3, 28},
+    {0x0ffffff4, 28},
+    {0x0ffffff5, 28},
+    {0x0ffffff6, 28},
+    {0x0ffffff7, 28},
+    {0x0ffffff8, 28},
+    {0x0ffffff9, 28},
+    {0x0ffffffa, 28},
+    {0x0ffffffb, 28},
+    {0x00000014,  6},
+    {0x000003f8, 10},
+    {0x000003f9, 10},
+    {0x00000ffa, 12},
+    {0x00001ff9, 13},
+    {0x00000015,  6},
+    {0x000000f8,  8},
+    {0x000007fa, 11},
+    {0x000003fa, 10},
+    {0x000003fb, 10},
+    {0x000000f9,  8},
+    {0x000007fb, 11},
+    {0x000000fa,  8},
+    {0x00000016,  6},
+    {0x00000017,  6},
+    {0x00000018,  6},
+    {0x00000000,  5},
+    {0x00000001,  5},
+    {0x00000002,  5},
+    {0x00000019,  6},
+    {0x0000001a,  6},
+    {0x0000001b,  6},
+    {0x0000001c,  6},
+    {0x0000001d,  6},
+    {0x0000001e,  6},
+    {0x0000001f,  6},
+    {0x0000005c,  7},
+    {0x000000fb,  8},
+    {0x00007ffc, 15},
+    {0x00000020,  6},
+    {0x00000ffb, 12},
+    {0x000003fc, 10},
+    {0x00001ffa, 13},
+    {0x00000021,  6},
+    {0x0000005d,  7},
+    {0x0000005e,  7},
+    {0x0000005f,  7},
+    {0x00000060,  7},
+    {0x00000061,  7},
+    {0x00000062,  7},
+    {0x00000063,  7},
+    {0x00000064,  7},
+    {0x00000065,  7},
+    {0x00000066,  7},
+    {0x00000067,  7},
+    {0x00000068,  7},
+    {0x00000069,  7},
+    {0x0000006a,  7},
+    {0x0000006b,  7},
+    {0x0000006c,  7},
+    {0x0000006d,  7},
+    {0x0000006e,  7},
+    {0x0000006f,  7},
+    {0x00000070,  7},
+    {0x00000071,  7},
+    {0x00000072,  7},
+    {0x000000fc,  8},
+    {0x00000073,  7},
+    {0x000000fd,  8},
+    {0x00001ffb, 13},
+    {0x0007fff0, 19},
+    {0x00001ffc, 13},
+    {0x00003ffc, 14},
+    {0x00000022,  6},
+    {0x00007ffd, 15},
+    {0x00000003,  5},
+    {0x00000023,  6},
+    {0x00000004,  5},
+    {0x00000024,  6},
+    {0x00000005,  5},
+    {0x00000025,  6},
+    {0x00000026,  6},
+    {0x00000027,  6},
+    {0x00000006,  5},
+    {0x00000074,  7},
+    {0x00000075,  7},
+    {0x00000028,  6},
+    {0x00000029,  6},
+    {0x0000002a,  6},
+    {0x00000007,  5},
+    {0x0000002b,  6},
+    {0x00000076,  7},
+    {0x0000002c,  6},
+    {0x00000008,  5},
+    {0x00000009,  5},
+    {0x0000002d,  6},
+    {0x00000077,  7},
+    {0x00000078,  7},
+    {0x00000079,  7},
+    {0x0000007a,  7},
+    {0x0000007b,  7},
+    {0x00007ffe, 15},
+    {0x000007fc, 11},
+    {0x00003ffd, 14},
+    {0x00001ffd, 13},
+    {0x0ffffffc, 28},
+    {0x000fffe6, 20},
+    {0x003fffd2, 22},
+    {0x000fffe7, 20},
+    {0x000fffe8, 20},
+    {0x003fffd3, 22},
+    {0x003fffd4, 22},
+    {0x003fffd5, 22},
+    {0x007fffd9, 23},
+    {0x003fffd6, 22},
+    {0x007fffda, 23},
+    {0x007fffdb, 23},
+    {0x007fffdc, 23},
+    {0x007fffdd, 23},
+    {0x007fffde, 23},
+    {0x00ffffeb, 24},
+    {0x007fffdf, 23},
+    {0x00ffffec, 24},
+    {0x00ffffed, 24},
+    {0x003fffd7, 22},
+    {0x007fffe0, 23},
+    {0x00ffffee, 24},
+    {0x007fffe1, 23},
+    {0x007fffe2, 23},
+    {0x007fffe3, 23},
+    {0x007fffe4, 23},
+    {0x001fffdc, 21},
+    {0x003fffd8, 22},
+    {0x007fffe5, 23},
+    {0x003fffd9, 22},
+    {0x007fffe6, 23},
+    {0x007fffe7, 23},
+    {0x00ffffef, 24},
+    {0x003fffda, 22},
+    {0x001fffdd, 21},
+    {0x000fffe9, 20},
+    {0x003fffdb, 22},
+    {0x003fffdc, 22},
+    {0x007fffe8, 23},
+    {0x007fffe9, 23},
+    {0x001fffde, 21},
+    {0x007fffea, 23},
+    {0x003fffdd, 22},
+    {0x003fffde, 22},
+    {0x00fffff0, 24},
+    {0x001fffdf, 21},
+    {0x003fffdf, 22},
+    {0x007fffeb, 23},
+    {0x007fffec, 23},
+    {0x001fffe0, 21},
+    {0x001fffe1, 21},
+    {0x003fffe0, 22},
+    {0x001fffe2, 21},
+    {0x007fffed, 23},
+    {0x003fffe1, 22},
+    {0x007fffee, 23},
+    {0x007fffef, 23},
+    {0x000fffea, 20},
+    {0x003fffe2, 22},
+    {0x003fffe3, 22},
+    {0x003fffe4, 22},
+    {0x007ffff0, 23},
+    {0x003fffe5, 22},
+    {0x003fffe6, 22},
+    {0x007ffff1, 23},
+    {0x03ffffe0, 26},
+    {0x03ffffe1, 26},
+    {0x000fffeb, 20},
+    {0x0007fff1, 19},
+    {0x003fffe7, 22},
+    {0x007ffff2, 23},
+    {0x003fffe8, 22},
+    {0x01ffffec, 25},
+    {0x03ffffe2, 26},
+    {0x03ffffe3, 26},
+    {0x03ffffe4, 26},
+    {0x07ffffde, 27},
+    {0x07ffffdf, 27},
+    {0x03ffffe5, 26},
+    {0x00fffff1, 24},
+    {0x01ffffed, 25},
+    {0x0007fff2, 19},
+    {0x001fffe3, 21},
+    {0x03ffffe6, 26},
+    {0x07ffffe0, 27},
+    {0x07ffffe1, 27},
+    {0x03ffffe7, 26},
+    {0x07ffffe2, 27},
+    {0x00fffff2, 24},
+    {0x001fffe4, 21},
+    {0x001fffe5, 21},
+    {0x03ffffe8, 26},
+    {0x03ffffe9, 26},
+    {0x0ffffffd, 28},
+    {0x07ffffe3, 27},
+    {0x07ffffe4, 27},
+    {0x07ffffe5, 27},
+    {0x000fffec, 20},
+    {0x00fffff3, 24},
+    {0x000fffed, 20},
+    {0x001fffe6, 21},
+    {0x003fffe9, 22},
+    {0x001fffe7, 21},
+    {0x001fffe8, 21},
+    {0x007ffff3, 23},
+    {0x003fffea, 22},
+    {0x003fffeb, 22},
+    {0x01ffffee, 25},
+    {0x01ffffef, 25},
+    {0x00fffff4, 24},
+    {0x00fffff5, 24},
+    {0x03ffffea, 26},
+    {0x007ffff4, 23},
+    {0x03ffffeb, 26},
+    {0x07ffffe6, 27},
+    {0x03ffffec, 26},
+    {0x03ffffed, 26},
+    {0x07ffffe7, 27},
+    {0x07ffffe8, 27},
+    {0x07ffffe9, 27},
+    {0x07ffffea, 27},
+    {0x07ffffeb, 27},
+    {0x0ffffffe, 28},
+    {0x07ffffec, 27},
+    {0x07ffffed, 27},
+    {0x07ffffee, 27},
+    {0x07ffffef, 27},
+    {0x07fffff0, 27},
+    {0x03ffffee, 26},
+    {0x3fffffff, 30}, // EOS
+}};
+
+// Maps the bits of a Huffman code onto a binary tree for decoding
+class huffman_tree {
+public:
+    struct node {
+        std::int16_t child[2] = {-1, -1};
+        std::int16_t symbol = -1;
+    };
+
+    huffman_tree()
+    {
+        nodes_.emplace_back();
+
+        for (int sym = 0; sym < static_cast<int>(huffman_codes.size()); ++sym) {
+            const auto code = huffman_codes[sym];
+            auto n = 0;
+            for (int i = code.bits - 1; i >= 0; --i) {
+                const auto bit = (code.code >> i) & 1;
+                if (nodes_[n].child[bit] < 0) {
+                    nodes_[n].child[bit] = static_cast<std::int16_t>(nodes_.size());
+                    nodes_.emplace_back();
+                }
+                n = nodes_[n].child[bit];
+            }
+            nodes_[n].symbol = static_cast<std::int16_t>(sym);
+        }
+    }
+
+    auto operator[](int n) const -> const node& { return nodes_[n]; }
+
+private:
+    std::vector<node> nodes_;
+};
+
+constexpr int eos_symbol = 256;
+
+auto huffman_length(const std::string& str) -> std::size_t
+{
+    std::size_t bits = 0;
+    for (const auto c : str) {
+        bits += huffman_codes[static_cast<std::uint8_t>(c)].bits;
+    }
+    return (bits + 7) / 8;
+}
+
+void encode_int(std::string& buf, std::uint8_t flags, int prefix_bits,
+                std::size_t value)
+{
+    const auto max_prefix = (std::size_t{1} << prefix_bits) - 1;
+
+    if (value < max_prefix) {
+        buf += static_cast<char>(flags | value);
+        return;
+    }
+
+    buf += static_cast<char>(flags | max_prefix);
+    value -= max_prefix;
+    while (value >= 128) {
+        buf += static_cast<char>(value % 128 + 128);
+        value /= 128;
+    }
+    buf += static_cast<char>(value);
+}
+
+void encode_string(std::string& buf, const std::string& str)
+{
+    const auto compressed = huffman_length(str);
+
+    if (compressed < str.size()) {
+        encode_int(buf, 0x80, 7, compressed);
+        huffman_encode(buf, str);
+    } else {
+        encode_int(buf, 0x00, 7, str.size());
+        buf += str;
+    }
+}
+
+auto decode_int(const std::uint8_t*& p, const std::uint8_t* end,
+                int prefix_bits) -> std::size_t
+{
+    if (p == end) {
+        throw std::runtime_error{"Truncated HPACK integer"};
+    }
+
+    const auto max_prefix = (std::size_t{1} << prefix_bits) - 1;
+    auto value = *p++ & max_prefix;
+
+    if (value < max_prefix) {
+        return value;
+    }
+
+    for (int shift = 0; ; shift += 7) {
+        if (p == end || shift > 28) {
+            throw std::runtime_error{"Malformed HPACK integer"};
+        }
+        const auto b = *p++;
+        value += static_cast<std::size_t>(b & 0x7f) << shift;
+        if ((b & 0x80) == 0) {
+            return value;
+        }
+    }
+}
+
+auto decode_string(const std::uint8_t*& p,
+                   const std::uint8_t* end) -> std::string
+{
+    if (p == end) {
+        throw std::runtime_error{"Truncated HPACK string"};
+    }
+
+    const bool huffman = (*p & 0x80) != 0;
+    const auto length = decode_int(p, end, 7);
+
+    if (length > static_cast<std::size_t>(end - p)) {
+        throw std::runtime_error{"Truncated HPACK string"};
+    }
+
+    auto output = huffman ?
+                  huffman_decode(p, length) :
+                  std::string(reinterpret_cast<const char*>(p), length);
+    p += length;
+    return output;
+}
+
+auto entry_size(const http::header& h) -> std::size_t
+{
+    return h.name.size() + h.value.size() + 32;
+}
+
+} // end anonymous namespace
+
+void huffman_encode(std::string& buf, const std::string& str)
+{
+    std::uint64_t acc = 0;
+    int bits = 0;
+
+    for (const auto c : str) {
+        const auto code = huffman_codes[static_cast<std::uint8_t>(c)];
+        acc = (acc << code.bits) | code.code;
+        bits += code.bits;
+        while (bits >= 8) {
+            bits -= 8;
+            buf += static_cast<char>(acc >> bits);
+        }
+        acc &= (std::uint64_t{1} << bits) - 1;
+    }
+
+    if (bits > 0) {
+        // Pad with the most significant bits of EOS, which are all ones
+        const auto padding = 8 - bits;
+        buf += static_cast<char>((acc << padding) | ((1u << padding) - 1));
+    }
+}
+
+auto huffman_decode(const std::uint8_t* data, std::size_t size) -> std::string
+{
+    static const huffman_tree tree;
+
+    auto output = std::string{};
+    auto n = 0;
+    auto bits_since_symbol = 0;
+    bool all_ones = true;
+
+    for (std::size_t i = 0; i < size; ++i) {
+        for (int shift = 7; shift >= 0; --shift) {
+            const auto bit = (data[i] >> shift) & 1;
+            n = tree[n].child[bit];
+            if (n < 0) {
+                throw std::runtime_error{"Invalid Huffman code"};
+            }
+            ++bits_since_symbol;
+            all_ones = all_ones && bit == 1;
+
+            const auto symbol = tree[n].symbol;
+            if (symbol == eos_symbol) {
+                throw std::runtime_error{"EOS symbol in Huffman-encoded string"};
+            }
+            if (symbol >= 0) {
+                output += static_cast<char>(symbol);
+                n = 0;
+                bits_since_symbol = 0;
+                all_ones = true;
+            }
+        }
+    }
+
+    if (bits_since_symbol > 7 || !all_ones) {
+        throw std::runtime_error{"Invalid Huffman padding"};
+    }
+
+    return output;
+}
+
+auto header_table::at(std::size_t index) const -> const http::header*
+{
+    if (index == 0) {
+        return nullptr;
+    }
+    if (index <= static_table.size()) {
+        return &static_table[index - 1];
+    }
+    index -= static_table.size() + 1;
+    return index < entries_.size() ? &entries_[index] : nullptr;
+}
+
+auto header_table::find(const http::header& h, bool& exact) const -> std::size_t
+{
+    std::size_t name_match = 0;
+    exact = false;
+
+    for (std::size_t i = 0; i < static_table.size() + entries_.size(); ++i) {
+        const auto& entry = i < static_table.size() ?
+                            static_table[i] :
+                            entries_[i - static_table.size()];
+        if (entry.name != h.name) {
+            continue;
+        }
+        if (entry.value == h.value) {
+            exact = true;
+            return i + 1;
+        }
+        if (name_match == 0) {
+            name_match = i + 1;
+        }
+    }
+
+    return name_match;
+}
+
+void header_table::add(http::header h)
+{
+    const auto size = entry_size(h);
+
+    if (size > max_size_) {
+        // Not an error, it just empties the table
+        entries_.clear();
+        size_ = 0;
+        return;
+    }
+
+    evict(size);
+    size_ += size;
+    entries_.push_front(std::move(h));
+}
+
+void header_table::set_max_size(std::size_t size)
+{
+    max_size_ = size;
+    evict(0);
+}
+
+void header_table::evict(std::size_t space_needed)
+{
+    while (!entries_.empty() && size_ + space_needed > max_size_) {
+        size_ -= entry_size(entries_.back());
+        entries_.pop_back();
+    }
+}
+
+void encoder::encode(std::string& buf, const std::vector<http::header>& headers)
+{
+    if (size_update_pending_) {
+        encode_int(buf, 0x20, 5, table_.max_size());
+        size_update_pending_ = false;
+    }
+
+    for (const auto& h : headers) {
+        bool exact = false;
+        const auto index = table_.find(h, exact);
+
+        if (exact) {
+            encode_int(buf, 0x80, 7, index);
+            continue;
+        }
+
+        // Anything which changes from request to request would just push
+        // more useful entries out of the table
+        const bool indexed = h.name != "content-length";
+
+        if (index != 0) {
+            encode_int(buf, indexed ? 0x40 : 0x00, indexed ? 6 : 4, index);
+        } else {
+            buf += static_cast<char>(indexed ? 0x40 : 0x00);
+            encode_string(buf, h.name);
+        }
+        encode_string(buf, h.value);
+
+        if (indexed) {
+            table_.add(h);
+        }
+    }
+}
+
+void encoder::set_max_table_size(std::size_t size)
+{
+    // We never need a bigger table than the default
+    size = std::min<std::size_t>(size, 4096);
+
+    if (size != table_.max_size()) {
+        table_.set_max_size(size);
+        size_update_pending_ = true;
+    }
+}
+
+decoder::decoder(std::size_t max_table_size)
+        : max_table_size_(max_table_size)
+{
+    table_.set_max_size(max_table_size);
+}
+
+auto decoder::decode(const std::uint8_t* data,
+                     std::size_t size) -> std::vector<http::header>
+{
+    auto output = std::vector<http::header>{};
+    const auto* p = data;
+    const auto* const end = data + size;
+
+    auto indexed_name = [&](std::size_t index) {
+        if (index == 0) {
+            return decode_string(p, end);
+        }
+        const auto* entry = table_.at(index);
+        if (entry == nullptr) {
+            throw std::runtime_error{"HPACK index out of range"};
+        }
+        return entry->name;
+    };
+
+    while (p != end) {
+        const auto b = *p;
+
+        if (b & 0x80) {
+            // Indexed header field
+            const auto* entry = table_.at(decode_int(p, end, 7));
+            if (entry == nullptr) {
+                throw std::runtime_error{"HPACK index out of range"};
+            }
+            output.push_back(*entry);
+        } else if ((b & 0xc0) == 0x40) {
+            // Literal with incremental indexing
+            auto name = indexed_name(decode_int(p, end, 6));
+            auto value = decode_string(p, end);
+            output.push_back(http::header{name, value});
+            table_.add(http::header{std::move(name), std::move(value)});
+        } else if ((b & 0xe0) == 0x20) {
+            // Dynamic table size update
+            const auto new_size = decode_int(p, end, 5);
+            if (new_size > max_table_size_) {
+                throw std::runtime_error{"HPACK table size update too large"};
+            }
+            table_.set_max_size(new_size);
+        } else {
+            // Literal without indexing, or never indexed
+            auto name = indexed_name(decode_int(p, end, 4));
+            auto value = decode_string(p, end);
+            output.push_back(http::header{std::move(name), std::move(value)});
+        }
+    }
+
+    return output;
+}
+
+} // end namespace hpack
+} // end namespace stockfighter
@@ -0,0 +1,73 @@
+#pragma once
+
+#include "http.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <vector>
+
+namespace stockfighter {
+namespace hpack {
+
+// The dynamic part of the HPACK header table (RFC 7541 section 2.3.2)
+class header_table {
+public:
+    // Looks up a 1-based index covering the static and dynamic tables,
+    // returns nullptr if it is out of range
+    auto at(std::size_t index) const -> const http::header*;
+
+    // Returns the index of an entry exactly matching the header, or of one
+    // with the same name if there is none. Returns 0 if neither is found.
+    auto find(const http::header& h, bool& exact) const -> std::size_t;
+
+    void add(http::header h);
+
+    void set_max_size(std::size_t size);
+
+    auto max_size() const -> std::size_t { return max_size_; }
+
+private:
+    void evict(std::size_t space_needed);
+
+    std::deque<http::header> entries_;
+    std::size_t size_ = 0;
+    std::size_t max_size_ = 4096;
+};
+
+class encoder {
+public:
+    // Appends the encoded header block to buf. Header names must already
+    // be lower case.
+    void encode(std::string& buf, const std::vector<http::header>& headers);
+
+    // To be called when the peer sends SETTINGS_HEADER_TABLE_SIZE
+    void set_max_table_size(std::size_t size);
+
+private:
+    header_table table_;
+    bool size_update_pending_ = false;
+};
+
+class decoder {
+public:
+    explicit decoder(std::size_t max_table_size = 4096);
+
+    // Throws std::runtime_error if the block is malformed, after which the
+    // decoder's state is unusable and the connection must be dropped
+    auto decode(const std::uint8_t* data,
+                std::size_t size) -> std::vector<http::header>;
+
+private:
+    header_table table_;
+    std::size_t max_table_size_;
+};
+
+// Exposed for testing
+void huffman_encode(std::string& buf, const std::string& str);
+
+auto huffman_decode(const std::uint8_t* data, std::size_t size) -> std::string;
+
+} // end namespace hpack
+} // end namespace stockfighter
@@ -0,0 +1,566 @@
+
+#include "http.hpp"
+
+#include "buffer_pool.hpp"
+
+#include <cppformat/format.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+
+namespace stockfighter {
+namespace http {
+
+namespace {
+
+// Names looked up in every response, made once; some are too long to be
+// built without allocating
+const std::string content_encoding = "Content-Encoding";
+const std::string transfer_encoding = "Transfer-Encoding";
+const std::string content_length = "Content-Length";
+
+bool iequals(const std::string& a, const std::string& b)
+{
+    return a.size() == b.size() &&
+           std::equal(a.begin(), a.end(), b.begin(), [](char x, char y) {
+               return std::tolower(static_cast<unsigned char>(x)) ==
+                      std::tolower(static_cast<unsigned char>(y));
+           });
+}
+
+// Sets out to s from pos onwards, without surrounding whitespace
+void assign_trimmed(std::string& out, const std::string& s, std::size_t pos)
+{
+    const auto first = s.find_first_not_of(" \t", pos);
+    if (first == std::string::npos) {
+        out.clear();
+        return;
+    }
+    const auto last = s.find_last_not_of(" \t");
+    out.assign(s, first, last - first + 1);
+}
+
+auto digit_value(char c) -> int
+{
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return 99;
+}
+
+auto default_port(const std::string& scheme) -> std::string
+{
+    return scheme == "https" ? "443" : "80";
+}
+
+} // end anonymous namespace
+
+auto parse_length(const std::string& text, int base) -> std::size_t
+{
+    const auto max = std::numeric_limits<std::size_t>::max();
+    const auto b = static_cast<std::size_t>(base);
+
+    std::size_t value = 0;
+    std::size_t i = 0;
+    for (; i < text.size(); ++i) {
+        const auto d = digit_value(text[i]);
+        if (d >= base) {
+            break;
+        }
+        if (value > (max - static_cast<std::size_t>(d)) / b) {
+            throw std::runtime_error{
+                    fmt::format("HTTP length \"{}\" is too large", text)};
+        }
+        value = value * b + static_cast<std::size_t>(d);
+    }
+
+    // Only a chunk size may be followed by anything, and then only by
+    // whitespace or extensions
+    const bool rest_ok = i == text.size() ||
+            (base == 16 && (text[i] == ';' || text[i] == ' ' || text[i] == '\t'));
+    if (i == 0 || !rest_ok) {
+        throw std::runtime_error{
+                fmt::format("Malformed HTTP length \"{}\"", text)};
+    }
+    return value;
+}
+
+auto parse_url(const std::string& str) -> url
+{
+    auto output = url{};
+
+    const auto scheme_end = str.find("://");
+    if (scheme_end == std::string::npos) {
+        throw std::runtime_error{
+                fmt::format("\"{}\" does not look like a URL", str)};
+    }
+    output.scheme = str.substr(0, scheme_end);
+
+    if (output.scheme != "http" && output.scheme != "https") {
+        throw std::runtime_error{
+                fmt::format("Unsupported URL scheme \"{}\"", output.scheme)};
+    }
+
+    const auto authority_begin = scheme_end + 3;
+    const auto target_begin = str.find('/', authority_begin);
+    const auto authority = str.substr(authority_begin,
+                                      target_begin - authority_begin);
+
+    const auto colon = authority.rfind(':');
+    if (colon != std::string::npos && authority.find(']', colon) == std::string::npos) {
+        output.host = authority.substr(0, colon);
+        output.port = authority.substr(colon + 1);
+    } else {
+        output.host = authority;
+        output.port = default_port(output.scheme);
+    }
+
+    if (output.host.empty()) {
+        throw std::runtime_error{
+                fmt::format("\"{}\" does not contain a host name", str)};
+    }
+
+    output.target = target_begin == std::string::npos ?
+                    "/" : str.substr(target_begin);
+
+    return output;
+}
+
+auto find_header(const std::vector<header>& headers,
+                 const std::string& name) -> const std::string*
+{
+    for (const auto& h : headers) {
+        if (iequals(h.name, name)) {
+            return &h.value;
+        }
+    }
+    return nullptr;
+}
+
+auto all_headers(const request& req) -> std::vector<header>
+{
+    auto headers = std::vector<header>{};
+    if (req.common) {
+        headers = req.common->headers;
+    }
+    headers.insert(headers.end(), req.headers.begin(), req.headers.end());
+    return headers;
+}
+
+auto make_header_block(const url& host, std::vector<header> headers)
+        -> std::shared_ptr<const header_block>
+{
+    auto block = std::make_shared<header_block>();
+
+    auto& out = block->serialised;
+    out += "Host: ";
+    out += host.host;
+    if (host.port != default_port(host.scheme)) {
+        out += ':';
+        out += host.port;
+    }
+    out += "\r\n";
+
+    for (const auto& h : headers) {
+        out += h.name;
+        out += ": ";
+        out += h.value;
+        out += "\r\n";
+    }
+
+    block->headers = std::move(headers);
+    return block;
+}
+
+void write_request(std::string& buf, const request& req)
+{
+    buf += req.method;
+    buf += ' ';
+    buf += req.uri.target;
+    buf += " HTTP/1.1\r\n";
+
+    if (req.common) {
+        buf += req.common->serialised;
+    } else {
+        buf += "Host: ";
+        buf += req.uri.host;
+        if (req.uri.port != default_port(req.uri.scheme)) {
+            buf += ':';
+            buf += req.uri.port;
+        }
+        buf += "\r\n";
+    }
+
+    for (const auto& h : req.headers) {
+        buf += h.name;
+        buf += ": ";
+        buf += h.value;
+        buf += "\r\n";
+    }
+
+    if (!req.body.empty() || req.method == "POST") {
+        buf += "Content-Length: ";
+        buf += std::to_string(req.body.size());
+        buf += "\r\n";
+    }
+
+    buf += "\r\n";
+    buf += req.body;
+}
+
+void inflater::end_stream::operator()(z_stream* s) const
+{
+    ::inflateEnd(s);
+    delete s;
+}
+
+bool inflater::start(const std::string& encoding)
+{
+    reset();
+
+    if (iequals(encoding, "gzip") || iequals(encoding, "x-gzip")) {
+        deflate_ = false;
+    } else if (iequals(encoding, "deflate")) {
+        deflate_ = true;
+    } else {
+        return false;
+    }
+
+    if (!stream_) {
+        stream_.reset(new z_stream{});
+    }
+    active_ = true;
+    return true;
+}
+
+void inflater::decode(const char* data, std::size_t size, std::string& out)
+{
+    if (finished_ || size == 0) {
+        return;
+    }
+
+    if (!started_) {
+        // "deflate" is meant to be zlib-wrapped, but some servers send a raw
+        // deflate stream instead. A zlib header is a multiple of 31.
+        int window_bits = 15 + 32;
+        if (deflate_) {
+            if (!held_ && size == 1) {
+                first_byte_ = data[0];
+                held_ = true;
+                return;
+            }
+            const auto b0 = static_cast<unsigned char>(held_ ? first_byte_ : data[0]);
+            const auto b1 = static_cast<unsigned char>(held_ ? data[0] : data[1]);
+            if ((b0 & 0x0f) != 8 || (b0 << 8 | b1) % 31 != 0) {
+                window_bits = -15;
+            }
+        }
+        const auto result = initialised_ ?
+                            ::inflateReset2(stream_.get(), window_bits) :
+                            ::inflateInit2(stream_.get(), window_bits);
+        if (result != Z_OK) {
+            throw std::runtime_error{"Could not set up decompression"};
+        }
+        initialised_ = true;
+        started_ = true;
+
+        if (held_) {
+            held_ = false;
+            feed(&first_byte_, 1, out);
+        }
+    }
+
+    feed(data, size, out);
+}
+
+void inflater::feed(const char* data, std::size_t size, std::string& out)
+{
+    if (finished_) {
+        return;
+    }
+
+    stream_->next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+    stream_->avail_in = static_cast<uInt>(size);
+
+    while (stream_->avail_in > 0) {
+        const auto old_size = out.size();
+        const auto chunk = std::max<std::size_t>(size * 4, 16384);
+        out.resize(old_size + chunk);
+        stream_->next_out = reinterpret_cast<Bytef*>(&out[old_size]);
+        stream_->avail_out = static_cast<uInt>(chunk);
+
+        const auto result = ::inflate(stream_.get(), Z_NO_FLUSH);
+        out.resize(old_size + chunk - stream_->avail_out);
+
+        if (result == Z_STREAM_END) {
+            // Anything after the end of the stream is ignored
+            finished_ = true;
+            return;
+        }
+        if (result != Z_OK) {
+            throw std::runtime_error{fmt::format(
+                    "Could not decompress response body: {}",
+                    stream_->msg != nullptr ? stream_->msg : "corrupt data")};
+        }
+    }
+}
+
+void inflater::reset()
+{
+    active_ = false;
+    started_ = false;
+    finished_ = false;
+    held_ = false;
+}
+
+auto response_parser::feed(const char* data, std::size_t size) -> std::size_t
+{
+    std::size_t pos = 0;
+
+    if (size > 0) {
+        started_ = true;
+        if (!have_buffer_) {
+            take_buffer();
+        }
+    }
+
+    while (pos < size && state_ != state::done) {
+        switch (state_) {
+        case state::body:
+        case state::chunk_data: {
+            if (inflater_.active()) {
+                const auto n = std::min(remaining_, size - pos);
+                inflater_.decode(data + pos, n, response_.body);
+                pos += n;
+                commit(n);
+                break;
+            }
+            std::size_t space = 0;
+            auto dest = body_space(space);
+            const auto n = std::min(space, size - pos);
+            std::memcpy(dest, data + pos, n);
+            pos += n;
+            commit(n);
+            break;
+        }
+        case state::body_until_close:
+            if (inflater_.active()) {
+                inflater_.decode(data + pos, size - pos, response_.body);
+            } else {
+                response_.body.append(data + pos, size - pos);
+            }
+            pos = size;
+            break;
+        default: {
+            const auto nl = static_cast<const char*>(
+                    std::memchr(data + pos, '\n', size - pos));
+            if (nl == nullptr) {
+                line_.append(data + pos, size - pos);
+                pos = size;
+                break;
+            }
+            line_.append(data + pos, nl);
+            pos = static_cast<std::size_t>(nl - data) + 1;
+            if (!line_.empty() && line_.back() == '\r') {
+                line_.pop_back();
+            }
+            on_line();
+            line_.clear();
+            break;
+        }
+        }
+    }
+
+    return pos;
+}
+
+auto response_parser::body_space(std::size_t& size) -> char*
+{
+    if ((state_ != state::body && state_ != state::chunk_data) ||
+        remaining_ == 0 || inflater_.active()) {
+        size = 0;
+        return nullptr;
+    }
+
+    if (unfilled_ == 0) {
+        grow_body();
+    }
+    size = unfilled_;
+    return &response_.body[response_.body.size() - unfilled_];
+}
+
+void response_parser::grow_body()
+{
+    // The server's length is only trusted as far as the room already set
+    // aside from the size hint; past that the body doubles as it fills,
+    // so a bogus length can't make us allocate more than we receive
+    const auto size = response_.body.size();
+    const auto step = std::max({response_.body.capacity() - size, size,
+                                min_body_reserve});
+    unfilled_ = std::min(step, remaining_);
+    response_.body.resize(size + unfilled_);
+}
+
+void response_parser::commit(std::size_t size)
+{
+    if (size > 0) {
+        started_ = true;
+    }
+
+    if (!inflater_.active()) {
+        unfilled_ -= size;
+    }
+    remaining_ -= size;
+    if (remaining_ == 0) {
+        state_ = state_ == state::body ? state::done : state::chunk_end;
+    }
+}
+
+bool response_parser::finish()
+{
+    if (state_ == state::body_until_close) {
+        state_ = state::done;
+    }
+    return done();
+}
+
+auto response_parser::release() -> response
+{
+    response_.headers.resize(std::min(headers_, response_.headers.size()));
+    // Room made for a body which never arrived
+    response_.body.resize(response_.body.size() - unfilled_);
+    unfilled_ = 0;
+    auto output = std::move(response_);
+    response_ = response{};
+    state_ = state::status_line;
+    started_ = false;
+    have_buffer_ = false;
+    headers_ = 0;
+    size_hint_ = 0;
+    line_.clear();
+    remaining_ = 0;
+    inflater_.reset();
+    return output;
+}
+
+void response_parser::take_buffer()
+{
+    response_ = default_response_pool().take(size_hint_);
+    have_buffer_ = true;
+    headers_ = 0;
+}
+
+void response_parser::on_line()
+{
+    switch (state_) {
+    case state::status_line: {
+        // e.g. "HTTP/1.1 200 OK"
+        if (line_.compare(0, 5, "HTTP/") != 0 || line_.size() < 12) {
+            throw std::runtime_error{
+                    fmt::format("Malformed HTTP status line \"{}\"", line_)};
+        }
+        response_.keep_alive = line_.compare(5, 3, "1.0") != 0;
+        response_.status = std::stoi(line_.substr(9, 3));
+        if (line_.size() > 13) {
+            response_.reason.assign(line_, 13, std::string::npos);
+        } else {
+            response_.reason.clear();
+        }
+        state_ = state::header_line;
+        break;
+    }
+    case state::header_line: {
+        if (line_.empty()) {
+            on_headers_complete();
+            break;
+        }
+        const auto colon = line_.find(':');
+        if (colon == std::string::npos) {
+            throw std::runtime_error{
+                    fmt::format("Malformed HTTP header \"{}\"", line_)};
+        }
+        // Written over a header left in the storage, if there is one, so
+        // that its strings' capacity is reused
+        if (headers_ == response_.headers.size()) {
+            response_.headers.emplace_back();
+        }
+        auto& h = response_.headers[headers_++];
+        h.name.assign(line_, 0, colon);
+        assign_trimmed(h.value, line_, colon + 1);
+        if (iequals(h.name, "Connection")) {
+            if (iequals(h.value, "close")) {
+                response_.keep_alive = false;
+            } else if (iequals(h.value, "keep-alive")) {
+                response_.keep_alive = true;
+            }
+        }
+        break;
+    }
+    case state::chunk_size: {
+        remaining_ = parse_length(line_, 16);
+        state_ = remaining_ == 0 ? state::trailer : state::chunk_data;
+        break;
+    }
+    case state::chunk_end:
+        state_ = state::chunk_size;
+        break;
+    case state::trailer:
+        if (line_.empty()) {
+            state_ = state::done;
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+void response_parser::on_headers_complete()
+{
+    const auto status = response_.status;
+    response_.headers.resize(headers_);
+
+    if (status >= 100 && status < 200) {
+        // Interim response, the real one follows
+        headers_ = 0;
+        response_.keep_alive = true;
+        state_ = state::status_line;
+        return;
+    }
+
+    if (status == 204 || status == 304) {
+        state_ = state::done;
+        return;
+    }
+
+    if (const auto* coding = find_header(response_.headers, content_encoding)) {
+        inflater_.start(*coding);
+    }
+
+    const auto* encoding = find_header(response_.headers, transfer_encoding);
+    if (encoding != nullptr && !iequals(*encoding, "identity")) {
+        state_ = state::chunk_size;
+        return;
+    }
+
+    if (const auto* length = find_header(response_.headers, content_length)) {
+        // The body is made room for as it arrives
+        remaining_ = parse_length(*length);
+        state_ = remaining_ == 0 ? state::done : state::body;
+        return;
+    }
+
+    response_.keep_alive = false;
+    state_ = state::body_until_close;
+}
+
+} // end namespace http
+} // end namespace stockfighter
@@ -0,0 +1,150 @@
+#pragma once
+
+#include <stockfighter/http.hpp>
+
+#include <zlib.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <string>
+
+namespace stockfighter {
+namespace http {
+
+auto parse_url(const std::string& str) -> url;
+
+// Builds the common headers for requests to host, serialising them once
+auto make_header_block(const url& host, std::vector<header> headers)
+        -> std::shared_ptr<const header_block>;
+
+// Appends the serialised request (request line, headers and body) to buf.
+// The common headers are copied in as they are.
+void write_request(std::string& buf, const request& req);
+
+// Reads a Content-Length, or with base 16 a chunk size (ignoring any chunk
+// extensions). Throws std::runtime_error unless it is a plain unsigned
+// number which fits in a size_t.
+auto parse_length(const std::string& text, int base = 10) -> std::size_t;
+
+// How much room to set aside for a body before any of it has arrived,
+// given the length the server announced and the size usually seen for the
+// request. The announced length is only a claim, so no more than the usual
+// size (or min_body_reserve, if that's bigger) is trusted to it.
+constexpr std::size_t min_body_reserve = 16 * 1024;
+
+inline auto body_reserve(std::size_t length, std::size_t usual) -> std::size_t
+{
+    return std::min(length, std::max(usual, min_body_reserve));
+}
+
+// Decompresses a gzip or deflate encoded body a piece at a time. The
+// zlib state is kept from one body to the next and reset rather than set
+// up again.
+class inflater {
+public:
+    // Returns false if the Content-Encoding is not one we can decode
+    bool start(const std::string& encoding);
+
+    bool active() const { return active_; }
+
+    // Appends the decompressed form of the data to out
+    void decode(const char* data, std::size_t size, std::string& out);
+
+    void reset();
+
+private:
+    struct end_stream {
+        void operator()(z_stream* s) const;
+    };
+
+    void feed(const char* data, std::size_t size, std::string& out);
+
+    std::unique_ptr<z_stream, end_stream> stream_;
+    bool active_ = false;
+    bool deflate_ = false;
+    // Whether stream_ has been through inflateInit2()
+    bool initialised_ = false;
+    // Whether any of the current body has been decoded
+    bool started_ = false;
+    bool finished_ = false;
+    // A deflate body's first byte, if it arrived on its own. The first two
+    // are needed to tell how it is wrapped.
+    bool held_ = false;
+    char first_byte_ = 0;
+};
+
+// Incremental HTTP/1.1 response parser. Bytes can be fed in arbitrarily
+// sized pieces as they arrive from the socket; feed() stops at the end of
+// the current response so that anything after it is left for the next one.
+// Compressed bodies are inflated as they are fed in. Each response is
+// built in storage taken from the response pool.
+class response_parser {
+public:
+    // How much room to set aside for the body of the next response
+    void expect(std::size_t size) { size_hint_ = size; }
+
+    // Returns the number of bytes consumed
+    auto feed(const char* data, std::size_t size) -> std::size_t;
+
+    // To be called when the peer closes the connection. Returns whether
+    // that completes the response, which it does if there is no
+    // Content-Length and the body is delimited by the close.
+    bool finish();
+
+    bool done() const { return state_ == state::done; }
+
+    // When the parser knows how many more body bytes are coming, returns
+    // where they belong in the response body and sets size to the number
+    // expected, so that they can be read straight from the socket instead
+    // of going through feed(). Returns nullptr otherwise, which includes
+    // compressed bodies as they must be inflated. commit() must be
+    // called with the number of bytes written.
+    auto body_space(std::size_t& size) -> char*;
+
+    void commit(std::size_t size);
+
+    // True once any part of a response has been received
+    bool started() const { return started_; }
+
+    // Moves out the completed response and resets the parser
+    auto release() -> response;
+
+private:
+    enum class state {
+        status_line,
+        header_line,
+        body,
+        body_until_close,
+        chunk_size,
+        chunk_data,
+        chunk_end,
+        trailer,
+        done
+    };
+
+    void take_buffer();
+    void on_line();
+    void on_headers_complete();
+
+    // Makes room at the end of the body for more of it to be read into
+    void grow_body();
+
+    state state_ = state::status_line;
+    bool started_ = false;
+    std::string line_;
+    std::size_t remaining_ = 0;
+    // Bytes at the end of the body which have been made room for, but not
+    // yet received; never more than remaining_
+    std::size_t unfilled_ = 0;
+    std::size_t size_hint_ = 0;
+    bool have_buffer_ = false;
+    // How many of response_.headers belong to this response; those after
+    // them are left over from whichever response the storage came from
+    std::size_t headers_ = 0;
+    response response_;
+    inflater inflater_;
+};
+
+} // end namespace http
+} // end namespace stockfighter
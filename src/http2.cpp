@@ -0,0 +1,1068 @@
+
+#include "http2.hpp"
+#include "cancellation.hpp"
+#include "connection_pool.hpp"
+#include "dns_cache.hpp"
+#include "session_cache.hpp"
+#include "socket_options.hpp"
+
+#include <boost/asio/bind_executor.hpp>
+#include <boost/asio/connect.hpp>
+#include <boost/asio/post.hpp>
+#include <boost/asio/ssl/host_name_verification.hpp>
+#include <boost/asio/write.hpp>
+
+#include <cppformat/format.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <future>
+#include <limits>
+
+namespace asio = boost::asio;
+using tcp = boost::asio::ip::tcp;
+using boost::system::error_code;
+
+namespace stockfighter {
+namespace net {
+
+namespace {
+
+// Frame types (RFC 7540 section 6)
+constexpr std::uint8_t frame_data = 0x0;
+constexpr std::uint8_t frame_headers = 0x1;
+constexpr std::uint8_t frame_rst_stream = 0x3;
+constexpr std::uint8_t frame_settings = 0x4;
+constexpr std::uint8_t frame_push_promise = 0x5;
+constexpr std::uint8_t frame_ping = 0x6;
+constexpr std::uint8_t frame_goaway = 0x7;
+constexpr std::uint8_t frame_window_update = 0x8;
+constexpr std::uint8_t frame_continuation = 0x9;
+
+// Flags
+constexpr std::uint8_t flag_end_stream = 0x1;
+constexpr std::uint8_t flag_ack = 0x1;
+constexpr std::uint8_t flag_end_headers = 0x4;
+constexpr std::uint8_t flag_padded = 0x8;
+constexpr std::uint8_t flag_priority = 0x20;
+
+// Settings
+constexpr std::uint16_t settings_header_table_size = 0x1;
+constexpr std::uint16_t settings_enable_push = 0x2;
+constexpr std::uint16_t settings_max_concurrent_streams = 0x3;
+constexpr std::uint16_t settings_initial_window_size = 0x4;
+constexpr std::uint16_t settings_max_frame_size = 0x5;
+
+// Error codes
+constexpr std::uint32_t refused_stream = 0x7;
+constexpr std::uint32_t cancel = 0x8;
+
+constexpr char preface[] = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+
+// We advertise a large receive window so that order books are never held
+// up by flow control, and top it up once half of it has been used
+constexpr std::size_t receive_window = 1 << 24;
+constexpr std::size_t default_window = 65535;
+constexpr std::size_t max_receive_frame = 16384;
+
+auto read_u32(const std::uint8_t* p) -> std::uint32_t
+{
+    return std::uint32_t(p[0]) << 24 | std::uint32_t(p[1]) << 16 |
+           std::uint32_t(p[2]) << 8 | std::uint32_t(p[3]);
+}
+
+void append_u32(std::string& buf, std::uint32_t n)
+{
+    buf += char(n >> 24);
+    buf += char(n >> 16);
+    buf += char(n >> 8);
+    buf += char(n);
+}
+
+void append_setting(std::string& buf, std::uint16_t id, std::uint32_t value)
+{
+    buf += char(id >> 8);
+    buf += char(id);
+    append_u32(buf, value);
+}
+
+auto protocol_error(const std::string& what) -> std::runtime_error
+{
+    return std::runtime_error{fmt::format("HTTP/2 protocol error: {}", what)};
+}
+
+// Removes the padding from a DATA or HEADERS frame payload
+void strip_padding(std::uint8_t flags, const std::uint8_t*& payload,
+                   std::size_t& size)
+{
+    if (!(flags & flag_padded)) {
+        return;
+    }
+    if (size < 1 || payload[0] >= size) {
+        throw protocol_error("bad padding");
+    }
+    size -= 1 + payload[0];
+    ++payload;
+}
+
+// Connection-specific headers are not allowed in HTTP/2
+bool is_connection_header(const std::string& name)
+{
+    return name == "connection" || name == "keep-alive" || name == "host" ||
+           name == "proxy-connection" || name == "transfer-encoding" ||
+           name == "upgrade" || name == "content-length";
+}
+
+auto lower(std::string s) -> std::string
+{
+    std::transform(s.begin(), s.end(), s.begin(), [](unsigned char c) {
+        return static_cast<char>(std::tolower(c));
+    });
+    return s;
+}
+
+auto host_key(const http::url& host) -> std::string
+{
+    return host.host + ":" + host.port;
+}
+
+} // end anonymous namespace
+
+http2_connection::http2_connection(asio::io_context& io,
+                                   asio::ssl::context& ssl,
+                                   const http::url& host,
+                                   hooks h,
+                                   const socket_options& sockets)
+        : strand_{asio::make_strand(io)},
+          resolver_{io},
+          stream_{io, ssl},
+          host_(host),
+          hooks_(std::move(h)),
+          sockets_(sockets)
+{}
+
+void http2_connection::start()
+{
+    auto self = shared_from_this();
+
+    auto fail_with = [self](const error_code& ec) {
+        self->fail(std::make_exception_ptr(boost::system::system_error{ec}));
+    };
+
+    auto on_handshake = [self, fail_with](const error_code& ec) {
+        if (ec) {
+            return fail_with(ec);
+        }
+        self->on_handshake();
+    };
+
+    auto on_connect = [self, fail_with, on_handshake](const error_code& ec,
+                                                      const tcp::endpoint&) {
+        if (ec) {
+            return fail_with(ec);
+        }
+        apply_socket_options(self->stream_.next_layer().native_handle(),
+                             self->sockets_);
+        self->dns_hold_ = default_dns_cache().hold(self->host_.host, self->host_.port);
+
+        // Offering http/1.1 as well keeps servers which are strict about
+        // ALPN from failing the handshake when they don't speak h2
+        static const unsigned char alpn[] = {
+                2, 'h', '2',
+                8, 'h', 't', 't', 'p', '/', '1', '.', '1'
+        };
+        auto ssl = self->stream_.native_handle();
+        if (!SSL_set_tlsext_host_name(ssl, self->host_.host.c_str()) ||
+            SSL_set_alpn_protos(ssl, alpn, sizeof(alpn)) != 0) {
+            return self->fail(std::make_exception_ptr(std::runtime_error{
+                    fmt::format("Could not set up TLS for \"{}\"",
+                                self->host_.host)}));
+        }
+        self->stream_.set_verify_mode(asio::ssl::verify_peer);
+        self->stream_.set_verify_callback(
+                asio::ssl::host_name_verification{self->host_.host});
+        default_session_cache().prepare(ssl, self->host_);
+        self->stream_.async_handshake(tls_stream::client,
+                                      asio::bind_executor(self->strand_, on_handshake));
+    };
+
+    auto on_resolve = [self, fail_with, on_connect](const error_code& ec,
+                                                    dns_cache::endpoints results) {
+        if (ec) {
+            return fail_with(ec);
+        }
+        asio::async_connect(self->stream_.next_layer(), results,
+                            asio::bind_executor(self->strand_, on_connect));
+    };
+
+    default_dns_cache().async_resolve(resolver_, host_.host, host_.port,
+                                      asio::bind_executor(strand_, on_resolve));
+}
+
+void http2_connection::on_handshake()
+{
+    default_session_cache().handshake_done(stream_.native_handle());
+
+    const unsigned char* proto = nullptr;
+    unsigned int length = 0;
+    SSL_get0_alpn_selected(stream_.native_handle(), &proto, &length);
+
+    if (length != 2 || std::memcmp(proto, "h2", 2) != 0) {
+        // Nothing has been sent, so everything can go over HTTP/1.1 instead
+        close();
+        hooks_.not_supported();
+        auto queued = std::move(queued_);
+        queued_.clear();
+        for (auto& p : queued) {
+            resubmit(p);
+        }
+        return notify_ready();
+    }
+
+    out_.append(preface, sizeof(preface) - 1);
+
+    auto settings = std::string{};
+    append_setting(settings, settings_enable_push, 0);
+    append_setting(settings, settings_initial_window_size, receive_window);
+    write_frame(frame_settings, 0, 0, settings.data(), settings.size());
+    write_window_update(0, receive_window - default_window);
+
+    state_ = state::open;
+    open_streams();
+    flush();
+    read();
+    notify_ready();
+}
+
+void http2_connection::resubmit(pending& p)
+{
+    p.token.remove_callback(p.cancel_slot);
+    hooks_.resubmit(std::move(p.req), std::move(p.handler), p.token);
+}
+
+void http2_connection::retire()
+{
+    usable_ = false;
+    goaway_ = true;
+    auto queued = std::move(queued_);
+    queued_.clear();
+    for (auto& p : queued) {
+        resubmit(p);
+    }
+}
+
+void http2_connection::when_ready(std::function<void()> fn)
+{
+    auto self = shared_from_this();
+    asio::post(strand_, [self, fn = std::move(fn)]() mutable {
+        if (self->state_ == state::connecting) {
+            return self->ready_waiters_.push_back(std::move(fn));
+        }
+        fn();
+    });
+}
+
+void http2_connection::notify_ready()
+{
+    auto waiters = std::move(ready_waiters_);
+    ready_waiters_.clear();
+    for (auto& fn : waiters) {
+        fn();
+    }
+}
+
+void http2_connection::async_send(http::request req,
+                                  http::response_handler handler,
+                                  const cancellation_token& token)
+{
+    auto self = shared_from_this();
+    const auto tag = next_tag_++;
+
+    auto p = pending{};
+    p.req = std::move(req);
+    p.handler = std::move(handler);
+    p.token = token;
+    p.tag = tag;
+    p.cancel_slot = token.on_cancel([weak = std::weak_ptr<http2_connection>{self}, tag] {
+        if (const auto self = weak.lock()) {
+            asio::post(self->strand_, [self, tag] { self->cancel_request(tag); });
+        }
+    });
+
+    asio::post(strand_, [self, p = std::move(p)]() mutable {
+        if (self->state_ == state::closed || self->goaway_) {
+            return self->resubmit(p);
+        }
+        self->queued_.push_back(std::move(p));
+        if (self->state_ == state::open) {
+            self->open_streams();
+            self->flush();
+        }
+    });
+}
+
+void http2_connection::open_streams()
+{
+    while (!queued_.empty() && streams_.size() < max_concurrent_streams_) {
+        if (next_stream_id_ > 0x7fffffff) {
+            // Out of stream ids, so this connection has to be retired
+            return retire();
+        }
+        auto p = std::move(queued_.front());
+        queued_.pop_front();
+        start_stream(std::move(p));
+    }
+}
+
+void http2_connection::start_stream(pending p)
+{
+    const auto id = next_stream_id_;
+    next_stream_id_ += 2;
+
+    const auto& uri = p.req.uri;
+    const bool default_port = uri.port == "443";
+
+    auto headers = std::vector<http::header>{
+            {":method",    p.req.method},
+            {":scheme",    "https"},
+            {":authority", default_port ? uri.host : uri.host + ":" + uri.port},
+            {":path",      uri.target}
+    };
+
+    auto add = [&headers](const std::vector<http::header>& from) {
+        for (const auto& h : from) {
+            auto name = lower(h.name);
+            if (!is_connection_header(name)) {
+                headers.push_back({std::move(name), h.value});
+            }
+        }
+    };
+    if (p.req.common) {
+        add(p.req.common->headers);
+    }
+    add(p.req.headers);
+
+    if (!p.req.body.empty() || p.req.method == "POST") {
+        headers.push_back({"content-length", std::to_string(p.req.body.size())});
+    }
+
+    auto block = std::string{};
+    encoder_.encode(block, headers);
+
+    const bool has_body = !p.req.body.empty();
+    std::size_t offset = 0;
+    do {
+        const auto n = std::min(block.size() - offset, max_frame_size_);
+        const bool last = offset + n == block.size();
+        std::uint8_t flags = last ? flag_end_headers : 0;
+        if (offset == 0 && !has_body) {
+            flags |= flag_end_stream;
+        }
+        write_frame(offset == 0 ? frame_headers : frame_continuation,
+                    flags, id, block.data() + offset, n);
+        offset += n;
+    } while (offset < block.size());
+
+    auto& s = streams_[id];
+    s.request = std::move(p);
+    s.send_window = initial_window_;
+
+    if (has_body) {
+        send_body(id, s);
+    }
+}
+
+void http2_connection::send_body(std::uint32_t id, stream& s)
+{
+    const auto& body = s.request.req.body;
+
+    while (s.body_sent < body.size()) {
+        const auto window = std::min(conn_send_window_, s.send_window);
+        if (window <= 0) {
+            // Carry on when the server sends a WINDOW_UPDATE
+            return;
+        }
+
+        const auto n = std::min({body.size() - s.body_sent, max_frame_size_,
+                                 static_cast<std::size_t>(window)});
+        const bool last = s.body_sent + n == body.size();
+        write_frame(frame_data, last ? flag_end_stream : 0, id,
+                    body.data() + s.body_sent, n);
+
+        s.body_sent += n;
+        s.send_window -= n;
+        conn_send_window_ -= n;
+    }
+}
+
+void http2_connection::write_frame(std::uint8_t type, std::uint8_t flags,
+                                   std::uint32_t id,
+                                   const char* data, std::size_t size)
+{
+    out_ += char(size >> 16);
+    out_ += char(size >> 8);
+    out_ += char(size);
+    out_ += char(type);
+    out_ += char(flags);
+    append_u32(out_, id & 0x7fffffff);
+    out_.append(data, size);
+}
+
+void http2_connection::write_window_update(std::uint32_t id,
+                                           std::size_t increment)
+{
+    auto payload = std::string{};
+    append_u32(payload, static_cast<std::uint32_t>(increment));
+    write_frame(frame_window_update, 0, id, payload.data(), payload.size());
+}
+
+void http2_connection::flush()
+{
+    if (write_in_progress_ || out_.empty() || state_ != state::open) {
+        return;
+    }
+
+    write_in_progress_ = true;
+    writing_.swap(out_);
+    out_.clear();
+
+    auto self = shared_from_this();
+    asio::async_write(stream_, asio::buffer(writing_),
+                      asio::bind_executor(strand_, [self](const error_code& ec,
+                                                          std::size_t) {
+        self->write_in_progress_ = false;
+        self->writing_.clear();
+        if (ec) {
+            return self->fail(std::make_exception_ptr(boost::system::system_error{ec}));
+        }
+        self->flush();
+    }));
+}
+
+void http2_connection::read()
+{
+    auto self = shared_from_this();
+    stream_.async_read_some(asio::buffer(read_buf_),
+                            asio::bind_executor(strand_, [self](const error_code& ec,
+                                                                std::size_t n) {
+        if (self->state_ == state::closed) {
+            return;
+        }
+        if (ec) {
+            return self->fail(std::make_exception_ptr(boost::system::system_error{ec}));
+        }
+        rearm_quick_ack(self->stream_.next_layer().native_handle(), self->sockets_);
+
+        self->in_.insert(self->in_.end(), self->read_buf_.data(),
+                         self->read_buf_.data() + n);
+        try {
+            self->process_input();
+        } catch (...) {
+            return self->fail(std::current_exception());
+        }
+
+        if (self->state_ == state::open) {
+            self->flush();
+            self->read();
+        }
+    }));
+}
+
+void http2_connection::process_input()
+{
+    std::size_t pos = 0;
+
+    while (in_.size() - pos >= 9 && state_ == state::open) {
+        const auto* h = in_.data() + pos;
+        const std::size_t size = h[0] << 16 | h[1] << 8 | h[2];
+
+        if (size > max_receive_frame) {
+            throw protocol_error("frame too large");
+        }
+        if (in_.size() - pos < 9 + size) {
+            break;
+        }
+
+        handle_frame(h[3], h[4], read_u32(h + 5) & 0x7fffffff, h + 9, size);
+        pos += 9 + size;
+    }
+
+    in_.erase(in_.begin(), in_.begin() + pos);
+}
+
+void http2_connection::handle_frame(std::uint8_t type, std::uint8_t flags,
+                                    std::uint32_t id,
+                                    const std::uint8_t* payload,
+                                    std::size_t size)
+{
+    if (continuation_stream_ != 0 &&
+        (type != frame_continuation || id != continuation_stream_)) {
+        throw protocol_error("expected CONTINUATION");
+    }
+
+    switch (type) {
+    case frame_data:
+        return on_data(flags, id, payload, size);
+    case frame_headers:
+        return on_headers(flags, id, payload, size);
+    case frame_continuation:
+        if (continuation_stream_ == 0) {
+            throw protocol_error("unexpected CONTINUATION");
+        }
+        header_block_.append(reinterpret_cast<const char*>(payload), size);
+        if (flags & flag_end_headers) {
+            continuation_stream_ = 0;
+            on_header_block(id, continuation_end_stream_);
+        }
+        return;
+    case frame_rst_stream:
+        return on_rst_stream(id, payload, size);
+    case frame_settings:
+        return on_settings(flags, payload, size);
+    case frame_push_promise:
+        throw protocol_error("server push was disabled");
+    case frame_ping:
+        if (size != 8) {
+            throw protocol_error("bad PING");
+        }
+        if (!(flags & flag_ack)) {
+            write_frame(frame_ping, flag_ack, 0,
+                        reinterpret_cast<const char*>(payload), size);
+        }
+        return;
+    case frame_goaway:
+        return on_goaway(payload, size);
+    case frame_window_update:
+        return on_window_update(id, payload, size);
+    default:
+        // PRIORITY and unknown frame types are ignored
+        return;
+    }
+}
+
+void http2_connection::on_data(std::uint8_t flags, std::uint32_t id,
+                               const std::uint8_t* payload, std::size_t size)
+{
+    if (id == 0) {
+        throw protocol_error("DATA on stream 0");
+    }
+
+    // Padding counts towards flow control too
+    conn_recv_unacked_ += size;
+    if (conn_recv_unacked_ >= receive_window / 2) {
+        write_window_update(0, conn_recv_unacked_);
+        conn_recv_unacked_ = 0;
+    }
+
+    const auto it = streams_.find(id);
+    if (it == streams_.end()) {
+        // Probably a stream we've given up on
+        return;
+    }
+    auto& s = it->second;
+
+    const auto frame_size = size;
+    strip_padding(flags, payload, size);
+    const auto data = reinterpret_cast<const char*>(payload);
+    if (!s.inflater.active()) {
+        s.response.body.append(data, size);
+    } else {
+        try {
+            s.inflater.decode(data, size, s.response.body);
+        } catch (...) {
+            // Only this stream is affected, the connection is fine
+            return reset_stream(id, std::current_exception());
+        }
+    }
+
+    if (flags & flag_end_stream) {
+        return finish_stream(id);
+    }
+
+    s.recv_unacked += frame_size;
+    if (s.recv_unacked >= receive_window / 2) {
+        write_window_update(id, s.recv_unacked);
+        s.recv_unacked = 0;
+    }
+}
+
+void http2_connection::on_headers(std::uint8_t flags, std::uint32_t id,
+                                  const std::uint8_t* payload, std::size_t size)
+{
+    if (id == 0) {
+        throw protocol_error("HEADERS on stream 0");
+    }
+
+    strip_padding(flags, payload, size);
+    if (flags & flag_priority) {
+        if (size < 5) {
+            throw protocol_error("bad HEADERS");
+        }
+        payload += 5;
+        size -= 5;
+    }
+
+    header_block_.assign(reinterpret_cast<const char*>(payload), size);
+
+    if (flags & flag_end_headers) {
+        on_header_block(id, flags & flag_end_stream);
+    } else {
+        continuation_stream_ = id;
+        continuation_end_stream_ = flags & flag_end_stream;
+    }
+}
+
+void http2_connection::on_header_block(std::uint32_t id, bool end_stream)
+{
+    // Always decode, even for streams we've forgotten about, to keep the
+    // decoder's table in step with the server's
+    auto headers = decoder_.decode(
+            reinterpret_cast<const std::uint8_t*>(header_block_.data()),
+            header_block_.size());
+    header_block_.clear();
+
+    const auto it = streams_.find(id);
+    if (it == streams_.end()) {
+        return;
+    }
+    auto& s = it->second;
+
+    // Anything after the final response headers is trailers, which we
+    // have no use for
+    if (!s.headers_done) {
+        for (auto& h : headers) {
+            if (h.name == ":status") {
+                s.response.status = std::stoi(h.value);
+            } else if (h.name.empty() || h.name[0] != ':') {
+                s.response.headers.push_back(std::move(h));
+            }
+        }
+
+        if (s.response.status >= 100 && s.response.status < 200) {
+            s.response = {};
+        } else {
+            s.headers_done = true;
+            if (const auto coding = http::find_header(s.response.headers,
+                                                      "content-encoding")) {
+                s.inflater.start(*coding);
+            }
+            if (const auto length = http::find_header(s.response.headers,
+                                                      "content-length")) {
+                // Compressed JSON typically expands by a factor of five or
+                // more, but past the usual size the body grows as it
+                // arrives rather than trusting the server
+                auto expected = http::parse_length(*length);
+                if (s.inflater.active() &&
+                    expected <= std::numeric_limits<std::size_t>::max() / 4) {
+                    expected *= 4;
+                }
+                s.response.body.reserve(http::body_reserve(
+                        expected, s.request.req.response_size_hint));
+            }
+        }
+    }
+
+    if (end_stream) {
+        finish_stream(id);
+    }
+}
+
+void http2_connection::on_settings(std::uint8_t flags,
+                                   const std::uint8_t* payload,
+                                   std::size_t size)
+{
+    if (flags & flag_ack) {
+        return;
+    }
+    if (size % 6 != 0) {
+        throw protocol_error("bad SETTINGS");
+    }
+
+    bool refuses_streams = false;
+
+    for (std::size_t i = 0; i < size; i += 6) {
+        const auto id = std::uint16_t(payload[i] << 8 | payload[i + 1]);
+        const auto value = read_u32(payload + i + 2);
+
+        switch (id) {
+        case settings_header_table_size:
+            encoder_.set_max_table_size(value);
+            break;
+        case settings_max_concurrent_streams:
+            max_concurrent_streams_ = value;
+            refuses_streams = value == 0;
+            break;
+        case settings_initial_window_size: {
+            if (value > 0x7fffffff) {
+                throw protocol_error("window too large");
+            }
+            const auto delta = std::int64_t(value) - initial_window_;
+            for (auto& s : streams_) {
+                s.second.send_window += delta;
+            }
+            initial_window_ = value;
+            break;
+        }
+        case settings_max_frame_size:
+            if (value < 16384 || value > 16777215) {
+                throw protocol_error("bad max frame size");
+            }
+            max_frame_size_ = value;
+            break;
+        default:
+            break;
+        }
+    }
+
+    write_frame(frame_settings, flag_ack, 0, nullptr, 0);
+
+    for (auto& s : streams_) {
+        send_body(s.first, s.second);
+    }
+
+    if (refuses_streams) {
+        // Nothing queued here would ever be sent, so it goes to a new
+        // connection instead, and this one is closed once its streams
+        // have finished
+        retire();
+        if (streams_.empty()) {
+            close();
+        }
+        return;
+    }
+    open_streams();
+}
+
+void http2_connection::on_goaway(const std::uint8_t* payload, std::size_t size)
+{
+    if (size < 8) {
+        throw protocol_error("bad GOAWAY");
+    }
+
+    const auto last_id = read_u32(payload) & 0x7fffffff;
+    usable_ = false;
+    goaway_ = true;
+
+    // Streams above the last id were never processed, so can safely be
+    // retried elsewhere, as can anything which hadn't been sent yet
+    auto retry = std::vector<pending>{};
+    for (auto it = streams_.upper_bound(last_id); it != streams_.end();) {
+        retry.push_back(std::move(it->second.request));
+        it = streams_.erase(it);
+    }
+    std::move(queued_.begin(), queued_.end(), std::back_inserter(retry));
+    queued_.clear();
+
+    if (streams_.empty()) {
+        close();
+    }
+
+    for (auto& p : retry) {
+        resubmit(p);
+    }
+}
+
+void http2_connection::on_rst_stream(std::uint32_t id,
+                                     const std::uint8_t* payload,
+                                     std::size_t size)
+{
+    if (size != 4) {
+        throw protocol_error("bad RST_STREAM");
+    }
+
+    const auto it = streams_.find(id);
+    if (it == streams_.end()) {
+        return;
+    }
+
+    auto p = std::move(it->second.request);
+    streams_.erase(it);
+
+    const auto code = read_u32(payload);
+    if (code == refused_stream) {
+        resubmit(p);
+    } else {
+        p.finish(std::make_exception_ptr(std::runtime_error{
+                          fmt::format("Request for \"{}\" was reset by the server, "
+                                      "error code {}", p.req.uri.target, code)}),
+                  {});
+    }
+
+    open_streams();
+}
+
+void http2_connection::on_window_update(std::uint32_t id,
+                                        const std::uint8_t* payload,
+                                        std::size_t size)
+{
+    if (size != 4) {
+        throw protocol_error("bad WINDOW_UPDATE");
+    }
+
+    const auto increment = read_u32(payload) & 0x7fffffff;
+
+    if (id == 0) {
+        conn_send_window_ += increment;
+        for (auto& s : streams_) {
+            send_body(s.first, s.second);
+        }
+    } else {
+        const auto it = streams_.find(id);
+        if (it != streams_.end()) {
+            it->second.send_window += increment;
+            send_body(id, it->second);
+        }
+    }
+}
+
+void http2_connection::finish_stream(std::uint32_t id)
+{
+    const auto it = streams_.find(id);
+    auto p = std::move(it->second.request);
+    auto response = std::move(it->second.response);
+    streams_.erase(it);
+
+    response.keep_alive = true;
+    p.finish(nullptr, std::move(response));
+
+    if (goaway_ && streams_.empty()) {
+        close();
+    } else {
+        open_streams();
+    }
+}
+
+void http2_connection::reset_stream(std::uint32_t id, std::exception_ptr error)
+{
+    const auto it = streams_.find(id);
+    auto p = std::move(it->second.request);
+    streams_.erase(it);
+
+    auto payload = std::string{};
+    append_u32(payload, cancel);
+    write_frame(frame_rst_stream, 0, id, payload.data(), payload.size());
+
+    p.finish(error, {});
+    open_streams();
+}
+
+void http2_connection::cancel_request(std::uint64_t tag)
+{
+    for (auto it = queued_.begin(); it != queued_.end(); ++it) {
+        if (it->tag == tag) {
+            auto p = std::move(*it);
+            queued_.erase(it);
+            return p.finish(cancelled_error(p.req), {});
+        }
+    }
+
+    for (const auto& s : streams_) {
+        if (s.second.request.tag == tag) {
+            reset_stream(s.first, cancelled_error(s.second.request.req));
+            return flush();
+        }
+    }
+}
+
+void http2_connection::fail(std::exception_ptr error)
+{
+    const bool was_open = state_ == state::open;
+    close();
+
+    auto streams = std::move(streams_);
+    auto queued = std::move(queued_);
+    streams_.clear();
+    queued_.clear();
+
+    for (auto& s : streams) {
+        s.second.request.finish(error, {});
+    }
+
+    // If we never managed to connect then neither would a new connection,
+    // otherwise the queued requests can be given another chance
+    for (auto& p : queued) {
+        if (was_open) {
+            resubmit(p);
+        } else {
+            p.finish(error, {});
+        }
+    }
+
+    notify_ready();
+}
+
+void http2_connection::close()
+{
+    if (state_ == state::closed) {
+        return;
+    }
+    state_ = state::closed;
+    usable_ = false;
+
+    auto ec = error_code{};
+    stream_.next_layer().close(ec);
+}
+
+http2_transport::http2_transport(io_runner& io, transport& fallback)
+        : io_(io),
+          fallback_(fallback),
+          ssl_{asio::ssl::context::tls_client}
+{
+    ssl_.set_default_verify_paths();
+    default_session_cache().attach(ssl_);
+}
+
+auto http2_transport::send(const http::request& req) -> http::response
+{
+    if (!connection_for(req.uri)) {
+        return fallback_.send(req);
+    }
+
+    auto promise = std::make_shared<std::promise<http::response>>();
+    auto future = promise->get_future();
+    async_send(req, [promise](std::exception_ptr error, http::response response) {
+        if (error) {
+            promise->set_exception(error);
+        } else {
+            promise->set_value(std::move(response));
+        }
+    }, cancellation_token::never());
+
+    return future.get();
+}
+
+auto http2_transport::send_pipelined(const std::vector<http::request>& reqs)
+        -> std::vector<http::response>
+{
+    if (reqs.empty() || !connection_for(reqs.front().uri)) {
+        return fallback_.send_pipelined(reqs);
+    }
+
+    // No need to pipeline, just send them all at once as separate streams
+    auto futures = std::vector<std::future<http::response>>{};
+    futures.reserve(reqs.size());
+
+    for (const auto& req : reqs) {
+        auto promise = std::make_shared<std::promise<http::response>>();
+        futures.push_back(promise->get_future());
+        async_send(req, [promise](std::exception_ptr error, http::response response) {
+            if (error) {
+                promise->set_exception(error);
+            } else {
+                promise->set_value(std::move(response));
+            }
+        }, cancellation_token::never());
+    }
+
+    // Wait for all of them before reporting any error
+    for (auto& f : futures) {
+        f.wait();
+    }
+
+    auto responses = std::vector<http::response>{};
+    responses.reserve(reqs.size());
+    for (auto& f : futures) {
+        responses.push_back(f.get());
+    }
+
+    return responses;
+}
+
+auto http2_transport::send_batch(const std::vector<http::request>& reqs)
+        -> std::vector<result<http::response>>
+{
+    if (reqs.empty() || !connection_for(reqs.front().uri)) {
+        return fallback_.send_batch(reqs);
+    }
+
+    // Each request is its own stream, and they all go out together anyway
+    return transport::send_batch(reqs);
+}
+
+void http2_transport::async_send(http::request req,
+                                 http::response_handler handler,
+                                 const cancellation_token& token)
+{
+    if (token.is_cancelled()) {
+        return handler(cancelled_error(req), {});
+    }
+
+    const auto conn = connection_for(req.uri);
+
+    if (!conn) {
+        return fallback_.async_send(std::move(req), std::move(handler), token);
+    }
+
+    conn->async_send(std::move(req), std::move(handler), token);
+}
+
+void http2_transport::async_warm_up(const http::url& host, int connections,
+                                    std::function<void()> done)
+{
+    const auto conn = connection_for(host);
+    if (!conn) {
+        return fallback_.async_warm_up(host, connections, std::move(done));
+    }
+
+    // The handshake may reveal that the host only speaks HTTP/1.1, in which
+    // case it's the fallback's connections which need warming
+    conn->when_ready([this, host, connections, done = std::move(done)]() mutable {
+        bool http1_only = false;
+        {
+            std::lock_guard<std::mutex> lock{mutex_};
+            http1_only = hosts_[host_key(host)].http1_only;
+        }
+        if (http1_only) {
+            return fallback_.async_warm_up(host, connections, std::move(done));
+        }
+        done();
+    });
+}
+
+auto http2_transport::connection_for(const http::url& host)
+        -> std::shared_ptr<http2_connection>
+{
+    if (host.scheme != "https") {
+        return nullptr;
+    }
+
+    const auto key = host_key(host);
+
+    std::lock_guard<std::mutex> lock{mutex_};
+    auto& state = hosts_[key];
+
+    if (state.http1_only) {
+        return nullptr;
+    }
+
+    if (!state.conn || !state.conn->usable()) {
+        io_.start();
+
+        auto h = http2_connection::hooks{};
+        h.not_supported = [this, key] {
+            std::lock_guard<std::mutex> lock{mutex_};
+            hosts_[key].http1_only = true;
+        };
+        h.resubmit = [this](http::request req, http::response_handler handler,
+                            cancellation_token token) {
+            async_send(std::move(req), std::move(handler), token);
+        };
+
+        state.conn = std::make_shared<http2_connection>(io_.context(), ssl_,
+                                                        host, std::move(h),
+                                                        get_pool_options().socket);
+        state.conn->start();
+    }
+
+    return state.conn;
+}
+
+auto default_http2() -> http2_transport&
+{
+    static http2_transport transport{default_io(), default_pool()};
+    return transport;
+}
+
+} // end namespace net
+} // end namespace stockfighter
@@ -0,0 +1,227 @@
+#pragma once
+
+#include "hpack.hpp"
+#include "http.hpp"
+#include "io_runner.hpp"
+#include "transport.hpp"
+
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/ssl/context.hpp>
+#include <boost/asio/ssl/stream.hpp>
+#include <boost/asio/strand.hpp>
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace stockfighter {
+namespace net {
+
+// A single HTTP/2 connection over TLS, carrying any number of concurrent
+// requests as separate streams. All of the connection's state is only
+// touched from its strand.
+class http2_connection : public std::enable_shared_from_this<http2_connection> {
+public:
+    struct hooks {
+        // Called if the server does not negotiate HTTP/2
+        std::function<void()> not_supported;
+        // Called with requests which the server never processed, and which
+        // should be sent again on another connection
+        std::function<void(http::request, http::response_handler,
+                           cancellation_token)> resubmit;
+    };
+
+    http2_connection(boost::asio::io_context& io,
+                     boost::asio::ssl::context& ssl,
+                     const http::url& host,
+                     hooks h,
+                     const socket_options& sockets = {});
+
+    // Begins connecting. Requests sent before the connection is ready are
+    // queued until it is.
+    void start();
+
+    void async_send(http::request req, http::response_handler handler,
+                    const cancellation_token& token);
+
+    // Calls fn once the connection is open, or has failed
+    void when_ready(std::function<void()> fn);
+
+    // False once the connection has failed or the server has asked us to
+    // go away, at which point new requests should use a new connection
+    bool usable() const { return usable_; }
+
+private:
+    enum class state {
+        connecting,
+        open,
+        closed
+    };
+
+    struct pending {
+        http::request req;
+        http::response_handler handler;
+        cancellation_token token;
+        // Identifies the request if it is cancelled
+        std::uint64_t tag = 0;
+        // This connection's callback on the token
+        cancellation_token::callback_id cancel_slot = 0;
+
+        // Calls the handler, once the cancellation callback is out of the
+        // way
+        void finish(std::exception_ptr error, http::response response)
+        {
+            token.remove_callback(cancel_slot);
+            handler(error, std::move(response));
+        }
+    };
+
+    struct stream {
+        pending request;
+        http::response response;
+        http::inflater inflater;
+        bool headers_done = false;
+        std::size_t body_sent = 0;
+        std::int64_t send_window = 0;
+        std::size_t recv_unacked = 0;
+    };
+
+    void on_handshake();
+    void notify_ready();
+    // Hands the request back to the transport to go on another connection
+    void resubmit(pending& p);
+    // Takes no more requests, handing back those which haven't been sent
+    void retire();
+
+    void open_streams();
+    void start_stream(pending p);
+    void send_body(std::uint32_t id, stream& s);
+
+    void write_frame(std::uint8_t type, std::uint8_t flags, std::uint32_t id,
+                     const char* data, std::size_t size);
+    void write_window_update(std::uint32_t id, std::size_t increment);
+    void flush();
+
+    void read();
+    void process_input();
+    void handle_frame(std::uint8_t type, std::uint8_t flags, std::uint32_t id,
+                      const std::uint8_t* payload, std::size_t size);
+    void on_data(std::uint8_t flags, std::uint32_t id,
+                 const std::uint8_t* payload, std::size_t size);
+    void on_headers(std::uint8_t flags, std::uint32_t id,
+                    const std::uint8_t* payload, std::size_t size);
+    void on_header_block(std::uint32_t id, bool end_stream);
+    void on_settings(std::uint8_t flags, const std::uint8_t* payload,
+                     std::size_t size);
+    void on_goaway(const std::uint8_t* payload, std::size_t size);
+    void on_rst_stream(std::uint32_t id, const std::uint8_t* payload,
+                       std::size_t size);
+    void on_window_update(std::uint32_t id, const std::uint8_t* payload,
+                          std::size_t size);
+
+    void finish_stream(std::uint32_t id);
+    // Abandons a single stream, telling the server to stop sending it
+    void reset_stream(std::uint32_t id, std::exception_ptr error);
+    void cancel_request(std::uint64_t tag);
+
+    // Fails every request in progress and gives the queued ones to
+    // another connection
+    void fail(std::exception_ptr error);
+    void close();
+
+    using tls_stream = boost::asio::ssl::stream<boost::asio::ip::tcp::socket>;
+
+    boost::asio::strand<boost::asio::io_context::executor_type> strand_;
+    boost::asio::ip::tcp::resolver resolver_;
+    // Keeps the host in the DNS cache while the connection is open
+    std::shared_ptr<const void> dns_hold_;
+    tls_stream stream_;
+    http::url host_;
+    hooks hooks_;
+    socket_options sockets_;
+
+    std::atomic<bool> usable_{true};
+    state state_ = state::connecting;
+    bool goaway_ = false;
+
+    std::deque<pending> queued_;
+    std::vector<std::function<void()>> ready_waiters_;
+    std::map<std::uint32_t, stream> streams_;
+    std::uint32_t next_stream_id_ = 1;
+    std::atomic<std::uint64_t> next_tag_{1};
+
+    // Settings received from the server
+    std::size_t max_concurrent_streams_ = 100;
+    std::int64_t initial_window_ = 65535;
+    std::size_t max_frame_size_ = 16384;
+
+    std::int64_t conn_send_window_ = 65535;
+    std::size_t conn_recv_unacked_ = 0;
+
+    hpack::encoder encoder_;
+    hpack::decoder decoder_;
+
+    // A header block split over HEADERS and CONTINUATION frames
+    std::uint32_t continuation_stream_ = 0;
+    bool continuation_end_stream_ = false;
+    std::string header_block_;
+
+    std::string out_;
+    std::string writing_;
+    bool write_in_progress_ = false;
+
+    std::vector<std::uint8_t> in_;
+    std::array<char, 16384> read_buf_;
+};
+
+// Transport which multiplexes all of the requests for a host over one
+// HTTP/2 connection. Hosts which don't support HTTP/2, and anything which
+// isn't https, go to the fallback transport instead.
+class http2_transport : public transport {
+public:
+    http2_transport(io_runner& io, transport& fallback);
+
+    auto send(const http::request& req) -> http::response override;
+
+    auto send_pipelined(const std::vector<http::request>& reqs)
+            -> std::vector<http::response> override;
+
+    void async_send(http::request req,
+                    http::response_handler handler,
+                    const cancellation_token& token) override;
+
+    auto send_batch(const std::vector<http::request>& reqs)
+            -> std::vector<result<http::response>> override;
+
+    // Only one connection is ever needed for HTTP/2, so the count is only
+    // used if the host turns out to want HTTP/1.1
+    void async_warm_up(const http::url& host, int connections,
+                       std::function<void()> done) override;
+
+private:
+    struct host_state {
+        std::shared_ptr<http2_connection> conn;
+        bool http1_only = false;
+    };
+
+    // Returns the connection to use, or nullptr to use the fallback
+    auto connection_for(const http::url& host) -> std::shared_ptr<http2_connection>;
+
+    io_runner& io_;
+    transport& fallback_;
+    boost::asio::ssl::context ssl_;
+
+    std::mutex mutex_;
+    std::map<std::string, host_state> hosts_;
+};
+
+auto default_http2() -> http2_transport&;
+
+} // end namespace net
+} // end namespace stockfighter
@@ -0,0 +1,56 @@
+
+#include "io_runner.hpp"
+
+#include <stockfighter/net.hpp>
+
+#include <algorithm>
+
+namespace stockfighter {
+namespace net {
+
+io_runner::io_runner(int threads)
+        : work_{boost::asio::make_work_guard(io_)},
+          thread_count_{std::max(threads, 1)}
+{}
+
+io_runner::~io_runner()
+{
+    work_.reset();
+    io_.stop();
+    for (auto& t : threads_) {
+        t.join();
+    }
+}
+
+void io_runner::start()
+{
+    std::lock_guard<std::mutex> lock{mutex_};
+
+    if (!threads_.empty()) {
+        return;
+    }
+
+    for (int i = 0; i < thread_count_; ++i) {
+        threads_.emplace_back([this] { io_.run(); });
+    }
+}
+
+void io_runner::set_threads(int count)
+{
+    std::lock_guard<std::mutex> lock{mutex_};
+    thread_count_ = std::max(count, 1);
+}
+
+auto default_io() -> io_runner&
+{
+    static io_runner io;
+    return io;
+}
+
+void set_io_threads(int count)
+{
+    default_io().set_threads(count);
+}
+
+} // end namespace net
+} // end namespace stockfighter
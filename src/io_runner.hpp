@@ -0,0 +1,45 @@
+#pragma once
+
+#include <boost/asio/executor_work_guard.hpp>
+#include <boost/asio/io_context.hpp>
+
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace stockfighter {
+namespace net {
+
+// The io_context shared by the transports, and the threads which run it.
+// The threads are only started once something needs them, so purely
+// synchronous use of the library doesn't create any.
+class io_runner {
+public:
+    explicit io_runner(int threads = 2);
+
+    ~io_runner();
+
+    io_runner(const io_runner&) = delete;
+    io_runner& operator=(const io_runner&) = delete;
+
+    auto context() -> boost::asio::io_context& { return io_; }
+
+    // Starts the threads if they are not already running
+    void start();
+
+    // Only has an effect before the threads have been started
+    void set_threads(int count);
+
+private:
+    boost::asio::io_context io_;
+    boost::asio::executor_work_guard<boost::asio::io_context::executor_type> work_;
+
+    std::mutex mutex_;
+    std::vector<std::thread> threads_;
+    int thread_count_;
+};
+
+auto default_io() -> io_runner&;
+
+} // end namespace net
+} // end namespace stockfighter
@@ -0,0 +1,211 @@
+
+#include <stockfighter/monitor.hpp>
+#include "monitor.hpp"
+#include "cancellation.hpp"
+
+#include <stockfighter/api.hpp>
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <future>
+#include <memory>
+#include <stdexcept>
+
+namespace stockfighter {
+
+namespace {
+
+using clock = std::chrono::steady_clock;
+
+// Everything known about one venue. Readers only ever load these, so they
+// never wait for the monitor.
+struct slot {
+    std::string venue;
+    std::atomic<int> watchers{0};
+    std::atomic<bool> fail_fast{false};
+    std::atomic<bool> up{true};
+    std::atomic<int> failures{0};
+    std::atomic<std::int64_t> rtt_us{0};
+    std::atomic<clock::rep> last_success{0};
+};
+
+// Every venue which has ever been monitored has a slot. Slots are only
+// ever added, and a slot's name is written before the count which makes
+// it visible, so they can be searched without a lock.
+class registry {
+public:
+    auto find(const std::string& venue) -> slot*
+    {
+        const auto n = count_.load(std::memory_order_acquire);
+        for (std::size_t i = 0; i < n; ++i) {
+            if (slots_[i].venue == venue) {
+                return &slots_[i];
+            }
+        }
+        return nullptr;
+    }
+
+    auto add(const std::string& venue) -> slot&
+    {
+        std::lock_guard<std::mutex> lock{adding_};
+        if (const auto s = find(venue)) {
+            return *s;
+        }
+
+        const auto n = count_.load(std::memory_order_relaxed);
+        if (n == slots_.size()) {
+            throw std::runtime_error{"Too many venues to monitor"};
+        }
+        slots_[n].venue = venue;
+        count_.store(n + 1, std::memory_order_release);
+        return slots_[n];
+    }
+
+private:
+    std::array<slot, 64> slots_;
+    std::atomic<std::size_t> count_{0};
+    std::mutex adding_;
+};
+
+auto default_registry() -> registry&
+{
+    static registry r;
+    return r;
+}
+
+// Whether a failed heartbeat says anything about the venue. Only getting
+// no response at all, or a 5xx status, does: a request held back by the
+// rate limiter or the scheduler never reached it.
+bool venue_at_fault(std::exception_ptr error)
+{
+    try {
+        std::rethrow_exception(error);
+    } catch (const call_failed& e) {
+        return e.details.code == errc::no_response || e.details.status >= 500;
+    } catch (const net::rate_limited&) {
+        return false;
+    } catch (const net::timed_out_unsent&) {
+        return false;
+    } catch (const net::cancelled&) {
+        return false;
+    } catch (...) {
+        return true;
+    }
+}
+
+void record(slot& s, bool ok, clock::duration rtt, int failures_before_down)
+{
+    if (ok) {
+        s.rtt_us = std::chrono::duration_cast<std::chrono::microseconds>(rtt).count();
+        s.last_success = clock::now().time_since_epoch().count();
+        s.failures = 0;
+        s.up = true;
+    } else if (++s.failures >= failures_before_down) {
+        s.up = false;
+    }
+}
+
+} // end anonymous namespace
+
+venue_monitor::venue_monitor(std::vector<std::string> venues,
+                             const monitor_options& options)
+        : venues_(std::move(venues)),
+          options_(options)
+{
+    auto& reg = default_registry();
+    for (const auto& venue : venues_) {
+        reg.add(venue);
+    }
+    for (const auto& venue : venues_) {
+        auto& s = *reg.find(venue);
+        s.fail_fast = options_.fail_fast;
+        ++s.watchers;
+    }
+
+    thread_ = std::thread{[this] { run(); }};
+}
+
+venue_monitor::~venue_monitor()
+{
+    {
+        std::lock_guard<std::mutex> lock{mutex_};
+        stopping_ = true;
+    }
+    stop_.cancel();
+    wake_.notify_one();
+    thread_.join();
+
+    auto& reg = default_registry();
+    for (const auto& venue : venues_) {
+        --reg.find(venue)->watchers;
+    }
+}
+
+void venue_monitor::run()
+{
+    std::unique_lock<std::mutex> lock{mutex_};
+    while (!stopping_) {
+        lock.unlock();
+        check_all();
+        lock.lock();
+        wake_.wait_for(lock, options_.interval, [this] { return stopping_; });
+    }
+}
+
+void venue_monitor::check_all()
+{
+    auto opts = net::call_options{};
+    opts.timeout = options_.timeout;
+    opts.token = stop_;
+
+    // The heartbeats go out together, so one venue which is slow to answer
+    // doesn't hold up the others
+    auto answered = std::vector<std::future<void>>{};
+    answered.reserve(venues_.size());
+
+    for (const auto& venue : venues_) {
+        auto& s = *default_registry().find(venue);
+        auto done = std::make_shared<std::promise<void>>();
+        answered.push_back(done->get_future());
+
+        const auto sent = clock::now();
+        api::async_venue_heartbeat(venue, [this, &s, sent, done](std::exception_ptr error, bool) {
+            // Being shut down says nothing about the venue, and nor do
+            // failures on this side
+            if (!stop_.is_cancelled() && (!error || venue_at_fault(error))) {
+                record(s, !error, clock::now() - sent, options_.failures_before_down);
+            }
+            done->set_value();
+        }, opts);
+    }
+
+    for (auto& f : answered) {
+        f.wait();
+    }
+}
+
+auto get_venue_health(const std::string& venue) -> venue_health
+{
+    auto health = venue_health{};
+    if (const auto s = default_registry().find(venue)) {
+        health.monitored = s->watchers > 0;
+        health.up = s->up;
+        health.failures = s->failures;
+        health.rtt = std::chrono::microseconds{s->rtt_us.load()};
+        health.last_success = clock::time_point{clock::duration{s->last_success.load()}};
+    }
+    return health;
+}
+
+namespace detail {
+
+bool refuses_orders(const std::string& venue)
+{
+    const auto s = default_registry().find(venue);
+    return s && s->watchers > 0 && s->fail_fast && !s->up;
+}
+
+} // end namespace detail
+
+} // end namespace stockfighter
@@ -0,0 +1,13 @@
+#pragma once
+
+#include <string>
+
+namespace stockfighter {
+namespace detail {
+
+// True if orders for the venue should fail without being sent, because a
+// venue_monitor has found it to be down
+bool refuses_orders(const std::string& venue);
+
+} // end namespace detail
+} // end namespace stockfighter
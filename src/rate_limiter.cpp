@@ -0,0 +1,232 @@
+
+#include "rate_limiter.hpp"
+
+#include <algorithm>
+#include <future>
+
+namespace stockfighter {
+namespace net {
+
+namespace {
+
+void call_all(std::vector<rate_limiter::ready_handler>& ready,
+              std::vector<rate_limiter::ready_handler>& expired)
+{
+    for (auto& h : ready) {
+        h(nullptr);
+    }
+    for (auto& h : expired) {
+        h(std::make_exception_ptr(rate_limited{
+                "Request dropped by the rate limiter after waiting too long"}));
+    }
+}
+
+} // end anonymous namespace
+
+rate_limiter::rate_limiter(io_runner& io)
+        : io_(io),
+          timer_{io.context()},
+          tokens_{options_.burst}
+{}
+
+void rate_limiter::async_acquire(priority p, ready_handler handler, int tokens)
+{
+    auto ready = std::vector<ready_handler>{};
+    auto expired = std::vector<ready_handler>{};
+
+    {
+        std::lock_guard<std::mutex> lock{mutex_};
+
+        if (!options_.enabled) {
+            ready.push_back(std::move(handler));
+        } else {
+            const auto index = static_cast<std::size_t>(p);
+            const auto max_wait = options_.max_wait[index];
+            auto deadline = clock::time_point::max();
+            if (max_wait != std::chrono::milliseconds::max()) {
+                deadline = clock::now() + max_wait;
+            }
+            waiters_[index].push_back(waiter{std::move(handler), deadline,
+                                             std::max(tokens, 1)});
+            dispatch(ready, expired);
+        }
+    }
+
+    call_all(ready, expired);
+}
+
+void rate_limiter::acquire(priority p, int tokens)
+{
+    {
+        // Don't bother with the promise if we know we can go at once
+        std::lock_guard<std::mutex> lock{mutex_};
+        if (!options_.enabled) {
+            return;
+        }
+    }
+
+    auto promise = std::promise<void>{};
+    auto future = promise.get_future();
+    async_acquire(p, [&promise](std::exception_ptr error) {
+        if (error) {
+            promise.set_exception(error);
+        } else {
+            promise.set_value();
+        }
+    }, tokens);
+    future.get();
+}
+
+void rate_limiter::set_options(const rate_limit_options& options)
+{
+    auto ready = std::vector<ready_handler>{};
+    auto expired = std::vector<ready_handler>{};
+
+    {
+        std::lock_guard<std::mutex> lock{mutex_};
+        refill(clock::now());
+        options_ = options;
+        tokens_ = std::min(tokens_, options_.burst);
+
+        if (!options_.enabled) {
+            for (auto& queue : waiters_) {
+                for (auto& w : queue) {
+                    ready.push_back(std::move(w.handler));
+                }
+                queue.clear();
+            }
+        } else {
+            dispatch(ready, expired);
+        }
+    }
+
+    call_all(ready, expired);
+}
+
+auto rate_limiter::options() const -> rate_limit_options
+{
+    std::lock_guard<std::mutex> lock{mutex_};
+    return options_;
+}
+
+auto rate_limiter::budget() -> double
+{
+    std::lock_guard<std::mutex> lock{mutex_};
+    refill(clock::now());
+    return tokens_;
+}
+
+void rate_limiter::refill(clock::time_point now)
+{
+    const auto elapsed = std::chrono::duration<double>(now - last_refill_).count();
+    last_refill_ = now;
+    tokens_ = std::min(options_.burst,
+                       tokens_ + elapsed * options_.requests_per_second);
+}
+
+void rate_limiter::dispatch(std::vector<ready_handler>& ready,
+                            std::vector<ready_handler>& expired)
+{
+    const auto now = clock::now();
+    refill(now);
+
+    // Highest priority first. A class which can't go blocks everything
+    // below it, as their reserves are at least as large.
+    auto next_wake = clock::time_point::max();
+    bool blocked = false;
+
+    for (std::size_t i = 0; i < waiters_.size(); ++i) {
+        auto& queue = waiters_[i];
+        const auto reserve = options_.reserve[i];
+
+        while (!blocked && !queue.empty() &&
+               tokens_ - needed(queue.front(), reserve) >= reserve) {
+            tokens_ -= queue.front().tokens;
+            ready.push_back(std::move(queue.front().handler));
+            queue.pop_front();
+        }
+
+        if (queue.empty()) {
+            continue;
+        }
+
+        if (!blocked && options_.requests_per_second > 0) {
+            const auto missing = reserve + needed(queue.front(), reserve) - tokens_;
+            const auto wait = std::chrono::duration<double>(
+                    missing / options_.requests_per_second);
+            next_wake = std::min(next_wake,
+                                 now + std::chrono::duration_cast<clock::duration>(wait));
+        }
+        blocked = true;
+
+        for (auto it = queue.begin(); it != queue.end();) {
+            if (it->deadline <= now) {
+                expired.push_back(std::move(it->handler));
+                it = queue.erase(it);
+            } else {
+                next_wake = std::min(next_wake, it->deadline);
+                ++it;
+            }
+        }
+    }
+
+    if (next_wake == clock::time_point::max() ||
+        (timer_pending_ && timer_expiry_ <= next_wake)) {
+        return;
+    }
+
+    io_.start();
+    timer_pending_ = true;
+    timer_expiry_ = next_wake;
+    timer_.expires_at(next_wake);
+    timer_.async_wait([this](const boost::system::error_code& ec) {
+        if (ec != boost::asio::error::operation_aborted) {
+            on_timer();
+        }
+    });
+}
+
+auto rate_limiter::needed(const waiter& w, double reserve) const -> double
+{
+    // No more than the bucket can hold above the reserve, or a big batch
+    // would never go
+    return std::min<double>(w.tokens, std::max(options_.burst - reserve, 1.0));
+}
+
+void rate_limiter::on_timer()
+{
+    auto ready = std::vector<ready_handler>{};
+    auto expired = std::vector<ready_handler>{};
+
+    {
+        std::lock_guard<std::mutex> lock{mutex_};
+        timer_pending_ = false;
+        dispatch(ready, expired);
+    }
+
+    call_all(ready, expired);
+}
+
+auto default_rate_limiter() -> rate_limiter&
+{
+    static rate_limiter limiter{default_io()};
+    return limiter;
+}
+
+void set_rate_limit(const rate_limit_options& options)
+{
+    default_rate_limiter().set_options(options);
+}
+
+auto get_rate_limit() -> rate_limit_options
+{
+    return default_rate_limiter().options();
+}
+
+auto rate_limit_budget() -> double
+{
+    return default_rate_limiter().budget();
+}
+
+} // end namespace net
+} // end namespace stockfighter
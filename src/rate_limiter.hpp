@@ -0,0 +1,82 @@
+#pragma once
+
+#include "io_runner.hpp"
+
+#include <stockfighter/net.hpp>
+
+#include <boost/asio/steady_timer.hpp>
+
+#include <array>
+#include <chrono>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+
+namespace stockfighter {
+namespace net {
+
+// Token bucket shared by all requests. Each priority class may only take a
+// token while more than its reserve would be left behind, so the last few
+// tokens are kept for the more important requests. Requests which can't
+// go yet wait in priority order.
+class rate_limiter {
+public:
+    using clock = std::chrono::steady_clock;
+    using ready_handler = std::function<void(std::exception_ptr error)>;
+
+    explicit rate_limiter(io_runner& io);
+
+    // Calls the handler once the request may go, which may be straight
+    // away, or with a net::rate_limited error if it waited too long. A
+    // batch takes a token for each of its requests, all at once and with
+    // a single deadline, so it is never left with only some of them. A
+    // batch bigger than the bucket goes once the bucket is full, leaving
+    // it in debt.
+    void async_acquire(priority p, ready_handler handler, int tokens = 1);
+
+    // Blocks until the request may go, or throws net::rate_limited
+    void acquire(priority p, int tokens = 1);
+
+    void set_options(const rate_limit_options& options);
+
+    auto options() const -> rate_limit_options;
+
+    auto budget() -> double;
+
+private:
+    struct waiter {
+        ready_handler handler;
+        clock::time_point deadline;
+        int tokens;
+    };
+
+    // How many tokens must be in the bucket, beyond the reserve, for the
+    // waiter to go
+    auto needed(const waiter& w, double reserve) const -> double;
+
+    void refill(clock::time_point now);
+
+    // Lets through whichever waiters can go now and fails any which have
+    // run out of time. Must be called with the lock held, and the handlers
+    // collected must be called once it has been released.
+    void dispatch(std::vector<ready_handler>& ready,
+                  std::vector<ready_handler>& expired);
+
+    void on_timer();
+
+    io_runner& io_;
+    boost::asio::steady_timer timer_;
+    mutable std::mutex mutex_;
+    rate_limit_options options_;
+    double tokens_;
+    clock::time_point last_refill_ = clock::now();
+    std::array<std::deque<waiter>, priority_count> waiters_;
+    bool timer_pending_ = false;
+    clock::time_point timer_expiry_;
+};
+
+auto default_rate_limiter() -> rate_limiter&;
+
+} // end namespace net
+} // end namespace stockfighter
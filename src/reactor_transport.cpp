@@ -0,0 +1,850 @@
+
+#include "reactor_transport.hpp"
+
+#ifdef __linux__
+
+#include "cancellation.hpp"
+#include "session_cache.hpp"
+#include "socket_options.hpp"
+
+#include <boost/asio/error.hpp>
+#include <boost/system/system_error.hpp>
+
+#include <cppformat/format.h>
+
+#include <openssl/err.h>
+
+#include <netinet/in.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <future>
+#include <mutex>
+#include <stdexcept>
+
+namespace stockfighter {
+namespace net {
+
+namespace {
+
+auto system_error(int err) -> std::exception_ptr
+{
+    return std::make_exception_ptr(boost::system::system_error{
+            boost::system::error_code{err, boost::system::system_category()}});
+}
+
+auto tls_error(const char* what) -> std::exception_ptr
+{
+    char reason[256];
+    ERR_error_string_n(ERR_get_error(), reason, sizeof(reason));
+    return std::make_exception_ptr(std::runtime_error{
+            fmt::format("TLS {} failed: {}", what, reason)});
+}
+
+} // end anonymous namespace
+
+// Requests and cancellations on their way to the transport's thread. It
+// is only woken through the eventfd if it is waiting for events.
+struct reactor_transport::inbox {
+    int event_fd = -1;
+    std::mutex mutex;
+    std::vector<std::unique_ptr<operation>> ops;
+    // Operations which can be reused
+    std::vector<std::unique_ptr<operation>> spare;
+    std::vector<std::uint64_t> cancels;
+    std::uint64_t next_tag = 1;
+    bool sleeping = false;
+    bool woken = false;
+    bool stopping = false;
+
+    // Must be called with the mutex held
+    void wake()
+    {
+        if (sleeping && !woken && !stopping) {
+            const std::uint64_t one = 1;
+            (void) ::write(event_fd, &one, sizeof(one));
+            woken = true;
+        }
+    }
+};
+
+reactor_transport::reactor_transport(const pool_options& options, bool nonblocking)
+        : options_(options),
+          nonblocking_(nonblocking),
+          inbox_(std::make_shared<inbox>())
+{
+    inbox_->event_fd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (inbox_->event_fd < 0) {
+        std::rethrow_exception(system_error(errno));
+    }
+
+    ssl_ctx_ = SSL_CTX_new(TLS_client_method());
+    if (!ssl_ctx_) {
+        ::close(inbox_->event_fd);
+        std::rethrow_exception(tls_error("setup"));
+    }
+    SSL_CTX_set_default_verify_paths(ssl_ctx_);
+    SSL_CTX_set_verify(ssl_ctx_, SSL_VERIFY_PEER, nullptr);
+    default_session_cache().attach(ssl_ctx_);
+}
+
+reactor_transport::~reactor_transport()
+{
+    ::close(inbox_->event_fd);
+    SSL_CTX_free(ssl_ctx_);
+}
+
+void reactor_transport::start()
+{
+    thread_ = std::thread{[this] { run(); }};
+}
+
+void reactor_transport::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock{inbox_->mutex};
+        inbox_->wake();
+        inbox_->stopping = true;
+    }
+    thread_.join();
+
+    const auto error = std::make_exception_ptr(
+            std::runtime_error{"The transport was shut down"});
+
+    for (auto& op : inbox_->ops) {
+        op->finish(error, {});
+    }
+    inbox_->ops.clear();
+    while (!connections_.empty()) {
+        fail(*connections_.begin()->second, error);
+    }
+    for (auto& host : hosts_) {
+        for (auto& op : host.second.waiting) {
+            op->finish(error, {});
+        }
+        host.second.waiting.clear();
+    }
+}
+
+auto reactor_transport::wake_fd() const -> int
+{
+    return inbox_->event_fd;
+}
+
+auto reactor_transport::send(const http::request& req) -> http::response
+{
+    if (std::this_thread::get_id() == thread_.get_id()) {
+        throw std::logic_error{"Blocking request made from a transport callback"};
+    }
+
+    // The handler only captures a pointer, so neither it nor the result
+    // needs to be allocated
+    struct waiter {
+        std::mutex mutex;
+        std::condition_variable done;
+        bool finished = false;
+        std::exception_ptr error;
+        http::response response;
+    } w;
+
+    // Copied into a recycled request, whose storage is likely to be big
+    // enough already
+    auto op = new_operation();
+    op->req = req;
+    op->handler = [&w](std::exception_ptr error, http::response response) {
+        std::lock_guard<std::mutex> lock{w.mutex};
+        w.error = error;
+        w.response = std::move(response);
+        w.finished = true;
+        w.done.notify_one();
+    };
+    submit(std::move(op), cancellation_token::never());
+
+    std::unique_lock<std::mutex> lock{w.mutex};
+    w.done.wait(lock, [&w] { return w.finished; });
+    if (w.error) {
+        std::rethrow_exception(w.error);
+    }
+    return std::move(w.response);
+}
+
+auto reactor_transport::send_pipelined(const std::vector<http::request>& reqs)
+        -> std::vector<http::response>
+{
+    auto futures = std::vector<std::future<http::response>>{};
+    futures.reserve(reqs.size());
+
+    for (const auto& req : reqs) {
+        auto promise = std::make_shared<std::promise<http::response>>();
+        futures.push_back(promise->get_future());
+        async_send(req, [promise](std::exception_ptr error, http::response response) {
+            if (error) {
+                promise->set_exception(error);
+            } else {
+                promise->set_value(std::move(response));
+            }
+        }, cancellation_token::never());
+    }
+
+    // Wait for all of them before reporting any error
+    for (auto& f : futures) {
+        f.wait();
+    }
+
+    auto responses = std::vector<http::response>{};
+    responses.reserve(reqs.size());
+    for (auto& f : futures) {
+        responses.push_back(f.get());
+    }
+
+    return responses;
+}
+
+void reactor_transport::async_send(http::request req,
+                                   http::response_handler handler,
+                                   const cancellation_token& token)
+{
+    if (token.is_cancelled()) {
+        return handler(cancelled_error(req), {});
+    }
+
+    auto op = new_operation();
+    op->req = std::move(req);
+    op->handler = std::move(handler);
+    submit(std::move(op), token);
+}
+
+auto reactor_transport::new_operation() -> std::unique_ptr<operation>
+{
+    {
+        std::lock_guard<std::mutex> lock{inbox_->mutex};
+        if (!inbox_->spare.empty()) {
+            auto op = std::move(inbox_->spare.back());
+            inbox_->spare.pop_back();
+            op->tag = inbox_->next_tag++;
+            return op;
+        }
+    }
+
+    // Allocated outside the lock
+    auto op = std::make_unique<operation>();
+    std::lock_guard<std::mutex> lock{inbox_->mutex};
+    op->tag = inbox_->next_tag++;
+    return op;
+}
+
+void reactor_transport::submit(std::unique_ptr<operation> op,
+                               const cancellation_token& token)
+{
+    const auto tag = op->tag;
+
+    // The callback has to be in place before the reactor can finish the
+    // request and remove it
+    if (token.can_be_cancelled()) {
+        op->token = token;
+        op->cancel_slot = token.on_cancel([weak = std::weak_ptr<inbox>{inbox_}, tag] {
+            if (const auto in = weak.lock()) {
+                std::lock_guard<std::mutex> lock{in->mutex};
+                in->cancels.push_back(tag);
+                in->wake();
+            }
+        });
+    }
+
+    std::lock_guard<std::mutex> lock{inbox_->mutex};
+    inbox_->ops.push_back(std::move(op));
+    // A cancel which came in before the request did would have been
+    // ignored, so it's sent again behind it
+    if (token.is_cancelled()) {
+        inbox_->cancels.push_back(tag);
+    }
+    inbox_->wake();
+}
+
+void reactor_transport::recycle(std::unique_ptr<operation> op)
+{
+    // Enough to cover a full set of connections to a few hosts
+    constexpr std::size_t max_spare = 64;
+    if (spent_ops_.size() < max_spare) {
+        op->handler = nullptr;
+        op->token = cancellation_token::never();
+        op->cancel_slot = 0;
+        op->warm_up = 0;
+        spent_ops_.push_back(std::move(op));
+    }
+}
+
+void reactor_transport::resolve(std::unique_ptr<operation> op)
+{
+    std::thread{[weak = std::weak_ptr<inbox>{inbox_}, op = std::move(op)]() mutable {
+        try {
+            (void) default_dns_cache().resolve(op->req.uri.host, op->req.uri.port);
+        } catch (...) {
+            return op->finish(std::current_exception(), {});
+        }
+
+        // Now that the host is in the cache, this goes straight through
+        if (const auto in = weak.lock()) {
+            std::unique_lock<std::mutex> lock{in->mutex};
+            if (!in->stopping) {
+                in->ops.push_back(std::move(op));
+                in->wake();
+                return;
+            }
+        }
+        op->finish(std::make_exception_ptr(
+                std::runtime_error{"The transport was shut down"}), {});
+    }}.detach();
+}
+
+void reactor_transport::async_warm_up(const http::url& host, int connections,
+                                      std::function<void()> done)
+{
+    auto op = std::make_unique<operation>();
+    op->req.uri = host;
+    op->handler = [done = std::move(done)](std::exception_ptr, http::response) {
+        done();
+    };
+    op->warm_up = std::max(connections, 1);
+
+    std::lock_guard<std::mutex> lock{inbox_->mutex};
+    op->tag = inbox_->next_tag++;
+    inbox_->ops.push_back(std::move(op));
+    inbox_->wake();
+}
+
+void reactor_transport::run()
+{
+    while (true) {
+        take_inbox();
+        free_closed();
+
+        // Only sleep if nothing has arrived in the meantime; otherwise just
+        // pick up whatever events are ready and come straight back
+        bool block = false;
+        {
+            std::lock_guard<std::mutex> lock{inbox_->mutex};
+            if (inbox_->stopping) {
+                return;
+            }
+            block = inbox_->ops.empty() && inbox_->cancels.empty();
+            inbox_->sleeping = block;
+            inbox_->woken = false;
+
+            for (auto& op : spent_ops_) {
+                inbox_->spare.push_back(std::move(op));
+            }
+            spent_ops_.clear();
+        }
+
+        poll(block);
+
+        if (block) {
+            std::lock_guard<std::mutex> lock{inbox_->mutex};
+            inbox_->sleeping = false;
+        }
+    }
+}
+
+void reactor_transport::take_inbox()
+{
+    // Swapping with vectors kept for the purpose means that neither side
+    // has to allocate once they've grown big enough
+    {
+        std::lock_guard<std::mutex> lock{inbox_->mutex};
+        if (inbox_->ops.empty() && inbox_->cancels.empty()) {
+            return;
+        }
+        taken_ops_.swap(inbox_->ops);
+        taken_cancels_.swap(inbox_->cancels);
+    }
+
+    for (auto& op : taken_ops_) {
+        dispatch(std::move(op));
+    }
+    for (const auto tag : taken_cancels_) {
+        cancel(tag);
+    }
+    taken_ops_.clear();
+    taken_cancels_.clear();
+}
+
+void reactor_transport::free_closed()
+{
+    closed_.erase(std::remove_if(closed_.begin(), closed_.end(),
+                                 [](const std::unique_ptr<connection>& c) {
+                                     return c->in_flight == 0;
+                                 }),
+                  closed_.end());
+}
+
+void reactor_transport::dispatch(std::unique_ptr<operation> op)
+{
+    auto& host = host_for(op->req.uri);
+
+    if (op->warm_up > 0) {
+        return warm(host, std::move(op));
+    }
+
+    // Idle connections are kept in the order they were returned, so any
+    // which have been sitting around for too long are at the front
+    const auto cutoff = std::chrono::steady_clock::now() - options_.idle_timeout;
+    while (!host.idle.empty() && host.idle.front()->last_used < cutoff) {
+        close(*host.idle.front());
+    }
+
+    if (!host.idle.empty()) {
+        auto& c = *host.idle.back();
+        host.idle.pop_back();
+        c.op = std::move(op);
+        return send_request(c);
+    }
+
+    if (host.open < std::max(options_.max_connections_per_host, 1)) {
+        return connect(host, std::move(op));
+    }
+
+    host.waiting.push_back(std::move(op));
+}
+
+auto reactor_transport::host_for(const http::url& url) -> host_state&
+{
+    key_buf_.clear();
+    key_buf_ += url.scheme;
+    key_buf_ += "://";
+    key_buf_ += url.host;
+    key_buf_ += ':';
+    key_buf_ += url.port;
+
+    const auto it = hosts_.find(key_buf_);
+    if (it != hosts_.end()) {
+        return it->second;
+    }
+    return hosts_[key_buf_];
+}
+
+void reactor_transport::connect(host_state& host, std::unique_ptr<operation> op)
+{
+    // Only connecting needs the addresses, and they're almost always
+    // cached already
+    auto addresses = dns_cache::endpoints{};
+    if (!default_dns_cache().lookup(op->req.uri.host, op->req.uri.port, addresses)) {
+        return resolve(std::move(op));
+    }
+
+    auto& c = open_connection(host, op->req.uri, std::move(addresses));
+    c.op = std::move(op);
+
+    if (!try_connect(c)) {
+        fail(c, system_error(errno));
+    }
+}
+
+void reactor_transport::warm(host_state& host, std::unique_ptr<operation> op)
+{
+    const auto count = std::min(op->warm_up,
+                                std::max(options_.max_connections_per_host, 1)) -
+                       host.open;
+    if (count <= 0) {
+        return op->finish(nullptr, {});
+    }
+
+    auto addresses = dns_cache::endpoints{};
+    if (!default_dns_cache().lookup(op->req.uri.host, op->req.uri.port, addresses)) {
+        return resolve(std::move(op));
+    }
+
+    auto group = std::make_shared<warm_group>();
+    group->remaining = count;
+    group->handler = std::move(op->handler);
+
+    // Each connection counts itself off as it becomes ready or closes
+    for (int i = 0; i < count; ++i) {
+        auto& c = open_connection(host, op->req.uri, addresses);
+        c.warming = group;
+        if (!try_connect(c)) {
+            close(c);
+        }
+    }
+}
+
+auto reactor_transport::open_connection(host_state& host, const http::url& url,
+                                        dns_cache::endpoints addresses)
+        -> connection&
+{
+    auto owned = std::make_unique<connection>();
+    auto& c = *owned;
+    connections_.emplace(&c, std::move(owned));
+    ++host.open;
+
+    c.host = &host;
+    c.url = url;
+    c.addresses = std::move(addresses);
+    c.dns_hold = default_dns_cache().hold(url.host, url.port);
+    return c;
+}
+
+bool reactor_transport::try_connect(connection& c)
+{
+    // Each address is tried in turn until one accepts the connection
+    for (; c.address < c.addresses.size(); ++c.address) {
+        const int fd = ::socket(c.addresses[c.address].data()->sa_family,
+                                SOCK_STREAM | SOCK_CLOEXEC |
+                                        (nonblocking_ ? SOCK_NONBLOCK : 0),
+                                0);
+        if (fd < 0) {
+            return false;
+        }
+
+        apply_socket_options(fd, options_.socket);
+
+        c.fd = fd;
+        c.st = connection::state::connecting;
+        const int err = begin_connect(c);
+        if (err == 0) {
+            return true;
+        }
+
+        ::close(fd);
+        c.fd = -1;
+        errno = err;
+    }
+    return false;
+}
+
+void reactor_transport::connected(connection& c, int err)
+{
+    if (err == 0) {
+        start_reading(c);
+        return on_connected(c);
+    }
+
+    closing(c);
+    ::close(c.fd);
+    c.fd = -1;
+    ++c.address;
+    if (!try_connect(c)) {
+        fail(c, system_error(err));
+    }
+}
+
+void reactor_transport::on_connected(connection& c)
+{
+    if (c.url.scheme != "https") {
+        return ready(c);
+    }
+
+    c.ssl = SSL_new(ssl_ctx_);
+    c.rbio = BIO_new(BIO_s_mem());
+    c.wbio = BIO_new(BIO_s_mem());
+    // An empty BIO means "no data yet", not end of file
+    BIO_set_mem_eof_return(c.rbio, -1);
+    SSL_set_bio(c.ssl, c.rbio, c.wbio);
+    SSL_set_connect_state(c.ssl);
+    SSL_set_tlsext_host_name(c.ssl, c.url.host.c_str());
+    SSL_set1_host(c.ssl, c.url.host.c_str());
+    default_session_cache().prepare(c.ssl, c.url);
+
+    c.st = connection::state::handshaking;
+    handshake(c);
+}
+
+void reactor_transport::handshake(connection& c)
+{
+    const int result = SSL_do_handshake(c.ssl);
+    take_ciphertext(c);
+    write(c);
+    if (c.closed) {
+        return;
+    }
+
+    if (result == 1) {
+        default_session_cache().handshake_done(c.ssl);
+        return ready(c);
+    }
+
+    if (SSL_get_error(c.ssl, result) == SSL_ERROR_WANT_READ) {
+        return;
+    }
+
+    const auto verify = SSL_get_verify_result(c.ssl);
+    if (verify != X509_V_OK) {
+        return fail(c, std::make_exception_ptr(std::runtime_error{
+                fmt::format("Certificate verification failed for {}: {}",
+                            c.url.host, X509_verify_cert_error_string(verify))}));
+    }
+    fail(c, tls_error("handshake"));
+}
+
+void reactor_transport::ready(connection& c)
+{
+    c.st = connection::state::ready;
+    if (c.op) {
+        return send_request(c);
+    }
+
+    // Opened ahead of time. Like a reused connection, the server may close
+    // it before the first request arrives, and then that can be retried.
+    c.reused = true;
+    c.last_used = std::chrono::steady_clock::now();
+    release(c);
+    finish_warming(c);
+}
+
+void reactor_transport::finish_warming(connection& c)
+{
+    const auto group = std::move(c.warming);
+    if (group && --group->remaining == 0) {
+        group->handler(nullptr, {});
+    }
+}
+
+void reactor_transport::send_request(connection& c)
+{
+    request_buf_.clear();
+    http::write_request(request_buf_, c.op->req);
+    c.parser.expect(c.op->req.response_size_hint);
+
+    if (c.ssl) {
+        if (SSL_write(c.ssl, request_buf_.data(),
+                      static_cast<int>(request_buf_.size())) <= 0) {
+            return fail(c, tls_error("write"));
+        }
+        take_ciphertext(c);
+    } else if (c.out.empty()) {
+        // Trade buffers rather than copying
+        c.out.swap(request_buf_);
+    } else {
+        c.out += request_buf_;
+    }
+
+    write(c);
+}
+
+void reactor_transport::take_ciphertext(connection& c)
+{
+    char* data = nullptr;
+    const auto size = BIO_get_mem_data(c.wbio, &data);
+    if (size > 0) {
+        c.out.append(data, static_cast<std::size_t>(size));
+        (void) BIO_reset(c.wbio);
+    }
+}
+
+auto reactor_transport::read_space(connection& c, std::size_t& size, bool& direct) -> char*
+{
+    // Plain bodies of known length go straight into the response
+    auto dest = !c.ssl && c.op ? c.parser.body_space(size) : nullptr;
+    direct = dest != nullptr;
+    if (!direct) {
+        dest = read_buf_.data();
+        size = read_buf_.size();
+    }
+    return dest;
+}
+
+void reactor_transport::received(connection& c, const char* data,
+                                 std::size_t size, bool direct)
+{
+    rearm_quick_ack(c.fd, options_.socket);
+
+    if (!c.ssl) {
+        return on_plaintext(c, data, size, direct);
+    }
+
+    BIO_write(c.rbio, data, static_cast<int>(size));
+    if (c.st == connection::state::handshaking) {
+        handshake(c);
+    } else {
+        read_tls(c);
+    }
+}
+
+void reactor_transport::read_tls(connection& c)
+{
+    // read_buf_ is free for plain text, since OpenSSL has its own copy of
+    // the ciphertext
+    while (!c.closed) {
+        auto space = std::size_t{0};
+        auto dest = c.op ? c.parser.body_space(space) : nullptr;
+        const bool direct = dest != nullptr;
+        if (!direct) {
+            dest = read_buf_.data();
+            space = read_buf_.size();
+        }
+
+        const int n = SSL_read(c.ssl, dest, static_cast<int>(space));
+        if (n > 0) {
+            on_plaintext(c, dest, static_cast<std::size_t>(n), direct);
+            continue;
+        }
+
+        const int err = SSL_get_error(c.ssl, n);
+        // Reading can produce something to send, e.g. a key update
+        take_ciphertext(c);
+        write(c);
+        if (c.closed) {
+            return;
+        }
+        if (err == SSL_ERROR_ZERO_RETURN) {
+            return on_eof(c, 0);
+        }
+        if (err != SSL_ERROR_WANT_READ) {
+            return fail(c, tls_error("read"));
+        }
+        return;
+    }
+}
+
+void reactor_transport::on_plaintext(connection& c, const char* data,
+                                     std::size_t size, bool direct)
+{
+    if (!c.op) {
+        // Nothing should arrive between requests
+        return close(c);
+    }
+
+    try {
+        if (direct) {
+            c.parser.commit(size);
+        } else {
+            c.parser.feed(data, size);
+        }
+    } catch (...) {
+        return fail(c, std::current_exception());
+    }
+
+    if (c.parser.done()) {
+        complete(c);
+    }
+}
+
+void reactor_transport::on_eof(connection& c, int err)
+{
+    if (c.closed) {
+        return;
+    }
+    if (!c.op) {
+        return close(c);
+    }
+
+    if (err == 0 && c.parser.finish()) {
+        return complete(c);
+    }
+
+    if (c.reused && !c.parser.started()) {
+        // The server closed a kept-alive connection just as we reused it.
+        // The request was never processed, so it can be sent again.
+        auto op = std::move(c.op);
+        close(c);
+        return dispatch(std::move(op));
+    }
+
+    fail(c, err != 0 ? system_error(err)
+                     : std::make_exception_ptr(boost::system::system_error{
+                               boost::asio::error::eof}));
+}
+
+void reactor_transport::complete(connection& c)
+{
+    auto response = c.parser.release();
+    auto op = std::move(c.op);
+    c.reused = true;
+    c.last_used = std::chrono::steady_clock::now();
+
+    if (response.keep_alive) {
+        release(c);
+    } else {
+        close(c);
+    }
+
+    op->finish(nullptr, std::move(response));
+    recycle(std::move(op));
+}
+
+void reactor_transport::fail(connection& c, std::exception_ptr error)
+{
+    auto op = std::move(c.op);
+    close(c);
+    if (op) {
+        op->finish(error, {});
+    }
+}
+
+void reactor_transport::cancel(std::uint64_t tag)
+{
+    for (auto& entry : hosts_) {
+        auto& waiting = entry.second.waiting;
+        for (auto it = waiting.begin(); it != waiting.end(); ++it) {
+            if ((*it)->tag == tag) {
+                auto op = std::move(*it);
+                waiting.erase(it);
+                return op->finish(cancelled_error(op->req), {});
+            }
+        }
+    }
+
+    // One on the wire can only be stopped by closing its connection
+    for (auto& entry : connections_) {
+        auto& c = *entry.second;
+        if (c.op && c.op->tag == tag) {
+            return fail(c, cancelled_error(c.op->req));
+        }
+    }
+}
+
+void reactor_transport::release(connection& c)
+{
+    auto& host = *c.host;
+    if (!host.waiting.empty()) {
+        c.op = std::move(host.waiting.front());
+        host.waiting.pop_front();
+        return send_request(c);
+    }
+    host.idle.push_back(&c);
+}
+
+void reactor_transport::close(connection& c)
+{
+    if (c.closed) {
+        return;
+    }
+    c.closed = true;
+
+    if (c.fd >= 0) {
+        closing(c);
+        ::close(c.fd);
+    }
+    if (c.ssl) {
+        SSL_free(c.ssl);
+    }
+
+    auto& host = *c.host;
+    --host.open;
+    host.idle.erase(std::remove(host.idle.begin(), host.idle.end(), &c),
+                    host.idle.end());
+
+    // Kept until any events for it have been dealt with
+    const auto it = connections_.find(&c);
+    closed_.push_back(std::move(it->second));
+    connections_.erase(it);
+
+    // Someone waiting for a connection can have this one's place
+    if (!host.waiting.empty() &&
+        host.open < std::max(options_.max_connections_per_host, 1)) {
+        auto op = std::move(host.waiting.front());
+        host.waiting.pop_front();
+        connect(host, std::move(op));
+    }
+
+    finish_warming(c);
+}
+
+} // end namespace net
+} // end namespace stockfighter
+
+#endif // __linux__
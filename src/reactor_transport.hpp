@@ -0,0 +1,250 @@
+#pragma once
+
+#ifdef __linux__
+
+#include "dns_cache.hpp"
+#include "http.hpp"
+#include "transport.hpp"
+
+#include <stockfighter/net.hpp>
+
+#include <openssl/ssl.h>
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace stockfighter {
+namespace net {
+
+// HTTP/1.1 transport for Linux which runs all of its connections on one
+// thread of its own. TLS goes through memory BIOs, so the socket is only
+// ever read and written by us, and the buffers for each connection are
+// reused from one request to the next. How the socket I/O is done is left
+// to the derived class. Handlers are called on the transport's thread, so
+// must not block; in particular they must not make synchronous calls
+// through this transport.
+class reactor_transport : public transport {
+public:
+    ~reactor_transport() override;
+
+    reactor_transport(const reactor_transport&) = delete;
+    reactor_transport& operator=(const reactor_transport&) = delete;
+
+    auto send(const http::request& req) -> http::response override;
+
+    // The requests are sent concurrently, over as many connections as the
+    // pool options allow, rather than pipelined
+    auto send_pipelined(const std::vector<http::request>& reqs)
+            -> std::vector<http::response> override;
+
+    void async_send(http::request req,
+                    http::response_handler handler,
+                    const cancellation_token& token) override;
+
+    void async_warm_up(const http::url& host, int connections,
+                       std::function<void()> done) override;
+
+    auto max_in_flight_per_host() const -> int override
+    {
+        return std::max(options_.max_connections_per_host, 1);
+    }
+
+protected:
+    // Operations are recycled once their requests are answered, so the
+    // request they hold keeps its storage from one to the next
+    struct operation {
+        http::request req;
+        http::response_handler handler;
+        std::uint64_t tag = 0;
+        // If non-zero, this isn't a request: it asks for that many
+        // connections to be opened to req.uri, and the handler is called
+        // once they are ready
+        int warm_up = 0;
+        // The caller's token, and the callback which tells the reactor
+        // about its cancellation
+        cancellation_token token = cancellation_token::never();
+        cancellation_token::callback_id cancel_slot = 0;
+
+        // Calls the handler, once the cancellation callback is out of the
+        // way
+        void finish(std::exception_ptr error, http::response response)
+        {
+            token.remove_callback(cancel_slot);
+            handler(error, std::move(response));
+        }
+    };
+
+    // Connections being opened for one warm-up
+    struct warm_group {
+        int remaining = 0;
+        http::response_handler handler;
+    };
+
+    struct connection;
+
+    struct host_state {
+        std::vector<connection*> idle;
+        std::deque<std::unique_ptr<operation>> waiting;
+        int open = 0;
+    };
+
+    struct connection {
+        enum class state {
+            connecting,
+            handshaking,
+            ready
+        };
+
+        int fd = -1;
+        SSL* ssl = nullptr;
+        // Ciphertext received from the peer, waiting for OpenSSL to read it
+        BIO* rbio = nullptr;
+        // Ciphertext written by OpenSSL, waiting to go to the peer
+        BIO* wbio = nullptr;
+
+        host_state* host = nullptr;
+        http::url url;
+        dns_cache::endpoints addresses;
+        std::size_t address = 0;
+        // Keeps the host in the DNS cache while the connection is open
+        std::shared_ptr<const void> dns_hold;
+
+        state st = state::connecting;
+        bool reused = false;
+        bool closed = false;
+        std::chrono::steady_clock::time_point last_used;
+
+        // The request in progress, if any
+        std::unique_ptr<operation> op;
+        // Set while a connection is opened ahead of any request
+        std::shared_ptr<warm_group> warming;
+        http::response_parser parser;
+
+        // Output waiting to be sent
+        std::string out;
+        // Output handed to the kernel, for backends which write
+        // asynchronously
+        std::string sending;
+        // How much of out, or of sending if it is used, has been sent
+        std::size_t out_pos = 0;
+
+        // Backend operations the kernel still holds against the connection,
+        // as a bit mask. A closed connection isn't freed until they've all
+        // completed.
+        unsigned in_flight = 0;
+        // The backend's receive buffer, if it has one for each connection
+        int slot = -1;
+        // Where a receive the kernel is working on will put the data
+        char* reading = nullptr;
+    };
+
+    // Sockets are created non-blocking unless told otherwise
+    explicit reactor_transport(const pool_options& options, bool nonblocking = true);
+
+    // Derived classes call start() once they are ready for events, and
+    // stop() first thing in their destructors. stop() fails everything
+    // still outstanding and closes every connection.
+    void start();
+    void stop();
+
+    // Deals with whatever events are ready. If block, waits for some
+    // first, returning early if woken through wake_fd().
+    virtual void poll(bool block) = 0;
+    // Starts connecting c.fd to c.addresses[c.address]. Returns an errno
+    // value if that fails straight away; otherwise connected() is called
+    // later.
+    virtual auto begin_connect(connection& c) -> int = 0;
+    // Called once a connection is established and should be read from
+    virtual void start_reading(connection& c) = 0;
+    // Sends, or carries on sending, c.out
+    virtual void write(connection& c) = 0;
+    // Called just before a connection's socket is closed
+    virtual void closing(connection& c) = 0;
+
+    // An eventfd which is written to wake up the transport's thread
+    auto wake_fd() const -> int;
+
+    void connected(connection& c, int err);
+    // Data has arrived on the socket. If direct, it is already in the
+    // space given by read_space().
+    void received(connection& c, const char* data, std::size_t size, bool direct);
+    // Where to read plain text to, given a choice: straight into the
+    // response body if possible, otherwise read_buf_
+    auto read_space(connection& c, std::size_t& size, bool& direct) -> char*;
+    // The peer has closed the connection, or err has happened on it
+    void on_eof(connection& c, int err);
+    // Frees closed connections the kernel is no longer using
+    void free_closed();
+
+    std::vector<std::unique_ptr<connection>> closed_;
+    std::array<char, 65536> read_buf_;
+
+private:
+    struct inbox;
+
+    void run();
+    void take_inbox();
+
+    // A spare operation, or a new one, with a fresh tag
+    auto new_operation() -> std::unique_ptr<operation>;
+    void submit(std::unique_ptr<operation> op, const cancellation_token& token);
+    // Keeps a finished operation for new_operation() to hand out again
+    void recycle(std::unique_ptr<operation> op);
+    // Looks the host up on a thread of its own, so as not to hold up the
+    // others, then sends the operation through the inbox again
+    void resolve(std::unique_ptr<operation> op);
+
+    auto host_for(const http::url& url) -> host_state&;
+    void dispatch(std::unique_ptr<operation> op);
+    void connect(host_state& host, std::unique_ptr<operation> op);
+    void warm(host_state& host, std::unique_ptr<operation> op);
+    auto open_connection(host_state& host, const http::url& url,
+                         dns_cache::endpoints addresses) -> connection&;
+    bool try_connect(connection& c);
+    void on_connected(connection& c);
+    void handshake(connection& c);
+    // The connection is ready for requests
+    void ready(connection& c);
+    void finish_warming(connection& c);
+    void send_request(connection& c);
+    void read_tls(connection& c);
+    void on_plaintext(connection& c, const char* data, std::size_t size, bool direct);
+    void complete(connection& c);
+    void fail(connection& c, std::exception_ptr error);
+    void cancel(std::uint64_t tag);
+
+    // Moves whatever TLS has produced for the peer into the output buffer
+    void take_ciphertext(connection& c);
+
+    void release(connection& c);
+    void close(connection& c);
+
+    pool_options options_;
+    bool nonblocking_;
+    SSL_CTX* ssl_ctx_ = nullptr;
+    std::shared_ptr<inbox> inbox_;
+    std::thread thread_;
+
+    // Everything below is only touched by the transport's thread
+    std::map<std::string, host_state> hosts_;
+    std::map<connection*, std::unique_ptr<connection>> connections_;
+    std::vector<std::unique_ptr<operation>> taken_ops_;
+    // Finished, and waiting to go back to the inbox
+    std::vector<std::unique_ptr<operation>> spent_ops_;
+    std::vector<std::uint64_t> taken_cancels_;
+    std::string key_buf_;
+    std::string request_buf_;
+};
+
+} // end namespace net
+} // end namespace stockfighter
+
+#endif // __linux__
@@ -1,11 +1,29 @@
 
 #include "rest.hpp"
 
-#include <boost/network/protocol/http/client.hpp>
+#include "async.hpp"
+#include "buffer_pool.hpp"
+#include "cancellation.hpp"
+#include "hedging.hpp"
+#include "http.hpp"
+#include "io_runner.hpp"
+#include "rate_limiter.hpp"
+#include "scheduler.hpp"
+#include "single_flight.hpp"
+#include "transport.hpp"
+
+#include <boost/asio/steady_timer.hpp>
 
 #include <cppformat/format.h>
 
-namespace http = boost::network::http;
+#include <array>
+#include <atomic>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace asio = boost::asio;
 namespace nl = nlohmann;
 
 namespace stockfighter {
@@ -13,65 +31,721 @@ namespace rest {
 
 namespace {
 
-template <typename ResponseType>
-auto check_response(const ResponseType& response)
+// Turns a response into its JSON, or into the error it reports, without
+// throwing: rejections are routine, and shouldn't cost an exception and a
+// formatted message each time
+auto to_result(const http::response& response) -> result<nl::json>
 {
-    if (status(response) != 200) {
-        throw std::runtime_error{
-                fmt::format("Error: received status message \"{}\"",
-                            std::to_string(status(response)),
-                            static_cast<std::string>(status_message(
-                                    response)))};
+    auto json = nl::json{};
+
+    // Error responses usually explain themselves in JSON as well
+    const bool maybe_json = !response.body.empty() && response.body.front() == '{';
+    if (response.status == 200 || maybe_json) {
+        try {
+            json = nl::json::parse(response.body);
+        } catch (...) {
+            if (response.status == 200) {
+                return error{errc::bad_response, response.status, {},
+                             std::current_exception()};
+            }
+        }
     }
 
-    const auto json = nlohmann::json::parse(body(response));
+    auto message = std::string{};
+    if (json.is_object()) {
+        const auto it = json.find("error");
+        if (it != json.end() && it->is_string()) {
+            message = std::move(it->get_ref<std::string&>());
+        }
+    }
+
+    if (!message.empty()) {
+        return error{errc::rejected, response.status, std::move(message), nullptr};
+    }
+    if (response.status != 200) {
+        return error{errc::bad_status, response.status, response.reason, nullptr};
+    }
+    return result<nl::json>{std::move(json)};
+}
+
+// Recent response body sizes for each endpoint, so that room can be set
+// aside for the next response before it arrives
+std::array<http::size_histogram, net::endpoint_count> body_sizes;
+
+// Interprets the response, then notes its size and keeps its storage for
+// another response to be received into
+auto finish(net::endpoint e, http::response&& response) -> result<nl::json>
+{
+    auto output = to_result(response);
+    body_sizes[static_cast<std::size_t>(e)].record(response.body.size());
+    http::default_response_pool().give_back(std::move(response));
+    return output;
+}
+
+auto check_response(net::endpoint e, http::response&& response)
+{
+    return finish(e, std::move(response)).value();
+}
+
+// The error for a request which was answered by an exception
+auto failure(std::exception_ptr exception) -> error
+{
+    try {
+        std::rethrow_exception(exception);
+    } catch (const call_failed& e) {
+        // Handed on from another caller's request
+        return e.details;
+    } catch (...) {
+        return error{errc::no_response, 0, {}, exception};
+    }
+}
+
+auto as_exception(const error& e) -> std::exception_ptr
+{
+    return e.exception ? e.exception : std::make_exception_ptr(call_failed{e});
+}
+
+auto checked(net::endpoint e, callback<nl::json> cb) -> http::response_handler
+{
+    return [e, cb](std::exception_ptr error, http::response response) {
+        auto json = nl::json{};
+        if (!error) {
+            try {
+                json = check_response(e, std::move(response));
+            } catch (...) {
+                error = std::current_exception();
+            }
+        }
+        cb(error, std::move(json));
+    };
+}
+
+// The headers which are the same for every request with a given host, key
+// and settings are serialised once and shared. There are only ever a few
+// combinations in use, so finding one is a quick scan which allocates
+// nothing.
+class header_templates {
+public:
+    auto get(const http::url& uri, const std::string& api_key, bool json_body)
+            -> std::shared_ptr<const http::header_block>
+    {
+        const bool compressed = net::get_compression();
+
+        std::lock_guard<std::mutex> lock{mutex_};
+        for (const auto& e : entries_) {
+            if (e.compressed == compressed && e.json_body == json_body &&
+                e.host.port == uri.port && e.host.host == uri.host &&
+                e.host.scheme == uri.scheme && e.api_key == api_key) {
+                return e.block;
+            }
+        }
 
-    if (!json.value("error", "").empty()) {
-        throw std::runtime_error{fmt::format("Remote error with message \"{}\"",
-                                             json["error"].template get<std::string>())};
+        auto headers = std::vector<http::header>{};
+        if (compressed) {
+            headers.push_back({"Accept-Encoding", "gzip, deflate"});
+        }
+        if (!api_key.empty()) {
+            headers.push_back({"X-Starfighter-Authorization", api_key});
+        }
+        if (json_body) {
+            headers.push_back({"Content-Type", "application/json"});
+        }
+
+        // Something is churning through keys; don't hang on to them all
+        if (entries_.size() >= max_entries) {
+            entries_.clear();
+        }
+        const auto host = http::url{uri.scheme, uri.host, uri.port, {}};
+        entries_.push_back({host, api_key, compressed, json_body,
+                            http::make_header_block(host, std::move(headers))});
+        return entries_.back().block;
     }
 
-    return json;
+private:
+    static constexpr std::size_t max_entries = 64;
+
+    struct entry {
+        http::url host;
+        std::string api_key;
+        bool compressed;
+        bool json_body;
+        std::shared_ptr<const http::header_block> block;
+    };
+
+    std::mutex mutex_;
+    std::vector<entry> entries_;
+};
+
+header_templates templates;
+
+auto make_request(net::endpoint e,
+                  const char* method,
+                  const std::string& uri,
+                  const std::string& api_key,
+                  bool json_body = false)
+{
+    auto request = http::request{};
+    request.method = method;
+    request.uri = http::parse_url(uri);
+    request.common = templates.get(request.uri, api_key, json_body);
+    request.response_size_hint = body_sizes[static_cast<std::size_t>(e)].typical();
+    return request;
+}
+
+auto make_post_request(net::endpoint e,
+                       const std::string& uri,
+                       const std::string& body,
+                       const std::string& api_key)
+{
+    auto request = make_request(e, "POST", uri, api_key, !body.empty());
+    request.body = body;
+    return request;
+}
+
+// Requests can only be shared by callers using the same key
+auto flight_key(const std::string& uri, const std::string& api_key)
+{
+    return api_key + ' ' + uri;
 }
 
-void add_header(http::client::request& request, const std::string& api_key)
+auto priority_for(net::endpoint e)
 {
-    if (!api_key.empty()) {
-        request << boost::network::header("X-Starfighter-Authorization",
-                                          api_key);
+    switch (e) {
+    case net::endpoint::cancel_order:
+        return net::priority::cancel;
+    case net::endpoint::place_order:
+    case net::endpoint::level_control:
+        return net::priority::order;
+    case net::endpoint::order_status:
+    case net::endpoint::level_status:
+        return net::priority::status;
+    case net::endpoint::heartbeat:
+    case net::endpoint::venue_heartbeat:
+        // The venue monitor relies on these, and they're cheap, so they
+        // mustn't be starved or dropped along with market data
+        return net::priority::status;
+    default:
+        return net::priority::market_data;
     }
 }
 
+bool is_guarded(const net::call_options& opts)
+{
+    return opts.timeout.count() > 0 || opts.token.can_be_cancelled();
+}
+
+// A request which is given up on when its deadline passes or the caller
+// cancels it. Whichever happens first of that and the response decides
+// what the handler is called with.
+struct guarded_request {
+    explicit guarded_request(asio::io_context& io) : timer{io} {}
+
+    // Returns the handler if the request hasn't already been completed
+    auto claim() -> http::response_handler
+    {
+        auto h = http::response_handler{};
+        {
+            std::lock_guard<std::mutex> lock{mutex};
+            if (done) {
+                return h;
+            }
+            done = true;
+            timer.cancel();
+            h = std::move(handler);
+        }
+        caller.remove_callback(caller_slot);
+        return h;
+    }
+
+    void give_up(std::exception_ptr error)
+    {
+        if (auto h = claim()) {
+            abort.cancel();
+            h(error, {});
+        }
+    }
+
+    std::mutex mutex;
+    asio::steady_timer timer;
+    http::response_handler handler;
+    // Tells the transport to abandon the request
+    net::cancellation_token abort;
+    net::cancellation_token caller = net::cancellation_token::never();
+    net::cancellation_token::callback_id caller_slot = 0;
+    bool done = false;
+    // Set once the request has been handed to the transport
+    std::atomic<bool> sent{false};
+};
+
+// What the stages of an asynchronous request need to know, besides the
+// request itself
+struct send_state {
+    net::request_scheduler::clock::time_point deadline =
+            net::request_scheduler::clock::time_point::max();
+    // If the request is guarded, set once it's handed to the transport
+    std::shared_ptr<std::atomic<bool>> sent;
+};
+
+// Returns the handler to give the transport, and sets abort to the token
+// which goes with it and state.sent to the flag it watches
+auto guard(const http::request& request,
+           const net::call_options& opts,
+           http::response_handler handler,
+           net::cancellation_token& abort,
+           send_state& state) -> http::response_handler
+{
+    if (!is_guarded(opts)) {
+        abort = net::cancellation_token::never();
+        return handler;
+    }
+
+    auto& io = net::default_io();
+    io.start();
+
+    auto g = std::make_shared<guarded_request>(io.context());
+    g->handler = std::move(handler);
+    abort = g->abort;
+    state.sent = std::shared_ptr<std::atomic<bool>>{g, &g->sent};
+
+    if (opts.timeout.count() > 0) {
+        std::lock_guard<std::mutex> lock{g->mutex};
+        g->timer.expires_after(opts.timeout);
+        g->timer.async_wait([g, request, timeout = opts.timeout](
+                const boost::system::error_code& ec) {
+            if (!ec) {
+                g->give_up(net::timed_out_error(request, timeout, g->sent));
+            }
+        });
+    }
+
+    if (opts.token.can_be_cancelled()) {
+        g->caller = opts.token;
+        const auto slot = g->caller.on_cancel(
+                [weak = std::weak_ptr<guarded_request>{g}, request] {
+                    if (const auto g = weak.lock()) {
+                        g->give_up(net::cancelled_error(request));
+                    }
+                });
+
+        std::unique_lock<std::mutex> lock{g->mutex};
+        if (g->done) {
+            lock.unlock();
+            g->caller.remove_callback(slot);
+        } else {
+            g->caller_slot = slot;
+        }
+    }
+
+    return [g](std::exception_ptr error, http::response response) {
+        if (auto h = g->claim()) {
+            h(error, std::move(response));
+        }
+    };
+}
+
+// Sends the request once the scheduler gives it its turn
+void scheduled_send(net::endpoint e,
+                    http::request request,
+                    http::response_handler handler,
+                    const net::cancellation_token& token,
+                    const send_state& state)
+{
+    net::default_scheduler().async_acquire(
+            request.uri, priority_for(e), state.deadline,
+            [request, handler, token, sent = state.sent](std::exception_ptr error) {
+                if (error) {
+                    return handler(error, {});
+                }
+                if (token.is_cancelled()) {
+                    net::default_scheduler().release(request.uri);
+                    return handler(net::cancelled_error(request), {});
+                }
+                if (sent) {
+                    *sent = true;
+                }
+                net::default_transport()->async_send(
+                        request,
+                        [uri = request.uri, handler](std::exception_ptr error,
+                                                     http::response response) {
+                            net::default_scheduler().release(uri);
+                            handler(error, std::move(response));
+                        },
+                        token);
+            });
+}
+
+// Sends the request once the rate limiter lets it through
+void limited_send(net::endpoint e,
+                  http::request request,
+                  http::response_handler handler,
+                  const net::cancellation_token& token,
+                  const send_state& state)
+{
+    net::default_rate_limiter().async_acquire(
+            priority_for(e),
+            [e, request, handler, token, state](std::exception_ptr error) {
+                if (error) {
+                    return handler(error, {});
+                }
+                if (token.is_cancelled()) {
+                    return handler(net::cancelled_error(request), {});
+                }
+                scheduled_send(e, request, handler, token, state);
+            });
+}
+
+void async_send(net::endpoint e,
+                http::request request,
+                const net::call_options& opts,
+                http::response_handler handler)
+{
+    auto state = send_state{};
+    if (opts.timeout.count() > 0) {
+        state.deadline = net::request_scheduler::clock::now() + opts.timeout;
+    }
+
+    auto token = net::cancellation_token::never();
+    handler = guard(request, opts, std::move(handler), token, state);
+
+    const auto hedge = net::get_hedging(e);
+
+    if (!hedge.enabled || request.method != "GET") {
+        return limited_send(e, std::move(request), std::move(handler), token,
+                            state);
+    }
+
+    default_hedger().send(e, hedge, std::move(request), std::move(handler),
+                          [e, state](http::request req, http::response_handler h,
+                                     const net::cancellation_token& t) {
+                              limited_send(e, std::move(req), std::move(h), t,
+                                           state);
+                          },
+                          token);
+}
+
+auto send(net::endpoint e,
+          const http::request& request,
+          const net::call_options& opts) -> http::response
+{
+    if (is_guarded(opts) ||
+        (request.method == "GET" && net::get_hedging(e).enabled)) {
+        // Needs to be able to stop waiting, or to wait for two responses
+        return detail::make_future<http::response>([&](auto handler) {
+            async_send(e, request, opts, std::move(handler));
+        }).get();
+    }
+
+    net::default_rate_limiter().acquire(priority_for(e));
+    net::default_scheduler().acquire(request.uri, priority_for(e));
+    try {
+        auto response = net::default_transport()->send(request);
+        net::default_scheduler().release(request.uri);
+        return response;
+    } catch (...) {
+        net::default_scheduler().release(request.uri);
+        throw;
+    }
+}
+
+// Only failures to get a response at all are exceptions, and they're
+// caught here
+auto send_checked(net::endpoint e,
+                  const http::request& request,
+                  const net::call_options& opts) -> result<nl::json>
+{
+    auto response = http::response{};
+    try {
+        response = send(e, request, opts);
+    } catch (...) {
+        return failure(std::current_exception());
+    }
+    return finish(e, std::move(response));
+}
+
 } // end anonymous namespace
 
-auto get(const std::string& uri,
-         const std::string& api_key) -> nl::json
+auto try_get(net::endpoint e,
+             const std::string& uri,
+             const std::string& api_key,
+             const net::call_options& opts) -> result<nl::json>
 {
-    auto request = http::client::request{uri};
-    add_header(request, api_key);
-    auto response = http::client{}.get(request);
-    return check_response(response);
+    const auto request = make_request(e, "GET", uri, api_key);
+    const auto coalesce = net::get_coalescing(e);
+
+    if (!coalesce.enabled || is_guarded(opts)) {
+        return send_checked(e, request, opts);
+    }
+
+    auto& flights = default_single_flight();
+    const auto key = flight_key(uri, api_key);
+
+    bool leader = false;
+    auto shared = detail::make_future<nl::json>([&](auto cb) {
+        leader = flights.join(key, coalesce.max_staleness, std::move(cb));
+    });
+
+    if (!leader) {
+        try {
+            return shared.get();
+        } catch (...) {
+            return failure(std::current_exception());
+        }
+    }
+
+    auto outcome = send_checked(e, request, opts);
+    if (outcome) {
+        flights.complete(key, nullptr, *outcome, coalesce.max_staleness);
+    } else {
+        flights.complete(key, as_exception(outcome.error()), {}, {});
+    }
+    return outcome;
 }
 
-auto post(const std::string& uri,
+auto try_post(net::endpoint e,
+              const std::string& uri,
+              const std::string& body_,
+              const std::string& api_key,
+              const net::call_options& opts) -> result<nl::json>
+{
+    return send_checked(e, make_post_request(e, uri, body_, api_key), opts);
+}
+
+auto try_delete(net::endpoint e,
+                const std::string& uri,
+                const std::string& api_key,
+                const net::call_options& opts) -> result<nl::json>
+{
+    return send_checked(e, make_request(e, "DELETE", uri, api_key), opts);
+}
+
+auto get(net::endpoint e,
+         const std::string& uri,
+         const std::string& api_key,
+         const net::call_options& opts) -> nl::json
+{
+    return try_get(e, uri, api_key, opts).value();
+}
+
+auto post(net::endpoint e,
+          const std::string& uri,
           const std::string& body_,
-          const std::string& api_key) -> nl::json
+          const std::string& api_key,
+          const net::call_options& opts) -> nl::json
+{
+    return try_post(e, uri, body_, api_key, opts).value();
+}
+
+auto delete_(net::endpoint e,
+             const std::string& uri,
+             const std::string& api_key,
+             const net::call_options& opts) -> nl::json
+{
+    return try_delete(e, uri, api_key, opts).value();
+}
+
+auto get_pipelined(net::endpoint e,
+                   const std::vector<std::string>& uris,
+                   const std::string& api_key,
+                   const net::call_options& opts) -> std::vector<nl::json>
+{
+    auto requests = std::vector<http::request>{};
+    requests.reserve(uris.size());
+    for (const auto& uri : uris) {
+        requests.push_back(make_request(e, "GET", uri, api_key));
+    }
+
+    auto output = std::vector<nl::json>{};
+    if (requests.empty()) {
+        return output;
+    }
+    output.reserve(requests.size());
+
+    if (is_guarded(opts)) {
+        auto futures = std::vector<std::future<http::response>>{};
+        futures.reserve(requests.size());
+        for (const auto& request : requests) {
+            futures.push_back(detail::make_future<http::response>([&](auto handler) {
+                async_send(e, request, opts, std::move(handler));
+            }));
+        }
+
+        // Wait for all of them before reporting any error
+        for (auto& f : futures) {
+            f.wait();
+        }
+        for (auto& f : futures) {
+            output.push_back(check_response(e, f.get()));
+        }
+        return output;
+    }
+
+    // Each request in the batch still counts against the rate limit, but
+    // the batch goes over one connection, so takes one turn from the
+    // scheduler
+    net::default_rate_limiter().acquire(priority_for(e),
+                                        static_cast<int>(requests.size()));
+    net::default_scheduler().acquire(requests.front().uri, priority_for(e));
+
+    auto responses = std::vector<http::response>{};
+    try {
+        responses = net::default_transport()->send_pipelined(requests);
+        net::default_scheduler().release(requests.front().uri);
+    } catch (...) {
+        net::default_scheduler().release(requests.front().uri);
+        throw;
+    }
+
+    for (auto& response : responses) {
+        output.push_back(check_response(e, std::move(response)));
+    }
+
+    return output;
+}
+
+auto post_batch(net::endpoint e,
+                const std::vector<std::string>& uris,
+                const std::vector<std::string>& bodies,
+                const std::string& api_key,
+                const net::call_options& opts) -> std::vector<result<nl::json>>
 {
-    auto request = http::client::request{uri};
-    add_header(request, api_key);
-    const auto response = http::client{}.post(request, body_);
-    return check_response(response);
+    auto requests = std::vector<http::request>{};
+    requests.reserve(uris.size());
+    for (std::size_t i = 0; i < uris.size(); ++i) {
+        requests.push_back(make_post_request(e, uris[i], bodies[i], api_key));
+    }
+
+    auto output = std::vector<result<nl::json>>{};
+    if (requests.empty()) {
+        return output;
+    }
+    output.reserve(requests.size());
+
+    if (is_guarded(opts)) {
+        auto futures = std::vector<std::future<http::response>>{};
+        futures.reserve(requests.size());
+        for (const auto& request : requests) {
+            futures.push_back(detail::make_future<http::response>([&](auto handler) {
+                async_send(e, request, opts, std::move(handler));
+            }));
+        }
+        for (auto& f : futures) {
+            try {
+                output.push_back(finish(e, f.get()));
+            } catch (...) {
+                output.push_back(failure(std::current_exception()));
+            }
+        }
+        return output;
+    }
+
+    try {
+        net::default_rate_limiter().acquire(priority_for(e),
+                                            static_cast<int>(requests.size()));
+        net::default_scheduler().acquire(requests.front().uri, priority_for(e));
+    } catch (...) {
+        // Nothing has been sent yet
+        const auto error = failure(std::current_exception());
+        output.assign(requests.size(), error);
+        return output;
+    }
+
+    auto responses = std::vector<result<http::response>>{};
+    try {
+        responses = net::default_transport()->send_batch(requests);
+        net::default_scheduler().release(requests.front().uri);
+    } catch (...) {
+        net::default_scheduler().release(requests.front().uri);
+        throw;
+    }
+
+    for (auto& response : responses) {
+        if (response) {
+            output.push_back(finish(e, std::move(*response)));
+        } else {
+            output.push_back(std::move(response).error());
+        }
+    }
+
+    return output;
+}
+
+void async_get(net::endpoint e,
+               const std::string& uri,
+               const std::string& api_key,
+               callback<nl::json> cb,
+               const net::call_options& opts)
+{
+    const auto coalesce = net::get_coalescing(e);
+
+    if (!coalesce.enabled || is_guarded(opts)) {
+        async_send(e, make_request(e, "GET", uri, api_key), opts,
+                   checked(e, std::move(cb)));
+        return;
+    }
+
+    auto& flights = default_single_flight();
+    const auto key = flight_key(uri, api_key);
+
+    if (!flights.join(key, coalesce.max_staleness, cb)) {
+        return;
+    }
+
+    async_send(
+            e, make_request(e, "GET", uri, api_key), opts,
+            checked(e, [&flights, key, keep_for = coalesce.max_staleness, cb](
+                    std::exception_ptr error, nl::json json) {
+                flights.complete(key, error, json, keep_for);
+                cb(error, std::move(json));
+            }));
 }
 
-auto delete_(const std::string& uri,
-             const std::string& api_key) -> nl::json
+void async_post(net::endpoint e,
+                const std::string& uri,
+                const std::string& body,
+                const std::string& api_key,
+                callback<nl::json> cb,
+                const net::call_options& opts)
 {
-    auto request = http::client::request{uri};
-    add_header(request, api_key);
-    const auto response = http::client{}.delete_(request);
-    return check_response(response);
+    async_send(e, make_post_request(e, uri, body, api_key), opts,
+               checked(e, std::move(cb)));
+}
+
+void async_delete(net::endpoint e,
+                  const std::string& uri,
+                  const std::string& api_key,
+                  callback<nl::json> cb,
+                  const net::call_options& opts)
+{
+    async_send(e, make_request(e, "DELETE", uri, api_key), opts,
+               checked(e, std::move(cb)));
+}
+
+void async_warm_up(const std::string& uri, int connections,
+                   std::function<void()> done)
+{
+    net::default_transport()->async_warm_up(http::parse_url(uri), connections,
+                                            std::move(done));
 }
 
 } // end namespace rest
-} // end namespace stockfighter
 
+namespace net {
+
+namespace {
+
+std::atomic<bool> compression{true};
+
+} // end anonymous namespace
+
+void set_compression(bool enabled)
+{
+    compression = enabled;
+}
+
+auto get_compression() -> bool
+{
+    return compression;
+}
+
+} // end namespace net
+} // end namespace stockfighter
@@ -1,20 +1,102 @@
 
 #pragma once
 
+#include <stockfighter/net.hpp>
+#include <stockfighter/result.hpp>
+#include <stockfighter/types.hpp>
+
 #include <json.hpp>
 
+#include <functional>
+#include <string>
+#include <vector>
+
 namespace stockfighter {
 namespace rest {
 
-auto get(const std::string& uri,
-         const std::string& api_key = {}) -> nlohmann::json;
+// The endpoint selects the settings, such as net::set_coalescing() and
+// the rate limiter's priority, which apply to the request. Requests with a
+// deadline or a cancellation token never share a response with others.
+auto get(net::endpoint e,
+         const std::string& uri,
+         const std::string& api_key = {},
+         const net::call_options& opts = {}) -> nlohmann::json;
 
-auto post(const std::string& uri,
+auto post(net::endpoint e,
+          const std::string& uri,
           const std::string& body = std::string{},
-          const std::string& api_key = {}) -> nlohmann::json;
+          const std::string& api_key = {},
+          const net::call_options& opts = {}) -> nlohmann::json;
+
+auto delete_(net::endpoint e,
+             const std::string& uri,
+             const std::string& api_key = {},
+             const net::call_options& opts = {}) -> nlohmann::json;
+
+// As above, but errors reported by the server are returned rather than
+// thrown. The throwing versions are wrappers around these.
+auto try_get(net::endpoint e,
+             const std::string& uri,
+             const std::string& api_key = {},
+             const net::call_options& opts = {}) -> result<nlohmann::json>;
+
+auto try_post(net::endpoint e,
+              const std::string& uri,
+              const std::string& body = std::string{},
+              const std::string& api_key = {},
+              const net::call_options& opts = {}) -> result<nlohmann::json>;
+
+auto try_delete(net::endpoint e,
+                const std::string& uri,
+                const std::string& api_key = {},
+                const net::call_options& opts = {}) -> result<nlohmann::json>;
+
+// Performs several GETs to the same host, pipelining them on a single
+// connection so that the whole batch costs roughly one round trip. The
+// results are in the same order as the URIs. A pipelined batch can't be
+// abandoned part way through, so with a deadline or cancellation token the
+// requests are sent concurrently instead.
+auto get_pipelined(net::endpoint e,
+                   const std::vector<std::string>& uris,
+                   const std::string& api_key = {},
+                   const net::call_options& opts = {}) -> std::vector<nlohmann::json>;
+
+// Performs several POSTs to the same host, pipelined where the transport
+// can, and returns what became of each in order. Unlike get_pipelined(),
+// nothing is sent twice which the server might have acted on. With a
+// deadline or cancellation token the requests are sent concurrently.
+auto post_batch(net::endpoint e,
+                const std::vector<std::string>& uris,
+                const std::vector<std::string>& bodies,
+                const std::string& api_key = {},
+                const net::call_options& opts = {})
+        -> std::vector<result<nlohmann::json>>;
+
+// Non-blocking versions of the above. The callback is invoked from one of
+// the I/O threads once the response has arrived and been checked.
+void async_get(net::endpoint e,
+               const std::string& uri,
+               const std::string& api_key,
+               callback<nlohmann::json> cb,
+               const net::call_options& opts = {});
+
+void async_post(net::endpoint e,
+                const std::string& uri,
+                const std::string& body,
+                const std::string& api_key,
+                callback<nlohmann::json> cb,
+                const net::call_options& opts = {});
+
+void async_delete(net::endpoint e,
+                  const std::string& uri,
+                  const std::string& api_key,
+                  callback<nlohmann::json> cb,
+                  const net::call_options& opts = {});
 
-auto delete_(const std::string& uri,
-             const std::string& api_key = {}) -> nlohmann::json;
+// Opens connections to the URI's host ahead of the requests which will need
+// them, calling done once they are ready or have failed
+void async_warm_up(const std::string& uri, int connections,
+                   std::function<void()> done);
 
 }
 }
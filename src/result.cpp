@@ -0,0 +1,42 @@
+
+#include <stockfighter/result.hpp>
+
+#include <cppformat/format.h>
+
+namespace stockfighter {
+
+namespace {
+
+auto describe(const error& e) -> std::string
+{
+    switch (e.code) {
+    case errc::rejected:
+        return fmt::format("Remote error with message \"{}\"", e.message);
+    case errc::bad_status:
+        return fmt::format("Error: received status {} \"{}\"", e.status, e.message);
+    case errc::bad_response:
+        return "Unexpected response from the server";
+    case errc::venue_down:
+        return "The venue is down";
+    case errc::no_response:
+        break;
+    }
+    return "No response from the server";
+}
+
+} // end anonymous namespace
+
+call_failed::call_failed(error e)
+        : std::runtime_error{describe(e)},
+          details(std::move(e))
+{}
+
+void throw_error(const error& e)
+{
+    if (e.exception) {
+        std::rethrow_exception(e.exception);
+    }
+    throw call_failed{e};
+}
+
+} // end namespace stockfighter
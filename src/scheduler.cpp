@@ -0,0 +1,199 @@
+
+#include "scheduler.hpp"
+#include "cancellation.hpp"
+#include "transport.hpp"
+
+#include <algorithm>
+#include <future>
+#include <limits>
+
+namespace stockfighter {
+namespace net {
+
+namespace {
+
+void call_all(std::vector<request_scheduler::ready_handler>& ready,
+              std::vector<request_scheduler::ready_handler>& expired)
+{
+    for (auto& h : ready) {
+        h(nullptr);
+    }
+    for (auto& h : expired) {
+        h(std::make_exception_ptr(timed_out_unsent{
+                "Market data request dropped: its deadline passed while it "
+                "was waiting to be sent"}));
+    }
+}
+
+} // end anonymous namespace
+
+void request_scheduler::async_acquire(const http::url& host, priority p,
+                                      clock::time_point deadline,
+                                      ready_handler handler)
+{
+    const auto max = limit();
+    auto ready = std::vector<ready_handler>{};
+    auto expired = std::vector<ready_handler>{};
+    bool go = false;
+
+    {
+        std::lock_guard<std::mutex> lock{mutex_};
+        auto& q = queue_for(host);
+        if (q.in_flight < max && is_empty(q)) {
+            // Nothing to wait behind, so there's no need to queue it
+            ++q.in_flight;
+            go = true;
+        } else {
+            q.waiting[static_cast<std::size_t>(p)].emplace(deadline, std::move(handler));
+            dispatch(q, max, ready, expired);
+        }
+    }
+
+    if (go) {
+        return handler(nullptr);
+    }
+    call_all(ready, expired);
+}
+
+void request_scheduler::acquire(const http::url& host, priority p)
+{
+    const auto max = limit();
+    {
+        // Don't bother with the promise if there's room straight away
+        std::lock_guard<std::mutex> lock{mutex_};
+        auto& q = queue_for(host);
+        if (q.in_flight < max && is_empty(q)) {
+            ++q.in_flight;
+            return;
+        }
+    }
+
+    auto promise = std::promise<void>{};
+    auto future = promise.get_future();
+    async_acquire(host, p, clock::time_point::max(),
+                  [&promise](std::exception_ptr error) {
+                      if (error) {
+                          promise.set_exception(error);
+                      } else {
+                          promise.set_value();
+                      }
+                  });
+    future.get();
+}
+
+void request_scheduler::release(const http::url& host)
+{
+    const auto max = limit();
+    auto ready = std::vector<ready_handler>{};
+    auto expired = std::vector<ready_handler>{};
+
+    {
+        std::lock_guard<std::mutex> lock{mutex_};
+        auto& q = queue_for(host);
+        if (q.in_flight > 0) {
+            --q.in_flight;
+        }
+        dispatch(q, max, ready, expired);
+    }
+
+    call_all(ready, expired);
+}
+
+void request_scheduler::set_options(const scheduler_options& options)
+{
+    {
+        std::lock_guard<std::mutex> lock{mutex_};
+        options_ = options;
+    }
+
+    // There may be room for more requests now
+    const auto max = limit();
+    auto ready = std::vector<ready_handler>{};
+    auto expired = std::vector<ready_handler>{};
+
+    {
+        std::lock_guard<std::mutex> lock{mutex_};
+        for (auto& entry : hosts_) {
+            dispatch(entry.second, max, ready, expired);
+        }
+    }
+
+    call_all(ready, expired);
+}
+
+auto request_scheduler::options() const -> scheduler_options
+{
+    std::lock_guard<std::mutex> lock{mutex_};
+    return options_;
+}
+
+auto request_scheduler::limit() const -> int
+{
+    const auto opts = options();
+    if (!opts.enabled) {
+        return std::numeric_limits<int>::max();
+    }
+    if (opts.max_in_flight_per_host > 0) {
+        return opts.max_in_flight_per_host;
+    }
+    const auto max = default_transport()->max_in_flight_per_host();
+    return max > 0 ? max : std::numeric_limits<int>::max();
+}
+
+auto request_scheduler::queue_for(const http::url& host) -> host_queue&
+{
+    key_buf_.clear();
+    key_buf_ += host.scheme;
+    key_buf_ += "://";
+    key_buf_ += host.host;
+    key_buf_ += ':';
+    key_buf_ += host.port;
+    return hosts_[key_buf_];
+}
+
+bool request_scheduler::is_empty(const host_queue& q)
+{
+    return std::all_of(q.waiting.begin(), q.waiting.end(),
+                       [](const auto& queue) { return queue.empty(); });
+}
+
+void request_scheduler::dispatch(host_queue& q, int limit,
+                                 std::vector<ready_handler>& ready,
+                                 std::vector<ready_handler>& expired)
+{
+    // Market data is kept in deadline order, so anything too late to be
+    // worth sending is at the front
+    auto& market_data = q.waiting[static_cast<std::size_t>(priority::market_data)];
+    const auto now = clock::now();
+    while (!market_data.empty() && market_data.begin()->first <= now) {
+        expired.push_back(std::move(market_data.begin()->second));
+        market_data.erase(market_data.begin());
+    }
+
+    for (auto& queue : q.waiting) {
+        while (q.in_flight < limit && !queue.empty()) {
+            ++q.in_flight;
+            ready.push_back(std::move(queue.begin()->second));
+            queue.erase(queue.begin());
+        }
+    }
+}
+
+auto default_scheduler() -> request_scheduler&
+{
+    static request_scheduler scheduler;
+    return scheduler;
+}
+
+void set_scheduler_options(const scheduler_options& options)
+{
+    default_scheduler().set_options(options);
+}
+
+auto get_scheduler_options() -> scheduler_options
+{
+    return default_scheduler().options();
+}
+
+} // end namespace net
+} // end namespace stockfighter
@@ -0,0 +1,78 @@
+#pragma once
+
+#include "http.hpp"
+
+#include <stockfighter/net.hpp>
+
+#include <array>
+#include <chrono>
+#include <exception>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace stockfighter {
+namespace net {
+
+// Decides which of the requests waiting for a host goes next once one of
+// its requests in flight completes: the most important class first, and
+// the earliest deadline within a class. Every request sent, scheduled or
+// not, must be released when its response arrives.
+class request_scheduler {
+public:
+    using clock = std::chrono::steady_clock;
+    using ready_handler = std::function<void(std::exception_ptr error)>;
+
+    // Calls the handler once the request may be sent, which may be straight
+    // away, or with a net::timed_out error if it is market data whose
+    // deadline passed while it waited
+    void async_acquire(const http::url& host, priority p,
+                       clock::time_point deadline, ready_handler handler);
+
+    // Blocks until the request may be sent
+    void acquire(const http::url& host, priority p);
+
+    // A request to the host has completed, so the next may go
+    void release(const http::url& host);
+
+    void set_options(const scheduler_options& options);
+
+    auto options() const -> scheduler_options;
+
+private:
+    struct host_queue {
+        int in_flight = 0;
+        // Indexed by priority. Requests with the same deadline keep the
+        // order they arrived in.
+        std::array<std::multimap<clock::time_point, ready_handler>,
+                   priority_count> waiting;
+    };
+
+    // From the scheduler options, or else the transport
+    auto limit() const -> int;
+
+    // Must be called with the lock held
+    auto queue_for(const http::url& host) -> host_queue&;
+    static bool is_empty(const host_queue& q);
+
+    // Lets through as many waiters as the host has room for, and drops
+    // any market data which is too late to be worth sending. Must be
+    // called with the lock held, and the handlers collected must be called
+    // once it has been released.
+    void dispatch(host_queue& q, int limit,
+                  std::vector<ready_handler>& ready,
+                  std::vector<ready_handler>& expired);
+
+    mutable std::mutex mutex_;
+    scheduler_options options_;
+    std::map<std::string, host_queue> hosts_;
+    // For building keys into hosts_ without allocating
+    std::string key_buf_;
+};
+
+auto default_scheduler() -> request_scheduler&;
+
+} // end namespace net
+} // end namespace stockfighter
@@ -0,0 +1,129 @@
+
+#include "session_cache.hpp"
+
+#include <stockfighter/net.hpp>
+
+#include <ctime>
+
+namespace stockfighter {
+namespace net {
+
+namespace {
+
+// Where an SSL object keeps a pointer to its host's key in the cache
+int key_index()
+{
+    static const int index = SSL_get_ex_new_index(0, nullptr, nullptr,
+                                                  nullptr, nullptr);
+    return index;
+}
+
+// Where a context keeps a pointer to the cache it is attached to
+int cache_index()
+{
+    static const int index = SSL_CTX_get_ex_new_index(0, nullptr, nullptr,
+                                                      nullptr, nullptr);
+    return index;
+}
+
+bool expired(SSL_SESSION* session)
+{
+    return SSL_SESSION_get_time(session) + SSL_SESSION_get_timeout(session) <=
+           std::time(nullptr);
+}
+
+} // end anonymous namespace
+
+session_cache::~session_cache()
+{
+    for (auto& entry : sessions_) {
+        SSL_SESSION_free(entry.second);
+    }
+}
+
+void session_cache::attach(boost::asio::ssl::context& ctx)
+{
+    attach(ctx.native_handle());
+}
+
+void session_cache::attach(SSL_CTX* ctx)
+{
+    // The sessions are kept here rather than in OpenSSL's own cache, which
+    // is keyed by session id and so no use to a client
+    SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_CLIENT |
+                                        SSL_SESS_CACHE_NO_INTERNAL_STORE);
+    SSL_CTX_set_ex_data(ctx, cache_index(), this);
+    SSL_CTX_sess_set_new_cb(ctx, on_new_session);
+}
+
+void session_cache::prepare(SSL* ssl, const http::url& host)
+{
+    std::lock_guard<std::mutex> lock{mutex_};
+
+    const auto it = sessions_.emplace(host.host + ":" + host.port, nullptr).first;
+    SSL_set_ex_data(ssl, key_index(), const_cast<std::string*>(&it->first));
+
+    auto& session = it->second;
+    if (session && (!SSL_SESSION_is_resumable(session) || expired(session))) {
+        SSL_SESSION_free(session);
+        session = nullptr;
+    }
+    if (session) {
+        SSL_set_session(ssl, session);
+    }
+}
+
+void session_cache::handshake_done(SSL* ssl)
+{
+    if (SSL_session_reused(ssl)) {
+        ++resumed_;
+    } else {
+        ++full_;
+    }
+}
+
+int session_cache::on_new_session(SSL* ssl, SSL_SESSION* session)
+{
+    const auto key = static_cast<const std::string*>(
+            SSL_get_ex_data(ssl, key_index()));
+    const auto cache = static_cast<session_cache*>(
+            SSL_CTX_get_ex_data(SSL_get_SSL_CTX(ssl), cache_index()));
+    if (!key || !cache) {
+        return 0;
+    }
+
+    // OpenSSL marks the session belonging to a connection as unusable if
+    // the connection is dropped without a TLS shutdown, which is how most
+    // of ours end, so keep a copy instead
+    if (auto copy = SSL_SESSION_dup(session)) {
+        cache->store(*key, copy);
+    }
+
+    return 0;
+}
+
+void session_cache::store(const std::string& key, SSL_SESSION* session)
+{
+    std::lock_guard<std::mutex> lock{mutex_};
+
+    auto& entry = sessions_[key];
+    if (entry) {
+        SSL_SESSION_free(entry);
+    }
+    entry = session;
+}
+
+auto default_session_cache() -> session_cache&
+{
+    static session_cache cache;
+    return cache;
+}
+
+auto get_tls_stats() -> tls_stats
+{
+    const auto& cache = default_session_cache();
+    return tls_stats{cache.full_handshakes(), cache.resumed_handshakes()};
+}
+
+} // end namespace net
+} // end namespace stockfighter
@@ -0,0 +1,62 @@
+#pragma once
+
+#include "http.hpp"
+
+#include <boost/asio/ssl/context.hpp>
+
+#include <openssl/ssl.h>
+
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <string>
+
+namespace stockfighter {
+namespace net {
+
+// Keeps the most recent TLS session for each host, so that reconnecting
+// after a connection is closed can use an abbreviated handshake rather
+// than a full one
+class session_cache {
+public:
+    session_cache() = default;
+
+    ~session_cache();
+
+    session_cache(const session_cache&) = delete;
+    session_cache& operator=(const session_cache&) = delete;
+
+    // Makes the context hand new sessions to this cache
+    void attach(boost::asio::ssl::context& ctx);
+
+    void attach(SSL_CTX* ctx);
+
+    // To be called before the handshake. Offers the host's cached session,
+    // if there is a usable one.
+    void prepare(SSL* ssl, const http::url& host);
+
+    // To be called once the handshake succeeds, to keep count of how many
+    // were resumed
+    void handshake_done(SSL* ssl);
+
+    auto full_handshakes() const -> long { return full_; }
+
+    auto resumed_handshakes() const -> long { return resumed_; }
+
+private:
+    static int on_new_session(SSL* ssl, SSL_SESSION* session);
+
+    void store(const std::string& key, SSL_SESSION* session);
+
+    std::mutex mutex_;
+    // Entries are never removed, so the keys can be referred to by the
+    // SSL objects which are waiting for a session
+    std::map<std::string, SSL_SESSION*> sessions_;
+    std::atomic<long> full_{0};
+    std::atomic<long> resumed_{0};
+};
+
+auto default_session_cache() -> session_cache&;
+
+} // end namespace net
+} // end namespace stockfighter
@@ -0,0 +1,121 @@
+
+#include "single_flight.hpp"
+
+#include <stockfighter/net.hpp>
+
+#include <algorithm>
+#include <array>
+
+namespace nl = nlohmann;
+
+namespace stockfighter {
+namespace rest {
+
+constexpr std::size_t single_flight::min_sweep_at;
+
+bool single_flight::join(const std::string& key,
+                         std::chrono::microseconds max_staleness,
+                         callback<nl::json> cb)
+{
+    std::unique_lock<std::mutex> lock{mutex_};
+
+    if (max_staleness.count() > 0) {
+        const auto it = recent_.find(key);
+        if (it != recent_.end() &&
+            clock::now() - it->second.received <= max_staleness) {
+            auto json = it->second.json;
+            lock.unlock();
+            cb(nullptr, std::move(json));
+            return false;
+        }
+    }
+
+    const auto it = in_flight_.find(key);
+    if (it != in_flight_.end()) {
+        it->second.push_back(std::move(cb));
+        return false;
+    }
+
+    in_flight_.emplace(key, std::vector<callback<nl::json>>{});
+    return true;
+}
+
+void single_flight::complete(const std::string& key,
+                             std::exception_ptr error,
+                             const nl::json& result,
+                             std::chrono::microseconds keep_for)
+{
+    auto waiters = std::vector<callback<nl::json>>{};
+
+    {
+        std::lock_guard<std::mutex> lock{mutex_};
+
+        const auto it = in_flight_.find(key);
+        if (it != in_flight_.end()) {
+            waiters = std::move(it->second);
+            in_flight_.erase(it);
+        }
+
+        if (!error && keep_for.count() > 0) {
+            const auto now = clock::now();
+            recent_[key] = recent_result{result, now, now + keep_for};
+            if (recent_.size() >= sweep_at_) {
+                sweep(now);
+            }
+        }
+    }
+
+    for (auto& w : waiters) {
+        w(error, result);
+    }
+}
+
+auto single_flight::recent_count() -> std::size_t
+{
+    std::lock_guard<std::mutex> lock{mutex_};
+    return recent_.size();
+}
+
+void single_flight::sweep(clock::time_point now)
+{
+    for (auto it = recent_.begin(); it != recent_.end();) {
+        if (it->second.expires < now) {
+            it = recent_.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    sweep_at_ = std::max(2 * recent_.size(), min_sweep_at);
+}
+
+auto default_single_flight() -> single_flight&
+{
+    static single_flight flights;
+    return flights;
+}
+
+} // end namespace rest
+
+namespace net {
+
+namespace {
+
+std::mutex coalescing_mutex;
+std::array<coalescing_options, endpoint_count> coalescing;
+
+} // end anonymous namespace
+
+void set_coalescing(endpoint e, const coalescing_options& options)
+{
+    std::lock_guard<std::mutex> lock{coalescing_mutex};
+    coalescing[static_cast<std::size_t>(e)] = options;
+}
+
+auto get_coalescing(endpoint e) -> coalescing_options
+{
+    std::lock_guard<std::mutex> lock{coalescing_mutex};
+    return coalescing[static_cast<std::size_t>(e)];
+}
+
+} // end namespace net
+} // end namespace stockfighter
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <stockfighter/types.hpp>
+
+#include <json.hpp>
+
+#include <chrono>
+#include <cstddef>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace stockfighter {
+namespace rest {
+
+// Lets identical GETs share a single request. The first caller for a key
+// becomes the leader and performs the request; anyone else asking for the
+// same key before it completes just waits for the leader's result.
+class single_flight {
+public:
+    using clock = std::chrono::steady_clock;
+
+    // Returns true if the caller is the leader, in which case it must
+    // perform the request and pass the outcome to complete(). Otherwise
+    // cb will be called with the leader's result, or has been called
+    // already if a result no older than max_staleness was available.
+    bool join(const std::string& key,
+              std::chrono::microseconds max_staleness,
+              callback<nlohmann::json> cb);
+
+    // Successful results are kept for later callers for up to keep_for,
+    // if it isn't zero
+    void complete(const std::string& key,
+                  std::exception_ptr error,
+                  const nlohmann::json& result,
+                  std::chrono::microseconds keep_for);
+
+    // The number of results being kept
+    auto recent_count() -> std::size_t;
+
+private:
+    struct recent_result {
+        nlohmann::json json;
+        clock::time_point received;
+        clock::time_point expires;
+    };
+
+    static constexpr std::size_t min_sweep_at = 64;
+
+    // Drops the results which are too old to be handed out. Must be called
+    // with the lock held.
+    void sweep(clock::time_point now);
+
+    std::mutex mutex_;
+    std::map<std::string, std::vector<callback<nlohmann::json>>> in_flight_;
+    std::map<std::string, recent_result> recent_;
+    // Old results are swept away once recent_ grows to this size, so that
+    // the sweeps cost next to nothing spread over the results added
+    std::size_t sweep_at_ = min_sweep_at;
+};
+
+auto default_single_flight() -> single_flight&;
+
+} // end namespace rest
+} // end namespace stockfighter
@@ -0,0 +1,66 @@
+
+#include "socket_options.hpp"
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+namespace stockfighter {
+namespace net {
+
+namespace {
+
+void set(int fd, int level, int name, int value)
+{
+    (void) ::setsockopt(fd, level, name, &value, sizeof(value));
+}
+
+} // end anonymous namespace
+
+void apply_socket_options(int fd, const socket_options& options)
+{
+    set(fd, IPPROTO_TCP, TCP_NODELAY, options.no_delay ? 1 : 0);
+
+    if (options.receive_buffer > 0) {
+        set(fd, SOL_SOCKET, SO_RCVBUF, options.receive_buffer);
+    }
+    if (options.send_buffer > 0) {
+        set(fd, SOL_SOCKET, SO_SNDBUF, options.send_buffer);
+    }
+
+    if (options.keepalive_interval.count() > 0) {
+        const auto seconds = static_cast<int>(options.keepalive_interval.count());
+        set(fd, SOL_SOCKET, SO_KEEPALIVE, 1);
+#ifdef TCP_KEEPIDLE
+        set(fd, IPPROTO_TCP, TCP_KEEPIDLE, seconds);
+#elif defined(TCP_KEEPALIVE)
+        set(fd, IPPROTO_TCP, TCP_KEEPALIVE, seconds);
+#endif
+#ifdef TCP_KEEPINTVL
+        set(fd, IPPROTO_TCP, TCP_KEEPINTVL, seconds);
+#endif
+    }
+
+#ifdef SO_BUSY_POLL
+    if (options.busy_poll.count() > 0) {
+        set(fd, SOL_SOCKET, SO_BUSY_POLL, static_cast<int>(options.busy_poll.count()));
+    }
+#endif
+
+    rearm_quick_ack(fd, options);
+}
+
+void rearm_quick_ack(int fd, const socket_options& options)
+{
+#ifdef TCP_QUICKACK
+    if (options.quick_ack) {
+        set(fd, IPPROTO_TCP, TCP_QUICKACK, 1);
+    }
+#else
+    (void) fd;
+    (void) options;
+#endif
+}
+
+} // end namespace net
+} // end namespace stockfighter
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <stockfighter/net.hpp>
+
+namespace stockfighter {
+namespace net {
+
+// Applies the options to a TCP socket, ideally before it connects. Any
+// which the system refuses are left as they were.
+void apply_socket_options(int fd, const socket_options& options);
+
+// TCP_QUICKACK only lasts until the kernel decides otherwise, so it is set
+// again after each read. Does nothing unless quick_ack is set.
+void rearm_quick_ack(int fd, const socket_options& options);
+
+} // end namespace net
+} // end namespace stockfighter
@@ -0,0 +1,160 @@
+
+#include "transport.hpp"
+#include "connection_pool.hpp"
+#include "epoll_transport.hpp"
+#include "http2.hpp"
+#include "uring_transport.hpp"
+
+#include <stockfighter/net.hpp>
+
+#include <atomic>
+#include <future>
+#include <mutex>
+
+namespace stockfighter {
+namespace net {
+
+namespace {
+
+std::atomic<protocol> selected_protocol{protocol::http1_1};
+std::atomic<backend> selected_backend{backend::asio};
+
+std::mutex custom_mutex;
+std::shared_ptr<transport> custom_transport;
+
+// The built-in transports live forever, so these don't own them
+auto unowned(transport& t) -> std::shared_ptr<transport>
+{
+    return std::shared_ptr<transport>{std::shared_ptr<void>{}, &t};
+}
+
+// Handlers get every header in req.headers, as they would without
+// pre-built common headers
+auto expanded(const http::request& req) -> http::request
+{
+    auto copy = req;
+    copy.headers = http::all_headers(req);
+    copy.common = nullptr;
+    return copy;
+}
+
+} // end anonymous namespace
+
+auto transport::send_batch(const std::vector<http::request>& reqs)
+        -> std::vector<result<http::response>>
+{
+    auto futures = std::vector<std::future<http::response>>{};
+    futures.reserve(reqs.size());
+
+    for (const auto& req : reqs) {
+        auto promise = std::make_shared<std::promise<http::response>>();
+        futures.push_back(promise->get_future());
+        async_send(req, [promise](std::exception_ptr error, http::response response) {
+            if (error) {
+                promise->set_exception(error);
+            } else {
+                promise->set_value(std::move(response));
+            }
+        }, cancellation_token::never());
+    }
+
+    auto results = std::vector<result<http::response>>{};
+    results.reserve(reqs.size());
+    for (auto& f : futures) {
+        try {
+            results.emplace_back(f.get());
+        } catch (...) {
+            results.emplace_back(error{errc::no_response, 0, {}, std::current_exception()});
+        }
+    }
+    return results;
+}
+
+auto default_transport() -> std::shared_ptr<transport>
+{
+    {
+        std::lock_guard<std::mutex> lock{custom_mutex};
+        if (custom_transport) {
+            return custom_transport;
+        }
+    }
+
+#ifdef __linux__
+    switch (selected_backend.load()) {
+    case backend::epoll:
+        return unowned(default_epoll());
+    case backend::io_uring:
+        return unowned(default_uring());
+    case backend::asio:
+        break;
+    }
+#endif
+
+    if (selected_protocol == protocol::http2) {
+        return unowned(default_http2());
+    }
+    return unowned(default_pool());
+}
+
+void set_transport(std::shared_ptr<transport> t)
+{
+    std::lock_guard<std::mutex> lock{custom_mutex};
+    custom_transport = std::move(t);
+}
+
+void set_protocol(protocol p)
+{
+    selected_protocol = p;
+}
+
+auto get_protocol() -> protocol
+{
+    return selected_protocol;
+}
+
+void set_backend(backend b)
+{
+    selected_backend = b;
+}
+
+auto get_backend() -> backend
+{
+    return selected_backend;
+}
+
+loopback_transport::loopback_transport(handler h)
+        : handler_(std::move(h))
+{}
+
+auto loopback_transport::send(const http::request& req) -> http::response
+{
+    return handler_(expanded(req));
+}
+
+auto loopback_transport::send_pipelined(const std::vector<http::request>& reqs)
+        -> std::vector<http::response>
+{
+    auto responses = std::vector<http::response>{};
+    responses.reserve(reqs.size());
+    for (const auto& req : reqs) {
+        responses.push_back(handler_(expanded(req)));
+    }
+    return responses;
+}
+
+void loopback_transport::async_send(http::request req,
+                                    http::response_handler handler,
+                                    const cancellation_token&)
+{
+    // Completes before anyone could cancel it
+    auto response = http::response{};
+    try {
+        response = handler_(expanded(req));
+    } catch (...) {
+        return handler(std::current_exception(), {});
+    }
+    handler(nullptr, std::move(response));
+}
+
+} // end namespace net
+} // end namespace stockfighter
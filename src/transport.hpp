@@ -0,0 +1,17 @@
+#pragma once
+
+#include "http.hpp"
+
+#include <stockfighter/transport.hpp>
+
+#include <memory>
+
+namespace stockfighter {
+namespace net {
+
+// The transport installed with net::set_transport() if there is one,
+// otherwise the one for the protocol chosen with net::set_protocol()
+auto default_transport() -> std::shared_ptr<transport>;
+
+} // end namespace net
+} // end namespace stockfighter
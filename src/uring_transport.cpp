@@ -0,0 +1,496 @@
+
+#include "uring_transport.hpp"
+
+#ifdef __linux__
+
+#include "epoll_transport.hpp"
+
+#include <boost/system/system_error.hpp>
+
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+namespace stockfighter {
+namespace net {
+
+namespace {
+
+// Number of receive buffers registered with the kernel when the ring is
+// set up. Registered memory is pinned, so this is kept modest; any
+// connections beyond it get buffers which aren't registered.
+constexpr int registered_slots = 64;
+
+constexpr unsigned ring_entries = 256;
+
+// user_data for the multishot poll on the wake eventfd. Cancellations are
+// submitted with user_data 0 and their completions are ignored.
+constexpr std::uint64_t wake_data = 1;
+
+auto io_uring_setup(unsigned entries, io_uring_params& params) -> int
+{
+    return static_cast<int>(::syscall(__NR_io_uring_setup, entries, &params));
+}
+
+auto io_uring_register(int fd, unsigned opcode, const void* arg, unsigned count) -> int
+{
+    return static_cast<int>(::syscall(__NR_io_uring_register, fd, opcode, arg, count));
+}
+
+[[noreturn]] void throw_errno(int err)
+{
+    throw boost::system::system_error{
+            boost::system::error_code{err, boost::system::system_category()}};
+}
+
+// Rings came in with Linux 5.1, but connect and send only arrived in 5.5
+// and 5.6. Kernels older than 5.6 can't be probed at all, which rules them
+// out too.
+bool has_operations(int ring_fd)
+{
+    constexpr unsigned count = 256;
+    // Kept in 64-bit words so that the probe is suitably aligned
+    auto storage = std::vector<std::uint64_t>(
+            (sizeof(io_uring_probe) + count * sizeof(io_uring_probe_op)) / 8);
+    auto* probe = reinterpret_cast<io_uring_probe*>(storage.data());
+    if (io_uring_register(ring_fd, IORING_REGISTER_PROBE, probe, count) != 0) {
+        return false;
+    }
+
+    for (const unsigned op : {IORING_OP_CONNECT, IORING_OP_SEND, IORING_OP_RECV,
+                              IORING_OP_READ_FIXED, IORING_OP_POLL_ADD,
+                              IORING_OP_ASYNC_CANCEL}) {
+        if (op > probe->last_op || !(probe->ops[op].flags & IO_URING_OP_SUPPORTED)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Multishot polls only came in with 5.13, and there's no opcode to probe
+// for them, so this arms one on an eventfd which is already readable and
+// checks that the kernel says it will stay armed
+bool has_multishot_poll(int ring_fd, const io_uring_params& params)
+{
+    const auto sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    const auto cq_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    const auto sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+
+    // Multishot polls are newer than single mappings, so there's no need
+    // to map the completion queue separately
+    if (!(params.features & IORING_FEAT_SINGLE_MMAP)) {
+        return false;
+    }
+    const auto ring_size = std::max(sq_size, cq_size);
+    auto* ring = ::mmap(nullptr, ring_size, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+    auto* sqes = ::mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+    const int event_fd = ::eventfd(1, EFD_CLOEXEC);
+
+    bool result = false;
+    if (ring != MAP_FAILED && sqes != MAP_FAILED && event_fd >= 0) {
+        auto* r = static_cast<char*>(ring);
+        auto* sqe = static_cast<io_uring_sqe*>(sqes);
+        std::memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = IORING_OP_POLL_ADD;
+        sqe->fd = event_fd;
+        sqe->poll32_events = POLLIN | EPOLLET;
+        sqe->len = IORING_POLL_ADD_MULTI;
+        sqe->user_data = wake_data;
+
+        // The ring is new, so the entry goes in the first slot
+        auto* sq_tail = reinterpret_cast<unsigned*>(r + params.sq_off.tail);
+        reinterpret_cast<unsigned*>(r + params.sq_off.array)[0] = 0;
+        __atomic_store_n(sq_tail, 1u, __ATOMIC_RELEASE);
+
+        if (::syscall(__NR_io_uring_enter, ring_fd, 1, 1, IORING_ENTER_GETEVENTS,
+                      nullptr, 0) == 1) {
+            const auto* cqes = reinterpret_cast<io_uring_cqe*>(r + params.cq_off.cqes);
+            const auto& cqe = cqes[0];
+            result = cqe.res > 0 && (cqe.flags & IORING_CQE_F_MORE);
+        }
+    }
+
+    // Closing the ring cancels the poll
+    if (event_fd >= 0) {
+        ::close(event_fd);
+    }
+    if (sqes != MAP_FAILED) {
+        ::munmap(sqes, sqes_size);
+    }
+    if (ring != MAP_FAILED) {
+        ::munmap(ring, ring_size);
+    }
+    return result;
+}
+
+} // end anonymous namespace
+
+bool uring_transport::available()
+{
+    static const bool result = [] {
+        auto params = io_uring_params{};
+        const int fd = io_uring_setup(2, params);
+        if (fd < 0) {
+            return false;
+        }
+        const bool usable = has_operations(fd) && has_multishot_poll(fd, params);
+        ::close(fd);
+        return usable;
+    }();
+    return result;
+}
+
+uring_transport::uring_transport(const pool_options& options)
+        // io_uring waits for blocking sockets itself, but gives up with
+        // EAGAIN on non-blocking ones
+        : reactor_transport(options, false)
+{
+    auto params = io_uring_params{};
+    ring_fd_ = io_uring_setup(ring_entries, params);
+    if (ring_fd_ < 0) {
+        throw_errno(errno);
+    }
+
+    sq_ring_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_ring_size_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    const bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single_mmap) {
+        sq_ring_size_ = cq_ring_size_ = std::max(sq_ring_size_, cq_ring_size_);
+    }
+    sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+
+    sq_ring_ = ::mmap(nullptr, sq_ring_size_, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQ_RING);
+    cq_ring_ = single_mmap ? sq_ring_
+                           : ::mmap(nullptr, cq_ring_size_, PROT_READ | PROT_WRITE,
+                                    MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_CQ_RING);
+    auto* sqes = ::mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQES);
+    if (sq_ring_ == MAP_FAILED || cq_ring_ == MAP_FAILED || sqes == MAP_FAILED) {
+        const int err = errno;
+        // The mappings go with the ring
+        ::close(ring_fd_);
+        throw_errno(err);
+    }
+    sqes_ = static_cast<io_uring_sqe*>(sqes);
+
+    auto* sq = static_cast<char*>(sq_ring_);
+    sq_head_ = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+    sq_tail_ = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+    sq_array_ = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+    sq_mask_ = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+    sq_entries_ = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_entries);
+    tail_ = *sq_tail_;
+
+    auto* cq = static_cast<char*>(cq_ring_);
+    cq_head_ = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+    cq_tail_ = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+    cq_mask_ = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+    cqes_ = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+
+    auto iovecs = std::vector<iovec>{};
+    for (int i = 0; i < registered_slots; ++i) {
+        slots_.push_back(std::make_unique<char[]>(slot_size));
+        iovecs.push_back({slots_.back().get(), slot_size});
+    }
+    // If the memory can't be pinned, the buffers are used unregistered
+    if (io_uring_register(ring_fd_, IORING_REGISTER_BUFFERS, iovecs.data(),
+                          static_cast<unsigned>(iovecs.size())) == 0) {
+        registered_ = registered_slots;
+    }
+    for (int i = registered_slots; i-- > 0;) {
+        free_slots_.push_back(i);
+    }
+
+    arm_wake();
+    start();
+}
+
+uring_transport::~uring_transport()
+{
+    stop();
+
+    // The kernel may still be using memory of ours, so wait until
+    // everything has been cancelled
+    stopping_ = true;
+    if (wake_armed_) {
+        auto* sqe = next_sqe(nullptr, op_kind{});
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->addr = wake_data;
+    }
+    free_closed();
+    while (wake_armed_ || !closed_.empty()) {
+        poll(true);
+        free_closed();
+    }
+
+    ::munmap(sqes_, sqes_size_);
+    if (cq_ring_ != sq_ring_) {
+        ::munmap(cq_ring_, cq_ring_size_);
+    }
+    ::munmap(sq_ring_, sq_ring_size_);
+    ::close(ring_fd_);
+}
+
+auto uring_transport::next_sqe(connection* c, op_kind kind) -> io_uring_sqe*
+{
+    if (tail_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE) >= sq_entries_) {
+        // Full, so hand what we have to the kernel to make room
+        enter(0, 0);
+    }
+
+    const auto index = tail_ & sq_mask_;
+    auto* sqe = &sqes_[index];
+    std::memset(sqe, 0, sizeof(*sqe));
+    sq_array_[index] = index;
+    ++tail_;
+    ++to_submit_;
+
+    if (c) {
+        sqe->user_data = reinterpret_cast<std::uintptr_t>(c) | kind;
+        c->in_flight |= kind;
+    }
+    return sqe;
+}
+
+auto uring_transport::enter(unsigned min_complete, unsigned flags) -> int
+{
+    __atomic_store_n(sq_tail_, tail_, __ATOMIC_RELEASE);
+    const int submitted = static_cast<int>(::syscall(
+            __NR_io_uring_enter, ring_fd_, to_submit_, min_complete, flags, nullptr, 0));
+    if (submitted > 0) {
+        to_submit_ -= static_cast<unsigned>(submitted);
+    }
+    return submitted;
+}
+
+void uring_transport::poll(bool block)
+{
+    // Everything queued since last time goes in the same call as the wait.
+    // If there's nothing to submit or wait for, the completion queue can
+    // be read without a system call at all.
+    if (block) {
+        enter(1, IORING_ENTER_GETEVENTS);
+    } else if (to_submit_ > 0) {
+        enter(0, 0);
+    }
+
+    auto head = *cq_head_;
+    while (head != __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE)) {
+        const auto cqe = cqes_[head & cq_mask_];
+        ++head;
+        // Free the entry before dealing with it, since that may submit more
+        __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+        on_completion(cqe.user_data, cqe.res, cqe.flags);
+    }
+}
+
+void uring_transport::on_completion(std::uint64_t user_data, int res, unsigned flags)
+{
+    if (user_data == 0) {
+        return;
+    }
+    if (user_data == wake_data) {
+        // Nothing to do but notice that the thread is awake; the multishot
+        // poll only needs re-arming if the kernel has dropped it
+        if (!(flags & IORING_CQE_F_MORE)) {
+            wake_armed_ = false;
+            if (stopping_) {
+                return;
+            }
+            if (res < 0) {
+                // Re-arming would only fail the same way again, so rather
+                // than spin, give up. This is on the transport's thread,
+                // so it ends the program.
+                throw_errno(-res);
+            }
+            arm_wake();
+        }
+        return;
+    }
+
+    const auto kind = static_cast<op_kind>(user_data & 7);
+    auto& c = *reinterpret_cast<connection*>(user_data & ~std::uint64_t{7});
+    c.in_flight &= ~kind;
+
+    if (c.closed) {
+        if (c.in_flight == 0) {
+            release_slot(c);
+        }
+        return;
+    }
+
+    switch (kind) {
+    case connect_op:
+        return connected(c, -res);
+    case send_op:
+        if (res < 0) {
+            return on_eof(c, -res);
+        }
+        c.out_pos += static_cast<std::size_t>(res);
+        if (c.out_pos == c.sending.size()) {
+            c.sending.clear();
+            c.out_pos = 0;
+        }
+        return write(c);
+    case recv_op:
+        if (res <= 0) {
+            return on_eof(c, -res);
+        }
+        received(c, c.reading, static_cast<std::size_t>(res),
+                 c.reading != slots_[static_cast<std::size_t>(c.slot)].get());
+        if (!c.closed) {
+            start_recv(c);
+        }
+        return;
+    }
+}
+
+auto uring_transport::begin_connect(connection& c) -> int
+{
+    const auto& address = c.addresses[c.address];
+    auto* sqe = next_sqe(&c, connect_op);
+    sqe->opcode = IORING_OP_CONNECT;
+    sqe->fd = c.fd;
+    sqe->addr = reinterpret_cast<std::uintptr_t>(address.data());
+    sqe->off = address.size();
+    return 0;
+}
+
+void uring_transport::start_reading(connection& c)
+{
+    if (c.slot < 0) {
+        if (free_slots_.empty()) {
+            free_slots_.push_back(static_cast<int>(slots_.size()));
+            slots_.push_back(std::make_unique<char[]>(slot_size));
+        }
+        c.slot = free_slots_.back();
+        free_slots_.pop_back();
+    }
+    start_recv(c);
+}
+
+void uring_transport::start_recv(connection& c)
+{
+    auto* sqe = next_sqe(&c, recv_op);
+    sqe->fd = c.fd;
+
+    // Plain bodies of known length are better read straight into the
+    // response than copied out of a registered buffer
+    auto space = std::size_t{0};
+    auto direct = false;
+    auto dest = read_space(c, space, direct);
+    if (!direct) {
+        dest = slots_[static_cast<std::size_t>(c.slot)].get();
+        space = slot_size;
+    }
+    c.reading = dest;
+    sqe->addr = reinterpret_cast<std::uintptr_t>(dest);
+    sqe->len = static_cast<std::uint32_t>(space);
+
+    if (!direct && c.slot < registered_) {
+        sqe->opcode = IORING_OP_READ_FIXED;
+        sqe->buf_index = static_cast<std::uint16_t>(c.slot);
+    } else {
+        sqe->opcode = IORING_OP_RECV;
+    }
+}
+
+void uring_transport::write(connection& c)
+{
+    // One send at a time for each connection. Anything written meanwhile
+    // waits in c.out, since c.sending mustn't move while the kernel has it.
+    if (c.in_flight & send_op) {
+        return;
+    }
+    if (c.sending.empty()) {
+        if (c.out.empty()) {
+            return;
+        }
+        c.sending.swap(c.out);
+        c.out_pos = 0;
+    }
+
+    auto* sqe = next_sqe(&c, send_op);
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = c.fd;
+    sqe->addr = reinterpret_cast<std::uintptr_t>(c.sending.data() + c.out_pos);
+    sqe->len = static_cast<std::uint32_t>(c.sending.size() - c.out_pos);
+    sqe->msg_flags = MSG_NOSIGNAL;
+}
+
+void uring_transport::closing(connection& c)
+{
+    // By user_data rather than by file descriptor, since the descriptor is
+    // closed before the cancellation is submitted
+    for (const auto kind : {connect_op, send_op, recv_op}) {
+        if (c.in_flight & kind) {
+            auto* sqe = next_sqe(nullptr, op_kind{});
+            sqe->opcode = IORING_OP_ASYNC_CANCEL;
+            sqe->addr = reinterpret_cast<std::uintptr_t>(&c) | kind;
+        }
+    }
+    c.sending.clear();
+    c.out_pos = 0;
+
+    if (c.in_flight == 0) {
+        release_slot(c);
+    }
+}
+
+void uring_transport::arm_wake()
+{
+    // Edge triggered, so the eventfd never needs to be read
+    auto* sqe = next_sqe(nullptr, op_kind{});
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = wake_fd();
+    sqe->poll32_events = POLLIN | EPOLLET;
+    sqe->len = IORING_POLL_ADD_MULTI;
+    sqe->user_data = wake_data;
+    wake_armed_ = true;
+}
+
+void uring_transport::release_slot(connection& c)
+{
+    if (c.slot >= 0) {
+        free_slots_.push_back(c.slot);
+        c.slot = -1;
+    }
+}
+
+auto default_uring() -> reactor_transport&
+{
+    static reactor_transport* const transport = []() -> reactor_transport* {
+        if (!uring_transport::available()) {
+            return nullptr;
+        }
+        try {
+            static uring_transport t{get_pool_options()};
+            return &t;
+        } catch (const std::exception&) {
+            return nullptr;
+        }
+    }();
+
+    if (!transport) {
+        return default_epoll();
+    }
+    return *transport;
+}
+
+} // end namespace net
+} // end namespace stockfighter
+
+#endif // __linux__
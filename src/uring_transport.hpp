@@ -0,0 +1,95 @@
+#pragma once
+
+#ifdef __linux__
+
+#include "reactor_transport.hpp"
+
+#include <linux/io_uring.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace stockfighter {
+namespace net {
+
+// Drives its connections with io_uring. The sends, receives and connects
+// for every connection are queued up while events are dealt with, and go
+// to the kernel together in the same system call which waits for the next
+// completions. Receives go into buffers registered with the kernel up
+// front, so it doesn't have to map them in again each time.
+class uring_transport : public reactor_transport {
+public:
+    // Throws if the kernel won't give us a ring
+    explicit uring_transport(const pool_options& options = {});
+    ~uring_transport() override;
+
+    // Whether io_uring can be used here at all; it may be missing from the
+    // kernel, disabled for this process, or too old (before Linux 5.13) to
+    // have everything the transport needs
+    static bool available();
+
+private:
+    // What a submission was for. Together with the connection's address,
+    // this is its user_data.
+    enum op_kind : unsigned {
+        connect_op = 1,
+        send_op = 2,
+        recv_op = 4
+    };
+
+    static constexpr std::size_t slot_size = 16384;
+
+    void poll(bool block) override;
+    auto begin_connect(connection& c) -> int override;
+    void start_reading(connection& c) override;
+    void write(connection& c) override;
+    void closing(connection& c) override;
+
+    auto next_sqe(connection* c, op_kind kind) -> io_uring_sqe*;
+    auto enter(unsigned min_complete, unsigned flags) -> int;
+    void on_completion(std::uint64_t user_data, int res, unsigned flags);
+    void start_recv(connection& c);
+    void arm_wake();
+    void release_slot(connection& c);
+
+    int ring_fd_ = -1;
+    void* sq_ring_ = nullptr;
+    std::size_t sq_ring_size_ = 0;
+    void* cq_ring_ = nullptr;
+    std::size_t cq_ring_size_ = 0;
+    io_uring_sqe* sqes_ = nullptr;
+    std::size_t sqes_size_ = 0;
+
+    unsigned* sq_head_ = nullptr;
+    unsigned* sq_tail_ = nullptr;
+    unsigned* sq_array_ = nullptr;
+    unsigned sq_mask_ = 0;
+    unsigned sq_entries_ = 0;
+    unsigned* cq_head_ = nullptr;
+    unsigned* cq_tail_ = nullptr;
+    io_uring_cqe* cqes_ = nullptr;
+    unsigned cq_mask_ = 0;
+
+    // Queued, but not yet handed to the kernel
+    unsigned tail_ = 0;
+    unsigned to_submit_ = 0;
+
+    bool wake_armed_ = false;
+    bool stopping_ = false;
+
+    // Receive buffers, one for each open connection. The first
+    // registered_ of them are registered with the kernel.
+    std::vector<std::unique_ptr<char[]>> slots_;
+    std::vector<int> free_slots_;
+    int registered_ = 0;
+};
+
+// The io_uring transport if the kernel allows it, otherwise the epoll one
+auto default_uring() -> reactor_transport&;
+
+} // end namespace net
+} // end namespace stockfighter
+
+#endif // __linux__
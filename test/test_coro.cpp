@@ -0,0 +1,125 @@
+#include <stockfighter/coro.hpp>
+#include <stockfighter/net.hpp>
+#include <stockfighter/transport.hpp>
+
+#include "catch.hpp"
+
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace sf = stockfighter;
+
+namespace {
+
+auto ok_response(const sf::http::request&) -> sf::http::response
+{
+    auto response = sf::http::response{};
+    response.status = 200;
+    response.body = R"({"ok":true})";
+    return response;
+}
+
+// Answers asynchronous requests from a thread of its own, so that the
+// awaiting coroutine really is suspended
+struct threaded_transport : sf::net::transport {
+    std::vector<std::thread> threads;
+
+    ~threaded_transport()
+    {
+        for (auto& t : threads) {
+            t.join();
+        }
+    }
+
+    auto send(const sf::http::request& req) -> sf::http::response override
+    {
+        return ok_response(req);
+    }
+
+    auto send_pipelined(const std::vector<sf::http::request>& reqs)
+            -> std::vector<sf::http::response> override
+    {
+        auto out = std::vector<sf::http::response>{};
+        for (const auto& req : reqs) {
+            out.push_back(ok_response(req));
+        }
+        return out;
+    }
+
+    void async_send(sf::http::request req, sf::http::response_handler handler,
+                    const sf::net::cancellation_token&) override
+    {
+        threads.emplace_back([req = std::move(req), handler = std::move(handler)] {
+            std::this_thread::sleep_for(std::chrono::milliseconds{1});
+            handler(nullptr, ok_response(req));
+        });
+    }
+};
+
+auto count_heartbeats(int n) -> sf::coro::task<int>
+{
+    int ok = 0;
+    for (int i = 0; i < n; ++i) {
+        if (co_await sf::coro::heartbeat()) {
+            ++ok;
+        }
+    }
+    co_return ok;
+}
+
+} // end anonymous namespace
+
+TEST_CASE("Calls which complete inline don't nest coroutine resumptions", "[loopback][coro]")
+{
+    sf::net::set_transport(std::make_shared<sf::net::loopback_transport>(ok_response));
+
+    // Enough to overflow the stack if each call resumed the coroutine from
+    // within the previous one
+    constexpr int calls = 100000;
+    bool done = false;
+    int result = 0;
+    sf::coro::spawn(count_heartbeats(calls),
+                    [&](std::exception_ptr error, int ok) {
+                        REQUIRE_FALSE(error);
+                        result = ok;
+                        done = true;
+                    });
+
+    // Everything completed on this thread
+    REQUIRE(done);
+    REQUIRE(result == calls);
+
+    sf::net::set_transport(nullptr);
+}
+
+TEST_CASE("Calls which complete later resume the coroutine", "[loopback][coro]")
+{
+    auto transport = std::make_shared<threaded_transport>();
+    sf::net::set_transport(transport);
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool done = false;
+    int result = 0;
+    sf::coro::spawn(count_heartbeats(5),
+                    [&](std::exception_ptr error, int ok) {
+                        std::lock_guard<std::mutex> lock{mutex};
+                        if (!error) {
+                            result = ok;
+                        }
+                        done = true;
+                        cv.notify_one();
+                    });
+
+    {
+        std::unique_lock<std::mutex> lock{mutex};
+        cv.wait(lock, [&] { return done; });
+    }
+    REQUIRE(result == 5);
+
+    sf::net::set_transport(nullptr);
+}
@@ -0,0 +1,145 @@
+#include "hpack.hpp"
+
+#include "catch.hpp"
+
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace sf = stockfighter;
+
+namespace {
+
+auto from_hex(const std::string& hex) -> std::vector<std::uint8_t>
+{
+    auto out = std::vector<std::uint8_t>{};
+    auto digits = std::string{};
+    for (const char c : hex) {
+        if (c != ' ') {
+            digits += c;
+        }
+    }
+    for (std::size_t i = 0; i + 1 < digits.size(); i += 2) {
+        out.push_back(std::uint8_t(std::stoi(digits.substr(i, 2), nullptr, 16)));
+    }
+    return out;
+}
+
+using headers = std::vector<std::pair<std::string, std::string>>;
+
+auto as_pairs(const std::vector<sf::http::header>& from) -> headers
+{
+    auto out = headers{};
+    for (const auto& h : from) {
+        out.emplace_back(h.name, h.value);
+    }
+    return out;
+}
+
+auto decode(sf::hpack::decoder& d, const std::string& hex) -> headers
+{
+    const auto bytes = from_hex(hex);
+    return as_pairs(d.decode(bytes.data(), bytes.size()));
+}
+
+// RFC 7541 appendix C.4: requests, with Huffman coding
+const headers c4_1 = {
+        {":method", "GET"},
+        {":scheme", "http"},
+        {":path", "/"},
+        {":authority", "www.example.com"}
+};
+const headers c4_2 = {
+        {":method", "GET"},
+        {":scheme", "http"},
+        {":path", "/"},
+        {":authority", "www.example.com"},
+        {"cache-control", "no-cache"}
+};
+const headers c4_3 = {
+        {":method", "GET"},
+        {":scheme", "https"},
+        {":path", "/index.html"},
+        {":authority", "www.example.com"},
+        {"custom-key", "custom-value"}
+};
+
+const char* const c4_1_hex = "8286 8441 8cf1 e3c2 e5f2 3a6b a0ab 90f4 ff";
+const char* const c4_2_hex = "8286 84be 5886 a8eb 1064 9cbf";
+const char* const c4_3_hex =
+        "8287 85bf 4088 25a8 49e9 5ba9 7d7f 8925 a849 e95b b8e8 b4bf";
+
+} // end anonymous namespace
+
+TEST_CASE("HPACK decodes the RFC 7541 request examples", "[hpack]")
+{
+    // One decoder for all three, as they build on each other's table entries
+    sf::hpack::decoder d;
+    REQUIRE(decode(d, c4_1_hex) == c4_1);
+    REQUIRE(decode(d, c4_2_hex) == c4_2);
+    REQUIRE(decode(d, c4_3_hex) == c4_3);
+}
+
+TEST_CASE("HPACK decodes the RFC 7541 response examples", "[hpack]")
+{
+    // Appendix C.6: responses, with Huffman coding and a 256 byte table, so
+    // that entries are evicted along the way
+    sf::hpack::decoder d{256};
+
+    REQUIRE(decode(d, "4882 6402 5885 aec3 771a 4b61 96d0 7abe"
+                      "9410 54d4 44a8 2005 9504 0b81 66e0 82a6"
+                      "2d1b ff6e 919d 29ad 1718 63c7 8f0b 97c8"
+                      "e9ae 82ae 43d3") ==
+            (headers{{":status", "302"},
+                     {"cache-control", "private"},
+                     {"date", "Mon, 21 Oct 2013 20:13:21 GMT"},
+                     {"location", "https://www.example.com"}}));
+
+    REQUIRE(decode(d, "4883 640e ffc1 c0bf") ==
+            (headers{{":status", "307"},
+                     {"cache-control", "private"},
+                     {"date", "Mon, 21 Oct 2013 20:13:21 GMT"},
+                     {"location", "https://www.example.com"}}));
+
+    REQUIRE(decode(d, "88c1 6196 d07a be94 1054 d444 a820 0595"
+                      "040b 8166 e084 a62d 1bff c05a 839b d9ab"
+                      "77ad 94e7 821d d7f2 e6c7 b335 dfdf cd5b"
+                      "3960 d5af 2708 7f36 72c1 ab27 0fb5 291f"
+                      "9587 3160 65c0 03ed 4ee5 b106 3d50 07") ==
+            (headers{{":status", "200"},
+                     {"cache-control", "private"},
+                     {"date", "Mon, 21 Oct 2013 20:13:22 GMT"},
+                     {"location", "https://www.example.com"},
+                     {"content-encoding", "gzip"},
+                     {"set-cookie", "foo=ASDJKHQKBZXOQWEOPIUAXQWEOIU; max-age=3600; version=1"}}));
+}
+
+TEST_CASE("HPACK encodes the RFC 7541 request examples", "[hpack]")
+{
+    sf::hpack::encoder e;
+
+    const std::pair<const headers*, const char*> examples[] = {
+            {&c4_1, c4_1_hex},
+            {&c4_2, c4_2_hex},
+            {&c4_3, c4_3_hex}
+    };
+    for (const auto& example : examples) {
+        auto in = std::vector<sf::http::header>{};
+        for (const auto& h : *example.first) {
+            in.push_back({h.first, h.second});
+        }
+        auto block = std::string{};
+        e.encode(block, in);
+        REQUIRE(std::vector<std::uint8_t>(block.begin(), block.end()) ==
+                from_hex(example.second));
+    }
+}
+
+TEST_CASE("HPACK rejects references past the end of the table", "[hpack]")
+{
+    sf::hpack::decoder d;
+    // Indexed header field 70, with nothing in the dynamic table
+    REQUIRE_THROWS_AS(decode(d, "c6"), const std::runtime_error&);
+}
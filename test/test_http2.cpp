@@ -0,0 +1,405 @@
+#include "http2.hpp"
+#include "tls_server.hpp"
+
+#include "catch.hpp"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace sf = stockfighter;
+
+namespace {
+
+constexpr std::uint8_t frame_data = 0x0;
+constexpr std::uint8_t frame_headers = 0x1;
+constexpr std::uint8_t frame_settings = 0x4;
+constexpr std::uint8_t frame_goaway = 0x7;
+constexpr std::uint8_t frame_window_update = 0x8;
+constexpr std::uint8_t frame_continuation = 0x9;
+
+constexpr std::uint8_t flag_end_stream = 0x1;
+constexpr std::uint8_t flag_ack = 0x1;
+constexpr std::uint8_t flag_end_headers = 0x4;
+
+constexpr std::uint16_t settings_max_concurrent_streams = 0x3;
+
+struct frame {
+    std::uint8_t type = 0;
+    std::uint8_t flags = 0;
+    std::uint32_t id = 0;
+    std::string payload;
+};
+
+auto u32(std::uint32_t n) -> std::string
+{
+    return {char(n >> 24), char(n >> 16), char(n >> 8), char(n)};
+}
+
+// The server's end of an HTTP/2 connection, driven a frame at a time by
+// the test
+class h2_peer {
+public:
+    explicit h2_peer(sf::test::tls_server::stream& s) : s_(s)
+    {
+        auto preface = std::string(24, '\0');
+        boost::asio::read(s_, boost::asio::buffer(&preface[0], preface.size()));
+        if (preface != "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n") {
+            throw std::runtime_error{"bad preface"};
+        }
+    }
+
+    auto read() -> frame
+    {
+        unsigned char h[9];
+        boost::asio::read(s_, boost::asio::buffer(h));
+        auto f = frame{};
+        f.type = h[3];
+        f.flags = h[4];
+        f.id = (std::uint32_t(h[5]) << 24 | h[6] << 16 | h[7] << 8 | h[8]) & 0x7fffffff;
+        f.payload.resize(h[0] << 16 | h[1] << 8 | h[2]);
+        if (!f.payload.empty()) {
+            boost::asio::read(s_, boost::asio::buffer(&f.payload[0], f.payload.size()));
+        }
+        return f;
+    }
+
+    // Skips anything else, such as the client's settings
+    auto read(std::uint8_t type) -> frame
+    {
+        while (true) {
+            auto f = read();
+            if (f.type == type) {
+                return f;
+            }
+        }
+    }
+
+    // The headers of the next request, following any CONTINUATIONs
+    auto read_headers(frame& first) -> std::vector<sf::http::header>
+    {
+        first = read(frame_headers);
+        auto block = first.payload;
+        auto flags = first.flags;
+        while (!(flags & flag_end_headers)) {
+            const auto f = read();
+            if (f.type != frame_continuation || f.id != first.id) {
+                throw std::runtime_error{"expected CONTINUATION"};
+            }
+            block += f.payload;
+            flags = f.flags;
+        }
+        return decoder_.decode(reinterpret_cast<const std::uint8_t*>(block.data()),
+                               block.size());
+    }
+
+    void write(std::uint8_t type, std::uint8_t flags, std::uint32_t id,
+               const std::string& payload = {})
+    {
+        const auto size = payload.size();
+        auto out = std::string{char(size >> 16), char(size >> 8), char(size),
+                               char(type), char(flags)};
+        out += u32(id);
+        out += payload;
+        boost::asio::write(s_, boost::asio::buffer(out));
+    }
+
+    void settings(std::uint16_t id = 0, std::uint32_t value = 0)
+    {
+        auto payload = std::string{};
+        if (id != 0) {
+            payload = {char(id >> 8), char(id)};
+            payload += u32(value);
+        }
+        write(frame_settings, 0, 0, payload);
+    }
+
+    auto encode(const std::vector<sf::http::header>& headers) -> std::string
+    {
+        auto block = std::string{};
+        encoder_.encode(block, headers);
+        return block;
+    }
+
+    // A 200 response with the body in a single DATA frame
+    void respond(std::uint32_t id, const std::string& body)
+    {
+        write(frame_headers, flag_end_headers, id, encode({{":status", "200"}}));
+        write(frame_data, flag_end_stream, id, body);
+    }
+
+    // Carries on reading until the client closes the connection
+    void drain()
+    {
+        while (true) {
+            read();
+        }
+    }
+
+private:
+    sf::test::tls_server::stream& s_;
+    sf::hpack::encoder encoder_;
+    sf::hpack::decoder decoder_;
+};
+
+// One http2_connection to a local server, with its own I/O thread.
+// Requests handed back for another connection are kept.
+struct h2_client {
+    explicit h2_client(unsigned short port)
+        : url("https://localhost:" + std::to_string(port))
+    {
+        sf::test::trust_localhost(ssl);
+        sf::net::pin_host("localhost", "127.0.0.1");
+
+        auto hooks = sf::net::http2_connection::hooks{};
+        hooks.not_supported = [] {};
+        hooks.resubmit = [this](sf::http::request req, sf::http::response_handler,
+                                sf::net::cancellation_token) {
+            std::lock_guard<std::mutex> lock{mutex};
+            resubmitted.push_back(req.uri.target);
+            resubmit_cv.notify_all();
+        };
+        conn = std::make_shared<sf::net::http2_connection>(
+                io, ssl, sf::http::parse_url(url), hooks);
+        conn->start();
+        thread = std::thread{[this] { io.run(); }};
+    }
+
+    ~h2_client()
+    {
+        work.reset();
+        io.stop();
+        thread.join();
+        sf::net::unpin_host("localhost");
+    }
+
+    auto send(const std::string& method, const std::string& target,
+              const std::string& body = {}) -> std::future<sf::http::response>
+    {
+        auto req = sf::http::request{};
+        req.method = method;
+        req.uri = sf::http::parse_url(url + target);
+        req.headers = {{"accept", "*/*"}};
+        req.body = body;
+        return send(std::move(req));
+    }
+
+    auto send(sf::http::request req) -> std::future<sf::http::response>
+    {
+        auto promise = std::make_shared<std::promise<sf::http::response>>();
+        auto future = promise->get_future();
+        conn->async_send(std::move(req), [promise](std::exception_ptr error,
+                                                   sf::http::response response) {
+            if (error) {
+                promise->set_exception(error);
+            } else {
+                promise->set_value(std::move(response));
+            }
+        }, sf::net::cancellation_token::never());
+        return future;
+    }
+
+    auto wait_for_resubmit(std::size_t count) -> std::vector<std::string>
+    {
+        std::unique_lock<std::mutex> lock{mutex};
+        resubmit_cv.wait_for(lock, std::chrono::seconds{5},
+                             [&] { return resubmitted.size() >= count; });
+        return resubmitted;
+    }
+
+    std::string url;
+    boost::asio::io_context io;
+    boost::asio::executor_work_guard<boost::asio::io_context::executor_type> work =
+            boost::asio::make_work_guard(io);
+    boost::asio::ssl::context ssl{boost::asio::ssl::context::tls_client};
+    std::shared_ptr<sf::net::http2_connection> conn;
+    std::thread thread;
+
+    std::mutex mutex;
+    std::condition_variable resubmit_cv;
+    std::vector<std::string> resubmitted;
+};
+
+template <typename T>
+auto ready(std::future<T>& f) -> bool
+{
+    return f.wait_for(std::chrono::seconds{5}) == std::future_status::ready;
+}
+
+} // end anonymous namespace
+
+TEST_CASE("Header blocks too big for one frame go in CONTINUATION frames", "[http2]")
+{
+    const auto big = std::string(40000, 'b');
+    std::promise<std::string> received;
+
+    sf::test::tls_server server{[&](sf::test::tls_server::stream& s) {
+        h2_peer peer{s};
+        peer.settings();
+
+        auto first = frame{};
+        auto value = std::string{};
+        for (const auto& h : peer.read_headers(first)) {
+            if (h.name == "x-big") {
+                value = h.value;
+            }
+        }
+        received.set_value(value);
+
+        // The response's headers come in three pieces
+        const auto block = peer.encode({{":status", "200"},
+                                        {"x-reply", std::string(300, 'r')}});
+        peer.write(frame_headers, 0, first.id, block.substr(0, 10));
+        peer.write(frame_continuation, 0, first.id, block.substr(10, 100));
+        peer.write(frame_continuation, flag_end_headers, first.id, block.substr(110));
+        peer.write(frame_data, flag_end_stream, first.id, "hello");
+        peer.drain();
+    }, true};
+
+    h2_client client{server.port()};
+    auto req = sf::http::request{};
+    req.method = "GET";
+    req.uri = sf::http::parse_url(client.url + "/big");
+    req.headers = {{"x-big", big}};
+    auto response = client.send(std::move(req));
+
+    REQUIRE(ready(response));
+    const auto r = response.get();
+    REQUIRE(r.status == 200);
+    REQUIRE(sf::http::find_header(r.headers, "x-reply"));
+    REQUIRE(*sf::http::find_header(r.headers, "x-reply") == std::string(300, 'r'));
+    REQUIRE(r.body == "hello");
+
+    auto value = received.get_future();
+    REQUIRE(value.get() == big);
+}
+
+TEST_CASE("Streams after the last one in a GOAWAY are resubmitted", "[http2]")
+{
+    sf::test::tls_server server{[&](sf::test::tls_server::stream& s) {
+        h2_peer peer{s};
+        peer.settings();
+
+        auto first = frame{};
+        auto second = frame{};
+        peer.read_headers(first);
+        peer.read_headers(second);
+
+        peer.write(frame_goaway, 0, 0, u32(first.id) + u32(0));
+        peer.respond(first.id, "first");
+        peer.drain();
+    }, true};
+
+    h2_client client{server.port()};
+    auto first = client.send("GET", "/first");
+    auto second = client.send("GET", "/second");
+
+    REQUIRE(ready(first));
+    REQUIRE(first.get().body == "first");
+    REQUIRE(client.wait_for_resubmit(1) == std::vector<std::string>{"/second"});
+    REQUIRE_FALSE(client.conn->usable());
+
+    // Anything sent from now on goes elsewhere too
+    client.send("GET", "/third");
+    REQUIRE(client.wait_for_resubmit(2) ==
+            (std::vector<std::string>{"/second", "/third"}));
+}
+
+TEST_CASE("A request body waits for WINDOW_UPDATE once the window is used up", "[http2]")
+{
+    // The initial windows are 65535 bytes, for the connection and the stream
+    auto body = std::string(65535 + 1000, 'x');
+    for (std::size_t i = 0; i < body.size(); ++i) {
+        body[i] = char('a' + i % 26);
+    }
+
+    std::promise<std::string> received;
+    std::size_t before_update = 0;
+    bool ended_early = false;
+
+    sf::test::tls_server server{[&](sf::test::tls_server::stream& s) {
+        h2_peer peer{s};
+        peer.settings();
+
+        auto headers = frame{};
+        peer.read_headers(headers);
+
+        auto data = std::string{};
+        while (data.size() < 65535) {
+            const auto f = peer.read(frame_data);
+            data += f.payload;
+            ended_early = ended_early || (f.flags & flag_end_stream);
+        }
+        before_update = data.size();
+
+        // Opening the connection's window isn't enough by itself
+        peer.write(frame_window_update, 0, 0, u32(1000));
+        peer.write(frame_window_update, 0, headers.id, u32(1000));
+
+        while (true) {
+            const auto f = peer.read(frame_data);
+            data += f.payload;
+            if (f.flags & flag_end_stream) {
+                break;
+            }
+        }
+        received.set_value(data);
+
+        peer.respond(headers.id, "ok");
+        peer.drain();
+    }, true};
+
+    h2_client client{server.port()};
+    auto response = client.send("POST", "/orders", body);
+
+    REQUIRE(ready(response));
+    REQUIRE(response.get().body == "ok");
+    REQUIRE(received.get_future().get() == body);
+    REQUIRE(before_update == 65535);
+    REQUIRE_FALSE(ended_early);
+}
+
+TEST_CASE("A server allowing no streams has its connection retired", "[http2]")
+{
+    std::promise<void> acked;
+    std::promise<void> go_on;
+
+    sf::test::tls_server server{[&](sf::test::tls_server::stream& s) {
+        h2_peer peer{s};
+
+        auto first = frame{};
+        peer.read_headers(first);
+        peer.settings(settings_max_concurrent_streams, 0);
+        while (true) {
+            const auto f = peer.read(frame_settings);
+            if (f.flags & flag_ack) {
+                break;
+            }
+        }
+        acked.set_value();
+
+        go_on.get_future().wait_for(std::chrono::seconds{5});
+        peer.respond(first.id, "first");
+        peer.drain();
+    }, true};
+
+    h2_client client{server.port()};
+    auto first = client.send("GET", "/first");
+    REQUIRE(acked.get_future().wait_for(std::chrono::seconds{5}) ==
+            std::future_status::ready);
+
+    REQUIRE_FALSE(client.conn->usable());
+    client.send("GET", "/second");
+    REQUIRE(client.wait_for_resubmit(1) == std::vector<std::string>{"/second"});
+
+    // The stream already open is still answered
+    go_on.set_value();
+    REQUIRE(ready(first));
+    REQUIRE(first.get().body == "first");
+}
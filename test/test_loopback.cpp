@@ -0,0 +1,839 @@
+
+#include <stockfighter/api.hpp>
+#include <stockfighter/game.hpp>
+#include <stockfighter/monitor.hpp>
+#include <stockfighter/net.hpp>
+#include <stockfighter/transport.hpp>
+
+#include "catch.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace sf = stockfighter;
+
+namespace {
+
+// Canned responses keyed by request target, so these tests run without a
+// network connection
+struct fake_exchange {
+    std::map<std::string, std::string> replies;
+    std::vector<sf::http::request> received;
+    int status = 200;
+
+    auto operator()(const sf::http::request& req) -> sf::http::response
+    {
+        received.push_back(req);
+
+        auto response = sf::http::response{};
+        response.status = status;
+        const auto it = replies.find(req.uri.target);
+        response.body = it != replies.end() ? it->second : R"({"ok":true})";
+        return response;
+    }
+};
+
+// Installs a loopback transport for the duration of a test
+struct loopback_guard {
+    std::shared_ptr<fake_exchange> exchange = std::make_shared<fake_exchange>();
+
+    loopback_guard()
+    {
+        auto ex = exchange;
+        sf::net::set_transport(std::make_shared<sf::net::loopback_transport>(
+                [ex](const sf::http::request& req) { return (*ex)(req); }));
+    }
+
+    ~loopback_guard() { sf::net::set_transport(nullptr); }
+};
+
+// Never answers, but notices when a request is abandoned
+struct stalled_transport : sf::net::transport {
+    std::atomic<int> abandoned{0};
+
+    auto send(const sf::http::request&) -> sf::http::response override
+    {
+        throw std::logic_error{"unexpected"};
+    }
+
+    auto send_pipelined(const std::vector<sf::http::request>&)
+            -> std::vector<sf::http::response> override
+    {
+        throw std::logic_error{"unexpected"};
+    }
+
+    void async_send(sf::http::request, sf::http::response_handler handler,
+                    const sf::net::cancellation_token& token) override
+    {
+        token.on_cancel([this, handler] {
+            ++abandoned;
+            handler(std::make_exception_ptr(std::runtime_error{"abandoned"}), {});
+        });
+    }
+};
+
+// Answers everything with {"ok":true}, unless told otherwise, keeping the
+// requests as they came
+struct recording_transport : sf::net::transport {
+    std::map<std::string, std::string> replies;
+    std::vector<sf::http::request> received;
+
+    auto send(const sf::http::request& req) -> sf::http::response override
+    {
+        received.push_back(req);
+        auto response = sf::http::response{};
+        response.status = 200;
+        const auto it = replies.find(req.uri.target);
+        response.body = it != replies.end() ? it->second : R"({"ok":true})";
+        return response;
+    }
+
+    auto send_pipelined(const std::vector<sf::http::request>& reqs)
+            -> std::vector<sf::http::response> override
+    {
+        auto responses = std::vector<sf::http::response>{};
+        for (const auto& req : reqs) {
+            responses.push_back(send(req));
+        }
+        return responses;
+    }
+
+    void async_send(sf::http::request req, sf::http::response_handler handler,
+                    const sf::net::cancellation_token&) override
+    {
+        handler(nullptr, send(req));
+    }
+};
+
+// Also notes what it was asked to warm up
+struct warming_transport : recording_transport {
+    std::vector<std::pair<std::string, int>> warmed;
+
+    void async_warm_up(const sf::http::url& host, int connections,
+                       std::function<void()> done) override
+    {
+        warmed.emplace_back(host.host, connections);
+        done();
+    }
+};
+
+// Holds on to asynchronous requests until told to answer the oldest
+struct held_transport : recording_transport {
+    std::mutex mutex;
+    std::vector<std::pair<sf::http::request, sf::http::response_handler>> held;
+    int limit = 0;
+
+    auto max_in_flight_per_host() const -> int override { return limit; }
+
+    void async_send(sf::http::request req, sf::http::response_handler handler,
+                    const sf::net::cancellation_token&) override
+    {
+        std::lock_guard<std::mutex> lock{mutex};
+        held.emplace_back(std::move(req), std::move(handler));
+    }
+
+    auto methods_sent() -> std::vector<std::string>
+    {
+        std::lock_guard<std::mutex> lock{mutex};
+        auto methods = std::vector<std::string>{};
+        for (const auto& h : held) {
+            methods.push_back(h.first.method);
+        }
+        return methods;
+    }
+
+    void answer(std::size_t index)
+    {
+        auto handler = sf::http::response_handler{};
+        auto req = sf::http::request{};
+        {
+            std::lock_guard<std::mutex> lock{mutex};
+            req = held[index].first;
+            handler = held[index].second;
+        }
+        handler(nullptr, send(req));
+    }
+};
+
+// Answers at once, except for one request which it holds on to until
+// that request is cancelled
+struct stalling_transport : recording_transport {
+    std::mutex mutex;
+    int calls = 0;
+    int stall = -1;
+    std::atomic<bool> stalled_cancelled{false};
+
+    // The next request made is the one held
+    void stall_next()
+    {
+        std::lock_guard<std::mutex> lock{mutex};
+        stall = calls;
+    }
+
+    void async_send(sf::http::request req, sf::http::response_handler handler,
+                    const sf::net::cancellation_token& token) override
+    {
+        auto response = sf::http::response{};
+        {
+            std::lock_guard<std::mutex> lock{mutex};
+            if (calls++ == stall) {
+                token.on_cancel([this, handler] {
+                    stalled_cancelled = true;
+                    handler(std::make_exception_ptr(std::runtime_error{"abandoned"}), {});
+                });
+                return;
+            }
+            response = send(req);
+        }
+        handler(nullptr, std::move(response));
+    }
+};
+
+const std::string order_json = R"({
+    "ok": true, "symbol": "FOOBAR", "venue": "TESTEX", "direction": "buy",
+    "originalQty": 10, "qty": 4, "price": 5100, "orderType": "limit",
+    "id": 42, "account": "EXB123456", "ts": "2015-12-04T09:02:16.680986205Z",
+    "fills": [{"price": 5050, "qty": 6, "ts": "2015-12-04T09:02:16.680986205Z"}],
+    "totalFilled": 6, "open": true
+})";
+
+} // end anon namespace
+
+TEST_CASE("Requests can be served by a loopback transport", "[loopback]")
+{
+    loopback_guard guard;
+
+    REQUIRE(sf::api::heartbeat());
+
+    REQUIRE(guard.exchange->received.size() == 1);
+    const auto& req = guard.exchange->received.front();
+    REQUIRE(req.method == "GET");
+    REQUIRE(req.uri.host == "api.stockfighter.io");
+    REQUIRE(req.uri.target == "/ob/api/heartbeat");
+}
+
+TEST_CASE("Loopback responses are parsed", "[loopback]")
+{
+    loopback_guard guard;
+    guard.exchange->replies["/ob/api/venues/TESTEX/stocks"] =
+            R"({"ok":true,"symbols":[{"name":"Foreign Owned Occluded Bridge","symbol":"FOOBAR"}]})";
+
+    const auto stocks = sf::api::get_stocks("TESTEX");
+    REQUIRE(stocks.size() == 1);
+    REQUIRE(stocks[0].symbol == "FOOBAR");
+    REQUIRE(stocks[0].name == "Foreign Owned Occluded Bridge");
+}
+
+TEST_CASE("Orders are sent as JSON with the API key", "[loopback]")
+{
+    loopback_guard guard;
+    guard.exchange->replies["/ob/api/venues/TESTEX/stocks/FOOBAR/orders"] = order_json;
+
+    const auto status = sf::api::place_order("KEY", "EXB123456", "TESTEX",
+                                             "FOOBAR", 5100, 10,
+                                             sf::direction::buy,
+                                             sf::order_type::limit);
+    REQUIRE(status.id == 42);
+    REQUIRE(status.total_filled == 6);
+    REQUIRE(status.fills.size() == 1);
+    REQUIRE(status.fills[0].price == 5050);
+
+    const auto& req = guard.exchange->received.front();
+    REQUIRE(req.method == "POST");
+    const auto key = sf::http::find_header(req.headers, "x-starfighter-authorization");
+    REQUIRE(key != nullptr);
+    REQUIRE(*key == "KEY");
+    REQUIRE(req.body.find(R"("orderType":"limit")") != std::string::npos);
+    REQUIRE(req.body.find(R"("qty":10)") != std::string::npos);
+}
+
+TEST_CASE("Errors reported by the server become exceptions", "[loopback]")
+{
+    loopback_guard guard;
+
+    SECTION("Bad status")
+    {
+        guard.exchange->status = 404;
+        REQUIRE_THROWS(sf::api::heartbeat());
+    }
+
+    SECTION("Error message in the body")
+    {
+        guard.exchange->replies["/ob/api/venues/XXXX/heartbeat"] =
+                R"({"ok":false,"error":"No venue exists with the symbol XXXX"})";
+        REQUIRE_THROWS(sf::api::venue_heartbeat("XXXX"));
+    }
+}
+
+TEST_CASE("Errors can be returned rather than thrown", "[loopback]")
+{
+    loopback_guard guard;
+
+    SECTION("Success")
+    {
+        guard.exchange->replies["/ob/api/venues/TESTEX/stocks/FOOBAR/orders"] = order_json;
+        const auto status = sf::api::place_order(std::nothrow, "KEY", "EXB123456",
+                                                 "TESTEX", "FOOBAR", 5100, 10,
+                                                 sf::direction::buy,
+                                                 sf::order_type::limit);
+        REQUIRE(status);
+        REQUIRE(status->id == 42);
+    }
+
+    SECTION("Rejected")
+    {
+        guard.exchange->replies["/ob/api/venues/TESTEX/stocks/FOOBAR/orders/42"] =
+                R"({"ok":false,"error":"Order 42 is not open"})";
+        const auto status = sf::api::cancel_order(std::nothrow, "KEY", "TESTEX",
+                                                  "FOOBAR", 42);
+        REQUIRE_FALSE(status);
+        REQUIRE(status.error().code == sf::errc::rejected);
+        REQUIRE(status.error().message == "Order 42 is not open");
+        REQUIRE_THROWS_AS(status.value(), const sf::call_failed&);
+    }
+
+    SECTION("Bad status")
+    {
+        guard.exchange->status = 503;
+        guard.exchange->replies["/ob/api/heartbeat"] = "Service Unavailable";
+        const auto ok = sf::api::heartbeat(std::nothrow);
+        REQUIRE_FALSE(ok);
+        REQUIRE(ok.error().code == sf::errc::bad_status);
+        REQUIRE(ok.error().status == 503);
+    }
+
+    SECTION("Malformed response")
+    {
+        guard.exchange->replies["/ob/api/venues/TESTEX/stocks/FOOBAR/quote"] = R"({"ok":true})";
+        const auto q = sf::api::get_quote(std::nothrow, "TESTEX", "FOOBAR");
+        REQUIRE_FALSE(q);
+        REQUIRE(q.error().code == sf::errc::bad_response);
+    }
+}
+
+TEST_CASE("Several orders can be placed at once", "[loopback]")
+{
+    loopback_guard guard;
+    guard.exchange->replies["/ob/api/venues/TESTEX/stocks/FOOBAR/orders"] = order_json;
+    guard.exchange->replies["/ob/api/venues/TESTEX/stocks/BADSYM/orders"] =
+            R"({"ok":false,"error":"symbol BADSYM does not exist"})";
+
+    auto order = sf::order_request{"EXB123456", "TESTEX", "FOOBAR", 5100, 10};
+    auto orders = std::vector<sf::order_request>{order, order, order};
+    orders[1].stock = "BADSYM";
+    orders[2].price = 5000;
+    orders[2].dir = sf::direction::sell;
+
+    const auto results = sf::api::place_orders("KEY", orders);
+
+    REQUIRE(results.size() == 3);
+    REQUIRE(results[0]);
+    REQUIRE(results[0]->id == 42);
+    REQUIRE_FALSE(results[1]);
+    REQUIRE(results[1].error().code == sf::errc::rejected);
+    REQUIRE(results[2]);
+
+    const auto& received = guard.exchange->received;
+    REQUIRE(received.size() == 3);
+    REQUIRE(received[1].uri.target == "/ob/api/venues/TESTEX/stocks/BADSYM/orders");
+    REQUIRE(received[2].body.find(R"("direction":"sell")") != std::string::npos);
+    REQUIRE(received[2].body.find(R"("price":5000)") != std::string::npos);
+}
+
+TEST_CASE("Orders for a venue the monitor has seen go down fail at once", "[loopback][monitor]")
+{
+    // Called from the monitor's thread as well as this one
+    std::atomic<bool> venue_up{true};
+    std::atomic<int> orders{0};
+    sf::net::set_transport(std::make_shared<sf::net::loopback_transport>(
+            [&](const sf::http::request& req) {
+                auto response = sf::http::response{};
+                response.status = 200;
+                if (req.method == "POST") {
+                    ++orders;
+                    response.body = order_json;
+                } else if (venue_up) {
+                    response.body = R"({"ok":true,"venue":"MONEX"})";
+                } else {
+                    response.status = 500;
+                }
+                return response;
+            }));
+
+    auto options = sf::monitor_options{};
+    options.interval = std::chrono::milliseconds{5};
+
+    const auto wait_for = [](auto condition) {
+        const auto give_up = std::chrono::steady_clock::now() + std::chrono::seconds{5};
+        while (!condition() && std::chrono::steady_clock::now() < give_up) {
+            std::this_thread::sleep_for(std::chrono::milliseconds{1});
+        }
+        return condition();
+    };
+    const auto place = [] {
+        return sf::api::place_order(std::nothrow, "KEY", "EXB123456", "MONEX",
+                                    "FOOBAR", 5100, 10, sf::direction::buy,
+                                    sf::order_type::limit);
+    };
+
+    {
+        sf::venue_monitor monitor{{"MONEX"}, options};
+        REQUIRE(wait_for([] {
+            return sf::get_venue_health("MONEX").last_success.time_since_epoch().count() != 0;
+        }));
+        REQUIRE(sf::get_venue_health("MONEX").monitored);
+        REQUIRE(sf::get_venue_health("MONEX").up);
+        REQUIRE(place());
+
+        venue_up = false;
+        REQUIRE(wait_for([] { return !sf::get_venue_health("MONEX").up; }));
+        const auto status = place();
+        REQUIRE_FALSE(status);
+        REQUIRE(status.error().code == sf::errc::venue_down);
+
+        // Asynchronous calls fail on the I/O threads, like any other
+        auto failed = std::promise<std::exception_ptr>{};
+        auto failed_on = std::thread::id{};
+        sf::api::async_place_order("KEY", "EXB123456", "MONEX", "FOOBAR", 5100, 10,
+                                   sf::direction::buy, sf::order_type::limit,
+                                   [&](std::exception_ptr error, sf::order_status) {
+                                       failed_on = std::this_thread::get_id();
+                                       failed.set_value(error);
+                                   });
+        REQUIRE(failed.get_future().get());
+        REQUIRE(failed_on != std::this_thread::get_id());
+        REQUIRE(orders == 1);
+
+        venue_up = true;
+        REQUIRE(wait_for([] { return sf::get_venue_health("MONEX").up; }));
+        REQUIRE(place());
+    }
+
+    // Once nothing is watching, orders are sent regardless
+    REQUIRE_FALSE(sf::get_venue_health("MONEX").monitored);
+    venue_up = false;
+    REQUIRE(place());
+    REQUIRE(orders == 3);
+    sf::net::set_transport(nullptr);
+}
+
+TEST_CASE("Asynchronous calls complete through the loopback", "[loopback]")
+{
+    loopback_guard guard;
+    guard.exchange->replies["/ob/api/venues/TESTEX/stocks/FOOBAR/orders/42"] = order_json;
+
+    auto called = false;
+    sf::api::async_get_order_status("KEY", "TESTEX", "FOOBAR", 42,
+                                    [&](std::exception_ptr error,
+                                        sf::order_status status) {
+        called = true;
+        REQUIRE_FALSE(error);
+        REQUIRE(status.account == "EXB123456");
+    });
+    REQUIRE(called);
+
+    guard.exchange->status = 500;
+    auto future = sf::api::async_heartbeat();
+    REQUIRE_THROWS(future.get());
+}
+
+TEST_CASE("Recent GET results can be shared", "[loopback][coalescing]")
+{
+    loopback_guard guard;
+    guard.exchange->replies["/ob/api/venues/TESTEX/stocks"] =
+            R"({"ok":true,"symbols":[{"name":"Foo","symbol":"FOOBAR"}]})";
+
+    auto options = sf::net::coalescing_options{};
+    options.enabled = true;
+    options.max_staleness = std::chrono::minutes{1};
+    sf::net::set_coalescing(sf::net::endpoint::stocks, options);
+
+    REQUIRE(sf::api::get_stocks("TESTEX").size() == 1);
+    REQUIRE(sf::api::async_get_stocks("TESTEX").get().size() == 1);
+    REQUIRE(guard.exchange->received.size() == 1);
+
+    // Only GETs for the same URL share results
+    sf::api::heartbeat();
+    REQUIRE(guard.exchange->received.size() == 2);
+
+    sf::net::set_coalescing(sf::net::endpoint::stocks, {});
+    sf::api::get_stocks("TESTEX");
+    REQUIRE(guard.exchange->received.size() == 3);
+}
+
+TEST_CASE("Requests answered promptly aren't hedged", "[loopback][hedging]")
+{
+    auto transport = std::make_shared<stalling_transport>();
+    sf::net::set_transport(transport);
+
+    auto options = sf::net::hedging_options{};
+    options.enabled = true;
+    options.min_delay = std::chrono::milliseconds{50};
+    sf::net::set_hedging(sf::net::endpoint::heartbeat, options);
+
+    const auto before = sf::net::get_hedging_stats();
+    for (int i = 0; i < 40; ++i) {
+        REQUIRE(sf::api::heartbeat());
+    }
+    const auto after = sf::net::get_hedging_stats();
+
+    REQUIRE(after.requests - before.requests == 40);
+    REQUIRE(after.hedges_sent == before.hedges_sent);
+    REQUIRE(transport->received.size() == 40);
+
+    sf::net::set_hedging(sf::net::endpoint::heartbeat, {});
+    sf::net::set_transport(nullptr);
+}
+
+TEST_CASE("A stalled request is hedged, and the original cancelled", "[loopback][hedging]")
+{
+    auto transport = std::make_shared<stalling_transport>();
+    transport->replies["/ob/api/venues/TESTEX/heartbeat"] = R"({"ok":true,"venue":"TESTEX"})";
+    sf::net::set_transport(transport);
+
+    auto options = sf::net::hedging_options{};
+    options.enabled = true;
+    options.min_delay = std::chrono::milliseconds{1};
+    sf::net::set_hedging(sf::net::endpoint::venue_heartbeat, options);
+
+    // Enough prompt answers for the hedger to know what to expect
+    for (int i = 0; i < 20; ++i) {
+        REQUIRE(sf::api::venue_heartbeat("TESTEX"));
+    }
+
+    transport->stall_next();
+    const auto before = sf::net::get_hedging_stats();
+    REQUIRE(sf::api::venue_heartbeat("TESTEX"));
+    const auto after = sf::net::get_hedging_stats();
+
+    REQUIRE(after.hedges_sent - before.hedges_sent == 1);
+    REQUIRE(after.hedges_won - before.hedges_won == 1);
+    REQUIRE(transport->stalled_cancelled);
+
+    sf::net::set_hedging(sf::net::endpoint::venue_heartbeat, {});
+    sf::net::set_transport(nullptr);
+}
+
+TEST_CASE("Heartbeats held back by the rate limiter don't count against the venue", "[loopback][monitor]")
+{
+    std::atomic<int> heartbeats{0};
+    sf::net::set_transport(std::make_shared<sf::net::loopback_transport>(
+            [&](const sf::http::request&) {
+                ++heartbeats;
+                auto response = sf::http::response{};
+                response.status = 200;
+                response.body = R"({"ok":true,"venue":"LIMEX"})";
+                return response;
+            }));
+
+    // Every class has to leave the whole bucket behind, so every heartbeat
+    // is turned away at once
+    auto limit = sf::net::rate_limit_options{};
+    limit.enabled = true;
+    limit.requests_per_second = 0.001;
+    limit.burst = 3;
+    limit.reserve.fill(3);
+    limit.max_wait.fill(std::chrono::milliseconds{0});
+    sf::net::set_rate_limit(limit);
+
+    auto options = sf::monitor_options{};
+    options.interval = std::chrono::milliseconds{5};
+    options.failures_before_down = 1;
+
+    {
+        sf::venue_monitor monitor{{"LIMEX"}, options};
+        std::this_thread::sleep_for(std::chrono::milliseconds{50});
+
+        const auto health = sf::get_venue_health("LIMEX");
+        REQUIRE(health.monitored);
+        REQUIRE(health.up);
+        REQUIRE(health.failures == 0);
+        REQUIRE(heartbeats == 0);
+    }
+
+    sf::net::set_rate_limit({});
+    sf::net::set_transport(nullptr);
+}
+
+TEST_CASE("Low priority requests are held back by the rate limiter", "[loopback][rate_limit]")
+{
+    loopback_guard guard;
+    guard.exchange->replies["/ob/api/venues/TESTEX/stocks/FOOBAR/orders"] = order_json;
+    guard.exchange->replies["/ob/api/venues/TESTEX/stocks/FOOBAR/orders/42"] = order_json;
+
+    // A bucket which effectively never refills
+    auto options = sf::net::rate_limit_options{};
+    options.enabled = true;
+    options.requests_per_second = 0.001;
+    options.burst = 3;
+    options.reserve = {{0, 1, 2, 3}};
+    options.max_wait = {{std::chrono::milliseconds::max(),
+                         std::chrono::milliseconds::max(),
+                         std::chrono::milliseconds{0},
+                         std::chrono::milliseconds{0}}};
+    sf::net::set_rate_limit(options);
+
+    REQUIRE_THROWS_AS(sf::api::get_orderbook("TESTEX", "FOOBAR"),
+                      const sf::net::rate_limited&);
+    REQUIRE(sf::api::cancel_order("KEY", "TESTEX", "FOOBAR", 42).id == 42);
+    REQUIRE_THROWS_AS(sf::api::get_order_status("KEY", "TESTEX", "FOOBAR", 42),
+                      const sf::net::rate_limited&);
+    REQUIRE(sf::api::place_order("KEY", "EXB123456", "TESTEX", "FOOBAR", 1, 1,
+                                 sf::direction::buy,
+                                 sf::order_type::limit).id == 42);
+
+    REQUIRE(guard.exchange->received.size() == 2);
+    REQUIRE(sf::net::rate_limit_budget() < 1.1);
+
+    sf::net::set_rate_limit({});
+    REQUIRE(sf::api::heartbeat());
+}
+
+TEST_CASE("Batches take all of their tokens at once or none of them", "[loopback][rate_limit]")
+{
+    loopback_guard guard;
+    guard.exchange->replies["/ob/api/venues/TESTEX/stocks/FOOBAR/orders"] = order_json;
+
+    // Start from a full bucket, which then effectively never refills
+    auto options = sf::net::rate_limit_options{};
+    options.enabled = true;
+    options.requests_per_second = 1e6;
+    options.burst = 3;
+    options.reserve = {{0, 0, 0, 0}};
+    options.max_wait.fill(std::chrono::milliseconds{0});
+    sf::net::set_rate_limit(options);
+    std::this_thread::sleep_for(std::chrono::milliseconds{1});
+    options.requests_per_second = 0.001;
+    sf::net::set_rate_limit(options);
+
+    const auto order = sf::order_request{"EXB123456", "TESTEX", "FOOBAR", 5100, 10};
+    REQUIRE(sf::api::place_orders("KEY", {order}).front());
+
+    // Two tokens left isn't enough for three orders, and none are used up
+    const auto dropped = sf::api::place_orders("KEY", {order, order, order});
+    REQUIRE(dropped.size() == 3);
+    for (const auto& r : dropped) {
+        REQUIRE_FALSE(r);
+    }
+    REQUIRE(guard.exchange->received.size() == 1);
+    REQUIRE(sf::net::rate_limit_budget() > 1.9);
+
+    const auto placed = sf::api::place_orders("KEY", {order, order});
+    REQUIRE(placed.size() == 2);
+    REQUIRE(placed[0]);
+    REQUIRE(placed[1]);
+    REQUIRE(guard.exchange->received.size() == 3);
+    REQUIRE(sf::net::rate_limit_budget() < 0.1);
+
+    sf::net::set_rate_limit({});
+}
+
+TEST_CASE("Heartbeats aren't held back with market data", "[loopback][rate_limit]")
+{
+    loopback_guard guard;
+    guard.exchange->replies["/ob/api/venues/TESTEX/heartbeat"] =
+            R"({"ok": true, "venue": "TESTEX"})";
+
+    // Start from a full bucket, which then effectively never refills
+    auto options = sf::net::rate_limit_options{};
+    options.enabled = true;
+    options.requests_per_second = 1e6;
+    options.burst = 3;
+    options.reserve = {{0, 1, 2, 3}};
+    options.max_wait.fill(std::chrono::milliseconds{0});
+    sf::net::set_rate_limit(options);
+    std::this_thread::sleep_for(std::chrono::milliseconds{1});
+    options.requests_per_second = 0.001;
+    sf::net::set_rate_limit(options);
+
+    REQUIRE_THROWS_AS(sf::api::get_orderbook("TESTEX", "FOOBAR"),
+                      const sf::net::rate_limited&);
+    REQUIRE(sf::api::venue_heartbeat("TESTEX"));
+
+    sf::net::set_rate_limit({});
+}
+
+TEST_CASE("Cancels go ahead of queued market data, and late market data is dropped", "[loopback][scheduler]")
+{
+    auto transport = std::make_shared<held_transport>();
+    transport->replies["/ob/api/venues/TESTEX/stocks/FOOBAR/orders/42"] = order_json;
+    transport->replies["/ob/api/venues/TESTEX/stocks/FOOBAR"] =
+            R"({"ok": true, "bids": [], "asks": [], "ts": "2015-12-04T09:02:16.680986205Z"})";
+    sf::net::set_transport(transport);
+
+    auto options = sf::net::scheduler_options{};
+    options.enabled = true;
+    options.max_in_flight_per_host = 1;
+    sf::net::set_scheduler_options(options);
+
+    auto hasty = sf::net::call_options{};
+    hasty.timeout = std::chrono::milliseconds{10};
+
+    auto first = sf::api::async_get_orderbook("TESTEX", "FOOBAR");
+    auto late = sf::api::async_get_orderbook("TESTEX", "FOOBAR", hasty);
+    auto second = sf::api::async_get_orderbook("TESTEX", "FOOBAR");
+    auto cancel = sf::api::async_cancel_order("KEY", "TESTEX", "FOOBAR", 42);
+    REQUIRE(transport->methods_sent() == std::vector<std::string>{"GET"});
+
+    REQUIRE_THROWS_AS(late.get(), const sf::net::timed_out&);
+
+    transport->answer(0);
+    REQUIRE(transport->methods_sent() == (std::vector<std::string>{"GET", "DELETE"}));
+    transport->answer(1);
+    REQUIRE(transport->methods_sent() ==
+            (std::vector<std::string>{"GET", "DELETE", "GET"}));
+    transport->answer(2);
+
+    REQUIRE(first.get().venue == "TESTEX");
+    REQUIRE(cancel.get().id == 42);
+    REQUIRE(second.get().venue == "TESTEX");
+
+    sf::net::set_scheduler_options({});
+    sf::net::set_transport(nullptr);
+}
+
+TEST_CASE("The scheduler is off unless enabled, and then follows the transport's limit", "[loopback][scheduler]")
+{
+    auto transport = std::make_shared<held_transport>();
+    transport->replies["/ob/api/venues/TESTEX/stocks/FOOBAR"] =
+            R"({"ok": true, "bids": [], "asks": [], "ts": "2015-12-04T09:02:16.680986205Z"})";
+    transport->limit = 1;
+    sf::net::set_transport(transport);
+
+    auto first = sf::api::async_get_orderbook("TESTEX", "FOOBAR");
+    auto second = sf::api::async_get_orderbook("TESTEX", "FOOBAR");
+    REQUIRE(transport->methods_sent().size() == 2);
+    transport->answer(0);
+    transport->answer(1);
+    REQUIRE(first.get().venue == "TESTEX");
+    REQUIRE(second.get().venue == "TESTEX");
+
+    auto options = sf::net::scheduler_options{};
+    options.enabled = true;
+    sf::net::set_scheduler_options(options);
+
+    first = sf::api::async_get_orderbook("TESTEX", "FOOBAR");
+    second = sf::api::async_get_orderbook("TESTEX", "FOOBAR");
+    REQUIRE(transport->methods_sent().size() == 3);
+    transport->answer(2);
+    REQUIRE(transport->methods_sent().size() == 4);
+    transport->answer(3);
+    REQUIRE(first.get().venue == "TESTEX");
+    REQUIRE(second.get().venue == "TESTEX");
+
+    sf::net::set_scheduler_options({});
+    sf::net::set_transport(nullptr);
+}
+
+TEST_CASE("Compressed responses are requested unless disabled", "[loopback][compression]")
+{
+    loopback_guard guard;
+
+    REQUIRE(sf::api::heartbeat());
+    const auto* accept = sf::http::find_header(guard.exchange->received.back().headers,
+                                               "Accept-Encoding");
+    REQUIRE(accept != nullptr);
+    REQUIRE(*accept == "gzip, deflate");
+
+    sf::net::set_compression(false);
+    REQUIRE(sf::api::heartbeat());
+    sf::net::set_compression(true);
+
+    REQUIRE(sf::http::find_header(guard.exchange->received.back().headers,
+                                  "Accept-Encoding") == nullptr);
+}
+
+TEST_CASE("Requests share pre-built common headers", "[loopback]")
+{
+    auto transport = std::make_shared<recording_transport>();
+    sf::net::set_transport(transport);
+
+    REQUIRE(sf::api::heartbeat());
+    REQUIRE(sf::api::heartbeat());
+    sf::net::set_transport(nullptr);
+
+    REQUIRE(transport->received.size() == 2);
+    const auto& first = transport->received[0];
+    const auto& second = transport->received[1];
+    REQUIRE(first.common != nullptr);
+    REQUIRE(first.common == second.common);
+    REQUIRE(first.common->serialised.find("Host: api.stockfighter.io\r\n") == 0);
+    REQUIRE(sf::http::find_header(sf::http::all_headers(first), "Accept-Encoding") != nullptr);
+}
+
+TEST_CASE("Starting a level warms up the connections to its venues", "[loopback]")
+{
+    auto transport = std::make_shared<warming_transport>();
+    transport->replies["/gm/levels/first_steps"] = R"({
+        "ok": true, "account": "EXB123456", "instanceId": 7,
+        "secondsPerTradingDay": 5, "tickers": ["FOOBAR"],
+        "venues": ["TESTEX", "OTHEREX"]
+    })";
+    sf::net::set_transport(transport);
+
+    const auto info = sf::game::start_level("key", 1);
+    sf::net::set_transport(nullptr);
+
+    REQUIRE(info.venues.size() == 2);
+    REQUIRE(transport->warmed.size() == 1);
+    REQUIRE(transport->warmed[0].first == "api.stockfighter.io");
+    REQUIRE(transport->warmed[0].second ==
+            sf::net::get_pool_options().max_connections_per_host);
+
+    auto targets = std::vector<std::string>{};
+    for (const auto& req : transport->received) {
+        targets.push_back(req.uri.target);
+    }
+    REQUIRE(targets.size() == 3);
+    REQUIRE(std::count(targets.begin(), targets.end(),
+                       "/ob/api/venues/TESTEX/heartbeat") == 1);
+    REQUIRE(std::count(targets.begin(), targets.end(),
+                       "/ob/api/venues/OTHEREX/heartbeat") == 1);
+}
+
+TEST_CASE("Requests fail with timed_out once their deadline passes", "[loopback][deadline]")
+{
+    auto transport = std::make_shared<stalled_transport>();
+    sf::net::set_transport(transport);
+
+    auto opts = sf::net::call_options{};
+    opts.timeout = std::chrono::milliseconds{20};
+
+    const auto start = std::chrono::steady_clock::now();
+    REQUIRE_THROWS_AS(sf::api::get_quote("TESTEX", "FOOBAR", opts),
+                      const sf::net::timed_out&);
+    REQUIRE(std::chrono::steady_clock::now() - start < std::chrono::seconds{5});
+    REQUIRE(transport->abandoned == 1);
+
+    sf::net::set_transport(nullptr);
+}
+
+TEST_CASE("Cancelling a token withdraws its requests", "[loopback][deadline]")
+{
+    auto transport = std::make_shared<stalled_transport>();
+    sf::net::set_transport(transport);
+
+    auto token = sf::net::cancellation_token{};
+    auto opts = sf::net::call_options{};
+    opts.token = token;
+    auto third = sf::api::async_get_quote("TESTEX", "FOOBAR", opts);
+    auto fourth = sf::api::async_get_orderbook("TESTEX", "FOOBAR", opts);
+    token.cancel();
+
+    REQUIRE_THROWS_AS(third.get(), const sf::net::cancelled&);
+    REQUIRE_THROWS_AS(fourth.get(), const sf::net::cancelled&);
+    REQUIRE(transport->abandoned == 2);
+
+    // Cancelling before the call fails it straight away
+    REQUIRE_THROWS_AS(sf::api::heartbeat(opts), const sf::net::cancelled&);
+
+    sf::net::set_transport(nullptr);
+}
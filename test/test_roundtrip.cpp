@@ -0,0 +1,398 @@
+#include "stand_in.hpp"
+#include "tls_server.hpp"
+
+#include "buffer_pool.hpp"
+#include "connection_pool.hpp"
+#include "dns_cache.hpp"
+#include "epoll_transport.hpp"
+#include "uring_transport.hpp"
+
+#include "catch.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <future>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+#include <zlib.h>
+
+#ifdef __linux__
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#endif
+
+namespace sf = stockfighter;
+
+namespace {
+
+auto get(const sf::bench::stand_in_server& server, const std::string& target)
+        -> sf::http::request
+{
+    auto req = sf::http::request{};
+    req.method = "GET";
+    req.uri = sf::http::parse_url(server.url(target));
+    return req;
+}
+
+auto async_get(sf::net::transport& transport, const sf::http::request& req)
+        -> std::future<sf::http::response>
+{
+    auto promise = std::make_shared<std::promise<sf::http::response>>();
+    auto future = promise->get_future();
+    transport.async_send(req, [promise](std::exception_ptr error,
+                                        sf::http::response response) {
+        if (error) {
+            promise->set_exception(error);
+        } else {
+            promise->set_value(std::move(response));
+        }
+    }, sf::net::cancellation_token::never());
+    return future;
+}
+
+// Sends requests every way the transport allows, to a server which closes
+// each connection after three responses
+void round_trips(sf::net::transport& transport)
+{
+    sf::bench::stand_in_server server{{R"({"ok":true})", 0, 3}};
+    const auto req = get(server, "/ob/api/heartbeat");
+
+    for (int i = 0; i < 5; ++i) {
+        const auto response = transport.send(req);
+        REQUIRE(response.status == 200);
+        REQUIRE(response.body == R"({"ok":true})");
+    }
+
+    const auto responses = transport.send_pipelined(
+            std::vector<sf::http::request>(10, req));
+    REQUIRE(responses.size() == 10);
+    for (const auto& response : responses) {
+        REQUIRE(response.body == R"({"ok":true})");
+    }
+
+    auto futures = std::vector<std::future<sf::http::response>>{};
+    for (int i = 0; i < 10; ++i) {
+        futures.push_back(async_get(transport, req));
+    }
+    for (auto& f : futures) {
+        REQUIRE(f.get().body == R"({"ok":true})");
+    }
+}
+
+#ifdef __linux__
+
+// The descriptor of our connection to the local port, or -1
+auto client_socket(const std::string& port) -> int
+{
+    for (int fd = 0; fd < 1024; ++fd) {
+        sockaddr_in peer{};
+        socklen_t len = sizeof(peer);
+        if (::getpeername(fd, reinterpret_cast<sockaddr*>(&peer), &len) == 0 &&
+            peer.sin_family == AF_INET && ntohs(peer.sin_port) == std::stoi(port)) {
+            return fd;
+        }
+    }
+    return -1;
+}
+
+auto get_option(int fd, int level, int name) -> int
+{
+    int value = 0;
+    socklen_t len = sizeof(value);
+    REQUIRE(::getsockopt(fd, level, name, &value, &len) == 0);
+    return value;
+}
+
+#endif // __linux__
+
+} // end anonymous namespace
+
+TEST_CASE("Requests on connections the server has closed are sent again", "[roundtrip][pool]")
+{
+    sf::bench::stand_in_server server{{R"({"ok":true})", 0, 1}};
+    sf::net::connection_pool pool{sf::net::default_io()};
+    const auto req = get(server, "/ob/api/heartbeat");
+
+    // Every request after the first finds its pooled connection closed
+    for (int i = 0; i < 5; ++i) {
+        const auto response = pool.send(req);
+        REQUIRE(response.status == 200);
+        REQUIRE(response.body == R"({"ok":true})");
+    }
+    for (int i = 0; i < 5; ++i) {
+        auto response = async_get(pool, req);
+        REQUIRE(response.get().body == R"({"ok":true})");
+    }
+
+    REQUIRE(server.connections() == 10);
+}
+
+TEST_CASE("Pipelined requests left unanswered when the server closes are sent again", "[roundtrip][pool]")
+{
+    sf::bench::stand_in_server server{{R"({"ok":true})", 0, 2}};
+    sf::net::connection_pool pool{sf::net::default_io()};
+    const auto reqs = std::vector<sf::http::request>(5, get(server, "/ob/api/heartbeat"));
+
+    // Each connection answers two of the batch and then closes
+    const auto responses = pool.send_pipelined(reqs);
+
+    REQUIRE(responses.size() == 5);
+    for (const auto& response : responses) {
+        REQUIRE(response.status == 200);
+        REQUIRE(response.body == R"({"ok":true})");
+    }
+    REQUIRE(server.connections() == 3);
+}
+
+TEST_CASE("Reconnecting to a TLS host resumes its session", "[roundtrip][pool][tls]")
+{
+    // Each connection is closed after one response
+    sf::test::tls_server server{[](sf::test::tls_server::stream& s) {
+        boost::asio::streambuf buf;
+        boost::asio::read_until(s, buf, "\r\n\r\n");
+        boost::asio::write(s, boost::asio::buffer(std::string{
+                "HTTP/1.1 200 OK\r\n"
+                "Connection: close\r\n"
+                "Content-Length: 11\r\n\r\n"
+                R"({"ok":true})"}));
+    }};
+
+    // The pool's context only trusts the system's certificates, which it
+    // finds through SSL_CERT_FILE
+    char cert_file[] = "/tmp/stockfighter-test-XXXXXX";
+    const auto& pem = sf::test::localhost_certificate().cert_pem;
+    const int fd = ::mkstemp(cert_file);
+    REQUIRE(fd >= 0);
+    REQUIRE(::write(fd, pem.data(), pem.size()) == static_cast<ssize_t>(pem.size()));
+    ::close(fd);
+    ::setenv("SSL_CERT_FILE", cert_file, 1);
+    sf::net::connection_pool pool{sf::net::default_io()};
+    ::unsetenv("SSL_CERT_FILE");
+    ::unlink(cert_file);
+
+    sf::net::pin_host("localhost", "127.0.0.1");
+    auto req = sf::http::request{};
+    req.method = "GET";
+    req.uri = sf::http::parse_url("https://localhost:" + std::to_string(server.port()) +
+                                  "/ob/api/heartbeat");
+
+    const auto before = sf::net::get_tls_stats();
+    for (int i = 0; i < 3; ++i) {
+        REQUIRE(pool.send(req).body == R"({"ok":true})");
+    }
+    const auto after = sf::net::get_tls_stats();
+    sf::net::unpin_host("localhost");
+
+    REQUIRE(server.connections() == 3);
+    REQUIRE(after.full_handshakes - before.full_handshakes == 1);
+    REQUIRE(after.resumed_handshakes - before.resumed_handshakes == 2);
+}
+
+TEST_CASE("Cached host names are resolved again before their TTL runs out", "[roundtrip][pool][dns]")
+{
+    sf::bench::stand_in_server server{{R"({"ok":true})"}};
+    sf::net::connection_pool pool{sf::net::default_io()};
+    auto& cache = sf::net::default_dns_cache();
+
+    auto req = get(server, "/ob/api/heartbeat");
+    req.uri.host = "localhost";
+
+    sf::net::set_dns_ttl(std::chrono::seconds{1});
+    REQUIRE(pool.send(req).body == R"({"ok":true})");
+    const auto first = cache.resolved_at(req.uri.host, req.uri.port);
+    REQUIRE(first != sf::net::dns_cache::clock::time_point{});
+
+    // The refresh is due after three quarters of the TTL
+    auto refreshed = first;
+    const auto give_up = std::chrono::steady_clock::now() + std::chrono::seconds{5};
+    while (refreshed == first && std::chrono::steady_clock::now() < give_up) {
+        std::this_thread::sleep_for(std::chrono::milliseconds{50});
+        refreshed = cache.resolved_at(req.uri.host, req.uri.port);
+    }
+    sf::net::set_dns_ttl(std::chrono::seconds{60});
+
+    REQUIRE(refreshed - first >= std::chrono::milliseconds{750});
+    REQUIRE(pool.send(req).body == R"({"ok":true})");
+}
+
+TEST_CASE("Gzipped bodies split across many reads are inflated whole", "[roundtrip][pool][gzip]")
+{
+    // Numbers rather than repeated text, so that the compressed body is
+    // long enough to span plenty of segments
+    std::mt19937 rng{42};
+    auto body = std::string{R"({"ok":true,"bids":[)"};
+    for (int i = 0; i < 2000; ++i) {
+        body += (i ? "," : "") + std::to_string(rng() % 100000);
+    }
+    body += "]}";
+
+    auto opts = sf::bench::stand_in_server::options{body, 10};
+    opts.segment_size = 100;
+    sf::bench::stand_in_server server{opts};
+    sf::net::connection_pool pool{sf::net::default_io()};
+
+    auto req = get(server, "/ob/api/venues/TESTEX/stocks/FOOBAR");
+    req.headers.push_back({"Accept-Encoding", "gzip, deflate"});
+
+    for (int i = 0; i < 2; ++i) {
+        server.reset_bytes_sent();
+        const auto response = pool.send(req);
+        REQUIRE(response.status == 200);
+        REQUIRE(response.body == body);
+        REQUIRE(server.bytes_sent() < server.body_size());
+        REQUIRE(server.gzipped_size() > 20 * opts.segment_size);
+    }
+}
+
+TEST_CASE("Raw deflate bodies are told apart however the first bytes arrive", "[roundtrip][gzip]")
+{
+    // Some servers send "deflate" without the zlib wrapper. Telling which
+    // takes the first two bytes of the body, which needn't come together.
+    const auto body = std::string{R"({"ok":true,"symbol":"FOOBAR","bids":[1,2,3]})"};
+    z_stream z{};
+    REQUIRE(deflateInit2(&z, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8,
+                         Z_DEFAULT_STRATEGY) == Z_OK);
+    auto compressed = std::string(deflateBound(&z, body.size()), '\0');
+    z.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(body.data()));
+    z.avail_in = static_cast<uInt>(body.size());
+    z.next_out = reinterpret_cast<Bytef*>(&compressed[0]);
+    z.avail_out = static_cast<uInt>(compressed.size());
+    REQUIRE(deflate(&z, Z_FINISH) == Z_STREAM_END);
+    compressed.resize(z.total_out);
+    deflateEnd(&z);
+
+    const auto head = std::string{"HTTP/1.1 200 OK\r\n"
+                                  "Content-Encoding: deflate\r\n"
+                                  "Content-Length: "} +
+                      std::to_string(compressed.size()) + "\r\n\r\n";
+    const auto response = head + compressed;
+
+    for (const std::size_t piece : {1, 2, 3}) {
+        // The pieces start at the end of the headers, so that the body's
+        // first byte arrives on its own
+        sf::http::response_parser parser;
+        auto pos = parser.feed(head.data(), head.size());
+        REQUIRE(pos == head.size());
+        while (pos < response.size()) {
+            const auto n = std::min(piece, response.size() - pos);
+            pos += parser.feed(response.data() + pos, n);
+        }
+        REQUIRE(parser.done());
+        REQUIRE(parser.release().body == body);
+    }
+}
+
+TEST_CASE("An adaptive pool grows under load and shrinks once it passes", "[roundtrip][pool][adaptive]")
+{
+    // Each response takes about 16ms to arrive
+    sf::bench::stand_in_server server{{std::string(20000, 'x'), 10}};
+    auto opts = sf::net::pool_options{};
+    opts.adaptive = true;
+    opts.min_connections_per_host = 1;
+    opts.max_connections_per_host = 4;
+    opts.scale_down_after = std::chrono::milliseconds{100};
+    sf::net::connection_pool pool{sf::net::default_io(), opts};
+    const auto req = get(server, "/ob/api/heartbeat");
+
+    auto futures = std::vector<std::future<sf::http::response>>{};
+    for (int i = 0; i < 16; ++i) {
+        futures.push_back(async_get(pool, req));
+    }
+    for (auto& f : futures) {
+        REQUIRE(f.get().body.size() == 20000);
+    }
+
+    auto stats = pool.stats();
+    REQUIRE(stats.size() == 1);
+    REQUIRE(stats[0].open > 1);
+    REQUIRE(stats[0].open <= 4);
+
+    // Once the connections have been idle for long enough, the next
+    // request closes all but one of them
+    std::this_thread::sleep_for(std::chrono::milliseconds{200});
+    REQUIRE(pool.send(req).body.size() == 20000);
+
+    stats = pool.stats();
+    REQUIRE(stats[0].open == 1);
+    REQUIRE(stats[0].limit == 1);
+}
+
+TEST_CASE("Responses given back have their storage reused", "[roundtrip][pool][buffers]")
+{
+    // Bigger than anything the other tests leave in the pool, so it is
+    // the best fit for the next response
+    const auto body = std::string(200000, 'x');
+    sf::bench::stand_in_server server{{body}};
+    sf::net::connection_pool pool{sf::net::default_io()};
+    const auto req = get(server, "/ob/api/heartbeat");
+
+    auto first = pool.send(req);
+    REQUIRE(first.body == body);
+    const auto* storage = first.body.data();
+    sf::http::default_response_pool().give_back(std::move(first));
+
+    const auto second = pool.send(req);
+    REQUIRE(second.body == body);
+    REQUIRE(second.body.data() == storage);
+}
+
+#ifdef __linux__
+
+TEST_CASE("The epoll transport round trips requests", "[roundtrip][epoll]")
+{
+    sf::net::epoll_transport transport;
+    round_trips(transport);
+}
+
+TEST_CASE("Socket options are applied to the connections opened", "[roundtrip][socket]")
+{
+    auto opts = sf::net::pool_options{};
+    opts.socket.no_delay = true;
+    opts.socket.receive_buffer = 32768;
+    opts.socket.keepalive_interval = std::chrono::seconds{7};
+
+    auto check = [](sf::net::transport& transport) {
+        sf::bench::stand_in_server server{{R"({"ok":true})"}};
+        const auto req = get(server, "/ob/api/heartbeat");
+        REQUIRE(transport.send(req).body == R"({"ok":true})");
+
+        // The connection stays open in the pool
+        const int fd = client_socket(req.uri.port);
+        REQUIRE(fd >= 0);
+        REQUIRE(get_option(fd, IPPROTO_TCP, TCP_NODELAY) != 0);
+        REQUIRE(get_option(fd, SOL_SOCKET, SO_KEEPALIVE) != 0);
+        REQUIRE(get_option(fd, IPPROTO_TCP, TCP_KEEPIDLE) == 7);
+        REQUIRE(get_option(fd, IPPROTO_TCP, TCP_KEEPINTVL) == 7);
+        // Linux doubles it to allow for its own bookkeeping
+        REQUIRE(get_option(fd, SOL_SOCKET, SO_RCVBUF) == 2 * 32768);
+    };
+
+    SECTION("asio") {
+        sf::net::connection_pool pool{sf::net::default_io(), opts};
+        check(pool);
+    }
+    SECTION("epoll") {
+        sf::net::epoll_transport transport{opts};
+        check(transport);
+    }
+}
+
+TEST_CASE("The io_uring transport round trips requests", "[roundtrip][uring]")
+{
+    if (!sf::net::uring_transport::available()) {
+        WARN("io_uring is not available here");
+        return;
+    }
+    sf::net::uring_transport transport;
+    round_trips(transport);
+}
+
+#endif // __linux__
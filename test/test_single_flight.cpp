@@ -0,0 +1,39 @@
+#include "single_flight.hpp"
+
+#include "catch.hpp"
+
+#include <chrono>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+namespace sf = stockfighter;
+namespace nl = nlohmann;
+
+TEST_CASE("Shared results past their reuse window are swept away", "[single_flight]")
+{
+    sf::rest::single_flight flights;
+    const auto json = nl::json{{"ok", true}};
+
+    flights.complete("kept", nullptr, json, std::chrono::hours{1});
+    for (int i = 0; i < 1000; ++i) {
+        flights.complete("short " + std::to_string(i), nullptr, json,
+                         std::chrono::microseconds{1});
+        std::this_thread::sleep_for(std::chrono::microseconds{10});
+    }
+    REQUIRE(flights.recent_count() < 64);
+
+    // Failures and results which aren't to be kept never go in
+    flights.complete("failed", std::make_exception_ptr(std::runtime_error{"no"}),
+                     {}, std::chrono::hours{1});
+    flights.complete("unkept", nullptr, json, {});
+
+    bool called = false;
+    REQUIRE_FALSE(flights.join("kept", std::chrono::hours{1},
+                               [&](std::exception_ptr error, nl::json result) {
+                                   called = !error && result == json;
+                               }));
+    REQUIRE(called);
+    REQUIRE(flights.join("failed", std::chrono::hours{1}, {}));
+    REQUIRE(flights.join("unkept", std::chrono::hours{1}, {}));
+}
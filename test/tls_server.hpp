@@ -0,0 +1,201 @@
+#pragma once
+
+#include <boost/asio.hpp>
+#include <boost/asio/ssl.hpp>
+
+#include <openssl/evp.h>
+#include <openssl/pem.h>
+#include <openssl/ssl.h>
+#include <openssl/x509.h>
+#include <openssl/x509v3.h>
+
+#include <atomic>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace stockfighter {
+namespace test {
+
+// A self-signed certificate for localhost, made afresh for each run of the
+// tests so that none has to be checked in
+struct certificate {
+    std::string cert_pem;
+    std::string key_pem;
+};
+
+inline auto localhost_certificate() -> const certificate&
+{
+    static const certificate cert = [] {
+        auto pem = [](auto write) {
+            auto* bio = BIO_new(BIO_s_mem());
+            write(bio);
+            char* data = nullptr;
+            const auto size = BIO_get_mem_data(bio, &data);
+            auto out = std::string(data, size);
+            BIO_free(bio);
+            return out;
+        };
+
+        EVP_PKEY* key = nullptr;
+        auto* kctx = EVP_PKEY_CTX_new_id(EVP_PKEY_EC, nullptr);
+        if (!kctx || EVP_PKEY_keygen_init(kctx) <= 0 ||
+            EVP_PKEY_CTX_set_ec_paramgen_curve_nid(kctx, NID_X9_62_prime256v1) <= 0 ||
+            EVP_PKEY_keygen(kctx, &key) <= 0) {
+            throw std::runtime_error{"Could not make a test key"};
+        }
+        EVP_PKEY_CTX_free(kctx);
+
+        auto* x509 = X509_new();
+        X509_set_version(x509, 2);
+        ASN1_INTEGER_set(X509_get_serialNumber(x509), 1);
+        X509_gmtime_adj(X509_getm_notBefore(x509), -60);
+        X509_gmtime_adj(X509_getm_notAfter(x509), 24 * 60 * 60);
+        X509_set_pubkey(x509, key);
+
+        auto* name = X509_get_subject_name(x509);
+        X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC,
+                                   reinterpret_cast<const unsigned char*>("localhost"),
+                                   -1, -1, 0);
+        X509_set_issuer_name(x509, name);
+
+        auto* san = X509V3_EXT_conf_nid(nullptr, nullptr, NID_subject_alt_name,
+                                        const_cast<char*>("DNS:localhost"));
+        X509_add_ext(x509, san, -1);
+        X509_EXTENSION_free(san);
+
+        if (!X509_sign(x509, key, EVP_sha256())) {
+            throw std::runtime_error{"Could not sign the test certificate"};
+        }
+
+        auto c = certificate{};
+        c.cert_pem = pem([x509](BIO* b) { PEM_write_bio_X509(b, x509); });
+        c.key_pem = pem([key](BIO* b) {
+            PEM_write_bio_PrivateKey(b, key, nullptr, nullptr, 0, nullptr, nullptr);
+        });
+        X509_free(x509);
+        EVP_PKEY_free(key);
+        return c;
+    }();
+    return cert;
+}
+
+// Makes the context trust localhost_certificate()
+inline void trust_localhost(boost::asio::ssl::context& ctx)
+{
+    ctx.set_verify_mode(boost::asio::ssl::verify_peer);
+    ctx.add_certificate_authority(boost::asio::buffer(localhost_certificate().cert_pem));
+}
+
+// A TLS server on the loopback interface which runs the session function
+// for each connection, on a thread of its own, once the handshake is done.
+// Sessions end quietly if the connection is closed under them. If h2 is
+// set, the server picks HTTP/2 when the client offers it.
+class tls_server {
+public:
+    using stream = boost::asio::ssl::stream<boost::asio::ip::tcp::socket>;
+    using session = std::function<void(stream&)>;
+
+    explicit tls_server(session s, bool h2 = false)
+        : session_(std::move(s)),
+          acceptor_(io_, {boost::asio::ip::address_v4::loopback(), 0})
+    {
+        const auto& cert = localhost_certificate();
+        ssl_.use_certificate_chain(boost::asio::buffer(cert.cert_pem));
+        ssl_.use_private_key(boost::asio::buffer(cert.key_pem),
+                             boost::asio::ssl::context::pem);
+        if (h2) {
+            SSL_CTX_set_alpn_select_cb(ssl_.native_handle(), select_h2, nullptr);
+        }
+        thread_ = std::thread{[this] { accept_loop(); }};
+    }
+
+    ~tls_server()
+    {
+        stopping_ = true;
+        boost::asio::ip::tcp::socket s{io_};
+        boost::system::error_code ec;
+        s.connect(acceptor_.local_endpoint(), ec);
+        thread_.join();
+
+        {
+            std::lock_guard<std::mutex> lock{mutex_};
+            for (auto& st : streams_) {
+                st->next_layer().shutdown(boost::asio::ip::tcp::socket::shutdown_both, ec);
+            }
+        }
+        for (auto& t : sessions_) {
+            t.join();
+        }
+    }
+
+    tls_server(const tls_server&) = delete;
+    tls_server& operator=(const tls_server&) = delete;
+
+    auto port() const -> unsigned short { return acceptor_.local_endpoint().port(); }
+
+    // How many connections have been accepted
+    auto connections() const -> int { return connections_; }
+
+private:
+    static int select_h2(SSL*, const unsigned char** out, unsigned char* outlen,
+                         const unsigned char* in, unsigned int inlen, void*)
+    {
+        static const unsigned char h2[] = {2, 'h', '2'};
+        unsigned char* selected = nullptr;
+        if (SSL_select_next_proto(&selected, outlen, h2, sizeof(h2), in, inlen) !=
+            OPENSSL_NPN_NEGOTIATED) {
+            return SSL_TLSEXT_ERR_NOACK;
+        }
+        *out = selected;
+        return SSL_TLSEXT_ERR_OK;
+    }
+
+    void accept_loop()
+    {
+        while (true) {
+            auto st = std::make_shared<stream>(io_, ssl_);
+            boost::system::error_code ec;
+            acceptor_.accept(st->next_layer(), ec);
+            if (stopping_) {
+                return;
+            }
+            if (ec) {
+                continue;
+            }
+            ++connections_;
+
+            std::lock_guard<std::mutex> lock{mutex_};
+            streams_.push_back(st);
+            sessions_.emplace_back([this, st] {
+                try {
+                    st->handshake(stream::server);
+                    session_(*st);
+                } catch (const std::exception&) {
+                    // The client went away, or the test is over
+                }
+                boost::system::error_code ec;
+                st->next_layer().shutdown(boost::asio::ip::tcp::socket::shutdown_both, ec);
+            });
+        }
+    }
+
+    session session_;
+    boost::asio::io_context io_;
+    boost::asio::ssl::context ssl_{boost::asio::ssl::context::tls_server};
+    boost::asio::ip::tcp::acceptor acceptor_;
+    std::atomic<bool> stopping_{false};
+    std::atomic<int> connections_{0};
+    std::thread thread_;
+    std::mutex mutex_;
+    std::vector<std::shared_ptr<stream>> streams_;
+    std::vector<std::thread> sessions_;
+};
+
+} // end namespace test
+} // end namespace stockfighter